@@ -0,0 +1,131 @@
+#include "admission.h"
+#include <string.h>
+
+void admission_init(AdmissionControl *control) {
+    memset(control, 0, sizeof(*control));
+    control->next_ticket = 1;
+}
+
+// The source's bucket, taking over the one idle longest when the table is full
+static AdmissionBucket *find_bucket(AdmissionControl *control, uid_t source, unsigned long long now_ms) {
+    AdmissionBucket *oldest = &control->buckets[0];
+    for (int i = 0; i < ADMISSION_SOURCES; i++) {
+        AdmissionBucket *bucket = &control->buckets[i];
+        if (bucket->used && bucket->source == source) {
+            return bucket;
+        }
+        if (!bucket->used || (oldest->used && bucket->last_seen_ms < oldest->last_seen_ms)) {
+            oldest = bucket;
+        }
+    }
+    oldest->used = 1;
+    oldest->source = source;
+    oldest->tokens = ADMISSION_BURST;
+    oldest->refilled_ms = now_ms;
+    return oldest;
+}
+
+static void refill(AdmissionBucket *bucket, unsigned long long now_ms) {
+    bucket->tokens += (double)(now_ms - bucket->refilled_ms) * ADMISSION_RATE_PER_SEC / 1000.0;
+    if (bucket->tokens > ADMISSION_BURST) {
+        bucket->tokens = ADMISSION_BURST;
+    }
+    bucket->refilled_ms = now_ms;
+    bucket->last_seen_ms = now_ms;
+}
+
+// Queued requests are seated ADMISSION_BATCH per tick at the least
+static int drain_estimate_ms(int queued) {
+    return (queued / ADMISSION_BATCH + 1) * TURN_CLOCK_TICK_MS;
+}
+
+int admission_charge(AdmissionControl *control, uid_t source, unsigned long long now_ms, int *retry_after_ms) {
+    AdmissionBucket *bucket = find_bucket(control, source, now_ms);
+    refill(bucket, now_ms);
+    if (bucket->tokens < 1.0) {
+        control->stats.throttled++;
+        *retry_after_ms = (int)((1.0 - bucket->tokens) * 1000.0 / ADMISSION_RATE_PER_SEC) + 1;
+        return -1;
+    }
+    bucket->tokens -= 1.0;
+    return 0;
+}
+
+AdmissionVerdict admission_offer(AdmissionControl *control, const AdmissionRequest *request, unsigned long long now_ms,
+                                 int *retry_after_ms) {
+    control->stats.offered++;
+
+    // A ticket was paid for by the attempt that was turned away
+    if (!request->priority && admission_charge(control, request->source, now_ms, retry_after_ms) == -1) {
+        return ADMISSION_THROTTLED;
+    }
+
+    AdmissionLane *lane = &control->lanes[request->priority ? 0 : 1];
+    if (lane->count == ADMISSION_QUEUE_CAPACITY) {
+        control->stats.shed++;
+        *retry_after_ms = drain_estimate_ms(admission_pending(control));
+        return ADMISSION_SHED;
+    }
+    AdmissionRequest *slot = &lane->requests[(lane->head + lane->count) % ADMISSION_QUEUE_CAPACITY];
+    *slot = *request;
+    slot->queued_ms = now_ms;
+    lane->count++;
+    if (admission_pending(control) > control->stats.max_depth) {
+        control->stats.max_depth = admission_pending(control);
+    }
+    return ADMISSION_QUEUED;
+}
+
+int admission_take(AdmissionControl *control, AdmissionRequest *request, unsigned long long now_ms) {
+    for (int i = 0; i < 2; i++) {
+        AdmissionLane *lane = &control->lanes[i];
+        if (lane->count == 0) {
+            continue;
+        }
+        *request = lane->requests[lane->head];
+        lane->head = (lane->head + 1) % ADMISSION_QUEUE_CAPACITY;
+        lane->count--;
+
+        unsigned long long waited = now_ms - request->queued_ms;
+        control->stats.admitted++;
+        control->stats.priority_admitted += i == 0;
+        control->stats.wait_ms += waited;
+        if (waited > control->stats.max_wait_ms) {
+            control->stats.max_wait_ms = waited;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+unsigned int admission_issue_ticket(AdmissionControl *control, unsigned long long now_ms) {
+    // Spread consecutive tickets so they cannot be guessed from one another
+    unsigned int ticket = control->next_ticket++ * 2654435761u;
+    if (ticket == 0) {
+        ticket = control->next_ticket++ * 2654435761u;
+    }
+    AdmissionTicket *slot = &control->tickets[control->next_ticket % ADMISSION_TICKETS];
+    slot->ticket = ticket;
+    slot->expires_ms = now_ms + ADMISSION_TICKET_MS;
+    return ticket;
+}
+
+int admission_redeem_ticket(AdmissionControl *control, unsigned int ticket, unsigned long long now_ms) {
+    for (int i = 0; ticket != 0 && i < ADMISSION_TICKETS; i++) {
+        AdmissionTicket *slot = &control->tickets[i];
+        if (slot->ticket == ticket) {
+            slot->ticket = 0;
+            return now_ms <= slot->expires_ms;
+        }
+    }
+    return 0;
+}
+
+void admission_report(const AdmissionControl *control, FILE *out) {
+    const AdmissionStats *stats = &control->stats;
+    unsigned long long admitted = stats->admitted > 0 ? stats->admitted : 1;
+    fprintf(out, "Admission: %llu offered, %llu admitted (%llu priority), %llu throttled, %llu shed, %llu abandoned; "
+                 "max queue %d, wait mean %.1f ms, max %llu ms\n",
+            stats->offered, stats->admitted, stats->priority_admitted, stats->throttled, stats->shed, stats->abandoned,
+            stats->max_depth, (double)stats->wait_ms / (double)admitted, stats->max_wait_ms);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "config.h"
+
+// Admission control for CONNECT. Every request is charged to a token bucket
+// for its source, the uid that owns its reply FIFO, and then waits in a
+// bounded accept queue; the server seats queued clients only when it has
+// no moves to handle, so a connect storm cannot slow down running matches.
+// A rejected client gets a retry-after hint and a ticket that puts its next
+// attempt in the priority lane, ahead of new arrivals.
+
+typedef struct {
+    int reply_fd; // -1 for a client on the shared server FIFO
+    uid_t source;
+    int priority; // Redeemed a ticket
+    unsigned long long queued_ms;
+} AdmissionRequest;
+
+typedef enum {
+    ADMISSION_QUEUED,
+    ADMISSION_THROTTLED, // The source is out of tokens
+    ADMISSION_SHED       // Its lane of the accept queue is full
+} AdmissionVerdict;
+
+typedef struct {
+    uid_t source;
+    int used;
+    double tokens;
+    unsigned long long refilled_ms;
+    unsigned long long last_seen_ms;
+} AdmissionBucket;
+
+typedef struct {
+    AdmissionRequest requests[ADMISSION_QUEUE_CAPACITY];
+    int head;
+    int count;
+} AdmissionLane;
+
+typedef struct {
+    unsigned int ticket;
+    unsigned long long expires_ms;
+} AdmissionTicket;
+
+typedef struct {
+    unsigned long long offered;
+    unsigned long long admitted;
+    unsigned long long priority_admitted;
+    unsigned long long throttled;
+    unsigned long long shed;
+    unsigned long long abandoned; // Gave up while queued
+    unsigned long long wait_ms;   // Summed over admitted requests
+    unsigned long long max_wait_ms;
+    int max_depth;
+} AdmissionStats;
+
+typedef struct {
+    AdmissionBucket buckets[ADMISSION_SOURCES];
+    AdmissionLane lanes[2]; // Priority, then new arrivals
+    AdmissionTicket tickets[ADMISSION_TICKETS];
+    unsigned int next_ticket;
+    AdmissionStats stats;
+} AdmissionControl;
+
+void admission_init(AdmissionControl *control);
+
+// Queues the request, or returns why not and sets retry_after_ms
+AdmissionVerdict admission_offer(AdmissionControl *control, const AdmissionRequest *request, unsigned long long now_ms,
+                                 int *retry_after_ms);
+
+// Charges one more seat for a source that is already connected, as an
+// OPEN_MATCH lane, without queueing anything. Returns -1 and sets
+// retry_after_ms when the source is out of tokens.
+int admission_charge(AdmissionControl *control, uid_t source, unsigned long long now_ms, int *retry_after_ms);
+
+// Takes the next request, priority lane first; returns 0 when both are empty
+int admission_take(AdmissionControl *control, AdmissionRequest *request, unsigned long long now_ms);
+
+static inline int admission_pending(const AdmissionControl *control) {
+    return control->lanes[0].count + control->lanes[1].count;
+}
+
+// A taken request whose client went away before it could be seated
+static inline void admission_abandoned(AdmissionControl *control) {
+    control->stats.admitted--;
+    control->stats.abandoned++;
+}
+
+// A ticket for a rejected client's next attempt
+unsigned int admission_issue_ticket(AdmissionControl *control, unsigned long long now_ms);
+
+// Returns 1 and retires the ticket when it was issued and has not expired
+int admission_redeem_ticket(AdmissionControl *control, unsigned int ticket, unsigned long long now_ms);
+
+void admission_report(const AdmissionControl *control, FILE *out);
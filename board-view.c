@@ -0,0 +1,117 @@
+#include "board-view.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define READ_ATTEMPTS 1000 // Before a reader gives up on a writer stuck mid-publish
+
+static size_t page_size(void) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (sizeof(BoardViewPage) + page - 1) / page * page;
+}
+
+static void view_name(char *name, size_t size, const char *server_name, int client_id) {
+    snprintf(name, size, BOARD_VIEW_SHM_TEMPLATE, server_name, client_id);
+}
+
+BoardViewPage *board_view_create(const char *server_name, int client_id) {
+    char name[BUFFER_SIZE];
+    view_name(name, sizeof(name), server_name, client_id);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Failed to create a board view");
+        return NULL;
+    }
+    // A page of another size is left from an older build and is laid out anew
+    struct stat info;
+    int fresh = fstat(fd, &info) == 0 && info.st_size != (off_t)page_size();
+    if (fresh && ftruncate(fd, (off_t)page_size()) == -1) {
+        perror("Failed to size a board view");
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, page_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map a board view");
+        return NULL;
+    }
+    BoardViewPage *page = map;
+    if (fresh || page->version != BOARD_VIEW_VERSION) {
+        memset(page, 0, sizeof(*page));
+        page->version = BOARD_VIEW_VERSION;
+        page->snapshot.match_id = -1;
+        page->snapshot.winner = -1;
+    } else {
+        uint32_t sequence = atomic_load_explicit(&page->sequence, memory_order_relaxed);
+        if (sequence & 1) {
+            // The last writer died mid-publish: the snapshot may be torn, so
+            // it reads as no match until this server publishes the seat
+            page->snapshot.match_id = -1;
+            atomic_store_explicit(&page->sequence, sequence + 1, memory_order_release);
+        }
+    }
+    return page;
+}
+
+const BoardViewPage *board_view_map(const char *server_name, int client_id) {
+    char name[BUFFER_SIZE];
+    view_name(name, sizeof(name), server_name, client_id);
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    void *map = mmap(NULL, page_size(), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map the board view");
+        return NULL;
+    }
+    const BoardViewPage *page = map;
+    if (page->version != BOARD_VIEW_VERSION) {
+        fprintf(stderr, "The server's board view has a different format\n");
+        munmap(map, page_size());
+        return NULL;
+    }
+    return page;
+}
+
+void board_view_unmap(const BoardViewPage *page) {
+    if (page != NULL) {
+        munmap((void *)page, page_size());
+    }
+}
+
+void board_view_unlink(const char *server_name, int client_id) {
+    char name[BUFFER_SIZE];
+    view_name(name, sizeof(name), server_name, client_id);
+    shm_unlink(name);
+}
+
+void board_view_publish(BoardViewPage *page, const BoardSnapshot *snapshot) {
+    uint32_t sequence = atomic_load_explicit(&page->sequence, memory_order_relaxed);
+    atomic_store_explicit(&page->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); // The odd count is seen before any new byte
+    memcpy(&page->snapshot, snapshot, sizeof(*snapshot));
+    atomic_store_explicit(&page->sequence, sequence + 2, memory_order_release);
+}
+
+int board_view_read(const BoardViewPage *page, BoardSnapshot *snapshot) {
+    for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+        uint32_t before = atomic_load_explicit(&page->sequence, memory_order_acquire);
+        if (before & 1) {
+            sched_yield(); // The server is between the two stores
+            continue;
+        }
+        memcpy(snapshot, (const void *)&page->snapshot, sizeof(*snapshot));
+        atomic_thread_fence(memory_order_acquire); // The copy is done before the count is read again
+        if (atomic_load_explicit(&page->sequence, memory_order_relaxed) == before) {
+            return 0;
+        }
+    }
+    return -1;
+}
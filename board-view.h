@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "config.h"
+
+// Board views the server publishes in shared memory, one page per client.
+// A page holds what its seat may see of the match: the shots on both
+// boards, never a ship nobody has hit. Page names are predictable, so the
+// seat's own fleet stays with the client that placed it. The server writes a
+// page under a seqlock before it sends the message that announces the
+// change, so a reader woken by the message finds the state it announces or
+// a newer one, without parsing anything. Clients map their page read-only;
+// the server unlinks the pages when it exits.
+
+#define BOARD_VIEW_VERSION 2 // 2: mine carries shots only
+
+typedef struct {
+    int32_t match_id; // -1 before the seat is taken
+    int32_t seat;
+    int32_t player_turn;
+    int32_t winner;   // Seat, -1 while playing or when nobody won
+    uint32_t finished;
+    uint32_t boards_ready; // Bit per seat that has placed its fleet
+    uint64_t moves;        // Moves applied to the match so far
+    uint64_t mine_shot_hash;  // Shot hash of the seat's own board
+    uint64_t enemy_shot_hash; // Shot hash of the opponent's board
+    uint8_t mine[BOARD_SIZE][BOARD_SIZE];  // 0 not shot at, 2 hit, 3 miss
+    uint8_t enemy[BOARD_SIZE][BOARD_SIZE]; // 0 not shot at, 2 hit, 3 miss
+} BoardSnapshot;
+
+typedef struct {
+    _Atomic uint32_t sequence; // Odd while the server writes the snapshot
+    uint32_t version;
+    BoardSnapshot snapshot;
+} BoardViewPage;
+
+// Creates, or after a handoff reopens, a client's page for the server to
+// write; returns NULL on failure. A page left by another layout is reset,
+// and one whose writer died mid-publish reads as no match.
+BoardViewPage *board_view_create(const char *server_name, int client_id);
+
+// Maps a client's page read-only, or returns NULL when the server has none
+const BoardViewPage *board_view_map(const char *server_name, int client_id);
+
+void board_view_unmap(const BoardViewPage *page);
+
+void board_view_unlink(const char *server_name, int client_id);
+
+// Only the server thread writes; readers never block it
+void board_view_publish(BoardViewPage *page, const BoardSnapshot *snapshot);
+
+// Copies a consistent snapshot, retrying while the server is writing.
+// Returns -1 when no consistent copy came in a bounded number of tries, as
+// when the server died mid-publish; the caller then has no view to go by.
+int board_view_read(const BoardViewPage *page, BoardSnapshot *snapshot);
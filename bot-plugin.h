@@ -0,0 +1,36 @@
+#pragma once
+
+#include "game-logic.h"
+#include "free-for-all.h"
+
+// Bot plugin ABI. A bot is a shared object exporting
+//
+//     const BotPlugin *battleship_bot_plugin(void);
+//
+// The plugin runs in its own worker process, so it may keep any state it
+// likes and cannot corrupt the client or the server. Every call is one move
+// and must return within the move budget or the bot forfeits.
+
+#define BOT_ABI_VERSION 2 // 2: GameBoard carries Zobrist hashes
+#define BOT_PLUGIN_SYMBOL "battleship_bot_plugin"
+
+typedef struct {
+    int abi_version; // Must be BOT_ABI_VERSION
+    const char *name;
+
+    // Optional; the returned pointer is passed to every other call
+    void *(*create)(unsigned int seed);
+    void (*destroy)(void *state);
+
+    // Picks the position of fleet->ships[ship_index] on a board that already
+    // holds the earlier ships. Returns 0 on success; a placement that breaks
+    // the rules counts as a forfeit.
+    int (*choose_placement)(void *state, const Fleet *fleet, int ship_index,
+                            const GameBoard *board, ShipPlacement *placement);
+
+    // Picks the next target. view is the opponent's board as far as it is
+    // known: 0 not fired at, 2 hit, 3 miss. Returns 0 on success.
+    int (*choose_shot)(void *state, const GameBoard *view, Shot *shot);
+} BotPlugin;
+
+typedef const BotPlugin *(*BotPluginEntry)(void);
@@ -0,0 +1,529 @@
+#include "bot-runner.h"
+#include "config.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+typedef enum {
+    BOT_REQUEST_PLACEMENT,
+    BOT_REQUEST_SHOT,
+    BOT_REQUEST_QUIT
+} BotRequestType;
+
+// Both messages fit in PIPE_BUF, so each one is written atomically
+typedef struct {
+    int type;
+    int ship_index;
+    Fleet fleet;
+    GameBoard board;
+} BotRequest;
+
+typedef struct {
+    int status;
+    ShipPlacement placement;
+    Shot shot;
+    char name[64];
+} BotReply;
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static int write_full(int fd, const void *data, size_t size) {
+    const char *cursor = data;
+    while (size > 0) {
+        ssize_t written = write(fd, cursor, size);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        cursor += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+static int read_full(int fd, void *data, size_t size) {
+    char *cursor = data;
+    while (size > 0) {
+        ssize_t received = read(fd, cursor, size);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        cursor += received;
+        size -= (size_t)received;
+    }
+    return 0;
+}
+
+// Runs in the forked worker and never returns
+static void worker_main(const char *path, unsigned int seed, int request_fd, int reply_fd) {
+    BotReply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.status = -1;
+
+    const BotPlugin *plugin = NULL;
+    void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) {
+        fprintf(stderr, "Failed to load bot %s: %s\n", path, dlerror());
+    } else {
+        BotPluginEntry entry = (BotPluginEntry)dlsym(library, BOT_PLUGIN_SYMBOL);
+        plugin = entry != NULL ? entry() : NULL;
+        if (plugin == NULL || plugin->abi_version != BOT_ABI_VERSION ||
+            plugin->choose_placement == NULL || plugin->choose_shot == NULL) {
+            fprintf(stderr, "%s does not provide a compatible bot plugin\n", path);
+            plugin = NULL;
+        }
+    }
+
+    if (plugin != NULL) {
+        reply.status = 0;
+        snprintf(reply.name, sizeof(reply.name), "%s", plugin->name != NULL ? plugin->name : path);
+    }
+    if (write_full(reply_fd, &reply, sizeof(reply)) == -1 || plugin == NULL) {
+        _exit(EXIT_FAILURE);
+    }
+
+    void *state = plugin->create != NULL ? plugin->create(seed) : NULL;
+    BotRequest request;
+    while (read_full(request_fd, &request, sizeof(request)) == 0 && request.type != BOT_REQUEST_QUIT) {
+        memset(&reply, 0, sizeof(reply));
+        if (request.type == BOT_REQUEST_PLACEMENT) {
+            reply.status = plugin->choose_placement(state, &request.fleet, request.ship_index,
+                                                    &request.board, &reply.placement);
+        } else {
+            reply.status = plugin->choose_shot(state, &request.board, &reply.shot);
+        }
+        if (write_full(reply_fd, &reply, sizeof(reply)) == -1) {
+            break;
+        }
+    }
+
+    if (plugin->destroy != NULL) {
+        plugin->destroy(state);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static void kill_worker(BotRunner *bot) {
+    if (bot->pid > 0) {
+        kill(bot->pid, SIGKILL);
+        waitpid(bot->pid, NULL, 0);
+        bot->pid = -1;
+    }
+}
+
+// Waits for a full reply until deadline_ns; returns 0, or -1 on expiry or EOF
+static int read_reply(BotRunner *bot, BotReply *reply, unsigned long long deadline_ns, int *timed_out) {
+    char *cursor = (char *)reply;
+    size_t remaining = sizeof(*reply);
+    *timed_out = 0;
+
+    while (remaining > 0) {
+        unsigned long long now = now_ns();
+        if (now >= deadline_ns) {
+            *timed_out = 1;
+            return -1;
+        }
+
+        struct pollfd descriptor = {bot->response_fd, POLLIN, 0};
+        int timeout_ms = (int)((deadline_ns - now + 999999ULL) / 1000000ULL);
+        int ready = poll(&descriptor, 1, timeout_ms);
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ready == 0) {
+            *timed_out = 1;
+            return -1;
+        }
+        if (ready < 0) {
+            return -1;
+        }
+
+        ssize_t received = read(bot->response_fd, cursor, remaining);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1; // The worker exited or crashed
+        }
+        cursor += received;
+        remaining -= (size_t)received;
+    }
+    return 0;
+}
+
+static void record_latency(BotLatencyStats *stats, unsigned long long elapsed_ns) {
+    stats->moves++;
+    stats->total_ns += elapsed_ns;
+    if (elapsed_ns > stats->max_ns) {
+        stats->max_ns = elapsed_ns;
+    }
+
+    unsigned long long micros = elapsed_ns / 1000;
+    int bucket = micros == 0 ? 0 : 64 - __builtin_clzll(micros);
+    if (bucket >= BOT_LATENCY_BUCKETS) {
+        bucket = BOT_LATENCY_BUCKETS - 1;
+    }
+    stats->buckets[bucket]++;
+}
+
+static BotResult run_request(BotRunner *bot, const BotRequest *request, BotReply *reply) {
+    if (bot->pid <= 0) {
+        return BOT_DEAD;
+    }
+
+    unsigned long long started = now_ns();
+    if (write_full(bot->request_fd, request, sizeof(*request)) == -1) {
+        kill_worker(bot);
+        bot->stats.failures++;
+        return BOT_DEAD;
+    }
+
+    int timed_out;
+    unsigned long long deadline = started + (unsigned long long)bot->move_budget_ms * 1000000ULL;
+    if (read_reply(bot, reply, deadline, &timed_out) == -1) {
+        kill_worker(bot);
+        if (timed_out) {
+            bot->stats.timeouts++;
+            return BOT_TIMEOUT;
+        }
+        bot->stats.failures++;
+        return BOT_DEAD;
+    }
+
+    record_latency(&bot->stats, now_ns() - started);
+    if (reply->status != 0) {
+        bot->stats.failures++;
+        return BOT_FAILED;
+    }
+    return BOT_OK;
+}
+
+int bot_move_budget_ms(void) {
+    const char *text = getenv("BATTLESHIP_BOT_BUDGET_MS");
+    int budget = text != NULL ? atoi(text) : 0;
+    return budget > 0 ? budget : BOT_DEFAULT_MOVE_BUDGET_MS;
+}
+
+int bot_runner_start(BotRunner *bot, const char *path, unsigned int seed) {
+    memset(bot, 0, sizeof(*bot));
+    bot->pid = -1;
+    bot->request_fd = -1;
+    bot->response_fd = -1;
+    bot->move_budget_ms = bot_move_budget_ms();
+
+    // A dead worker must surface as a write error, not kill the caller
+    signal(SIGPIPE, SIG_IGN);
+
+    int requests[2], replies[2];
+    if (pipe(requests) == -1) {
+        perror("Failed to create bot request pipe");
+        return -1;
+    }
+    if (pipe(replies) == -1) {
+        perror("Failed to create bot reply pipe");
+        close(requests[0]);
+        close(requests[1]);
+        return -1;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Failed to start bot worker");
+        close(requests[0]);
+        close(requests[1]);
+        close(replies[0]);
+        close(replies[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(requests[1]);
+        close(replies[0]);
+        worker_main(path, seed, requests[0], replies[1]);
+    }
+
+    close(requests[0]);
+    close(replies[1]);
+    bot->pid = pid;
+    bot->request_fd = requests[1];
+    bot->response_fd = replies[0];
+
+    BotReply hello;
+    int timed_out;
+    if (read_reply(bot, &hello, now_ns() + BOT_LOAD_BUDGET_MS * 1000000ULL, &timed_out) == -1 || hello.status != 0) {
+        fprintf(stderr, "Bot %s did not start%s\n", path, timed_out ? " in time" : "");
+        bot_runner_stop(bot);
+        return -1;
+    }
+    snprintf(bot->name, sizeof(bot->name), "%s", hello.name);
+    return 0;
+}
+
+void bot_runner_stop(BotRunner *bot) {
+    if (bot->pid > 0) {
+        BotRequest request;
+        memset(&request, 0, sizeof(request));
+        request.type = BOT_REQUEST_QUIT;
+        if (write_full(bot->request_fd, &request, sizeof(request)) == 0) {
+            waitpid(bot->pid, NULL, 0);
+            bot->pid = -1;
+        } else {
+            kill_worker(bot);
+        }
+    }
+    if (bot->request_fd != -1) {
+        close(bot->request_fd);
+        bot->request_fd = -1;
+    }
+    if (bot->response_fd != -1) {
+        close(bot->response_fd);
+        bot->response_fd = -1;
+    }
+}
+
+BotResult bot_runner_place_fleet(BotRunner *bot, GameBoard *board, ShipPlacement placements[FLEET_SIZE]) {
+    BotRequest request;
+    memset(&request, 0, sizeof(request));
+    request.type = BOT_REQUEST_PLACEMENT;
+    initialize_fleet(&request.fleet);
+
+    for (int i = 0; i < FLEET_SIZE; i++) {
+        BotReply reply;
+        request.ship_index = i;
+        request.board = *board;
+
+        BotResult result = run_request(bot, &request, &reply);
+        if (result != BOT_OK) {
+            return result;
+        }
+        if (!place_ship_from_fleet(board, reply.placement.x, reply.placement.y,
+                                   &request.fleet.ships[i], reply.placement.orientation)) {
+            bot->stats.failures++;
+            return BOT_FAILED;
+        }
+        placements[i] = reply.placement;
+    }
+    return BOT_OK;
+}
+
+BotResult bot_runner_choose_shot(BotRunner *bot, const GameBoard *view, Shot *shot) {
+    BotRequest request;
+    BotReply reply;
+    memset(&request, 0, sizeof(request));
+    request.type = BOT_REQUEST_SHOT;
+    request.board = *view;
+
+    BotResult result = run_request(bot, &request, &reply);
+    if (result != BOT_OK) {
+        return result;
+    }
+
+    // Firing outside the board or at a known cell breaks the rules
+    if (reply.shot.x < 0 || reply.shot.x >= BOARD_SIZE || reply.shot.y < 0 || reply.shot.y >= BOARD_SIZE ||
+        view->grid[reply.shot.y][reply.shot.x] != 0) {
+        bot->stats.failures++;
+        return BOT_FAILED;
+    }
+    *shot = reply.shot;
+    return BOT_OK;
+}
+
+void bot_view_from_board(const GameBoard *board, GameBoard *view) {
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            int cell = board->grid[i][j];
+            view->grid[i][j] = (cell == 2 || cell == 3) ? cell : 0;
+        }
+    }
+    view->ships_remaining = 0;
+    view->ship_hash = 0;
+    view->shot_hash = board->shot_hash;
+}
+
+const char *bot_result_name(BotResult result) {
+    switch (result) {
+    case BOT_OK:
+        return "ok";
+    case BOT_FAILED:
+        return "broke the rules";
+    case BOT_TIMEOUT:
+        return "ran out of time";
+    default:
+        return "worker died";
+    }
+}
+
+// Upper bound, in microseconds, of the bucket holding the given fraction of moves
+static unsigned long long latency_percentile(const BotLatencyStats *stats, double fraction) {
+    unsigned long long target = (unsigned long long)((double)stats->moves * fraction);
+    unsigned long long seen = 0;
+    for (int bucket = 0; bucket < BOT_LATENCY_BUCKETS; bucket++) {
+        seen += stats->buckets[bucket];
+        if (seen > target) {
+            return 1ULL << bucket;
+        }
+    }
+    return 1ULL << (BOT_LATENCY_BUCKETS - 1);
+}
+
+static void report_stats(const char *name, int budget_ms, const BotLatencyStats *stats, FILE *out) {
+    fprintf(out, "Bot %s: %llu moves, %llu timeouts, %llu failures (budget %d ms)\n",
+            name, stats->moves, stats->timeouts, stats->failures, budget_ms);
+    if (stats->moves > 0) {
+        fprintf(out, "  latency: mean %.1f us, p50 <= %llu us, p99 <= %llu us, max %.1f us\n",
+                (double)stats->total_ns / (double)stats->moves / 1000.0,
+                latency_percentile(stats, 0.5), latency_percentile(stats, 0.99),
+                (double)stats->max_ns / 1000.0);
+    }
+}
+
+void bot_runner_report(const BotRunner *bot, FILE *out) {
+    report_stats(bot->name, bot->move_budget_ms, &bot->stats, out);
+}
+
+static void merge_stats(BotLatencyStats *total, const BotLatencyStats *stats) {
+    total->moves += stats->moves;
+    total->timeouts += stats->timeouts;
+    total->failures += stats->failures;
+    total->total_ns += stats->total_ns;
+    if (stats->max_ns > total->max_ns) {
+        total->max_ns = stats->max_ns;
+    }
+    for (int i = 0; i < BOT_LATENCY_BUCKETS; i++) {
+        total->buckets[i] += stats->buckets[i];
+    }
+}
+
+typedef struct {
+    BotRunner bots[2];
+    long games;
+    long wins[2];
+    long forfeits[2];
+    unsigned long long shots;
+} TournamentLane;
+
+// Plays one game; returns the index of the winning bot
+static int play_bot_game(TournamentLane *lane, int first) {
+    GameBoard boards[2];
+    ShipPlacement placements[FLEET_SIZE];
+
+    for (int side = 0; side < 2; side++) {
+        initialize_board(&boards[side]);
+        if (bot_runner_place_fleet(&lane->bots[side], &boards[side], placements) != BOT_OK) {
+            lane->forfeits[side]++;
+            return 1 - side;
+        }
+    }
+
+    for (int turn = first;; turn = 1 - turn) {
+        GameBoard view;
+        Shot shot;
+        int outcome;
+        bot_view_from_board(&boards[1 - turn], &view);
+        if (bot_runner_choose_shot(&lane->bots[turn], &view, &shot) != BOT_OK) {
+            lane->forfeits[turn]++;
+            return 1 - turn;
+        }
+        lane->shots++;
+        if (attack_salvo(&boards[1 - turn], &shot, 1, &outcome) == 2) {
+            return turn;
+        }
+    }
+}
+
+static void *run_tournament_lane(void *arg) {
+    TournamentLane *lane = arg;
+    for (long game = 0; game < lane->games; game++) {
+        lane->wins[play_bot_game(lane, (int)(game % 2))]++;
+    }
+    return NULL;
+}
+
+void bot_tournament(const char *path_a, const char *path_b, long games, int thread_count, FILE *out) {
+    if (thread_count < 1) {
+        thread_count = 1;
+    } else if (thread_count > MAX_CLIENTS) {
+        thread_count = MAX_CLIENTS;
+    }
+
+    TournamentLane *lanes = calloc((size_t)thread_count, sizeof(TournamentLane));
+    pthread_t *threads = calloc((size_t)thread_count, sizeof(pthread_t));
+    if (lanes == NULL || threads == NULL) {
+        free(lanes);
+        free(threads);
+        fprintf(out, "Bot tournament could not start.\n");
+        return;
+    }
+
+    // Workers are forked before any lane thread exists
+    int started = 0;
+    unsigned int seed = (unsigned int)now_ns();
+    for (; started < thread_count; started++) {
+        TournamentLane *lane = &lanes[started];
+        lane->games = games / thread_count + (started < games % thread_count ? 1 : 0);
+        if (bot_runner_start(&lane->bots[0], path_a, seed + 2 * (unsigned int)started) == -1 ||
+            bot_runner_start(&lane->bots[1], path_b, seed + 2 * (unsigned int)started + 1) == -1) {
+            bot_runner_stop(&lane->bots[0]);
+            break;
+        }
+    }
+    if (started < thread_count) {
+        for (int i = 0; i < started; i++) {
+            bot_runner_stop(&lanes[i].bots[0]);
+            bot_runner_stop(&lanes[i].bots[1]);
+        }
+        free(lanes);
+        free(threads);
+        fprintf(out, "Bot tournament could not start.\n");
+        return;
+    }
+
+    unsigned long long began = now_ns();
+    for (int i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i], NULL, run_tournament_lane, &lanes[i]);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = (double)(now_ns() - began) / 1e9;
+
+    long wins[2] = {0, 0}, forfeits[2] = {0, 0};
+    unsigned long long shots = 0;
+    BotLatencyStats totals[2];
+    memset(totals, 0, sizeof(totals));
+    for (int i = 0; i < thread_count; i++) {
+        for (int side = 0; side < 2; side++) {
+            wins[side] += lanes[i].wins[side];
+            forfeits[side] += lanes[i].forfeits[side];
+            merge_stats(&totals[side], &lanes[i].bots[side].stats);
+            bot_runner_stop(&lanes[i].bots[side]);
+        }
+        shots += lanes[i].shots;
+    }
+
+    fprintf(out, "Tournament: %ld games on %d threads in %.3f s (%.1f games/s, %llu shots)\n",
+            games, thread_count, seconds, (double)games / seconds, shots);
+    fprintf(out, "  %s: %ld wins, %ld forfeits\n", lanes[0].bots[0].name, wins[0], forfeits[0]);
+    fprintf(out, "  %s: %ld wins, %ld forfeits\n", lanes[0].bots[1].name, wins[1], forfeits[1]);
+    report_stats(lanes[0].bots[0].name, lanes[0].bots[0].move_budget_ms, &totals[0], out);
+    report_stats(lanes[0].bots[1].name, lanes[0].bots[1].move_budget_ms, &totals[1], out);
+
+    free(lanes);
+    free(threads);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "bot-plugin.h"
+
+#define BOT_DEFAULT_MOVE_BUDGET_MS 100
+#define BOT_LOAD_BUDGET_MS 2000
+#define BOT_LATENCY_BUCKETS 32
+
+typedef enum {
+    BOT_OK,
+    BOT_FAILED,  // The plugin returned an error or broke the rules
+    BOT_TIMEOUT, // The move budget expired; the worker was killed
+    BOT_DEAD     // The worker is gone (crashed or killed earlier)
+} BotResult;
+
+typedef struct {
+    unsigned long long moves;
+    unsigned long long timeouts;
+    unsigned long long failures;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long buckets[BOT_LATENCY_BUCKETS]; // Moves by log2 of microseconds
+} BotLatencyStats;
+
+// A plugin loaded into a forked worker process. Requests and replies travel
+// over a pipe pair, so a move that overruns its budget is answered by
+// killing the worker instead of waiting for it.
+typedef struct {
+    char name[64];
+    pid_t pid;
+    int request_fd;
+    int response_fd;
+    int move_budget_ms;
+    BotLatencyStats stats;
+} BotRunner;
+
+// Budget per move in milliseconds, from BATTLESHIP_BOT_BUDGET_MS
+int bot_move_budget_ms(void);
+
+// Forks a worker and loads the plugin in it; returns 0 when the plugin
+// answered with a compatible ABI
+int bot_runner_start(BotRunner *bot, const char *path, unsigned int seed);
+
+void bot_runner_stop(BotRunner *bot);
+
+// Places the whole fleet on board, one budgeted call per ship
+BotResult bot_runner_place_fleet(BotRunner *bot, GameBoard *board, ShipPlacement placements[FLEET_SIZE]);
+
+BotResult bot_runner_choose_shot(BotRunner *bot, const GameBoard *view, Shot *shot);
+
+// Copies what an opponent may see of board: hits and misses, but no ships
+void bot_view_from_board(const GameBoard *board, GameBoard *view);
+
+const char *bot_result_name(BotResult result);
+
+void bot_runner_report(const BotRunner *bot, FILE *out);
+
+// Plays games between two plugins on thread_count threads, each thread with
+// its own pair of workers, and prints the score and both bots' latencies
+void bot_tournament(const char *path_a, const char *path_b, long games, int thread_count, FILE *out);
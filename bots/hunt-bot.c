@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include "../bot-plugin.h"
+#include "../prior-table.h"
+
+// Sample bot: random placement, then parity hunting with target mode around
+// hits. Ships never touch, so cells diagonal to a hit are always water.
+// BATTLESHIP_BOT_PRIOR_TABLE may name a file written by make-priors, which
+// can fold in the placements history-query observed: ships are then placed
+// from its placement lists and the hunt follows its opening order. The file
+// is mapped, so every bot on the host shares it.
+
+#define SIZE 10
+
+typedef struct {
+    unsigned int seed;
+    PriorFile prior_file;
+    const PriorTable *table; // NULL without a table for this board
+} HuntBot;
+
+static void *hunt_create(unsigned int seed) {
+    HuntBot *bot = malloc(sizeof(HuntBot));
+    if (bot != NULL) {
+        bot->seed = seed;
+        const char *path = getenv("BATTLESHIP_BOT_PRIOR_TABLE");
+        bot->table = NULL;
+        if (path != NULL && *path != '\0' && prior_file_open(&bot->prior_file, path) == 0) {
+            bot->table = prior_file_find(&bot->prior_file, SIZE, NULL);
+        } else {
+            bot->prior_file.header = NULL;
+        }
+    }
+    return bot;
+}
+
+static void hunt_destroy(void *state) {
+    HuntBot *bot = state;
+    if (bot != NULL) {
+        prior_file_close(&bot->prior_file);
+    }
+    free(bot);
+}
+
+static int cell(const GameBoard *board, int x, int y) {
+    if (x < 0 || x >= SIZE || y < 0 || y >= SIZE) {
+        return -1;
+    }
+    return board->grid[y][x];
+}
+
+static int fits(const GameBoard *board, int x, int y, int length, char orientation) {
+    int dx = orientation == 'H' ? 1 : 0;
+    int dy = orientation == 'V' ? 1 : 0;
+    if (x + dx * (length - 1) >= SIZE || y + dy * (length - 1) >= SIZE) {
+        return 0;
+    }
+    for (int i = x - 1; i <= x + dx * (length - 1) + 1; i++) {
+        for (int j = y - 1; j <= y + dy * (length - 1) + 1; j++) {
+            if (cell(board, i, j) > 0) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// A random listed placement whose halo holds no ship yet
+static int place_from_table(HuntBot *bot, const PriorTable *table, int ship_index, const GameBoard *board,
+                            ShipPlacement *placement) {
+    uint64_t occupied[2] = {0, 0};
+    for (int y = 0; y < SIZE; y++) {
+        for (int x = 0; x < SIZE; x++) {
+            if (board->grid[y][x] > 0) {
+                int cell = y * SIZE + x;
+                occupied[cell >> 6] |= 1ULL << (cell & 63);
+            }
+        }
+    }
+    uint32_t count = table->placement_count[ship_index];
+    uint32_t start = count > 0 ? (uint32_t)rand_r(&bot->seed) % count : 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const PriorPlacement *candidate = &table->placements[ship_index][(start + i) % count];
+        if ((candidate->halo[0] & occupied[0]) == 0 && (candidate->halo[1] & occupied[1]) == 0) {
+            placement->x = candidate->x;
+            placement->y = candidate->y;
+            placement->orientation = (char)candidate->orientation;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int hunt_choose_placement(void *state, const Fleet *fleet, int ship_index,
+                                 const GameBoard *board, ShipPlacement *placement) {
+    HuntBot *bot = state;
+    int length = fleet->ships[ship_index].size;
+    const PriorTable *table = prior_file_find(&bot->prior_file, SIZE, fleet);
+    if (table != NULL) {
+        return place_from_table(bot, table, ship_index, board, placement);
+    }
+
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        int x = rand_r(&bot->seed) % SIZE;
+        int y = rand_r(&bot->seed) % SIZE;
+        char orientation = rand_r(&bot->seed) % 2 ? 'H' : 'V';
+        if (fits(board, x, y, length, orientation)) {
+            placement->x = x;
+            placement->y = y;
+            placement->orientation = orientation;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int next_to_hit_diagonally(const GameBoard *view, int x, int y) {
+    return cell(view, x - 1, y - 1) == 2 || cell(view, x + 1, y - 1) == 2 ||
+           cell(view, x - 1, y + 1) == 2 || cell(view, x + 1, y + 1) == 2;
+}
+
+static int hunt_choose_shot(void *state, const GameBoard *view, Shot *shot) {
+    HuntBot *bot = state;
+    static const int directions[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+    // Target mode: extend a line of hits first, then try any side of a hit
+    for (int pass = 0; pass < 2; pass++) {
+        for (int y = 0; y < SIZE; y++) {
+            for (int x = 0; x < SIZE; x++) {
+                if (view->grid[y][x] != 2) {
+                    continue;
+                }
+                for (int d = 0; d < 4; d++) {
+                    int dx = directions[d][0], dy = directions[d][1];
+                    if (pass == 0 && cell(view, x - dx, y - dy) != 2) {
+                        continue;
+                    }
+                    int tx = x + dx, ty = y + dy;
+                    while (cell(view, tx, ty) == 2) {
+                        tx += dx;
+                        ty += dy;
+                    }
+                    if (cell(view, tx, ty) == 0 && !next_to_hit_diagonally(view, tx, ty)) {
+                        shot->x = tx;
+                        shot->y = ty;
+                        return 0;
+                    }
+                }
+            }
+        }
+    }
+
+    // Hunt mode: the first cell of the opening order that can still hold a
+    // ship, when there is a table
+    for (int k = 0; bot->table != NULL && k < PRIOR_CELLS; k++) {
+        int x = bot->table->opening[k] % SIZE, y = bot->table->opening[k] / SIZE;
+        if (view->grid[y][x] == 0 && !next_to_hit_diagonally(view, x, y)) {
+            shot->x = x;
+            shot->y = y;
+            return 0;
+        }
+    }
+
+    // Otherwise a random parity cell, then any cell that can still hold a
+    // ship, then anything not fired at
+    int candidates[SIZE * SIZE];
+    for (int strictness = 2; strictness >= 0; strictness--) {
+        int count = 0;
+        for (int y = 0; y < SIZE; y++) {
+            for (int x = 0; x < SIZE; x++) {
+                if (view->grid[y][x] == 0 && (strictness < 1 || !next_to_hit_diagonally(view, x, y)) &&
+                    (strictness < 2 || (x + y) % 2 == 0)) {
+                    candidates[count++] = y * SIZE + x;
+                }
+            }
+        }
+        if (count > 0) {
+            int chosen = candidates[rand_r(&bot->seed) % count];
+            shot->x = chosen % SIZE;
+            shot->y = chosen / SIZE;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static const BotPlugin hunt_bot = {
+    BOT_ABI_VERSION,
+    "hunt",
+    hunt_create,
+    hunt_destroy,
+    hunt_choose_placement,
+    hunt_choose_shot,
+};
+
+const BotPlugin *battleship_bot_plugin(void) {
+    return &hunt_bot;
+}
@@ -11,8 +11,15 @@
 #include "pipe.h"
 #include "config.h"
 #include "server.h"
+#include "router.h"
+#include "leaderboard.h"
+#include "perf-counters.h"
+#include "wait-strategy.h"
 #include <errno.h>
 #include <stdbool.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
 
 int quit_pipe[2]; // Global pipe for signaling quit
 
@@ -51,20 +58,56 @@ void send_board_to_server(int write_fd, int client_id, GameBoard *board) {
 
 int run_client(int argc, char *argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <server_name>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <server_name> [classic|salvo|salvo:N|ffa:PLAYERS[:SIZE]] "
+                        "[--bot <plugin.so> [--matches N]]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
+    perf_profile_init("client");
 
     const char *server_name = argv[1];
     ThreadArgs args = {0};
 
+    const char *variant_text = NULL;
+    const char *bot_path = NULL;
+    int match_count = 1;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--bot") == 0 && i + 1 < argc) {
+            bot_path = argv[++i];
+        } else if (strcmp(argv[i], "--matches") == 0 && i + 1 < argc) {
+            match_count = atoi(argv[++i]);
+        } else {
+            variant_text = argv[i];
+        }
+    }
+
+    // Only a bot keeps up with more than one match
+    if (match_count < 1 || match_count > MAX_CLIENTS || (match_count > 1 && bot_path == NULL)) {
+        fprintf(stderr, "--matches takes 1 to %d matches and needs --bot\n", MAX_CLIENTS);
+        exit(EXIT_FAILURE);
+    }
+
+    // The variant only matters when this client ends up starting the server
+    GameVariant variant;
+    if (parse_game_variant(variant_text, &variant) == -1) {
+        fprintf(stderr, "Unknown game variant: %s\n", variant_text);
+        exit(EXIT_FAILURE);
+    }
+
     initialize_quit_pipe();
 
     // Setup communication and initialize game state
-    setup_communication(server_name, &args);
-
-    // Connect to server and handle threads
-    connect_to_server(&args);
+    setup_communication(server_name, &variant, &args);
+
+    // Connect to server and handle threads. A router answers with the
+    // worker that hosts the match, and the client then plays on that worker.
+    char worker_name[BUFFER_SIZE];
+    if (connect_to_server(server_name, &args, worker_name, sizeof(worker_name)) == 1) {
+        sem_close(args.sem_command);
+        pipe_close(args.write_fd);
+        server_name = worker_name;
+        open_server_channel(server_name, &args);
+        connect_to_server(server_name, &args, NULL, 0);
+    }
 
     char sem_response_name[BUFFER_SIZE];
     char client_read_fifo[BUFFER_SIZE];
@@ -84,8 +127,35 @@ int run_client(int argc, char *argv[]) {
     
     args.read_fd = read_fd_client;
     args.sem_response = sem_open(sem_response_name, O_RDWR);
+    args.view = board_view_map(server_name, args.client_id);
+
+    // Start the bot after a server we may have forked and before any thread
+    // exists; its worker is a forked process too
+    BotRunner bot;
+    if (bot_path != NULL) {
+        if (bot_runner_start(&bot, bot_path, (unsigned int)getpid()) == -1) {
+            char buffer[BUFFER_SIZE];
+            snprintf(buffer, sizeof(buffer), "CLIENT_%d:QUIT", args.client_id);
+            send_message(args.write_fd, buffer);
+            sem_post(args.sem_command);
+            exit(EXIT_FAILURE);
+        }
+        printf("Bot %s loaded, %d ms per move.\n", bot.name, bot.move_budget_ms);
+        args.bot = &bot;
+    }
+    send_player_name(&args);
+
+    if (match_count > 1) {
+        run_match_farm(&args, match_count);
+    } else {
+        handle_client_threads(&args);
+    }
 
-    handle_client_threads(&args);
+    if (args.bot != NULL) {
+        bot_runner_report(args.bot, stdout);
+        bot_runner_stop(args.bot);
+        args.bot = NULL;
+    }
 
     // Cleanup resources after threads finish
     cleanup_resources(&args);
@@ -93,18 +163,51 @@ int run_client(int argc, char *argv[]) {
     return 0;
 }
 
+static void send_player_name_for(ThreadArgs *args, int client_id);
+
+// Names the player for the server's ratings: BATTLESHIP_PLAYER, else the
+// bot's name or the login name. A client with no name plays unrated.
+void send_player_name(ThreadArgs *args) {
+    send_player_name_for(args, args->client_id);
+}
+
+static void send_player_name_for(ThreadArgs *args, int client_id) {
+    const char *name = getenv("BATTLESHIP_PLAYER");
+    char bot_name[BUFFER_SIZE];
+    if ((name == NULL || *name == '\0') && args->bot != NULL) {
+        snprintf(bot_name, sizeof(bot_name), "bot-%s", args->bot->name);
+        name = bot_name;
+    }
+    if (name == NULL || *name == '\0') {
+        name = getenv("USER");
+    }
+    if (name == NULL || *name == '\0') {
+        return;
+    }
+    char clean[PLAYER_NAME_MAX];
+    leaderboard_clean_name(name, clean);
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, sizeof(buffer), "CLIENT_%d:PLAYER_%s", client_id, clean);
+    send_message(args->write_fd, buffer);
+    sem_post(args->sem_command);
+}
+
 void initialize_client_game_state(ClientGameState *state) {
     initialize_board(&state->my_board);
     initialize_board(&state->enemy_board);
     initialize_fleet(&state->fleet);
     state->ships_to_place = 5;
     atomic_init(&state->game_over, false);
+    atomic_init(&state->pending_shot, -1);
     state->board_ready = 0;
+    parse_game_variant(NULL, &state->variant);
 }
 
-void create_server_process(const char *server_name) {
+void create_server_process(const char *server_name, const GameVariant *variant) {
+    fflush(stdout); // Or the child prints our buffered output again
     pid_t pid = fork();
     if (pid == 0) {
+        set_server_variant(variant);
         run_server(server_name); // Child process: Start the server
         exit(EXIT_SUCCESS);
     } else if (pid > 0) {
@@ -115,19 +218,57 @@ void create_server_process(const char *server_name) {
     }
 }
 
-void setup_communication(const char *server_name, ThreadArgs *args) {
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e3 + (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// The server holds its read FIFO open while it runs, so a non-blocking
+// write open fails with ENOENT when there never was a server and with ENXIO
+// when it is gone
+static int server_is_listening(const char *server_read_fifo, int *stale) {
+    int fd = open(server_read_fifo, O_WRONLY | O_NONBLOCK);
+    if (fd == -1) {
+        *stale = errno == ENXIO;
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+void open_server_channel(const char *server_name, ThreadArgs *args) {
+    char sem_command_name[BUFFER_SIZE], server_read_fifo[BUFFER_SIZE];
+    snprintf(sem_command_name, sizeof(sem_command_name), SEM_COMMAND_TEMPLATE, server_name);
+    snprintf(server_read_fifo, sizeof(server_read_fifo), SERVER_READ_FIFO_TEMPLATE, server_name);
+
+    args->sem_command = sem_open(sem_command_name, O_RDWR, 0666, 0);
+    if (args->sem_command == SEM_FAILED) {
+            perror("Failed to open command semaphore");
+            exit(EXIT_FAILURE);
+        
+    }
+
+    args->write_fd = pipe_open_write(server_read_fifo);
+    args->read_fd = -1; // The CONNECT reply FIFO, until connect_to_server() is done
+
+    if (args->write_fd == -1) {
+        perror("Failed to open pipes");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void setup_communication(const char *server_name, const GameVariant *variant, ThreadArgs *args) {
     char sem_connect_name[BUFFER_SIZE], sem_command_name[BUFFER_SIZE];
     snprintf(sem_connect_name, sizeof(sem_connect_name), SEM_CONNECT_TEMPLATE, server_name);
     snprintf(sem_command_name, sizeof(sem_command_name), SEM_COMMAND_TEMPLATE, server_name);
 
-    char server_read_fifo[BUFFER_SIZE], server_write_fifo[BUFFER_SIZE];
+    char server_read_fifo[BUFFER_SIZE];
     snprintf(server_read_fifo, sizeof(server_read_fifo), SERVER_READ_FIFO_TEMPLATE, server_name);
-    snprintf(server_write_fifo, sizeof(server_write_fifo), SERVER_WRITE_FIFO_TEMPLATE, server_name);
-
 
-
-    // Check if FIFOs exist; if not, create a new server process
-    if (access(server_read_fifo, F_OK) == -1 || access(server_write_fifo, F_OK) == -1) {
+    // Start a server when nobody is listening
+    int stale = 0;
+    if (!server_is_listening(server_read_fifo, &stale)) {
         sem_unlink(sem_connect_name);
         sem_t *sem_connect = sem_open(sem_connect_name, O_CREAT | O_EXCL, 0666, 0);
         if (sem_connect == SEM_FAILED) {
@@ -135,32 +276,34 @@ void setup_communication(const char *server_name, ThreadArgs *args) {
             exit(EXIT_FAILURE);
         }
 
-        printf("Server does not exist. Creating a new server...\n");
-        create_server_process(server_name);
+        printf(stale ? "Server %s is gone. Creating a new server...\n" : "Server does not exist. Creating a new server...\n",
+               server_name);
+        create_server_process(server_name, variant);
 
+        // Posted once the server listens on its FIFO
         printf("Waiting for server initialization...\n");
-        sem_wait(sem_connect);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += CONNECT_TIMEOUT_MS / 1000;
+        deadline.tv_nsec += (CONNECT_TIMEOUT_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int result;
+        while ((result = sem_timedwait(sem_connect, &deadline)) == -1 && errno == EINTR) {
+        }
         sem_close(sem_connect);
-    }
-
-    printf("Server is ready. Connecting...\n");
-
-    args->sem_command = sem_open(sem_command_name, O_RDWR, 0666, 0);
-    if (args->sem_command == SEM_FAILED) {
-            perror("Failed to open command semaphore");
+        if (result == -1) {
+            fprintf(stderr, "Server %s did not start within %d ms.\n", server_name, CONNECT_TIMEOUT_MS);
             exit(EXIT_FAILURE);
-        
+        }
     }
 
-    args->write_fd = pipe_open_write(server_read_fifo);
-    args->read_fd = pipe_open_read(server_write_fifo);
-
-    if (args->write_fd == -1 || args->read_fd == -1) {
-        perror("Failed to open pipes");
-        exit(EXIT_FAILURE);
-    }
+    printf("Server is ready. Connecting...\n");
+    open_server_channel(server_name, args);
 
-    args->game_state = malloc(sizeof(ClientGameState));
+    args->game_state = calloc(1, sizeof(ClientGameState));
     if (!args->game_state) {
         perror("Failed to allocate memory for game state");
         exit(EXIT_FAILURE);
@@ -191,39 +334,107 @@ void cleanup_resources(ThreadArgs *args) {
         args->sem_continue = NULL;
     }
 
+    board_view_unmap(args->view);
+    args->view = NULL;
+
+    if (args->game_state != NULL && args->game_state->ffa_board.slots != NULL) {
+        sparse_board_free(&args->game_state->ffa_board);
+    }
     free(args->game_state);
     args->game_state = NULL;
 
     pipe_close(args->write_fd);
-    pipe_close(args->read_fd);
+    if (args->read_fd != -1) {
+        pipe_close(args->read_fd);
+    }
 }
 
 
-void connect_to_server(ThreadArgs *args) {
-    send_message(args->write_fd, "CONNECT");
-    sem_post(args->sem_command);
+// Sends CONNECT_<pid> and sleeps in poll() until the server answers on this
+// client's own reply FIFO, so concurrent clients never read each other's
+// CLIENT_ID, or until CONNECT_TIMEOUT_MS runs out. A busy server answers
+// REJECT_<ms>_<ticket>: try again after that long, with the ticket.
+int connect_to_server(const char *server_name, ThreadArgs *args, char *route, size_t route_size) {
+    char reply_fifo[BUFFER_SIZE], buffer[BUFFER_SIZE];
+    snprintf(reply_fifo, sizeof(reply_fifo), CONNECT_FIFO_TEMPLATE, server_name, (int)getpid());
+    pipe_init(reply_fifo);
+    args->read_fd = pipe_open_read(reply_fifo);
+    if (args->read_fd == -1) {
+        unlink(reply_fifo);
+        exit(EXIT_FAILURE);
+    }
 
-    char buffer[BUFFER_SIZE];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    snprintf(buffer, sizeof(buffer), "CONNECT_%d", (int)getpid());
+    send_message(args->write_fd, buffer);
+    sem_post(args->sem_command);
 
-    while (1) {
-        if (receive_message(args->read_fd, buffer, BUFFER_SIZE) == 0 && strncmp(buffer, "CLIENT_ID:", 10) == 0) {
-            sscanf(buffer + 10, "%d", &args->client_id);
-            pipe_close(args->read_fd);
-            printf("Successfully connected with ID: %d\n", args->client_id);
-            if (args->client_id == 0) {
-                args->game_state->my_turn = true;
+    MessageReader reader;
+    message_reader_init(&reader, args->read_fd);
+    int answered = 0;
+    int retry_after_ms;
+    unsigned int ticket;
+    while (!answered) {
+        int remaining = CONNECT_TIMEOUT_MS - (int)elapsed_ms(&start);
+        struct pollfd reply = {args->read_fd, POLLIN, 0};
+        int ready = remaining > 0 ? poll(&reply, 1, remaining) : 0;
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        char chunk[BUFFER_SIZE];
+        ssize_t length = ready > 0 ? read(args->read_fd, chunk, sizeof(chunk)) : -1;
+        if (length <= 0) {
+            if (ready == 0) {
+                fprintf(stderr, "Server %s did not answer within %d ms; it may be stuck. "
+                                "Remove /tmp/%s_server_* to start a new one.\n",
+                        server_name, CONNECT_TIMEOUT_MS, server_name);
             } else {
-                args->game_state->my_turn = false;
+                perror("Failed to wait for the server");
             }
-            break;
-        } else if (strncmp(buffer, "REJECT", 6) == 0) {
-            printf("Connection rejected by the server. The game is full.\n");
-            cleanup_resources(args); // Cleanup before exiting
-            exit(EXIT_SUCCESS);
+            unlink(reply_fifo);
+            cleanup_resources(args);
+            exit(EXIT_FAILURE);
+        }
+        message_reader_push(&reader, chunk, (size_t)length);
+        answered = message_reader_pop(&reader, buffer, sizeof(buffer));
+
+        if (answered && sscanf(buffer, "REJECT_%d_%u", &retry_after_ms, &ticket) == 2 &&
+            elapsed_ms(&start) + retry_after_ms < CONNECT_TIMEOUT_MS) {
+            printf("Server is busy. Retrying in %d ms...\n", retry_after_ms);
+            poll(NULL, 0, retry_after_ms);
+            snprintf(buffer, sizeof(buffer), "CONNECT_%d_%u", (int)getpid(), ticket);
+            send_message(args->write_fd, buffer);
+            sem_post(args->sem_command);
+            answered = 0;
         }
+    }
+    unlink(reply_fifo);
+    pipe_close(args->read_fd);
+    args->read_fd = -1;
 
-        usleep(100000); // Retry after delay
+    if (strncmp(buffer, "CLIENT_ID:", 10) == 0) {
+        int consumed = 0;
+        if (sscanf(buffer + 10, "%d:%d:%n", &args->client_id, &args->game_state->seat, &consumed) == 2 && consumed > 0) {
+            parse_game_variant(buffer + 10 + consumed, &args->game_state->variant);
+        }
+        printf("Successfully connected with ID: %d (seat %d) in %.2f ms\n", args->client_id, args->game_state->seat,
+               elapsed_ms(&start));
+        args->game_state->my_turn = args->game_state->seat == 0;
+    } else if (route != NULL && strncmp(buffer, ROUTE_PREFIX, strlen(ROUTE_PREFIX)) == 0) {
+        snprintf(route, route_size, "%s", buffer + strlen(ROUTE_PREFIX));
+        printf("Routed to worker %s in %.2f ms\n", route, elapsed_ms(&start));
+        return 1;
+    } else if (strncmp(buffer, "REJECT_", 7) == 0) {
+        printf("Connection rejected by the server. It is too busy; try again later.\n");
+        cleanup_resources(args);
+        exit(EXIT_FAILURE);
+    } else {
+        printf("Connection rejected by the server. The game is full.\n");
+        cleanup_resources(args); // Cleanup before exiting
+        exit(EXIT_SUCCESS);
     }
+    return 0;
 }
 
 void handle_client_threads(ThreadArgs *args) {
@@ -235,6 +446,13 @@ void handle_client_threads(ThreadArgs *args) {
 
     pthread_create(&command_thread, NULL, handle_commands, args);
     pthread_create(&update_thread, NULL, handle_updates, args);
+
+    // pthread_join() sleeps through signals, so leave the report signal to
+    // the two threads, whose waits return EINTR and poll for it
+    sigset_t report_signal;
+    sigemptyset(&report_signal);
+    sigaddset(&report_signal, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &report_signal, NULL);
     pthread_join(command_thread, NULL);
     pthread_join(update_thread, NULL);
 
@@ -265,6 +483,11 @@ void *handle_commands(void *arg) {
         return NULL;
     }
 
+    if (args->bot != NULL) {
+        run_bot_turns(args);
+        return NULL;
+    }
+
     while (!atomic_load(&args->game_state->game_over)) {
         fd_set read_fds;
         FD_ZERO(&read_fds);
@@ -281,16 +504,17 @@ void *handle_commands(void *arg) {
 
             if (FD_ISSET(STDIN_FILENO, &read_fds)) {
                 if (fgets(buffer, sizeof(buffer), stdin) != NULL) {
-                    if (strncmp(buffer, "ATTACK", 6) == 0) {
-                        int x, y;
-                        if (sscanf(buffer, "ATTACK %d %d", &x, &y) == 2) {
-                            snprintf(buffer, sizeof(buffer), "CLIENT_%d:ATTACK_%d_%d", args->client_id, x, y);
-                            send_message(args->write_fd, buffer);
-                            sem_post(args->sem_command); // Notify server of new command
-                            printf("Attack sent. Waiting for result...\n");
-                        } else {
-                            printf("Invalid input. Use: ATTACK x y\n");
-                        }
+                    if (strncmp(buffer, "ATTACK", 6) == 0 && args->game_state->variant.mode == GAME_MODE_FFA) {
+                        send_ffa_attack_command(args, buffer + 6);
+                    } else if (strncmp(buffer, "ATTACK", 6) == 0) {
+                        send_attack_command(args, buffer + 6);
+                    } else if (strncmp(buffer, "SALVO", 5) == 0) {
+                        send_salvo_command(args, buffer + 5);
+                    } else if (strncmp(buffer, "HINT", 4) == 0) {
+                        show_hint(args);
+                    } else if (strncmp(buffer, "RANK", 4) == 0 || strncmp(buffer, "TOP", 3) == 0 ||
+                               strncmp(buffer, "AROUND", 6) == 0) {
+                        send_leaderboard_query(args, buffer);
                     } else if (strncmp(buffer, "QUIT", 4) == 0) {
                         snprintf(buffer, sizeof(buffer), "CLIENT_%d:QUIT", args->client_id);
                         send_message(args->write_fd, buffer);
@@ -302,6 +526,8 @@ void *handle_commands(void *arg) {
                     }
                 }
             }
+        } else if (result < 0 && errno == EINTR) {
+            perf_profile_poll(); // The report signal may land on this thread
         } else if (result < 0) {
             perror("Error in select");
             break;
@@ -314,18 +540,31 @@ void *handle_commands(void *arg) {
 void *handle_updates(void *arg) {
     ThreadArgs *args = (ThreadArgs *)arg;
 
+    // The server may queue several messages before we read, so frames are
+    // split here instead of assuming one message per read()
+    MessageReader reader;
+    message_reader_init(&reader, args->read_fd);
+    WaitStrategy response_wait;
+    wait_strategy_from_env(&response_wait);
+
     char buffer[BUFFER_SIZE];
     while (!atomic_load(&args->game_state->game_over)) { // Check game_over flag
-        sem_wait(args->sem_response);
+        if (wait_strategy_wait(&response_wait, args->sem_response, NULL) == -1 && errno == EINTR) {
+            perf_profile_poll(); // A signal, not a message
+            continue;
+        }
 
-        if (receive_message(args->read_fd, buffer, BUFFER_SIZE) == 0) {
+        if (message_reader_next(&reader, buffer, BUFFER_SIZE) == 0) {
             process_server_message(args, buffer); // Handle different message types
 
+            // Acknowledge every message so the server can track delivery
+            sem_post(args->sem_continue);
+
             // Set game_over flag if GAME_OVER or OPPONENT_QUIT is received
-            if (strstr(buffer, "GAME_OVER") != NULL || strstr(buffer, "OPPONENT_QUIT") != NULL || strstr(buffer, "MY_QUIT") != NULL) {
+            if (strstr(buffer, "GAME_OVER") != NULL || strstr(buffer, "OPPONENT_QUIT") != NULL || strstr(buffer, "MY_QUIT") != NULL ||
+                strstr(buffer, "MATCH_CLOSED") != NULL) {
 
                 atomic_store(&args->game_state->game_over, true); // Signal game over
-                sem_post(args->sem_continue);
                 write(quit_pipe[1], "Q", 1); // Write to the pipe to signal quit
                 break;
             }
@@ -333,9 +572,317 @@ void *handle_updates(void *arg) {
             perror("Failed to receive message from server");
         }
     }
+    if (response_wait.mode != WAIT_BLOCK) {
+        wait_strategy_report(&response_wait, "server messages", stdout);
+    }
     return NULL;
 }
 
+// Both boards, with the shot still waiting for the server drawn as pending
+static void draw_boards(ClientGameState *state) {
+    int pending = atomic_load(&state->pending_shot);
+    print_boards_pending(&state->my_board, &state->enemy_board, pending < 0 ? -1 : pending % BOARD_SIZE,
+                         pending < 0 ? -1 : pending / BOARD_SIZE);
+}
+
+// Draws the shot before it is sent, so the board answers at once however
+// long the server takes. A cell that is resolved or still pending is refused
+// here without a round trip; ATTACK_RESULT resolves the pending cell and
+// WRONG_TURN or ATTACK_REJECTED takes it back.
+void send_attack_command(ThreadArgs *args, const char *coordinates) {
+    ClientGameState *state = args->game_state;
+    int x, y;
+    if (sscanf(coordinates, "%d %d", &x, &y) != 2 || x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
+        printf("Invalid input. Use: ATTACK x y\n");
+        return;
+    }
+    int cell = state->enemy_board.grid[y][x];
+    if (cell == 2 || cell == 3) {
+        printf("You already fired at (%d, %d).\n", x, y);
+        return;
+    }
+    int expected = -1;
+    if (!atomic_compare_exchange_strong(&state->pending_shot, &expected, y * BOARD_SIZE + x)) {
+        printf("Still waiting for the result at (%d, %d).\n", expected % BOARD_SIZE, expected / BOARD_SIZE);
+        return;
+    }
+
+    clear_screen();
+    draw_boards(state);
+    printf("Attack sent at (%d, %d).\n", x, y);
+    fflush(stdout);
+
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, sizeof(buffer), "CLIENT_%d:ATTACK_%d_%d", args->client_id, x, y);
+    send_message(args->write_fd, buffer);
+    sem_post(args->sem_command); // Notify server of new command
+}
+
+// RANK [name], TOP [count] and AROUND [count]; the server answers between moves
+void send_leaderboard_query(ThreadArgs *args, const char *line) {
+    char command[16] = "", argument[PLAYER_NAME_MAX] = "";
+    sscanf(line, "%15s %23s", command, argument);
+    char buffer[BUFFER_SIZE];
+    int length = snprintf(buffer, sizeof(buffer), "CLIENT_%d:%s", args->client_id, command);
+    if (argument[0] != '\0') {
+        char clean[PLAYER_NAME_MAX];
+        leaderboard_clean_name(argument, clean);
+        snprintf(buffer + length, sizeof(buffer) - (size_t)length, "_%s", clean);
+    }
+    send_message(args->write_fd, buffer);
+    sem_post(args->sem_command);
+}
+
+static void print_turn_prompt(const ClientGameState *state) {
+    if (!state->my_turn) {
+        printf("Waiting for opponent's move...\n");
+    } else if (state->variant.mode == GAME_MODE_FFA) {
+        printf("\nEnter command (ATTACK x y player / QUIT): ");
+    } else if (state->variant.mode == GAME_MODE_SALVO) {
+        printf("\nEnter command (SALVO x y [x y ...], %d shots / HINT / RANK / TOP / QUIT): ",
+               salvo_shots_allowed(&state->variant, &state->my_board));
+    } else {
+        printf("\nEnter command (ATTACK x y / HINT / RANK / TOP / QUIT): ");
+    }
+}
+
+// HINT draws the chance of a ship on every unresolved cell of the opponent's
+// board. The shot hash names the view, so asking again before the next shot
+// costs nothing.
+void show_hint(ThreadArgs *args) {
+    ClientGameState *state = args->game_state;
+    if (state->variant.mode == GAME_MODE_FFA) {
+        printf("Hints are only available in classic and salvo games.\n");
+        return;
+    }
+
+    GameBoard view = state->enemy_board; // The update thread keeps writing the original
+    if (!state->hint_valid || state->hint.key != view.shot_hash) {
+        state->hint_valid = hint_compute(&view, &state->fleet, 0, hint_budget_ms(), &state->hint) == 0;
+        if (!state->hint_valid) {
+            printf("No layout of the fleet matches what we know of the opponent's board.\n");
+            return;
+        }
+    }
+
+    const HintResult *hint = &state->hint;
+    clear_screen();
+    print_boards_with_hint(&state->my_board, &view, hint->probability, hint->best_x, hint->best_y);
+    if (hint->best_x >= 0) {
+        printf("Hint (%s, %llu layouts, %.0f ms): best shot (%d, %d), %.0f%% chance of a ship.\n",
+               hint->exact ? "exact" : "sampled", hint->layouts, hint->seconds * 1000.0, hint->best_x, hint->best_y,
+               hint->probability[hint->best_y][hint->best_x] * 100.0);
+    }
+    print_turn_prompt(state);
+    fflush(stdout);
+}
+
+void send_salvo_command(ThreadArgs *args, const char *coordinates) {
+    ClientGameState *state = args->game_state;
+    int allowed = salvo_shots_allowed(&state->variant, &state->my_board);
+    int values[MAX_SALVO_SHOTS * 2 + 1];
+    int value_count = 0;
+    char *end;
+
+    if (state->variant.mode != GAME_MODE_SALVO) {
+        printf("This game does not use salvos. Use: ATTACK x y\n");
+        return;
+    }
+
+    for (const char *cursor = coordinates; value_count <= MAX_SALVO_SHOTS * 2; cursor = end) {
+        long value = strtol(cursor, &end, 10);
+        if (end == cursor) {
+            break;
+        }
+        values[value_count++] = (int)value;
+    }
+
+    if (value_count == 0 || value_count % 2 != 0 || value_count / 2 > allowed) {
+        printf("Invalid input. Use: SALVO x y [x y ...] with up to %d shots\n", allowed);
+        return;
+    }
+
+    char buffer[BUFFER_SIZE];
+    int length = snprintf(buffer, sizeof(buffer), "CLIENT_%d:SALVO_%d", args->client_id, value_count / 2);
+    for (int i = 0; i < value_count; i += 2) {
+        length += snprintf(buffer + length, sizeof(buffer) - (size_t)length, "_%d_%d", values[i], values[i + 1]);
+    }
+    send_message(args->write_fd, buffer);
+    sem_post(args->sem_command); // Notify server of new command
+    printf("Salvo of %d shots sent. Waiting for result...\n", value_count / 2);
+}
+
+void send_ffa_attack_command(ThreadArgs *args, const char *arguments) {
+    int x, y, target;
+    if (sscanf(arguments, "%d %d %d", &x, &y, &target) != 3) {
+        printf("Invalid input. Use: ATTACK x y player\n");
+        return;
+    }
+    if (target == args->game_state->seat) {
+        printf("You cannot attack your own fleet.\n");
+        return;
+    }
+
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, sizeof(buffer), "CLIENT_%d:ATTACK_%d_%d_%d", args->client_id, x, y, target);
+    send_message(args->write_fd, buffer);
+    sem_post(args->sem_command); // Notify server of new command
+    printf("Attack on player %d sent. Waiting for result...\n", target);
+}
+
+// Free-for-all boards are too large to draw, so shots are reported as text
+static void process_ffa_message(ThreadArgs *args, const char *message) {
+    ClientGameState *state = args->game_state;
+
+    if (strncmp(message, "FLEET_ACCEPTED", 14) == 0) {
+        printf("Fleet accepted. Waiting for the other players...\n");
+    } else if (strncmp(message, "FLEET_REJECTED", 14) == 0) {
+        printf("The server rejected your fleet.\n");
+    } else if (strncmp(message, "FFA_TURN", 8) == 0) {
+        int turn;
+        if (sscanf(message + 9, "%d", &turn) == 1) {
+            state->my_turn = turn == state->seat;
+            printf("All fleets are placed. Player %d starts.\n", turn);
+            print_turn_prompt(state);
+        }
+    } else if (strncmp(message, "FFA_SHOT", 8) == 0) {
+        int attacker, target, x, y, next;
+        char outcome;
+        if (sscanf(message + 9, "%d_%d_%c_%d_%d_%d", &attacker, &target, &outcome, &x, &y, &next) != 6) {
+            return;
+        }
+        const char *text = outcome == 'S' ? "sank the last ship of" : (outcome == 'H' ? "hit" : "missed");
+        if (target == state->seat) {
+            sparse_board_attack(&state->ffa_board, x, y);
+            printf("Player %d %s you at (%d, %d). %ld of your ship cells remain.\n", attacker, text, x, y,
+                   state->ffa_board.ship_cells - state->ffa_board.ship_cells_hit);
+        } else {
+            printf("Player %d %s player %d at (%d, %d).\n", attacker, text, target, x, y);
+        }
+        state->my_turn = next == state->seat;
+        print_turn_prompt(state);
+    } else if (strncmp(message, "PLAYER_QUIT", 11) == 0) {
+        int player, next;
+        if (sscanf(message + 12, "%d_%d", &player, &next) == 2) {
+            printf("Player %d left the game.\n", player);
+            state->my_turn = next == state->seat;
+            print_turn_prompt(state);
+        }
+    } else if (strncmp(message, "ATTACK_REJECTED", 15) == 0) {
+        printf("Attack rejected. Pick a player still afloat and a cell you have not fired at.\n");
+        print_turn_prompt(state);
+    }
+    fflush(stdout);
+}
+
+static void send_quit(ThreadArgs *args);
+
+// Compares our copy of a board with the hash the server sent for it and asks
+// for that board again when they differ
+static void request_resync(ThreadArgs *args, int client_id, const char *which) {
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, sizeof(buffer), "CLIENT_%d:RESYNC_%s", client_id, which);
+    send_message(args->write_fd, buffer);
+    sem_post(args->sem_command);
+}
+
+static void verify_board_hash(ThreadArgs *args, const char *which, unsigned long long local,
+                              unsigned long long remote) {
+    if (local == remote) {
+        return;
+    }
+    printf("Board out of sync (%s: %016llx, server %016llx), requesting a resync.\n", which, local, remote);
+    request_resync(args, args->client_id, which);
+}
+
+// Replaces a board with "<100 cells as 'A' + value>_<hash>" from BOARD_STATE
+static void apply_board_state(const char *state, GameBoard *board, bool mine) {
+    if (strlen(state) < BOARD_SIZE * BOARD_SIZE + 1) {
+        return;
+    }
+    int index = 0;
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            board->grid[i][j] = state[index++] - 'A';
+        }
+    }
+    board_rehash(board);
+
+    unsigned long long remote;
+    if (sscanf(state + index, "_%llx", &remote) == 1) {
+        unsigned long long local = mine ? board_hash(board) : board->shot_hash;
+        if (local != remote) {
+            printf("Resynced board still differs from the server.\n");
+        }
+    }
+}
+
+// Copies the shots on both grids from the page the server wrote before it
+// sent the message being handled; our own ships are the ones we placed.
+// Returns false when there is no page to read or it stays mid-write, and
+// the boards are then checked against the hashes in the message.
+static bool refresh_from_view(ThreadArgs *args) {
+    if (args->view == NULL) {
+        return false;
+    }
+    BoardSnapshot snapshot;
+    if (board_view_read(args->view, &snapshot) != 0 || snapshot.match_id < 0 ||
+        snapshot.seat != args->game_state->seat) {
+        return false;
+    }
+    GameBoard *mine = &args->game_state->my_board;
+    GameBoard *enemy = &args->game_state->enemy_board;
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            int ship = mine->grid[i][j] == 1 || mine->grid[i][j] == 2;
+            mine->grid[i][j] = snapshot.mine[i][j] != 0 ? snapshot.mine[i][j] : ship;
+            enemy->grid[i][j] = snapshot.enemy[i][j];
+        }
+    }
+    board_rehash(mine);
+    board_rehash(enemy);
+    return true;
+}
+
+// Applies "<count>_<H|M|I>_<x>_<y>..._<hash>" to a board, printing each shot
+// when verbose; returns the trailing hash, or 0 when there is none
+static unsigned long long apply_salvo_report(const char *report, GameBoard *board, bool incoming, bool verbose) {
+    int count, consumed;
+    if (sscanf(report, "%d%n", &count, &consumed) != 1) {
+        return 0;
+    }
+
+    for (int k = 0; k < count && k < MAX_SALVO_SHOTS; k++) {
+        char outcome;
+        int x, y, step;
+        report += consumed;
+        if (sscanf(report, "_%c_%d_%d%n", &outcome, &x, &y, &step) != 3) {
+            break;
+        }
+        consumed = step;
+
+        if (outcome == 'I' || x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
+            if (verbose) {
+                printf("Shot at (%d, %d) was not valid.\n", x, y);
+            }
+        } else if (outcome == 'H') {
+            if (verbose) {
+                printf(incoming ? "You were hit at (%d, %d)!\n" : "You hit a ship at (%d, %d)!\n", x, y);
+            }
+            board_mark_shot(board, x, y, 2);
+        } else {
+            if (verbose) {
+                printf(incoming ? "Opponent missed you at (%d, %d).\n" : "You missed at (%d, %d).\n", x, y);
+            }
+            board_mark_shot(board, x, y, 3);
+        }
+    }
+
+    unsigned long long hash = 0;
+    sscanf(report + consumed, "_%llx", &hash);
+    return hash;
+}
+
 void process_server_message(ThreadArgs *args, const char *buffer) {
     char expected_prefix[BUFFER_SIZE];
     snprintf(expected_prefix, sizeof(expected_prefix), "CLIENT_%d:", args->client_id);
@@ -346,68 +893,158 @@ void process_server_message(ThreadArgs *args, const char *buffer) {
 
     const char *message = buffer + strlen(expected_prefix);
 
-    if (strncmp(message, "BOARD_RECEIVED", 13) == 0) {
+    if (args->game_state->variant.mode == GAME_MODE_FFA &&
+        (strncmp(message, "FLEET_", 6) == 0 || strncmp(message, "FFA_", 4) == 0 ||
+         strncmp(message, "PLAYER_QUIT", 11) == 0 || strncmp(message, "ATTACK_REJECTED", 15) == 0)) {
+        process_ffa_message(args, message);
+        return;
+    }
+
+    if (strncmp(message, "BOARD_REJECTED", 14) == 0) {
+        // The server checks every fleet; ours only fails if the board was
+        // corrupted on the way, so there is nothing left to play
+        printf("The server rejected our fleet (%s).\n", message + 15);
+        send_quit(args);
+
+    } else if (strncmp(message, "BOARD_RECEIVED", 13) == 0) {
         clear_screen();
-        print_boards(&args->game_state->my_board, &args->game_state->enemy_board);
-        if (args->game_state->my_turn) {
-            printf("\nEnter command (ATTACK x y / QUIT): ");
-        } else {
-            printf("Waiting for opponent's move...\n");
+        unsigned long long hash;
+        if (!refresh_from_view(args) && sscanf(message + 14, "_%llx", &hash) == 1) {
+            verify_board_hash(args, "MINE", board_hash(&args->game_state->my_board), hash);
         }
+        draw_boards(args->game_state);
+        print_turn_prompt(args->game_state);
         fflush(stdout);
 
     } else if (strncmp(message, "ATTACK_RESULT", 13) == 0) {
         clear_screen();
         int x, y;
         char result;
-        if (sscanf(message + 14, "%c_%d_%d", &result, &x, &y) == 3) {
+        unsigned long long hash;
+        int fields = sscanf(message + 14, "%c_%d_%d_%llx", &result, &x, &y, &hash);
+        atomic_store(&args->game_state->pending_shot, -1);
+        if (fields >= 3) {
             if (result == 'H') {
                 printf("You hit a ship at (%d, %d)!\n", x, y);
-                args->game_state->enemy_board.grid[y][x] = 2;
+                board_mark_shot(&args->game_state->enemy_board, x, y, 2);
             } else {
                 printf("You missed at (%d, %d).\n", x, y);
-                args->game_state->enemy_board.grid[y][x] = 3;
+                board_mark_shot(&args->game_state->enemy_board, x, y, 3);
             }
         }
-        args->game_state->my_turn = false;
-        sem_post(args->sem_continue);
-        print_boards(&args->game_state->my_board, &args->game_state->enemy_board);
-        if (args->game_state->my_turn) {
-            printf("\nEnter command (ATTACK x y / QUIT): ");
-        } else {
-            printf("Waiting for opponent's move...\n");
+        if (!refresh_from_view(args) && fields == 4) {
+            verify_board_hash(args, "ENEMY", args->game_state->enemy_board.shot_hash, hash);
         }
+        args->game_state->my_turn = false;
+        draw_boards(args->game_state);
+        print_turn_prompt(args->game_state);
         fflush(stdout);
 
     } else if (strncmp(message, "OPPONENT_ATTACKED", 17) == 0) {
         clear_screen();
         int x, y;
         char result;
-        if (sscanf(message + 18, "%c_%d_%d", &result, &x, &y) == 3) {
+        unsigned long long hash;
+        int fields = sscanf(message + 18, "%c_%d_%d_%llx", &result, &x, &y, &hash);
+        if (fields >= 3) {
             if (result == 'H') {
                 printf("You were hit at (%d, %d)!\n", x, y);
-                args->game_state->my_board.grid[y][x] = 2;
+                board_mark_shot(&args->game_state->my_board, x, y, 2);
             } else {
                 printf("Opponent missed you at (%d, %d).\n", x, y);
-                args->game_state->my_board.grid[y][x] = 3;
+                board_mark_shot(&args->game_state->my_board, x, y, 3);
             }
         }
+        if (!refresh_from_view(args) && fields == 4) {
+            verify_board_hash(args, "MINE", board_hash(&args->game_state->my_board), hash);
+        }
         args->game_state->my_turn = true;
-        sem_post(args->sem_continue);
-        print_boards(&args->game_state->my_board, &args->game_state->enemy_board);
-        if (args->game_state->my_turn) {
-            printf("\nEnter command (ATTACK x y / QUIT): ");
-        } else {
-            printf("Waiting for opponent's move...\n");
+        draw_boards(args->game_state);
+        print_turn_prompt(args->game_state);
+        fflush(stdout);
+
+    } else if (strncmp(message, "SALVO_RESULT", 12) == 0) {
+        clear_screen();
+        unsigned long long hash = apply_salvo_report(message + 13, &args->game_state->enemy_board, false, true);
+        if (!refresh_from_view(args) && hash != 0) {
+            verify_board_hash(args, "ENEMY", args->game_state->enemy_board.shot_hash, hash);
+        }
+        args->game_state->my_turn = false;
+        draw_boards(args->game_state);
+        print_turn_prompt(args->game_state);
+        fflush(stdout);
+
+    } else if (strncmp(message, "OPPONENT_SALVO", 14) == 0) {
+        clear_screen();
+        unsigned long long hash = apply_salvo_report(message + 15, &args->game_state->my_board, true, true);
+        if (!refresh_from_view(args) && hash != 0) {
+            verify_board_hash(args, "MINE", board_hash(&args->game_state->my_board), hash);
+        }
+        args->game_state->my_turn = true;
+        draw_boards(args->game_state);
+        print_turn_prompt(args->game_state);
+        fflush(stdout);
+
+    } else if (strncmp(message, "BOARD_STATE_MINE", 16) == 0) {
+        apply_board_state(message + 17, &args->game_state->my_board, true);
+
+    } else if (strncmp(message, "BOARD_STATE_ENEMY", 17) == 0) {
+        apply_board_state(message + 18, &args->game_state->enemy_board, false);
+
+    } else if (strncmp(message, "SALVO_REJECTED", 14) == 0) {
+        int allowed = 0;
+        sscanf(message + 15, "%d", &allowed);
+        printf("Salvo rejected by the server. You may fire up to %d shots.\n", allowed);
+
+    } else if (strncmp(message, "RANK_UNNAMED", 12) == 0) {
+        printf("You are not rated: set BATTLESHIP_PLAYER to play under a name.\n");
+
+    } else if (strncmp(message, "RANK_", 5) == 0) {
+        long rank, players;
+        double rating;
+        unsigned int wins, games;
+        char name[PLAYER_NAME_MAX];
+        if (sscanf(message + 5, "%ld_%ld_%lf_%u_%u_%23s", &rank, &players, &rating, &wins, &games, name) == 6) {
+            if (rank == 0) {
+                printf("%s has no rated games yet; %ld players are rated.\n", name, players);
+            } else {
+                printf("%s is ranked %ld of %ld at %.0f (%u of %u games won).\n", name, rank, players, rating, wins,
+                       games);
+            }
         }
+
+    } else if (strncmp(message, "LEADERBOARD_END", 15) == 0) {
+        printf("(%s players rated)\n", message + 16);
         fflush(stdout);
 
+    } else if (strncmp(message, "LEADERBOARD_", 12) == 0) {
+        char entries[BUFFER_SIZE];
+        snprintf(entries, sizeof(entries), "%s", message + 12);
+        char *saved;
+        for (char *entry = strtok_r(entries, ",", &saved); entry != NULL; entry = strtok_r(NULL, ",", &saved)) {
+            long rank;
+            char name[PLAYER_NAME_MAX];
+            double rating;
+            if (sscanf(entry, "%ld:%23[^:]:%lf", &rank, name, &rating) == 3) {
+                printf("%6ld. %-*s %5.0f\n", rank, PLAYER_NAME_MAX, name, rating);
+            }
+        }
+
+    } else if (strncmp(message, "WRONG_MODE", 10) == 0) {
+        printf("That command is not available in this game mode.\n");
+
     } else if (strncmp(message, "GAME_OVER_W", 11) == 0) {
+        if (strstr(message, "TIMEOUT") != NULL) {
+            printf("\nYour opponent ran out of time.");
+        }
         printf("\nCongratulations! You WON the game!\n");
         atomic_store(&args->game_state->game_over, true);
         write(quit_pipe[1], "Q", 1);
 
     } else if (strncmp(message, "GAME_OVER_L", 11) == 0) {
+        if (strstr(message, "TIMEOUT") != NULL) {
+            printf("\nYou ran out of time.");
+        }
         printf("\nSorry! You LOST the game!\n");
         atomic_store(&args->game_state->game_over, true);
         write(quit_pipe[1], "Q", 1);
@@ -422,8 +1059,43 @@ void process_server_message(ThreadArgs *args, const char *buffer) {
         atomic_store(&args->game_state->game_over, true);
         write(quit_pipe[1], "Q", 1);
 
+    } else if (strncmp(message, "MATCH_CLOSED", 12) == 0) {
+        printf("\nThe server closed the match before an opponent joined.\n");
+        atomic_store(&args->game_state->game_over, true);
+        write(quit_pipe[1], "Q", 1);
+
+    } else if (strncmp(message, "ATTACK_REJECTED", 15) == 0) {
+        // Off the board or already shot on the server's board, so ours is
+        // behind it; the turn is still ours
+        int pending = atomic_exchange(&args->game_state->pending_shot, -1);
+        clear_screen();
+        draw_boards(args->game_state);
+        if (pending >= 0) {
+            printf("The server rejected the attack at (%d, %d); it was taken back.\n", pending % BOARD_SIZE,
+                   pending / BOARD_SIZE);
+        }
+        request_resync(args, args->client_id, "ENEMY");
+        if (args->bot != NULL) {
+            atomic_store(&args->game_state->my_turn, true); // A stale view only costs another rejection
+        }
+        print_turn_prompt(args->game_state);
+        fflush(stdout);
+
     } else if (strncmp(message, "WRONG_TURN", 10) == 0) {
+        int pending = atomic_exchange(&args->game_state->pending_shot, -1);
+        if (pending >= 0) {
+            clear_screen();
+            draw_boards(args->game_state);
+            printf("The server refused the attack at (%d, %d); it was taken back.\n", pending % BOARD_SIZE,
+                   pending / BOARD_SIZE);
+        }
         printf("It's not your turn, please wait...\n");
+        if (args->bot != NULL) {
+            // A bot only fires on its own turn, so this means the opponent has
+            // not joined yet; try again shortly
+            usleep(50000);
+            atomic_store(&args->game_state->my_turn, true);
+        }
 
     } else {
         // Ostatné správy ignorujeme alebo si ich môžete logovať
@@ -432,18 +1104,107 @@ void process_server_message(ThreadArgs *args, const char *buffer) {
 }
 
 
+static void send_quit(ThreadArgs *args) {
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, sizeof(buffer), "CLIENT_%d:QUIT", args->client_id);
+    send_message(args->write_fd, buffer);
+    sem_post(args->sem_command);
+    atomic_store(&args->game_state->game_over, true); // Signal game over
+}
+
+// Bots forfeit by quitting; the opponent sees an ordinary OPPONENT_QUIT
+static void forfeit_bot_game(ThreadArgs *args, BotResult result) {
+    printf("Bot %s forfeits: %s.\n", args->bot->name, bot_result_name(result));
+    send_quit(args);
+}
+
+static bool place_bot_fleet(ClientGameState *game_state, ThreadArgs *args) {
+    if (game_state->variant.mode == GAME_MODE_FFA) {
+        printf("Bots only play classic and salvo games.\n");
+        send_quit(args);
+        return false;
+    }
+
+    BotResult result = bot_runner_place_fleet(args->bot, &game_state->my_board, game_state->placements);
+    if (result != BOT_OK) {
+        forfeit_bot_game(args, result);
+        return false;
+    }
+
+    send_board_to_server(args->write_fd, args->client_id, &game_state->my_board);
+    sem_post(args->sem_command);
+    return true;
+}
+
+void run_bot_turns(ThreadArgs *args) {
+    ClientGameState *state = args->game_state;
+
+    while (!atomic_load(&state->game_over)) {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(quit_pipe[0], &read_fds);
+        struct timeval wait = {0, 5000}; // Re-check the turn every 5 ms
+
+        int result = select(quit_pipe[0] + 1, &read_fds, NULL, NULL, &wait);
+        if (result > 0) {
+            break;
+        }
+        if (result < 0 && errno != EINTR) {
+            perror("Error in select");
+            break;
+        }
+        if (!atomic_load(&state->my_turn)) {
+            continue;
+        }
+
+        // The board only changes after our shot, so it is stable while we think
+        Shot shot;
+        BotResult outcome = bot_runner_choose_shot(args->bot, &state->enemy_board, &shot);
+        if (outcome != BOT_OK) {
+            forfeit_bot_game(args, outcome);
+            break;
+        }
+
+        // Clear the turn before sending so the same turn is never played twice
+        atomic_store(&state->my_turn, false);
+        char buffer[BUFFER_SIZE];
+        if (state->variant.mode == GAME_MODE_SALVO) {
+            snprintf(buffer, sizeof(buffer), "CLIENT_%d:SALVO_1_%d_%d", args->client_id, shot.x, shot.y);
+        } else {
+            snprintf(buffer, sizeof(buffer), "CLIENT_%d:ATTACK_%d_%d", args->client_id, shot.x, shot.y);
+        }
+        send_message(args->write_fd, buffer);
+        sem_post(args->sem_command);
+    }
+}
+
 bool place_ships(ClientGameState *game_state, ThreadArgs *args) {
     char buffer[BUFFER_SIZE];
     int index = 0;
 
     initialize_fleet(&game_state->fleet);
 
+    bool ffa = game_state->variant.mode == GAME_MODE_FFA;
+    if (args->bot != NULL) {
+        return place_bot_fleet(game_state, args);
+    }
+    if (ffa && sparse_board_init(&game_state->ffa_board, game_state->variant.board_size,
+                                 game_state->variant.board_size) == -1) {
+        fprintf(stderr, "Failed to allocate a %dx%d board\n", game_state->variant.board_size,
+                game_state->variant.board_size);
+        return false;
+    }
 
     while (!atomic_load(&args->game_state->game_over) && index < 5) { // Check game_over flag
         clear_screen();
         print_fleet(&game_state->fleet, game_state->ships_to_place - index);
-        printf("\nYour current board:\n");
-        print_board(&game_state->my_board);
+        if (ffa) {
+            printf("\nBoard size: %dx%d, players: %d\n", game_state->variant.board_size,
+                   game_state->variant.board_size, game_state->variant.players);
+        } else {
+            printf("\nYour current board:\n");
+            print_board(&game_state->my_board);
+        }
 
         printf("\nPlacing ship: %s (Size: %d)\n",
                game_state->fleet.ships[index].name,
@@ -474,7 +1235,16 @@ bool place_ships(ClientGameState *game_state, ThreadArgs *args) {
                 if (fgets(buffer, sizeof(buffer), stdin) != NULL) {
                     int x, y;
                     char orientation;
-                    if (sscanf(buffer, "PLACE %d %d %c", &x, &y, &orientation) == 3) {
+                    if (ffa && sscanf(buffer, "PLACE %d %d %c", &x, &y, &orientation) == 3) {
+                        if (sparse_board_place_ship(&game_state->ffa_board, x, y,
+                                                    game_state->fleet.ships[index].size, orientation)) {
+                            game_state->placements[index] = (ShipPlacement){x, y, orientation};
+                            printf("Ship placed successfully!\n");
+                            index++;
+                        } else {
+                            printf("Failed to place ship. Invalid position or overlap. Try again.\n");
+                        }
+                    } else if (sscanf(buffer, "PLACE %d %d %c", &x, &y, &orientation) == 3) {
                         if (place_ship_from_fleet(&game_state->my_board, x, y, &game_state->fleet.ships[index], orientation)) {
                             printf("Ship placed successfully!\n");
                             index++;
@@ -493,6 +1263,8 @@ bool place_ships(ClientGameState *game_state, ThreadArgs *args) {
                     }
                 }
             }
+        } else if (result < 0 && errno == EINTR) {
+            perf_profile_poll(); // The report signal may land on this thread
         } else if (result < 0) {
             perror("Error in select");
             return false;
@@ -500,7 +1272,17 @@ bool place_ships(ClientGameState *game_state, ThreadArgs *args) {
     }
 
     // Notify server that all ships are placed
-    send_board_to_server(args->write_fd, args->client_id, &game_state->my_board);
+    if (ffa) {
+        int length = snprintf(buffer, sizeof(buffer), "CLIENT_%d:PLACE_FLEET", args->client_id);
+        for (int i = 0; i < index; i++) {
+            length += snprintf(buffer + length, sizeof(buffer) - (size_t)length, "_%d_%d_%c",
+                               game_state->placements[i].x, game_state->placements[i].y,
+                               game_state->placements[i].orientation);
+        }
+        send_message(args->write_fd, buffer);
+    } else {
+        send_board_to_server(args->write_fd, args->client_id, &game_state->my_board);
+    }
     sem_post(args->sem_command);
     return true;
 }
@@ -533,3 +1315,305 @@ void handle_gameplay_commands(ThreadArgs *args) {
         }
     }
 }
+
+static unsigned long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000ULL + (unsigned long long)now.tv_nsec / 1000000ULL;
+}
+
+static void send_lane_command(ThreadArgs *args, int client_id, const char *command) {
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, sizeof(buffer), "CLIENT_%d:%s", client_id, command);
+    send_message(args->write_fd, buffer);
+    sem_post(args->sem_command);
+}
+
+// The server answers with MY_QUIT, which ends the lane
+static void forfeit_lane(ThreadArgs *args, MatchLane *lane, const char *reason) {
+    printf("Match %d: bot %s forfeits: %s.\n", lane->client_id, args->bot->name, reason);
+    send_lane_command(args, lane->client_id, "QUIT");
+    lane->my_turn = false;
+    lane->retry_at_ms = 0;
+}
+
+static void start_lane(ThreadArgs *args, MatchLane *lane) {
+    ShipPlacement placements[FLEET_SIZE];
+    BotResult result = bot_runner_place_fleet(args->bot, &lane->my_board, placements);
+    if (result != BOT_OK) {
+        forfeit_lane(args, lane, bot_result_name(result));
+        return;
+    }
+    send_board_to_server(args->write_fd, lane->client_id, &lane->my_board);
+    sem_post(args->sem_command);
+}
+
+static void fire_lane(ThreadArgs *args, MatchLane *lane) {
+    Shot shot;
+    BotResult outcome = bot_runner_choose_shot(args->bot, &lane->enemy_board, &shot);
+    if (outcome != BOT_OK) {
+        forfeit_lane(args, lane, bot_result_name(outcome));
+        return;
+    }
+
+    // Cleared before sending, as in run_bot_turns()
+    lane->my_turn = false;
+    char command[BUFFER_SIZE];
+    if (args->game_state->variant.mode == GAME_MODE_SALVO) {
+        snprintf(command, sizeof(command), "SALVO_1_%d_%d", shot.x, shot.y);
+    } else {
+        snprintf(command, sizeof(command), "ATTACK_%d_%d", shot.x, shot.y);
+    }
+    send_lane_command(args, lane->client_id, command);
+}
+
+// Fires the shots WRONG_TURN held back whose time has come. Returns when
+// the next one is due, or 0 when none is left.
+static unsigned long long fire_due_lanes(ThreadArgs *args, MatchLane *lanes, int lane_count) {
+    unsigned long long now = monotonic_ms(), next = 0;
+    for (int i = 0; i < lane_count; i++) {
+        MatchLane *lane = &lanes[i];
+        if (lane->retry_at_ms == 0 || lane->over) {
+            continue;
+        }
+        if (lane->retry_at_ms <= now) {
+            lane->retry_at_ms = 0;
+            fire_lane(args, lane);
+        } else if (next == 0 || lane->retry_at_ms < next) {
+            next = lane->retry_at_ms;
+        }
+    }
+    return next;
+}
+
+static void check_lane_hash(ThreadArgs *args, const MatchLane *lane, const char *which, unsigned long long local,
+                            unsigned long long remote) {
+    if (local != remote) {
+        printf("Match %d: board out of sync (%s), requesting a resync.\n", lane->client_id, which);
+        request_resync(args, lane->client_id, which);
+    }
+}
+
+// What process_server_message() does for one match, without the screen
+static void process_lane_message(ThreadArgs *args, MatchLane *lane, const char *message) {
+    int x, y, fields;
+    char result;
+    unsigned long long hash = 0;
+
+    if (strncmp(message, "ATTACK_RESULT", 13) == 0) {
+        fields = sscanf(message + 14, "%c_%d_%d_%llx", &result, &x, &y, &hash);
+        if (fields >= 3) {
+            board_mark_shot(&lane->enemy_board, x, y, result == 'H' ? 2 : 3);
+        }
+        if (fields == 4) {
+            check_lane_hash(args, lane, "ENEMY", lane->enemy_board.shot_hash, hash);
+        }
+        lane->my_turn = false;
+    } else if (strncmp(message, "OPPONENT_ATTACKED", 17) == 0) {
+        fields = sscanf(message + 18, "%c_%d_%d_%llx", &result, &x, &y, &hash);
+        if (fields >= 3) {
+            board_mark_shot(&lane->my_board, x, y, result == 'H' ? 2 : 3);
+        }
+        if (fields == 4) {
+            check_lane_hash(args, lane, "MINE", board_hash(&lane->my_board), hash);
+        }
+        lane->my_turn = true;
+    } else if (strncmp(message, "SALVO_RESULT", 12) == 0) {
+        hash = apply_salvo_report(message + 13, &lane->enemy_board, false, false);
+        if (hash != 0) {
+            check_lane_hash(args, lane, "ENEMY", lane->enemy_board.shot_hash, hash);
+        }
+        lane->my_turn = false;
+    } else if (strncmp(message, "OPPONENT_SALVO", 14) == 0) {
+        hash = apply_salvo_report(message + 15, &lane->my_board, true, false);
+        if (hash != 0) {
+            check_lane_hash(args, lane, "MINE", board_hash(&lane->my_board), hash);
+        }
+        lane->my_turn = true;
+    } else if (strncmp(message, "BOARD_STATE_MINE", 16) == 0) {
+        apply_board_state(message + 17, &lane->my_board, true);
+    } else if (strncmp(message, "BOARD_STATE_ENEMY", 17) == 0) {
+        apply_board_state(message + 18, &lane->enemy_board, false);
+    } else if (strncmp(message, "BOARD_REJECTED", 14) == 0) {
+        forfeit_lane(args, lane, "fleet rejected");
+    } else if (strncmp(message, "ATTACK_REJECTED", 15) == 0) {
+        // Our view of the enemy board is behind the server's; the resync is
+        // answered before the shot fired again
+        request_resync(args, lane->client_id, "ENEMY");
+        lane->my_turn = true;
+    } else if (strncmp(message, "WRONG_TURN", 10) == 0) {
+        // The opponent has not joined yet
+        lane->retry_at_ms = monotonic_ms() + FARM_RETRY_MS;
+    } else if (strncmp(message, "GAME_OVER_W", 11) == 0 || strncmp(message, "GAME_OVER_L", 11) == 0 ||
+               strncmp(message, "OPPONENT_QUIT", 13) == 0 || strncmp(message, "MY_QUIT", 7) == 0 ||
+               strncmp(message, "MATCH_CLOSED", 12) == 0) {
+        lane->over = true;
+        lane->outcome = strncmp(message, "GAME_OVER_", 10) == 0 ? message[10] : 'Q';
+        lane->my_turn = false;
+        lane->retry_at_ms = 0;
+    }
+}
+
+// A realtime deadline for sem_timedwait() at the monotonic time at_ms
+static void deadline_at(struct timespec *deadline, unsigned long long at_ms) {
+    unsigned long long now = monotonic_ms();
+    long delay_ms = at_ms > now ? (long)(at_ms - now) : 0;
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += delay_ms / 1000;
+    deadline->tv_nsec += (delay_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// Asks for the other matches FARM_OPEN_WINDOW at a time, asking again for
+// any the server throttled once its hint has passed, then places every
+// fleet and plays all matches from this one thread as their messages come
+// in. No fleet goes out before every match is open, so no match can end and
+// let a server this client started exit while OPEN_MATCH is unanswered.
+void run_match_farm(ThreadArgs *args, int match_count) {
+    ClientGameState *state = args->game_state;
+    if (state->variant.mode == GAME_MODE_FFA) {
+        printf("Bots only play classic and salvo games.\n");
+        send_quit(args);
+        return;
+    }
+    MatchLane *lanes = calloc((size_t)match_count, sizeof(MatchLane));
+    if (lanes == NULL) {
+        perror("Failed to allocate the matches");
+        send_quit(args);
+        return;
+    }
+    int lane_of[MAX_CLIENTS]; // Index into lanes by client id, -1 for none
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        lane_of[i] = -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int lane_count = 1;
+    lanes[0].client_id = args->client_id;
+    lanes[0].seat = state->seat;
+    lane_of[args->client_id] = 0;
+    int requested = 1, answered = 1, refused = 0, ended = 0;
+    bool started = false;
+    unsigned long long next_retry_ms = 0;
+    unsigned long long open_after_ms = 0; // A throttled OPEN_MATCH is asked again then
+
+    MessageReader reader;
+    message_reader_init(&reader, args->read_fd);
+    WaitStrategy response_wait;
+    wait_strategy_from_env(&response_wait);
+
+    char buffer[BUFFER_SIZE];
+    while (!started || ended < lane_count) {
+        if (open_after_ms != 0 && open_after_ms <= monotonic_ms()) {
+            open_after_ms = 0;
+        }
+        while (requested < match_count && requested - answered < FARM_OPEN_WINDOW && refused == 0 &&
+               open_after_ms == 0) {
+            send_lane_command(args, args->client_id, "OPEN_MATCH");
+            requested++;
+        }
+        if (!started && answered == requested && (requested == match_count || refused > 0)) {
+            started = true;
+            printf("Playing %d matches over one channel.\n", lane_count);
+            for (int i = 0; i < lane_count; i++) {
+                MatchLane *lane = &lanes[i];
+                initialize_board(&lane->my_board);
+                initialize_board(&lane->enemy_board);
+                lane->my_turn = lane->seat == 0;
+                if (!lane->over) {
+                    start_lane(args, lane);
+                }
+            }
+            // Our matches often pair our own lanes; every fleet is in first
+            for (int i = 0; i < lane_count; i++) {
+                if (lanes[i].my_turn && !lanes[i].over) {
+                    fire_lane(args, &lanes[i]);
+                }
+            }
+            continue;
+        }
+
+        unsigned long long wake_ms = next_retry_ms;
+        if (open_after_ms != 0 && (wake_ms == 0 || open_after_ms < wake_ms)) {
+            wake_ms = open_after_ms;
+        }
+        struct timespec deadline;
+        if (wake_ms != 0) {
+            deadline_at(&deadline, wake_ms);
+        }
+        if (wait_strategy_wait(&response_wait, args->sem_response, wake_ms != 0 ? &deadline : NULL) == -1) {
+            if (errno == EINTR) {
+                perf_profile_poll();
+            } else if (errno != ETIMEDOUT) {
+                perror("Failed to wait for the server");
+                break;
+            }
+            next_retry_ms = next_retry_ms != 0 ? fire_due_lanes(args, lanes, lane_count) : 0;
+            continue;
+        }
+        if (message_reader_next(&reader, buffer, BUFFER_SIZE) != 0) {
+            perror("Failed to receive message from server");
+            continue;
+        }
+
+        int client_id, consumed = 0, opened_id, seat, retry_ms;
+        if (sscanf(buffer, "CLIENT_%d:%n", &client_id, &consumed) == 1 && consumed > 0) {
+            const char *message = buffer + consumed;
+            if (sscanf(message, "MATCH_OPENED_%d_%d", &opened_id, &seat) == 2) {
+                answered++;
+                if (opened_id >= 0 && opened_id < MAX_CLIENTS && lane_count < match_count) {
+                    lane_of[opened_id] = lane_count;
+                    lanes[lane_count].client_id = opened_id;
+                    lanes[lane_count].seat = seat;
+                    lane_count++;
+                    send_player_name_for(args, opened_id);
+                }
+            } else if (sscanf(message, "MATCH_REFUSED_%d", &retry_ms) == 1) {
+                requested--; // Throttled, not full: asked for again
+                open_after_ms = monotonic_ms() + (unsigned long long)(retry_ms > 0 ? retry_ms : 1);
+            } else if (strncmp(message, "MATCH_REFUSED", 13) == 0) {
+                answered++;
+                refused++;
+            } else if (client_id >= 0 && client_id < MAX_CLIENTS && lane_of[client_id] >= 0) {
+                MatchLane *lane = &lanes[lane_of[client_id]];
+                if (!lane->over) {
+                    process_lane_message(args, lane, message);
+                    if (lane->over) {
+                        ended++;
+                    } else if (lane->retry_at_ms != 0) {
+                        if (next_retry_ms == 0 || lane->retry_at_ms < next_retry_ms) {
+                            next_retry_ms = lane->retry_at_ms;
+                        }
+                    } else if (started && lane->my_turn) {
+                        fire_lane(args, lane);
+                    }
+                }
+            }
+        }
+        // Acknowledge every message so the server can track delivery
+        sem_post(args->sem_continue);
+        if (next_retry_ms != 0 && next_retry_ms <= monotonic_ms()) {
+            next_retry_ms = fire_due_lanes(args, lanes, lane_count);
+        }
+    }
+
+    int won = 0, lost = 0;
+    for (int i = 0; i < lane_count; i++) {
+        won += lanes[i].outcome == 'W';
+        lost += lanes[i].outcome == 'L';
+    }
+    printf("Played %d matches in %.2f s: %d won, %d lost, %d ended by a quit\n", lane_count,
+           elapsed_ms(&start) / 1e3, won, lost, lane_count - won - lost);
+    if (lane_count < match_count) {
+        printf("The server had room for %d of the %d matches asked for.\n", lane_count, match_count);
+    }
+    if (response_wait.mode != WAIT_BLOCK) {
+        wait_strategy_report(&response_wait, "server messages", stdout);
+    }
+    atomic_store(&state->game_over, true);
+    free(lanes);
+}
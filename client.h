@@ -2,6 +2,10 @@
 #include <stddef.h>
 #include <semaphore.h>
 #include "game-logic.h"
+#include "free-for-all.h"
+#include "bot-runner.h"
+#include "hint-engine.h"
+#include "board-view.h"
 #include <stdbool.h>
 #include <stdatomic.h> // For atomic_bool
 
@@ -13,9 +17,34 @@ typedef struct {
     int ships_to_place;
     atomic_bool game_over; // Atomic flag to signal game termination
     int board_ready;
-    bool my_turn;
+    atomic_bool my_turn; // Also read by the bot thread
+    int seat; // Position in the match; seat 0 moves first
+    GameVariant variant; // Rules announced by the server in CLIENT_ID
+    SparseBoard ffa_board; // Own fleet in free-for-all games, too large for GameBoard
+    ShipPlacement placements[FLEET_SIZE];
+    HintResult hint; // Last HINT, reused while hint.key matches the enemy board
+    bool hint_valid;
+    atomic_int pending_shot; // Cell of an ATTACK the server has not answered, y * BOARD_SIZE + x, or -1
 } ClientGameState;
 
+// A client with --matches N plays N matches over its one channel: the first
+// is the one it connected to, the others are lanes the server opens on
+// OPEN_MATCH. One thread and one bot play them all, so a match costs this
+// struct and no descriptor or thread.
+#define FARM_OPEN_WINDOW 16 // OPEN_MATCH requests awaiting an answer
+#define FARM_RETRY_MS 50    // Before a shot refused with WRONG_TURN is fired again
+
+typedef struct {
+    int client_id;
+    int seat;
+    GameBoard my_board;
+    GameBoard enemy_board;
+    bool my_turn;
+    bool over;
+    char outcome; // 'W', 'L' or 'Q' once over
+    unsigned long long retry_at_ms; // Fire again then after WRONG_TURN, 0 when not waiting
+} MatchLane;
+
 typedef struct {
     int write_fd;
     int read_fd;
@@ -24,6 +53,8 @@ typedef struct {
     sem_t *sem_command;  // For sending commands
     sem_t *sem_response; // For reading responses
     sem_t *sem_continue; // For reading responses
+    BotRunner *bot;      // Plays instead of stdin when --bot was given
+    const BoardViewPage *view; // The server's page for this client, NULL without one
 } ThreadArgs;
 
 void handle_game_over(const char *message);
@@ -34,13 +65,20 @@ int run_client(int argc, char *argv[]);
 
 void initialize_client_game_state(ClientGameState *state) ;
 
-void create_server_process(const char *server_name);
+void create_server_process(const char *server_name, const GameVariant *variant);
 
-void setup_communication(const char *server_name, ThreadArgs *args);
+void setup_communication(const char *server_name, const GameVariant *variant, ThreadArgs *args);
 
 void cleanup_resources(ThreadArgs *args);
 
-void connect_to_server(ThreadArgs *args);
+// Opens the server FIFO and command semaphore of a running server
+void open_server_channel(const char *server_name, ThreadArgs *args);
+
+// Returns 0 once the server has assigned a seat, or 1 when a router sent the
+// client on to the worker named in route; exits when the server rejects the
+// client or does not answer within CONNECT_TIMEOUT_MS. A NULL route refuses
+// to be routed.
+int connect_to_server(const char *server_name, ThreadArgs *args, char *route, size_t route_size);
 
 void handle_client_threads(ThreadArgs *args);
 
@@ -52,4 +90,21 @@ void handle_gameplay_commands(ThreadArgs *args);
 
 bool place_ships(ClientGameState *game_state, ThreadArgs *args) ;
 
-void process_server_message(ThreadArgs *args, const char *message);
\ No newline at end of file
+void process_server_message(ThreadArgs *args, const char *message);
+
+void send_attack_command(ThreadArgs *args, const char *coordinates);
+
+void send_salvo_command(ThreadArgs *args, const char *coordinates);
+
+void send_ffa_attack_command(ThreadArgs *args, const char *arguments);
+
+void show_hint(ThreadArgs *args);
+
+void send_player_name(ThreadArgs *args);
+
+void send_leaderboard_query(ThreadArgs *args, const char *line);
+
+void run_bot_turns(ThreadArgs *args);
+
+// Plays match_count matches with args->bot, the first on args->client_id
+void run_match_farm(ThreadArgs *args, int match_count);
@@ -1,4 +1,5 @@
 #include "communication.h"
+#include "perf-counters.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
@@ -11,7 +12,11 @@ int send_message(int fd, const char *message) {
     }
 
     size_t len = strlen(message) + 1; // Include null terminator
-    if (write(fd, message, len) == -1) {
+    ssize_t written;
+    while ((written = write(fd, message, len)) == -1 && errno == EINTR) {
+        // A signal arrived before anything was written; try again
+    }
+    if (written == -1) {
         fprintf(stderr, "Failed to write to FIFO: %s\n", strerror(errno));
         return -1;
     }
@@ -38,3 +43,76 @@ int receive_message(int fd, char *buffer, size_t buffer_size) {
 
     return -1;
 }
+
+void message_reader_init(MessageReader *reader, int fd) {
+    reader->fd = fd;
+    reader->start = 0;
+    reader->end = 0;
+}
+
+int message_reader_push(MessageReader *reader, const char *data, size_t length) {
+    // Compact the buffer before appending so frames stay contiguous
+    if (reader->start > 0) {
+        memmove(reader->data, reader->data + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    if (length > sizeof(reader->data) - reader->end) {
+        fprintf(stderr, "Message reader overflow, dropping %zu bytes.\n", length);
+        return -1;
+    }
+
+    memcpy(reader->data + reader->end, data, length);
+    reader->end += length;
+    return 0;
+}
+
+static int pop_frame(MessageReader *reader, char *buffer, size_t buffer_size) {
+    const char *frame = reader->data + reader->start;
+    const char *terminator = memchr(frame, '\0', reader->end - reader->start);
+    if (terminator == NULL) {
+        return 0;
+    }
+
+    size_t length = (size_t)(terminator - frame);
+    if (length >= buffer_size) {
+        length = buffer_size - 1; // Truncate oversized frames
+    }
+    memcpy(buffer, frame, length);
+    buffer[length] = '\0';
+
+    reader->start += (size_t)(terminator - frame) + 1;
+    if (reader->start == reader->end) {
+        reader->start = 0;
+        reader->end = 0;
+    }
+    return 1;
+}
+
+int message_reader_pop(MessageReader *reader, char *buffer, size_t buffer_size) {
+    PerfSample sample;
+    perf_begin(&sample);
+    int popped = pop_frame(reader, buffer, buffer_size);
+    perf_end(PERF_REGION_PARSE_MESSAGE, &sample);
+    return popped;
+}
+
+int message_reader_next(MessageReader *reader, char *buffer, size_t buffer_size) {
+    while (!message_reader_pop(reader, buffer, buffer_size)) {
+        char chunk[BUFFER_SIZE];
+        ssize_t bytes_read = read(reader->fd, chunk, sizeof(chunk));
+        if (bytes_read > 0) {
+            if (message_reader_push(reader, chunk, (size_t)bytes_read) == -1) {
+                return -1;
+            }
+        } else if (bytes_read == 0) {
+            fprintf(stderr, "No data available in FIFO.\n");
+            return -1;
+        } else if (errno != EINTR) {
+            fprintf(stderr, "Failed to read from FIFO: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
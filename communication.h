@@ -1,9 +1,30 @@
 #pragma once
 
 #include <stddef.h>
+#include "config.h"
+
+// Buffers NUL-terminated frames read from a FIFO, so that several messages
+// arriving in one read() are delivered one by one instead of being dropped
+typedef struct {
+    int fd;
+    char data[BUFFER_SIZE * 4];
+    size_t start;
+    size_t end;
+} MessageReader;
 
 // Send a message through a file descriptor
 int send_message(int fd, const char *message);
 
 // Receive a message from a file descriptor
 int receive_message(int fd, char *buffer, size_t buffer_size);
+
+void message_reader_init(MessageReader *reader, int fd);
+
+// Append raw bytes (e.g. from an io_uring completion) to the reader
+int message_reader_push(MessageReader *reader, const char *data, size_t length);
+
+// Pop the next complete frame; returns 1 if a frame was copied, 0 otherwise
+int message_reader_pop(MessageReader *reader, char *buffer, size_t buffer_size);
+
+// Pop the next frame, reading from the descriptor only when none is buffered
+int message_reader_next(MessageReader *reader, char *buffer, size_t buffer_size);
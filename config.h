@@ -2,8 +2,44 @@
 #define CONFIG_H
 
 #define BUFFER_SIZE 1024
-#define MAX_CLIENTS 2
+#define MAX_CLIENTS 512 // Client ids per server, lanes included; classic and salvo games use two
+#define MAX_CHANNEL_LANES 63 // Client ids one channel may add with OPEN_MATCH; odd, so its seats pair up
 #define BOARD_SIZE 10
+#define PLAYER_NAME_MAX 24 // Rated player names, with the terminator
+
+// Outbound delivery. A player more than OUTBOUND_MAX_LAG messages behind,
+// or whose queue is full, is disconnected.
+#define OUTBOUND_QUEUE_CAPACITY 32   // Messages per client id on a queue
+#define OUTBOUND_QUEUE_BYTES 8192    // Message text per client id on a queue
+#define OUTBOUND_MAX_LAG 64          // Queued plus written but unacknowledged
+#define OUTBOUND_RETRY_MS 10         // Before writing to a full FIFO again
+#define OUTBOUND_DRAIN_TIMEOUT_MS 2000
+
+// Turn clocks; BATTLESHIP_MOVE_LIMIT_MS and BATTLESHIP_GAME_LIMIT_MS override
+// the limits, 0 turns one off
+#define TURN_CLOCK_TICK_MS 50
+#define DEFAULT_MOVE_LIMIT_MS 60000  // Per move
+#define DEFAULT_GAME_LIMIT_MS 600000 // Per player over the whole game
+
+// Idle-match hibernation; BATTLESHIP_HIBERNATE_MS overrides the idle time, 0
+// turns it off
+#define DEFAULT_HIBERNATE_MS 30000 // Without a message before a match is spilled
+#define HIBERNATE_SWEEP_MS 1000    // Between looks for idle matches
+
+// How long a client waits for a server to start or to answer CONNECT
+#define CONNECT_TIMEOUT_MS 5000
+
+// How long either side of a live handoff waits for the other
+#define HANDOFF_TIMEOUT_MS 5000
+
+// Admission control for CONNECT storms
+#define ADMISSION_SOURCES 32        // Token buckets, one per connecting uid
+#define ADMISSION_BURST 32          // Connects a source may make at once
+#define ADMISSION_RATE_PER_SEC 16   // Sustained connects per source
+#define ADMISSION_QUEUE_CAPACITY 16 // Per lane: retries with a ticket, new arrivals
+#define ADMISSION_BATCH 4           // Clients seated per pass
+#define ADMISSION_TICKETS 64        // Retry tickets outstanding
+#define ADMISSION_TICKET_MS 10000
 
 // Semaphore templates
 #define SEM_CONNECT_TEMPLATE "/sem_connect_%s"
@@ -14,6 +50,11 @@
 // FIFO templates
 #define SERVER_READ_FIFO_TEMPLATE "/tmp/%s_server_read"
 #define SERVER_WRITE_FIFO_TEMPLATE "/tmp/%s_server_write"
+#define CONNECT_FIFO_TEMPLATE "/tmp/%s_connect_%d" // Per connecting process, for its CLIENT_ID
+#define HANDOFF_SOCKET_TEMPLATE "/tmp/%s_handoff"     // Unix socket a new server binary takes over through
+#define SPILL_FILE_TEMPLATE "/tmp/%s_spill"           // Hibernated matches; unlinked once mapped
+#define BOARD_VIEW_SHM_TEMPLATE "/view_%s_%d"         // Shared memory page with a client's board view
+#define ROUTER_WORKER_TEMPLATE "%s-w%d.%u"            // Server name of a router's worker and its generation
 
 #define CLIENT_READ_FIFO_TEMPLATE "/tmp/%s_client_read_%d"
 #define CLIENT_WRITE_FIFO_TEMPLATE "/tmp/%s_client_write_%d"
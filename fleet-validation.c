@@ -0,0 +1,315 @@
+#include "fleet-validation.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CELLS (BOARD_SIZE * BOARD_SIZE)
+#define BENCH_SAMPLES 4096 // Distinct boards the benchmark cycles through
+
+// Cell (x, y) is bit y * BOARD_SIZE + x, the order the cells are sent in
+typedef unsigned __int128 Bitboard;
+
+static inline int bitboard_count(Bitboard board) {
+    return __builtin_popcountll((uint64_t)board) + __builtin_popcountll((uint64_t)(board >> 64));
+}
+
+// Bit 0 of every row; times a row pattern it repeats that pattern on all rows
+#define FIRST_COLUMN ((((Bitboard)1 << CELLS) - 1) / ((1u << BOARD_SIZE) - 1))
+
+// Cells whose column lies in [first, last]
+static inline Bitboard column_mask(int first, int last) {
+    return FIRST_COLUMN * ((2u << last) - (1u << first));
+}
+
+void fleet_rules_init(FleetRules *rules, const Fleet *fleet) {
+    memset(rules, 0, sizeof(*rules));
+    for (int i = 0; i < FLEET_SIZE; i++) {
+        int size = fleet->ships[i].size;
+        rules->cells += size;
+        for (int k = 2; k <= size && k <= BOARD_SIZE; k++) {
+            rules->windows[k] += size - k + 1;
+        }
+    }
+}
+
+// Packs eight 'A'/'B' characters into bits, cell 0 in bit 0; sets *bad if
+// any other character shows up. After the XOR with '@' a good byte is 1
+// (water) or 2 (ship), so its two low bits must differ and nothing above them
+// may be set. The multiply gathers the ship bits into the top byte.
+static inline unsigned int pack_cells(uint64_t word, uint64_t *bad) {
+    const uint64_t low = 0x0101010101010101ULL;
+    word ^= 0x4040404040404040ULL;
+    *bad |= (word & 0xFCFCFCFCFCFCFCFCULL) | (~(word ^ (word >> 1)) & low);
+    return (unsigned int)((((word >> 1) & low) * 0x0102040810204080ULL) >> 56);
+}
+
+FleetCheck validate_fleet_cells(const FleetRules *rules, const char *cells, size_t length,
+                                uint16_t rows[BOARD_SIZE]) {
+    if (length < CELLS) {
+        return FLEET_BAD_CELLS;
+    }
+
+    uint64_t bad = 0;
+    Bitboard board = 0;
+    uint64_t word;
+    int offset = 0;
+    for (; offset + 8 <= CELLS; offset += 8) {
+        memcpy(&word, cells + offset, sizeof(word));
+        board |= (Bitboard)pack_cells(word, &bad) << offset;
+    }
+    if (offset < CELLS) {
+        // The last few cells: reload the final eight and drop what was seen
+        int seen = 8 - (CELLS - offset);
+        memcpy(&word, cells + CELLS - 8, sizeof(word));
+        board |= (Bitboard)(pack_cells(word, &bad) >> seen) << offset;
+    }
+    if (bad != 0) {
+        return FLEET_BAD_CELLS;
+    }
+    if (bitboard_count(board) != rules->cells) {
+        return FLEET_BAD_CELL_COUNT;
+    }
+
+    // Ships may not touch, not even at a corner. Two ship cells that are
+    // diagonal neighbours mean two ships touch, two parallel ships lie side by
+    // side or a ship bends, so once none exist every connected component is a
+    // straight horizontal or vertical segment.
+    Bitboard down_left = (board >> (BOARD_SIZE - 1)) & column_mask(1, BOARD_SIZE - 1);
+    Bitboard down_right = (board >> (BOARD_SIZE + 1)) & column_mask(0, BOARD_SIZE - 2);
+    if (board & (down_left | down_right)) {
+        return FLEET_TOUCHING;
+    }
+
+    // A segment of length L holds L - k + 1 windows of k cells in its own
+    // direction and none in the other, so the window counts for k = 2, 3, ...
+    // give the number of segments of each length without labeling them one by
+    // one. Ships of length one are what remains of the cell count.
+    // Horizontal windows are built from pairs of neighbours in one row, so
+    // they never wrap from the end of a row into the next one.
+    Bitboard pairs = board & (board >> 1) & column_mask(0, BOARD_SIZE - 2);
+    Bitboard horizontal = pairs;
+    Bitboard vertical = board & (board >> BOARD_SIZE);
+    for (int k = 2; k <= BOARD_SIZE + 1; k++) {
+        if (k > 2) {
+            horizontal &= pairs >> (k - 2);
+            vertical &= board >> ((k - 1) * BOARD_SIZE);
+        }
+        if (bitboard_count(horizontal) + bitboard_count(vertical) != rules->windows[k]) {
+            return FLEET_BAD_LENGTHS;
+        }
+        if ((horizontal | vertical) == 0) {
+            break; // Every longer window count is zero as well
+        }
+    }
+
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        rows[y] = (uint16_t)((board >> (y * BOARD_SIZE)) & ((1u << BOARD_SIZE) - 1));
+    }
+    return FLEET_VALID;
+}
+
+const char *fleet_check_name(FleetCheck check) {
+    switch (check) {
+        case FLEET_VALID:
+            return "VALID";
+        case FLEET_BAD_CELLS:
+            return "CELLS";
+        case FLEET_BAD_CELL_COUNT:
+            return "COUNT";
+        case FLEET_TOUCHING:
+            return "TOUCHING";
+        case FLEET_BAD_LENGTHS:
+            return "LENGTHS";
+    }
+    return "UNKNOWN";
+}
+
+// Straightforward flood fill over a grid, used to cross-check the bitmask
+// version on every benchmark sample
+static FleetCheck reference_check(const FleetRules *rules, const char *cells) {
+    int grid[BOARD_SIZE][BOARD_SIZE];
+    int label[BOARD_SIZE][BOARD_SIZE];
+    int count = 0;
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            char cell = cells[y * BOARD_SIZE + x];
+            if (cell != 'A' && cell != 'B') {
+                return FLEET_BAD_CELLS;
+            }
+            grid[y][x] = cell == 'B';
+            label[y][x] = 0;
+            count += grid[y][x];
+        }
+    }
+    if (count != rules->cells) {
+        return FLEET_BAD_CELL_COUNT;
+    }
+
+    int stack[BOARD_SIZE * BOARD_SIZE][2];
+    int sizes[BOARD_SIZE * BOARD_SIZE + 1];
+    int labels = 0;
+    int touching = 0;
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            if (!grid[y][x] || label[y][x]) {
+                continue;
+            }
+            labels++;
+            int top = 0, size = 0;
+            int min_x = x, max_x = x, min_y = y, max_y = y;
+            label[y][x] = labels;
+            stack[top][0] = x;
+            stack[top++][1] = y;
+            while (top > 0) {
+                top--;
+                int cx = stack[top][0], cy = stack[top][1];
+                size++;
+                min_x = cx < min_x ? cx : min_x;
+                max_x = cx > max_x ? cx : max_x;
+                min_y = cy < min_y ? cy : min_y;
+                max_y = cy > max_y ? cy : max_y;
+                static const int steps[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+                for (int d = 0; d < 4; d++) {
+                    int nx = cx + steps[d][0], ny = cy + steps[d][1];
+                    if (nx >= 0 && nx < BOARD_SIZE && ny >= 0 && ny < BOARD_SIZE &&
+                        grid[ny][nx] && !label[ny][nx]) {
+                        label[ny][nx] = labels;
+                        stack[top][0] = nx;
+                        stack[top++][1] = ny;
+                    }
+                }
+            }
+            sizes[labels] = size;
+            if (min_x != max_x && min_y != max_y) {
+                touching = 1; // Bent
+            }
+        }
+    }
+
+    // Any ship cell around a ship that belongs to another ship
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            for (int dy = -1; grid[y][x] && dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int nx = x + dx, ny = y + dy;
+                    if (nx >= 0 && nx < BOARD_SIZE && ny >= 0 && ny < BOARD_SIZE &&
+                        grid[ny][nx] && label[ny][nx] != label[y][x]) {
+                        touching = 1;
+                    }
+                }
+            }
+        }
+    }
+    if (touching) {
+        return FLEET_TOUCHING;
+    }
+
+    int windows[BOARD_SIZE + 2] = {0};
+    for (int i = 1; i <= labels; i++) {
+        for (int k = 2; k <= sizes[i]; k++) {
+            windows[k] += sizes[i] - k + 1;
+        }
+    }
+    return memcmp(windows, rules->windows, sizeof(windows)) == 0 ? FLEET_VALID : FLEET_BAD_LENGTHS;
+}
+
+// Random legal fleet, then, for every other board, one kind of damage
+static void generate_sample(char *cells, const Fleet *fleet, unsigned int *seed, int sample) {
+    GameBoard board;
+    int placed;
+    do {
+        initialize_board(&board);
+        placed = 0;
+        for (int attempt = 0; attempt < 1000 && placed < FLEET_SIZE; attempt++) {
+            placed += place_ship_c(&board, rand_r(seed) % BOARD_SIZE, rand_r(seed) % BOARD_SIZE,
+                                   fleet->ships[placed].size, rand_r(seed) % 2 ? 'H' : 'V');
+        }
+    } while (placed < FLEET_SIZE);
+
+    for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+        cells[i] = board.grid[i / BOARD_SIZE][i % BOARD_SIZE] ? 'B' : 'A';
+    }
+
+    int target = rand_r(seed) % (BOARD_SIZE * BOARD_SIZE);
+    switch (sample % 8) {
+        case 1:
+            cells[target] = 'C';
+            break;
+        case 3:
+            cells[target] = cells[target] == 'A' ? 'B' : 'A';
+            break;
+        case 5:
+        case 7: {
+            // Move one ship cell so the count still matches
+            int from;
+            do {
+                from = rand_r(seed) % (BOARD_SIZE * BOARD_SIZE);
+            } while (cells[from] != 'B');
+            while (cells[target] != 'A') {
+                target = rand_r(seed) % (BOARD_SIZE * BOARD_SIZE);
+            }
+            cells[from] = 'A';
+            cells[target] = 'B';
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void fleet_validation_benchmark(long board_count, FILE *out) {
+    Fleet fleet;
+    FleetRules rules;
+    initialize_fleet(&fleet);
+    fleet_rules_init(&rules, &fleet);
+
+    char (*samples)[BOARD_SIZE * BOARD_SIZE] = malloc(BENCH_SAMPLES * sizeof(*samples));
+    if (samples == NULL || board_count < 1) {
+        fprintf(out, "Fleet validation benchmark could not start.\n");
+        free(samples);
+        return;
+    }
+
+    unsigned int seed = 33;
+    uint16_t rows[BOARD_SIZE];
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        generate_sample(samples[i], &fleet, &seed, i);
+        FleetCheck expected = reference_check(&rules, samples[i]);
+        FleetCheck actual = validate_fleet_cells(&rules, samples[i], sizeof(samples[i]), rows);
+        if (actual != expected) {
+            fprintf(out, "Sample %d: bitmask check says %s, flood fill says %s\n", i,
+                    fleet_check_name(actual), fleet_check_name(expected));
+        }
+    }
+
+    unsigned long long reasons[FLEET_BAD_LENGTHS + 1] = {0};
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < board_count; i++) {
+        reasons[validate_fleet_cells(&rules, samples[i % BENCH_SAMPLES], BOARD_SIZE * BOARD_SIZE, rows)]++;
+    }
+    double seconds = elapsed_seconds(&start);
+
+    fprintf(out, "Fleet validation: %ld boards in %.3f s, %.1f ns per board, %.1f M boards/s\n", board_count,
+            seconds, seconds * 1e9 / (double)board_count, (double)board_count / seconds / 1e6);
+    for (int i = 0; i <= FLEET_BAD_LENGTHS; i++) {
+        fprintf(out, "  %-8s %llu\n", fleet_check_name((FleetCheck)i), reasons[i]);
+    }
+
+    // The flood fill for comparison, on a tenth of the boards
+    long reference_count = board_count / 10 > 0 ? board_count / 10 : 1;
+    unsigned long long valid = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < reference_count; i++) {
+        valid += reference_check(&rules, samples[i % BENCH_SAMPLES]) == FLEET_VALID;
+    }
+    seconds = elapsed_seconds(&start);
+    fprintf(out, "Flood fill: %.1f ns per board (%llu valid)\n", seconds * 1e9 / (double)reference_count, valid);
+    free(samples);
+}
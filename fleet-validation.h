@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "config.h"
+#include "game-logic.h"
+
+// Server-side check of a board uploaded with SEND_BOARD. The 100 cells are
+// packed into one 128-bit board and its connected components are measured
+// with shifts and popcounts, so a board is checked without branching per
+// cell and without touching a GameBoard at all.
+
+typedef enum {
+    FLEET_VALID,
+    FLEET_BAD_CELLS,      // Too short, or a cell other than 'A' (water) or 'B' (ship)
+    FLEET_BAD_CELL_COUNT, // Ship cells do not add up to the fleet
+    FLEET_TOUCHING,       // Ships touch at a corner or side, or one bends
+    FLEET_BAD_LENGTHS     // Ship lengths differ from the fleet
+} FleetCheck;
+
+// What a valid board must contain, derived once from a Fleet.
+// windows[k] counts the k cells long stretches that fit inside a ship, over
+// all ships; together with the cell count it fixes every ship length.
+typedef struct {
+    int cells;
+    int windows[BOARD_SIZE + 2];
+} FleetRules;
+
+void fleet_rules_init(FleetRules *rules, const Fleet *fleet);
+
+// Checks length characters of 'A'/'B' cells, row by row. On FLEET_VALID,
+// rows holds one bit per ship cell, bit x of rows[y] for cell (x, y).
+FleetCheck validate_fleet_cells(const FleetRules *rules, const char *cells, size_t length,
+                                uint16_t rows[BOARD_SIZE]);
+
+// Short name sent to the client in BOARD_REJECTED_<name>
+const char *fleet_check_name(FleetCheck check);
+
+// Validates board_count generated boards, half of them broken, on one thread
+// and prints the rate and the reason counts
+void fleet_validation_benchmark(long board_count, FILE *out);
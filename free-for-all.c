@@ -0,0 +1,154 @@
+#include "free-for-all.h"
+#include <string.h>
+
+static void advance_turn(FreeForAll *game) {
+    if (game->alive == 0) {
+        return;
+    }
+    int next = game->turn;
+    do {
+        next = (next + 1) % game->player_count;
+    } while (game->eliminated[next]);
+    game->turn = next;
+}
+
+int ffa_init(FreeForAll *game, int player_count, int board_size) {
+    memset(game, 0, sizeof(*game));
+    if (player_count < 2 || player_count > FFA_MAX_PLAYERS) {
+        return -1;
+    }
+
+    for (int i = 0; i < player_count; i++) {
+        if (sparse_board_init(&game->boards[i], board_size, board_size) == -1) {
+            for (int j = 0; j < i; j++) {
+                sparse_board_free(&game->boards[j]);
+            }
+            return -1;
+        }
+    }
+
+    game->player_count = player_count;
+    game->board_size = board_size;
+    game->alive = player_count;
+    return 0;
+}
+
+void ffa_free(FreeForAll *game) {
+    for (int i = 0; i < game->player_count; i++) {
+        sparse_board_free(&game->boards[i]);
+    }
+    game->player_count = 0;
+}
+
+int ffa_place_fleet(FreeForAll *game, int player, const ShipPlacement *placements, int count) {
+    if (player < 0 || player >= game->player_count || game->fleet_ready[player] || count != FLEET_SIZE) {
+        return 0;
+    }
+
+    Fleet fleet;
+    initialize_fleet(&fleet);
+
+    // Place on a scratch board first so a bad fleet leaves no partial state
+    SparseBoard board;
+    if (sparse_board_init(&board, game->board_size, game->board_size) == -1) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!sparse_board_place_ship(&board, placements[i].x, placements[i].y,
+                                     fleet.ships[i].size, placements[i].orientation)) {
+            sparse_board_free(&board);
+            return 0;
+        }
+    }
+
+    sparse_board_free(&game->boards[player]);
+    game->boards[player] = board;
+    game->fleet_ready[player] = 1;
+    game->fleets_ready++;
+    return 1;
+}
+
+int ffa_started(const FreeForAll *game) {
+    return game->player_count > 0 && game->fleets_ready == game->player_count;
+}
+
+int ffa_attack(FreeForAll *game, int attacker, int target, int x, int y) {
+    if (!ffa_started(game) || attacker != game->turn || target == attacker ||
+        target < 0 || target >= game->player_count || game->eliminated[target]) {
+        return -1;
+    }
+
+    int result = sparse_board_attack(&game->boards[target], x, y);
+    if (result == -1) {
+        return -1;
+    }
+
+    if (result == 2) {
+        game->eliminated[target] = 1;
+        game->alive--;
+    }
+    advance_turn(game);
+    return result;
+}
+
+int ffa_eliminate(FreeForAll *game, int player) {
+    if (player < 0 || player >= game->player_count || game->eliminated[player]) {
+        return 0;
+    }
+
+    game->eliminated[player] = 1;
+    game->alive--;
+    if (!game->fleet_ready[player]) {
+        game->fleet_ready[player] = 1; // Nobody waits for a fleet that will never come
+        game->fleets_ready++;
+    }
+    if (game->turn == player) {
+        advance_turn(game);
+    }
+    return 1;
+}
+
+int ffa_winner(const FreeForAll *game) {
+    if (game->alive != 1) {
+        return -1;
+    }
+    for (int i = 0; i < game->player_count; i++) {
+        if (!game->eliminated[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+size_t ffa_memory(const FreeForAll *game) {
+    size_t total = sizeof(*game);
+    for (int i = 0; i < game->player_count; i++) {
+        total += sparse_board_memory(&game->boards[i]);
+    }
+    return total;
+}
+
+void ffa_encode(const FreeForAll *game, HandoffBuffer *buffer) {
+    handoff_put(buffer, game->fleet_ready, (size_t)game->player_count);
+    handoff_put(buffer, game->eliminated, (size_t)game->player_count);
+    handoff_put_int(buffer, game->fleets_ready);
+    handoff_put_int(buffer, game->alive);
+    handoff_put_int(buffer, game->turn);
+    for (int i = 0; i < game->player_count; i++) {
+        sparse_board_encode(&game->boards[i], buffer);
+    }
+}
+
+int ffa_decode(FreeForAll *game, HandoffBuffer *buffer) {
+    handoff_get(buffer, game->fleet_ready, (size_t)game->player_count);
+    handoff_get(buffer, game->eliminated, (size_t)game->player_count);
+    game->fleets_ready = (int)handoff_get_int(buffer);
+    game->alive = (int)handoff_get_int(buffer);
+    game->turn = (int)handoff_get_int(buffer);
+    for (int i = 0; i < game->player_count; i++) {
+        if (sparse_board_decode(&game->boards[i], buffer) == -1) {
+            return -1;
+        }
+    }
+    return buffer->failed ? -1 : 0;
+}
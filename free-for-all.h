@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include "game-logic.h"
+#include "sparse-board.h"
+
+#define FFA_MAX_PLAYERS 64
+#define FFA_DEFAULT_BOARD_SIZE 1000
+
+typedef struct {
+    int x;
+    int y;
+    char orientation;
+} ShipPlacement;
+
+// Free-for-all match: every player owns a sparse board and may fire at any
+// other player still afloat. Turns rotate over the surviving players.
+typedef struct {
+    int player_count;
+    int board_size;
+    SparseBoard boards[FFA_MAX_PLAYERS];
+    unsigned char fleet_ready[FFA_MAX_PLAYERS];
+    unsigned char eliminated[FFA_MAX_PLAYERS];
+    int fleets_ready; // Seats with a fleet, or that left before placing one
+    int alive;
+    int turn;
+} FreeForAll;
+
+int ffa_init(FreeForAll *game, int player_count, int board_size);
+
+void ffa_free(FreeForAll *game);
+
+// Places the standard fleet, one placement per ship in Fleet order.
+// Returns 1 if every ship fits, 0 otherwise (the board is left untouched).
+int ffa_place_fleet(FreeForAll *game, int player, const ShipPlacement *placements, int count);
+
+// The match starts once every seat has a fleet
+int ffa_started(const FreeForAll *game);
+
+// Returns -1 for an invalid shot, 0 miss, 1 hit, 2 hit that sank the target's
+// last ship. Passes the turn on every valid shot.
+int ffa_attack(FreeForAll *game, int attacker, int target, int x, int y);
+
+// Removes a player that left; returns 1 if they were still in the game
+int ffa_eliminate(FreeForAll *game, int player);
+
+// The last player afloat, or -1 while the match is undecided
+int ffa_winner(const FreeForAll *game);
+
+size_t ffa_memory(const FreeForAll *game);
+
+// Writes the whole match for a live handoff
+void ffa_encode(const FreeForAll *game, HandoffBuffer *buffer);
+
+// Refills a game set up with ffa_init() for the same players and board size
+int ffa_decode(FreeForAll *game, HandoffBuffer *buffer);
@@ -1,4 +1,7 @@
 #include "game-logic.h"
+#include "free-for-all.h"
+#include "zobrist.h"
+#include "perf-counters.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -12,9 +15,11 @@ void initialize_board(GameBoard *board) {
         }
     }
     board->ships_remaining = 0;
+    board->ship_hash = 0;
+    board->shot_hash = 0;
 }
 
-int place_ship_c(GameBoard *board, int x, int y, int length, char orientation) {
+static int place_ship_unprofiled(GameBoard *board, int x, int y, int length, char orientation) {
     // Validate coordinates and ship length
     if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE || length < 2 || length > 5) {
         return 0; // Invalid input
@@ -44,6 +49,7 @@ int place_ship_c(GameBoard *board, int x, int y, int length, char orientation) {
         // Place the ship horizontally
         for (int i = x; i < x + length; i++) {
             board->grid[y][i] = 1; // Mark ship parts
+            board->ship_hash ^= zobrist_ship_key(i, y);
         }
     } else if (orientation == 'V') {
         // Check if the ship fits vertically
@@ -67,6 +73,7 @@ int place_ship_c(GameBoard *board, int x, int y, int length, char orientation) {
         // Place the ship vertically
         for (int j = y; j < y + length; j++) {
             board->grid[j][x] = 1; // Mark ship parts
+            board->ship_hash ^= zobrist_ship_key(x, j);
         }
     } else {
         return 0; // Invalid orientation
@@ -77,7 +84,15 @@ int place_ship_c(GameBoard *board, int x, int y, int length, char orientation) {
     return 1; // Ship placed successfully
 }
 
-int attack(GameBoard *board, int x, int y) {
+int place_ship_c(GameBoard *board, int x, int y, int length, char orientation) {
+    PerfSample sample;
+    perf_begin(&sample);
+    int placed = place_ship_unprofiled(board, x, y, length, orientation);
+    perf_end(PERF_REGION_PLACE_SHIP, &sample);
+    return placed;
+}
+
+static int attack_unprofiled(GameBoard *board, int x, int y) {
     // Check if the coordinates are within bounds
     if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
         printf("Invalid coordinates (%d, %d). Out of bounds.\n", x, y);
@@ -93,6 +108,7 @@ int attack(GameBoard *board, int x, int y) {
     // Determine if it's a hit or miss
     if (board->grid[y][x] == 1) { // 1 indicates a ship is present
         board->grid[y][x] = 2;    // Mark as hit
+        board->shot_hash ^= zobrist_shot_key(x, y, 1);
         printf("Hit at (%d, %d)!\n", x, y);
         if (is_game_over(board)) {
             return 2; // Game over
@@ -100,11 +116,189 @@ int attack(GameBoard *board, int x, int y) {
         return 1; // Hit
     } else { // Empty cell
         board->grid[y][x] = 3; // Mark as miss
+        board->shot_hash ^= zobrist_shot_key(x, y, 0);
         printf("Miss at (%d, %d).\n", x, y);
         return 0; // Miss
     }
 }
 
+int attack(GameBoard *board, int x, int y) {
+    PerfSample sample;
+    perf_begin(&sample);
+    int result = attack_unprofiled(board, x, y);
+    perf_end(PERF_REGION_ATTACK, &sample);
+    return result;
+}
+
+void board_mark_shot(GameBoard *board, int x, int y, int cell) {
+    if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE || board->grid[y][x] == cell) {
+        return;
+    }
+    int previous = board->grid[y][x];
+    if (previous == 2 || previous == 3) {
+        board->shot_hash ^= zobrist_shot_key(x, y, previous == 2);
+    }
+    board->grid[y][x] = cell;
+    board->shot_hash ^= zobrist_shot_key(x, y, cell == 2);
+}
+
+void board_rehash(GameBoard *board) {
+    board->ship_hash = 0;
+    board->shot_hash = 0;
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            int cell = board->grid[i][j];
+            if (cell == 1 || cell == 2) {
+                board->ship_hash ^= zobrist_ship_key(j, i);
+            }
+            if (cell == 2 || cell == 3) {
+                board->shot_hash ^= zobrist_shot_key(j, i, cell == 2);
+            }
+        }
+    }
+}
+
+uint64_t board_hash(const GameBoard *board) {
+    return board->ship_hash ^ board->shot_hash;
+}
+
+int attack_salvo(GameBoard *board, const Shot *shots, int shot_count, int *results) {
+    PerfSample sample;
+    perf_begin(&sample);
+    unsigned char targeted[BOARD_SIZE][BOARD_SIZE] = {{0}};
+
+    // Mark the salvo first, rejecting repeated or out-of-range shots
+    for (int k = 0; k < shot_count; k++) {
+        int x = shots[k].x;
+        int y = shots[k].y;
+        if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE ||
+            board->grid[y][x] == 2 || board->grid[y][x] == 3 || targeted[y][x]) {
+            results[k] = -1;
+            continue;
+        }
+        targeted[y][x] = 1;
+        results[k] = 0;
+    }
+
+    // One pass resolves every targeted cell and counts the ship cells left
+    int ship_cells_left = 0;
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            if (targeted[i][j]) {
+                int hit = board->grid[i][j] == 1;
+                board->grid[i][j] = hit ? 2 : 3;
+                board->shot_hash ^= zobrist_shot_key(j, i, hit);
+            } else if (board->grid[i][j] == 1) {
+                ship_cells_left++;
+            }
+        }
+    }
+
+    int hits = 0;
+    for (int k = 0; k < shot_count; k++) {
+        if (results[k] == 0 && board->grid[shots[k].y][shots[k].x] == 2) {
+            results[k] = 1;
+            hits++;
+        }
+    }
+
+    perf_end(PERF_REGION_ATTACK, &sample);
+    if (ship_cells_left == 0) {
+        return 2;
+    }
+    return hits > 0 ? 1 : 0;
+}
+
+int count_surviving_ships(const GameBoard *board) {
+    int surviving = 0;
+
+    // Ships are straight and never touch, so each one starts at a ship cell
+    // with no ship cell above it or to its left
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            int cell = board->grid[i][j];
+            if (cell != 1 && cell != 2) {
+                continue;
+            }
+            int up = i > 0 ? board->grid[i - 1][j] : 0;
+            int left = j > 0 ? board->grid[i][j - 1] : 0;
+            if (up == 1 || up == 2 || left == 1 || left == 2) {
+                continue;
+            }
+
+            int intact = 0;
+            int horizontal = j + 1 < BOARD_SIZE && (board->grid[i][j + 1] == 1 || board->grid[i][j + 1] == 2);
+            int di = horizontal ? 0 : 1;
+            int dj = horizontal ? 1 : 0;
+            for (int r = i, c = j; r < BOARD_SIZE && c < BOARD_SIZE; r += di, c += dj) {
+                int part = board->grid[r][c];
+                if (part == 1) {
+                    intact = 1;
+                } else if (part != 2) {
+                    break;
+                }
+            }
+            surviving += intact;
+        }
+    }
+    return surviving;
+}
+
+int salvo_shots_allowed(const GameVariant *variant, const GameBoard *own_board) {
+    if (variant->mode != GAME_MODE_SALVO) {
+        return 1;
+    }
+    if (variant->salvo_shots > 0) {
+        return variant->salvo_shots;
+    }
+
+    int surviving = count_surviving_ships(own_board);
+    return surviving > 0 ? surviving : 1;
+}
+
+int parse_game_variant(const char *text, GameVariant *variant) {
+    variant->mode = GAME_MODE_CLASSIC;
+    variant->salvo_shots = 0;
+    variant->players = 2;
+    variant->board_size = BOARD_SIZE;
+
+    if (text == NULL || strcmp(text, "classic") == 0) {
+        return 0;
+    }
+    if (strcmp(text, "salvo") == 0) {
+        variant->mode = GAME_MODE_SALVO;
+        return 0;
+    }
+
+    int shots;
+    if (sscanf(text, "salvo:%d", &shots) == 1 && shots >= 1 && shots <= MAX_SALVO_SHOTS) {
+        variant->mode = GAME_MODE_SALVO;
+        variant->salvo_shots = shots;
+        return 0;
+    }
+
+    int players, size = FFA_DEFAULT_BOARD_SIZE;
+    if (sscanf(text, "ffa:%d:%d", &players, &size) >= 1 &&
+        players >= 2 && players <= FFA_MAX_PLAYERS && size >= BOARD_SIZE && size <= SPARSE_MAX_BOARD_SIZE) {
+        variant->mode = GAME_MODE_FFA;
+        variant->players = players;
+        variant->board_size = size;
+        return 0;
+    }
+    return -1;
+}
+
+void format_game_variant(const GameVariant *variant, char *buffer, size_t buffer_size) {
+    if (variant->mode == GAME_MODE_FFA) {
+        snprintf(buffer, buffer_size, "ffa:%d:%d", variant->players, variant->board_size);
+    } else if (variant->mode == GAME_MODE_SALVO && variant->salvo_shots > 0) {
+        snprintf(buffer, buffer_size, "salvo:%d", variant->salvo_shots);
+    } else if (variant->mode == GAME_MODE_SALVO) {
+        snprintf(buffer, buffer_size, "salvo");
+    } else {
+        snprintf(buffer, buffer_size, "classic");
+    }
+}
 
 int is_game_over(GameBoard *board) {
     for (int i = 0; i < 10; i++) {
@@ -146,7 +340,11 @@ void print_board(GameBoard *board) {
 }
 
 
-void print_boards(GameBoard *my_board, GameBoard *enemy_board) {
+static void print_boards_marked(GameBoard *my_board, GameBoard *enemy_board,
+                                const double probability[BOARD_SIZE][BOARD_SIZE], int best_x, int best_y,
+                                int pending_x, int pending_y) {
+    PerfSample sample;
+    perf_begin(&sample);
     printf("   Vaša mapa:                          Superova mapa:\n");
     printf("   ");
 
@@ -179,7 +377,13 @@ void print_boards(GameBoard *my_board, GameBoard *enemy_board) {
         printf(" %d ", i);
         for (int j = 0; j < BOARD_SIZE; j++) {
             char cell = enemy_board->grid[i][j];
-            if (cell == 0 || cell == 1) {
+            if ((cell == 0 || cell == 1) && j == pending_x && i == pending_y) {
+                printf("[?]"); // Výstrel čaká na výsledok
+            } else if ((cell == 0 || cell == 1) && probability != NULL) {
+                // Tenths of the chance of a ship; the best shot is starred
+                int tenths = (int)(probability[i][j] * 10.0);
+                printf(j == best_x && i == best_y ? "[*]" : "[%d]", tenths > 9 ? 9 : tenths);
+            } else if (cell == 0 || cell == 1) {
                 printf("[ ]"); // Voda alebo neodhalená loď
             } else if (cell == 2) {
                 printf("[X]"); // Zásah
@@ -189,6 +393,20 @@ void print_boards(GameBoard *my_board, GameBoard *enemy_board) {
         }
         printf("\n");
     }
+    perf_end(PERF_REGION_PRINT_BOARDS, &sample);
+}
+
+void print_boards(GameBoard *my_board, GameBoard *enemy_board) {
+    print_boards_with_hint(my_board, enemy_board, NULL, -1, -1);
+}
+
+void print_boards_with_hint(GameBoard *my_board, GameBoard *enemy_board,
+                            const double probability[BOARD_SIZE][BOARD_SIZE], int best_x, int best_y) {
+    print_boards_marked(my_board, enemy_board, probability, best_x, best_y, -1, -1);
+}
+
+void print_boards_pending(GameBoard *my_board, GameBoard *enemy_board, int pending_x, int pending_y) {
+    print_boards_marked(my_board, enemy_board, NULL, -1, -1, pending_x, pending_y);
 }
 
 void initialize_fleet(Fleet *fleet) {
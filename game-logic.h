@@ -1,11 +1,14 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 // Štruktúra hernej mriežky
 typedef struct {
     int grid[10][10];   // Player's ships and enemy attacks
     int ships_remaining;
+    uint64_t ship_hash; // Zobrist hash of the ship cells
+    uint64_t shot_hash; // Zobrist hash of the hit and missed cells: the opponent's view
 } GameBoard;
 
 typedef struct {
@@ -23,6 +26,27 @@ typedef struct {
     Ship ships[5];
 } Fleet;
 
+#define FLEET_SIZE 5
+#define MAX_SALVO_SHOTS FLEET_SIZE
+
+typedef enum {
+    GAME_MODE_CLASSIC, // One shot per turn
+    GAME_MODE_SALVO,   // Several shots per turn, sent and evaluated together
+    GAME_MODE_FFA      // N players on large sparse boards, last fleet afloat wins
+} GameMode;
+
+typedef struct {
+    GameMode mode;
+    int salvo_shots; // Shots per salvo; 0 means one per surviving ship
+    int players;     // Seats in the match
+    int board_size;  // Side of each board
+} GameVariant;
+
+typedef struct {
+    int x;
+    int y;
+} Shot;
+
 
 void initialize_fleet(Fleet *fleet);
 
@@ -35,6 +59,32 @@ int place_ship_c(GameBoard *board, int x, int y, int length, char orientation);
 // Simuluje útok na konkrétnu pozíciu
 int attack(GameBoard *board, int x, int y);
 
+// Records a shot result on a board copy (2 hit, 3 miss) and updates its hash
+void board_mark_shot(GameBoard *board, int x, int y, int cell);
+
+// Recomputes both hashes after the grid was written directly
+void board_rehash(GameBoard *board);
+
+// Hash of the whole board: ships and shots
+uint64_t board_hash(const GameBoard *board);
+
+// Evaluates a whole salvo in one pass over the board. results[i] is 1 for a
+// hit, 0 for a miss and -1 for an invalid or repeated shot. Returns 2 when the
+// salvo sinks the last ship, 1 if anything was hit, 0 otherwise.
+int attack_salvo(GameBoard *board, const Shot *shots, int shot_count, int *results);
+
+// Counts ships that still have at least one cell that was not hit
+int count_surviving_ships(const GameBoard *board);
+
+// Number of shots a player with this board may fire in one turn
+int salvo_shots_allowed(const GameVariant *variant, const GameBoard *own_board);
+
+// Parses "classic", "salvo", "salvo:N" or "ffa:PLAYERS[:SIZE]"; returns 0 on success
+int parse_game_variant(const char *text, GameVariant *variant);
+
+// Writes the variant in the form accepted by parse_game_variant()
+void format_game_variant(const GameVariant *variant, char *buffer, size_t buffer_size);
+
 // Overí, či sú všetky lode zničené
 int is_game_over(GameBoard *board);
 
@@ -42,6 +92,15 @@ void print_board(GameBoard *board);
 
 void print_boards(GameBoard *my_board, GameBoard *enemy_board);
 
+// print_boards() with the chance of a ship drawn on the opponent's unresolved
+// cells, in tenths, and the cell (best_x, best_y) marked with '*'
+void print_boards_with_hint(GameBoard *my_board, GameBoard *enemy_board,
+                            const double probability[10][10], int best_x, int best_y);
+
+// print_boards() with the opponent's cell (pending_x, pending_y) marked '?'
+// while the shot at it waits for the server; -1 draws no pending cell
+void print_boards_pending(GameBoard *my_board, GameBoard *enemy_board, int pending_x, int pending_y);
+
 int place_ship_from_fleet(GameBoard *board, int x, int y, Ship *ship, char orientation);
 
 void print_fleet(Fleet *fleet, int ships);
\ No newline at end of file
@@ -0,0 +1,476 @@
+#include "handoff.h"
+#include "match.h"
+#include "timer-wheel.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define HANDOFF_MAGIC 0x46464f444e414842ULL // "BHANDOFF"
+
+void handoff_buffer_init(HandoffBuffer *buffer) {
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void handoff_buffer_free(HandoffBuffer *buffer) {
+    free(buffer->data);
+    handoff_buffer_init(buffer);
+}
+
+void handoff_put(HandoffBuffer *buffer, const void *data, size_t length) {
+    if (buffer->failed) {
+        return;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 65536;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            buffer->failed = 1;
+            return;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+void handoff_get(HandoffBuffer *buffer, void *data, size_t length) {
+    if (buffer->failed || length > buffer->length - buffer->cursor) {
+        buffer->failed = 1;
+        memset(data, 0, length);
+        return;
+    }
+    memcpy(data, buffer->data + buffer->cursor, length);
+    buffer->cursor += length;
+}
+
+// Eight bytes per step, so checking a large snapshot costs little next to sending it
+static uint64_t checksum(const unsigned char *data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int write_all(int fd, const void *data, size_t length) {
+    const char *cursor = data;
+    while (length > 0) {
+        ssize_t written = write(fd, cursor, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to write to the handoff socket");
+            return -1;
+        }
+        cursor += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *data, size_t length) {
+    char *cursor = data;
+    while (length > 0) {
+        ssize_t bytes_read = read(fd, cursor, length);
+        if (bytes_read == 0) {
+            return -1; // The peer went away
+        }
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to read from the handoff socket");
+            return -1;
+        }
+        cursor += bytes_read;
+        length -= (size_t)bytes_read;
+    }
+    return 0;
+}
+
+static int socket_address(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Handoff socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un address;
+    if (socket_address(path, &address) == -1) {
+        return -1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener == -1) {
+        perror("Failed to create the handoff socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(listener, 1) == -1) {
+        perror("Failed to listen on the handoff socket");
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+int handoff_accept(int listener) {
+    if (listener == -1) {
+        return -1;
+    }
+    int fd = accept(listener, NULL, NULL);
+    if (fd != -1) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return fd;
+}
+
+int handoff_connect(const char *path) {
+    struct sockaddr_un address;
+    if (socket_address(path, &address) == -1) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("Failed to create the handoff socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_send_snapshot(int socket, const HandoffBuffer *snapshot) {
+    uint64_t header[4] = {HANDOFF_MAGIC, HANDOFF_VERSION, snapshot->length,
+                          checksum(snapshot->data, snapshot->length)};
+    if (write_all(socket, header, sizeof(header)) == -1) {
+        return -1;
+    }
+    return write_all(socket, snapshot->data, snapshot->length);
+}
+
+int handoff_receive_snapshot(int socket, HandoffBuffer *snapshot) {
+    uint64_t header[4];
+    if (read_all(socket, header, sizeof(header)) == -1) {
+        return -1;
+    }
+    if (header[0] != HANDOFF_MAGIC || header[1] != HANDOFF_VERSION) {
+        fprintf(stderr, "Handoff snapshot version %llu, expected %d\n", (unsigned long long)header[1],
+                HANDOFF_VERSION);
+        return -1;
+    }
+
+    handoff_buffer_init(snapshot);
+    snapshot->data = malloc(header[2] > 0 ? header[2] : 1);
+    if (snapshot->data == NULL) {
+        perror("Failed to allocate the handoff snapshot");
+        return -1;
+    }
+    snapshot->length = header[2];
+    snapshot->capacity = header[2];
+    if (read_all(socket, snapshot->data, snapshot->length) == -1) {
+        handoff_buffer_free(snapshot);
+        return -1;
+    }
+    if (checksum(snapshot->data, snapshot->length) != header[3]) {
+        fprintf(stderr, "Handoff snapshot failed its checksum.\n");
+        handoff_buffer_free(snapshot);
+        return -1;
+    }
+    return 0;
+}
+
+typedef union {
+    char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MESSAGE)];
+    struct cmsghdr align;
+} FdControl;
+
+int handoff_send_fds(int socket, const int *fds, int count) {
+    for (int sent = 0; sent < count;) {
+        int batch = count - sent < HANDOFF_FDS_PER_MESSAGE ? count - sent : HANDOFF_FDS_PER_MESSAGE;
+        FdControl control;
+        memset(&control, 0, sizeof(control));
+        char marker = 'F'; // Descriptors need at least one byte to travel with
+        struct iovec iov = {&marker, 1};
+        struct msghdr message = {0};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)batch);
+
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)batch);
+        memcpy(CMSG_DATA(header), fds + sent, sizeof(int) * (size_t)batch);
+
+        if (sendmsg(socket, &message, 0) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to pass descriptors");
+            return -1;
+        }
+        sent += batch;
+    }
+    return 0;
+}
+
+int handoff_receive_fds(int socket, int *fds, int count) {
+    for (int received = 0; received < count;) {
+        int batch = count - received < HANDOFF_FDS_PER_MESSAGE ? count - received : HANDOFF_FDS_PER_MESSAGE;
+        FdControl control;
+        char marker;
+        struct iovec iov = {&marker, 1};
+        struct msghdr message = {0};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+
+        ssize_t bytes_read = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        struct cmsghdr *header = bytes_read == 1 ? CMSG_FIRSTHDR(&message) : NULL;
+        if (header == NULL || header->cmsg_type != SCM_RIGHTS ||
+            header->cmsg_len != CMSG_LEN(sizeof(int) * (size_t)batch) || (message.msg_flags & MSG_CTRUNC)) {
+            fprintf(stderr, "Handoff descriptors missing or cut short.\n");
+            return -1;
+        }
+        memcpy(fds + received, CMSG_DATA(header), sizeof(int) * (size_t)batch);
+        received += batch;
+    }
+    return 0;
+}
+
+int handoff_signal(int socket) {
+    char ready = 'R';
+    return write_all(socket, &ready, 1);
+}
+
+int handoff_await(int socket, int timeout_ms) {
+    struct pollfd peer = {socket, POLLIN, 0};
+    int ready;
+    do {
+        ready = poll(&peer, 1, timeout_ms);
+    } while (ready == -1 && errno == EINTR);
+    if (ready != 1) {
+        return -1;
+    }
+    char signal;
+    return read_all(socket, &signal, 1);
+}
+
+static double elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) * 1e3 + (double)(now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+// A classic match halfway through: both fleets placed, thirty shots each
+static void fill_benchmark_match(Match *match, long index) {
+    static const int lengths[FLEET_SIZE] = {5, 4, 3, 3, 2};
+    for (int seat = 0; seat < 2; seat++) {
+        GameBoard *board = &match->boards[seat];
+        for (int ship = 0; ship < FLEET_SIZE; ship++) {
+            for (int k = 0; k < lengths[ship]; k++) {
+                board->grid[ship * 2][k] = 1;
+            }
+        }
+        board->ships_remaining = FLEET_SIZE;
+        match->seats[seat] = (int)(index * 2 + seat);
+        match->clock_ms[seat] = DEFAULT_GAME_LIMIT_MS;
+    }
+    for (int turn = 0; turn < 30; turn++) {
+        for (int seat = 0; seat < 2; seat++) {
+            int cell = (turn * 37 + seat * 11 + (int)index) % (BOARD_SIZE * BOARD_SIZE);
+            int *target = &match->boards[1 - seat].grid[cell / BOARD_SIZE][cell % BOARD_SIZE];
+            int hit = *target == 1 || *target == 2;
+            *target = hit ? 2 : 3;
+            match->shots[match->shot_count++] = history_shot(seat, turn, cell % BOARD_SIZE, cell / BOARD_SIZE, hit);
+        }
+    }
+    board_rehash(&match->boards[0]);
+    board_rehash(&match->boards[1]);
+    match->turns[0] = match->turns[1] = 30;
+    match->seated = 2;
+    match->boards_ready = 3;
+    match->clock_seat = 0;
+    match->sequence = 60;
+}
+
+static void benchmark_clock_expired(TimerEntry *timer, void *context) {
+    (void)timer;
+    (void)context;
+}
+
+typedef struct {
+    double receive_ms; // Snapshot and descriptors
+    double restore_ms; // Decoding the matches and arming their clocks
+} RestoreTimes;
+
+// The new server's side: everything is received before anything is rebuilt,
+// as in a real takeover. Descriptors are closed batch by batch, since both
+// ends holding one per seat would not fit in a usual descriptor limit.
+static void restore_benchmark_matches(int socket, long match_count) {
+    RestoreTimes times;
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    HandoffBuffer snapshot;
+    if (handoff_receive_snapshot(socket, &snapshot) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+    int fd_count = (int)handoff_get_int(&snapshot);
+    int batch[HANDOFF_FDS_PER_MESSAGE];
+    for (int received = 0; received < fd_count; received += HANDOFF_FDS_PER_MESSAGE) {
+        int count = fd_count - received < HANDOFF_FDS_PER_MESSAGE ? fd_count - received : HANDOFF_FDS_PER_MESSAGE;
+        if (handoff_receive_fds(socket, batch, count) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; i++) {
+            close(batch[i]);
+        }
+    }
+    times.receive_ms = elapsed_ms(&started);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    TimerWheel wheel;
+    timer_wheel_init(&wheel, 0);
+    long restored = 0;
+    for (long i = 0; i < match_count; i++) {
+        Match *match = match_decode(&snapshot);
+        if (match == NULL) {
+            break;
+        }
+        long long remaining_ms = handoff_get_int(&snapshot);
+        timer_entry_init(&match->turn_clock, benchmark_clock_expired, match);
+        timer_wheel_add(&wheel, &match->turn_clock, (unsigned long long)remaining_ms / TURN_CLOCK_TICK_MS);
+        restored++;
+    }
+    times.restore_ms = elapsed_ms(&started);
+
+    if (restored != match_count || write_all(socket, &times, sizeof(times)) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static void free_benchmark_matches(Match **matches, long count) {
+    for (long i = 0; i < count; i++) {
+        match_destroy(matches[i]);
+    }
+    free(matches);
+}
+
+void handoff_benchmark(long match_count, FILE *out) {
+    if (match_count < 1 || match_pools_init() == -1) {
+        fprintf(out, "Handoff benchmark could not start.\n");
+        return;
+    }
+    GameVariant variant;
+    parse_game_variant(NULL, &variant);
+    Match **matches = calloc((size_t)match_count, sizeof(Match *));
+    long created = 0;
+    while (matches != NULL && created < match_count && (matches[created] = match_create((int)created, &variant)) != NULL) {
+        fill_benchmark_match(matches[created], created);
+        created++;
+    }
+
+    int sockets[2];
+    if (created < match_count || socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1) {
+        fprintf(out, "Handoff benchmark could not set up %ld matches.\n", match_count);
+        free_benchmark_matches(matches, created);
+        return;
+    }
+    fflush(out);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sockets[0]);
+        restore_benchmark_matches(sockets[1], match_count);
+    }
+    close(sockets[1]);
+    if (pid == -1) {
+        perror("Failed to fork the receiving server");
+        close(sockets[0]);
+        free_benchmark_matches(matches, created);
+        return;
+    }
+
+    // The same sequence as a takeover: encode, send, pass two descriptors
+    // per match, then wait until the other side has everything rebuilt
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    int fd_count = (int)(match_count * 2);
+    HandoffBuffer snapshot;
+    handoff_buffer_init(&snapshot);
+    handoff_put_int(&snapshot, fd_count);
+    for (long i = 0; i < match_count; i++) {
+        match_encode(matches[i], &snapshot);
+        handoff_put_int(&snapshot, 30000 + i % 30000); // Turn time left
+    }
+    double encode_ms = elapsed_ms(&started);
+
+    struct timespec sending;
+    clock_gettime(CLOCK_MONOTONIC, &sending);
+    int status = snapshot.failed ? -1 : handoff_send_snapshot(sockets[0], &snapshot);
+    int batch[HANDOFF_FDS_PER_MESSAGE];
+    for (int sent = 0; status == 0 && sent < fd_count; sent += HANDOFF_FDS_PER_MESSAGE) {
+        int count = fd_count - sent < HANDOFF_FDS_PER_MESSAGE ? fd_count - sent : HANDOFF_FDS_PER_MESSAGE;
+        for (int i = 0; i < count; i++) {
+            batch[i] = dup(sockets[0]);
+        }
+        status = handoff_send_fds(sockets[0], batch, count);
+        for (int i = 0; i < count; i++) {
+            close(batch[i]);
+        }
+    }
+    double send_ms = elapsed_ms(&sending);
+
+    RestoreTimes times;
+    if (status == 0) {
+        status = read_all(sockets[0], &times, sizeof(times));
+    }
+    double total_ms = elapsed_ms(&started);
+    close(sockets[0]);
+    waitpid(pid, NULL, 0);
+
+    if (status == -1) {
+        fprintf(out, "Handoff benchmark failed.\n");
+    } else {
+        fprintf(out, "Handoff: %ld matches, %d descriptors, %.1f MB snapshot (%zu bytes per match)\n", match_count,
+                fd_count, (double)snapshot.length / 1e6, snapshot.length / (size_t)match_count);
+        fprintf(out, "  encode %.2f ms, send %.2f ms, receive %.2f ms, restore %.2f ms\n", encode_ms, send_ms,
+                times.receive_ms, times.restore_ms);
+        fprintf(out, "  total pause %.2f ms\n", total_ms);
+    }
+
+    handoff_buffer_free(&snapshot);
+    free_benchmark_matches(matches, created);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Live handoff to a new server binary. The new process connects to the
+// running server's Unix socket and asks for the handoff; the running server
+// stops reading, sends a snapshot of its matches and sessions and then every
+// channel descriptor with SCM_RIGHTS, and exits once told that the new one
+// is ready. Clients keep their FIFOs and semaphores and only see a pause.
+
+#define HANDOFF_REQUEST "HANDOFF" // Sent on the server FIFO by the new server
+#define HANDOFF_VERSION 4 // 4: and the uid that connected each client id
+#define HANDOFF_FDS_PER_MESSAGE 250 // The kernel takes at most 253 per message
+
+// Snapshot fields are written one at a time at fixed widths, so the layout
+// does not depend on how either binary lays out its structs
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    size_t cursor; // Next byte to read
+    int failed;    // Out of memory, or read past the end
+} HandoffBuffer;
+
+void handoff_buffer_init(HandoffBuffer *buffer);
+
+void handoff_buffer_free(HandoffBuffer *buffer);
+
+void handoff_put(HandoffBuffer *buffer, const void *data, size_t length);
+
+// Zero-fills data and marks the buffer failed when fewer bytes are left
+void handoff_get(HandoffBuffer *buffer, void *data, size_t length);
+
+static inline void handoff_put_int(HandoffBuffer *buffer, int64_t value) {
+    handoff_put(buffer, &value, sizeof(value));
+}
+
+static inline int64_t handoff_get_int(HandoffBuffer *buffer) {
+    int64_t value;
+    handoff_get(buffer, &value, sizeof(value));
+    return value;
+}
+
+// Non-blocking listener on path, replacing any socket left there
+int handoff_listen(const char *path);
+
+// The new server waiting on the listener, or -1 when there is none
+int handoff_accept(int listener);
+
+int handoff_connect(const char *path);
+
+// The snapshot travels behind a header with its version, length and checksum
+int handoff_send_snapshot(int socket, const HandoffBuffer *snapshot);
+
+// Returns -1 when the peer closed the socket or the snapshot is damaged
+int handoff_receive_snapshot(int socket, HandoffBuffer *snapshot);
+
+int handoff_send_fds(int socket, const int *fds, int count);
+
+int handoff_receive_fds(int socket, int *fds, int count);
+
+// One byte each way: the new server is ready, then the old one lets it go
+int handoff_signal(int socket);
+
+// Returns 0 once the peer signals, -1 when it closes the socket or timeout_ms passes
+int handoff_await(int socket, int timeout_ms);
+
+// Encodes match_count active matches, passes them and a descriptor per
+// seat to a forked process that rebuilds them, and prints each phase's time
+void handoff_benchmark(long match_count, FILE *out);
@@ -0,0 +1,311 @@
+#include "hint-engine.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CELLS (BOARD_SIZE * BOARD_SIZE)
+#define MAX_PLACEMENTS (2 * CELLS)
+#define MAX_HINT_THREADS 64
+#define DEADLINE_CHECK_MASK 4095 // Nodes between two looks at the clock
+
+// Cell (x, y) is bit y * BOARD_SIZE + x
+typedef unsigned __int128 Bitboard;
+
+typedef struct {
+    Bitboard ship;
+    Bitboard halo; // The ship and every cell around it; no other ship may enter
+} Placement;
+
+typedef struct {
+    int ship_count;
+    int lengths[FLEET_SIZE];       // Longest first, so the big branches are cut early
+    int remaining[FLEET_SIZE + 1]; // Cells in ships depth.. that are still to be placed
+    int same_length[FLEET_SIZE];   // Same length as the previous ship: place it later in the list only
+    Placement placements[FLEET_SIZE][MAX_PLACEMENTS];
+    int placement_count[FLEET_SIZE];
+    Bitboard misses;
+    Bitboard hits;
+
+    unsigned long long deadline_ns;
+    atomic_int next_item; // Next placement of the first ship to hand out
+    atomic_bool expired;
+} HintSearch;
+
+typedef struct {
+    HintSearch *search;
+    unsigned long long counts[CELLS]; // Layouts with a ship in each cell
+    unsigned long long layouts;
+    unsigned long long nodes;
+    uint64_t seed;
+    pthread_t thread;
+} HintWorker;
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static inline Bitboard cell_bit(int x, int y) {
+    return (Bitboard)1 << (y * BOARD_SIZE + x);
+}
+
+static inline int bitboard_count(Bitboard board) {
+    return __builtin_popcountll((uint64_t)board) + __builtin_popcountll((uint64_t)(board >> 64));
+}
+
+static inline void add_cells(unsigned long long counts[CELLS], Bitboard board, unsigned long long amount) {
+    for (uint64_t word = (uint64_t)board; word != 0; word &= word - 1) {
+        counts[__builtin_ctzll(word)] += amount;
+    }
+    for (uint64_t word = (uint64_t)(board >> 64); word != 0; word &= word - 1) {
+        counts[64 + __builtin_ctzll(word)] += amount;
+    }
+}
+
+// Every position of a ship of this length that the view allows on its own:
+// no cell on a miss and no hit right next to it, since that hit would belong
+// to a ship touching this one
+static int list_placements(int length, Bitboard misses, Bitboard hits, Placement *placements) {
+    int count = 0;
+    for (int vertical = 0; vertical < (length > 1 ? 2 : 1); vertical++) {
+        for (int y = 0; y + (vertical ? length - 1 : 0) < BOARD_SIZE; y++) {
+            for (int x = 0; x + (vertical ? 0 : length - 1) < BOARD_SIZE; x++) {
+                Placement placement = {0, 0};
+                for (int i = 0; i < length; i++) {
+                    int cx = x + (vertical ? 0 : i), cy = y + (vertical ? i : 0);
+                    placement.ship |= cell_bit(cx, cy);
+                    for (int ny = cy - 1; ny <= cy + 1; ny++) {
+                        for (int nx = cx - 1; nx <= cx + 1; nx++) {
+                            if (nx >= 0 && nx < BOARD_SIZE && ny >= 0 && ny < BOARD_SIZE) {
+                                placement.halo |= cell_bit(nx, ny);
+                            }
+                        }
+                    }
+                }
+                if ((placement.ship & misses) == 0 && (placement.halo & ~placement.ship & hits) == 0) {
+                    placements[count++] = placement;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+static int deadline_passed(HintWorker *worker) {
+    HintSearch *search = worker->search;
+    if ((++worker->nodes & DEADLINE_CHECK_MASK) == 0 && now_ns() >= search->deadline_ns) {
+        atomic_store(&search->expired, true);
+    }
+    return atomic_load_explicit(&search->expired, memory_order_relaxed);
+}
+
+// Places ship depth at placements [first, end) and everything after it.
+// blocked holds the misses and the halo of every ship placed so far.
+static void enumerate(HintWorker *worker, int depth, int first, int end, Bitboard blocked, Bitboard ships,
+                      Bitboard hits_left) {
+    HintSearch *search = worker->search;
+    if (deadline_passed(worker) || bitboard_count(hits_left) > search->remaining[depth]) {
+        return;
+    }
+
+    const Placement *placements = search->placements[depth];
+    if (depth == search->ship_count - 1) {
+        // The last ship completes a layout wherever it fits and covers the
+        // remaining hits, so those layouts are counted without recursing
+        unsigned long long fits = 0;
+        for (int i = first; i < end; i++) {
+            if ((placements[i].ship & blocked) == 0 && (hits_left & ~placements[i].ship) == 0) {
+                add_cells(worker->counts, placements[i].ship, 1);
+                fits++;
+            }
+        }
+        if (fits > 0) {
+            add_cells(worker->counts, ships, fits);
+            worker->layouts += fits;
+        }
+        return;
+    }
+
+    int next_count = search->placement_count[depth + 1];
+    for (int i = first; i < end; i++) {
+        if ((placements[i].ship & blocked) != 0) {
+            continue;
+        }
+        // Ships of equal length are interchangeable, so each set of their
+        // positions is counted once, in increasing order
+        int next_first = search->same_length[depth + 1] ? i + 1 : 0;
+        enumerate(worker, depth + 1, next_first, next_count, blocked | placements[i].halo,
+                  ships | placements[i].ship, hits_left & ~placements[i].ship);
+    }
+}
+
+static void *exact_worker(void *arg) {
+    HintWorker *worker = arg;
+    HintSearch *search = worker->search;
+    int item;
+    while ((item = atomic_fetch_add(&search->next_item, 1)) < search->placement_count[0] &&
+           !atomic_load(&search->expired)) {
+        enumerate(worker, 0, item, item + 1, search->misses, 0, search->hits);
+    }
+    return NULL;
+}
+
+static inline uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Draws every ship uniformly from its own placements and keeps the layouts
+// that are legal and cover every hit, which makes the kept layouts uniform
+// over all legal ones
+static void *sampling_worker(void *arg) {
+    HintWorker *worker = arg;
+    HintSearch *search = worker->search;
+
+    while (!deadline_passed(worker)) {
+        Bitboard blocked = search->misses, ships = 0;
+        int depth = 0;
+        for (; depth < search->ship_count; depth++) {
+            const Placement *placement =
+                &search->placements[depth][next_random(&worker->seed) % (uint64_t)search->placement_count[depth]];
+            if ((placement->ship & blocked) != 0) {
+                break;
+            }
+            blocked |= placement->halo;
+            ships |= placement->ship;
+        }
+        if (depth == search->ship_count && (search->hits & ~ships) == 0) {
+            add_cells(worker->counts, ships, 1);
+            worker->layouts++;
+        }
+    }
+    return NULL;
+}
+
+// Runs body on thread_count workers and folds their counts into the first
+static void run_workers(HintWorker *workers, int thread_count, void *(*body)(void *)) {
+    int started = 1;
+    for (; started < thread_count; started++) {
+        if (pthread_create(&workers[started].thread, NULL, body, &workers[started]) != 0) {
+            break; // Fewer threads only make it slower
+        }
+    }
+    body(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        for (int cell = 0; cell < CELLS; cell++) {
+            workers[0].counts[cell] += workers[i].counts[cell];
+        }
+        workers[0].layouts += workers[i].layouts;
+    }
+}
+
+int hint_budget_ms(void) {
+    const char *text = getenv("BATTLESHIP_HINT_BUDGET_MS");
+    int budget = text != NULL ? atoi(text) : 0;
+    return budget > 0 ? budget : HINT_DEFAULT_BUDGET_MS;
+}
+
+int hint_compute(const GameBoard *view, const Fleet *fleet, int thread_count, int budget_ms,
+                 HintResult *result) {
+    if (thread_count < 1) {
+        thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (thread_count < 1) {
+        thread_count = 1;
+    } else if (thread_count > MAX_HINT_THREADS) {
+        thread_count = MAX_HINT_THREADS;
+    }
+
+    HintSearch *search = calloc(1, sizeof(HintSearch));
+    HintWorker *workers = calloc((size_t)thread_count, sizeof(HintWorker));
+    if (search == NULL || workers == NULL) {
+        free(search);
+        free(workers);
+        return -1;
+    }
+
+    unsigned long long started = now_ns();
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            if (view->grid[y][x] == 2) {
+                search->hits |= cell_bit(x, y);
+            } else if (view->grid[y][x] == 3) {
+                search->misses |= cell_bit(x, y);
+            }
+        }
+    }
+
+    // Longest ships first
+    search->ship_count = FLEET_SIZE;
+    for (int i = 0; i < FLEET_SIZE; i++) {
+        int length = fleet->ships[i].size, j = i;
+        for (; j > 0 && search->lengths[j - 1] < length; j--) {
+            search->lengths[j] = search->lengths[j - 1];
+        }
+        search->lengths[j] = length;
+    }
+    int possible = 1;
+    for (int i = FLEET_SIZE - 1; i >= 0; i--) {
+        search->remaining[i] = search->remaining[i + 1] + search->lengths[i];
+        search->same_length[i] = i > 0 && search->lengths[i] == search->lengths[i - 1];
+        search->placement_count[i] = list_placements(search->lengths[i], search->misses, search->hits,
+                                                     search->placements[i]);
+        possible &= search->placement_count[i] > 0;
+    }
+
+    // Exact count first; if it runs out of half the budget, sample for the rest
+    unsigned long long budget_ns = (unsigned long long)budget_ms * 1000000ULL;
+    search->deadline_ns = started + budget_ns / 2;
+    atomic_init(&search->next_item, 0);
+    atomic_init(&search->expired, false);
+    for (int i = 0; i < thread_count; i++) {
+        workers[i].search = search;
+        workers[i].seed = started + (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+    }
+    if (possible) {
+        run_workers(workers, thread_count, exact_worker);
+    }
+
+    result->exact = !atomic_load(&search->expired);
+    if (!result->exact) {
+        for (int i = 0; i < thread_count; i++) {
+            memset(workers[i].counts, 0, sizeof(workers[i].counts));
+            workers[i].layouts = 0;
+        }
+        search->deadline_ns = started + budget_ns;
+        atomic_store(&search->expired, false);
+        run_workers(workers, thread_count, sampling_worker);
+    }
+
+    result->layouts = workers[0].layouts;
+    result->best_x = -1;
+    result->best_y = -1;
+    result->key = view->shot_hash;
+    double best = -1.0;
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            double probability = result->layouts > 0
+                                     ? (double)workers[0].counts[y * BOARD_SIZE + x] / (double)result->layouts
+                                     : 0.0;
+            result->probability[y][x] = probability;
+            if (view->grid[y][x] == 0 && probability > best) {
+                best = probability;
+                result->best_x = x;
+                result->best_y = y;
+            }
+        }
+    }
+    result->seconds = (double)(now_ns() - started) / 1e9;
+
+    free(workers);
+    free(search);
+    return result->layouts > 0 ? 0 : -1;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include "config.h"
+#include "game-logic.h"
+
+#define HINT_DEFAULT_BUDGET_MS 500
+
+// Chance of a ship in every cell of the opponent's board, given what is known
+// of it: hits, misses and the fleet. Every legal layout of the fleet that
+// agrees with the view is counted, so the result is exact; when there are too
+// many to count before the deadline it is estimated from random layouts.
+typedef struct {
+    double probability[BOARD_SIZE][BOARD_SIZE];
+    unsigned long long layouts; // Layouts counted, or samples accepted
+    int exact;                  // 0 when the estimate comes from sampling
+    int best_x;                 // Unresolved cell most likely to hold a ship
+    int best_y;
+    double seconds;
+    uint64_t key;               // Shot hash of the view the hint belongs to
+} HintResult;
+
+// Budget per hint in milliseconds, from BATTLESHIP_HINT_BUDGET_MS
+int hint_budget_ms(void);
+
+// view holds 0 for cells not fired at, 2 for hits and 3 for misses. Returns
+// 0 on success, or -1 when no layout of the fleet matches the view.
+int hint_compute(const GameBoard *view, const Fleet *fleet, int thread_count, int budget_ms,
+                 HintResult *result);
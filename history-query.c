@@ -0,0 +1,502 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "history.h"
+#include "game-logic.h"
+
+// Aggregates over a history store. Every query maps the columns it needs
+// and splits the scan into one contiguous range per thread; the ranges are
+// merged at the end.
+
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+
+#define COUNTER_PLANES 16
+#define PLANE_FLUSH_GAMES 65535 // Largest count the planes hold
+
+static const int slot_lengths[FLEET_SIZE] = {5, 4, 3, 3, 2};
+static const char *end_names[] = {"sunk", "quit", "timeout"};
+
+typedef struct {
+    uint64_t games;
+    uint64_t shots;
+    uint64_t duration_ms;
+    uint64_t wins[3]; // Seat 0, seat 1, nobody
+    uint64_t ends[3]; // HistoryEnd
+} VariantSummary;
+
+typedef struct {
+    const HistoryStore *store;
+    uint64_t begin; // Games, or shots for the shot scans
+    uint64_t end;
+    VariantSummary summary[256]; // Per variant code
+    uint64_t fleet_bits[256]; // Ship cells per bit of the four fleet words of a game
+    uint64_t origins[HISTORY_SHIP_SLOTS][256]; // Per ship slot and origin byte
+    uint32_t shots[65536]; // Per distinct HistoryShot
+} Partition;
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void *scan_summary(void *argument) {
+    Partition *partition = argument;
+    const HistoryStore *store = partition->store;
+    for (uint64_t game = partition->begin; game < partition->end; game++) {
+        VariantSummary *summary = &partition->summary[store->variant[game]];
+        uint8_t winner = store->winner[game];
+        uint8_t end = store->end[game];
+        summary->games++;
+        summary->shots += store->shot_count[game];
+        summary->duration_ms += store->duration_ms[game];
+        summary->wins[winner < 2 ? winner : 2]++;
+        summary->ends[end < 3 ? end : HISTORY_END_QUIT]++;
+    }
+    return NULL;
+}
+
+// Adds the bit planes into per-bit totals and clears them
+static void flush_planes(u64x4 planes[COUNTER_PLANES], uint64_t totals[256]) {
+    for (int word = 0; word < 4; word++) {
+        for (int bit = 0; bit < 64; bit++) {
+            uint64_t count = 0;
+            for (int plane = 0; plane < COUNTER_PLANES; plane++) {
+                count |= ((planes[plane][word] >> bit) & 1) << plane;
+            }
+            totals[word * 64 + bit] += count;
+        }
+    }
+    memset(planes, 0, COUNTER_PLANES * sizeof(u64x4));
+}
+
+// Positional popcount over the fleet column: the four fleet words of a game
+// are one vector, added into bit-sliced counters, so one game costs a couple
+// of vector AND and XOR steps instead of a loop over its 34 ship cells
+static void *scan_placements(void *argument) {
+    Partition *partition = argument;
+    const HistoryStore *store = partition->store;
+    u64x4 planes[COUNTER_PLANES];
+    memset(planes, 0, sizeof(planes));
+
+    int pending = 0;
+    for (uint64_t game = partition->begin; game < partition->end; game++) {
+        u64x4 carry;
+        memcpy(&carry, &store->fleet[game * 4], sizeof(carry));
+        for (int plane = 0; plane < COUNTER_PLANES; plane++) {
+            u64x4 next = planes[plane] & carry;
+            planes[plane] ^= carry;
+            carry = next;
+            if ((carry[0] | carry[1] | carry[2] | carry[3]) == 0) {
+                break;
+            }
+        }
+        if (++pending == PLANE_FLUSH_GAMES) {
+            flush_planes(planes, partition->fleet_bits);
+            pending = 0;
+        }
+
+        const uint8_t *ships = &store->ships[game * 2 * HISTORY_SHIP_SLOTS];
+        for (int slot = 0; slot < 2 * HISTORY_SHIP_SLOTS; slot++) {
+            partition->origins[slot % HISTORY_SHIP_SLOTS][ships[slot]]++;
+        }
+    }
+    flush_planes(planes, partition->fleet_bits);
+    return NULL;
+}
+
+static void *scan_shots(void *argument) {
+    Partition *partition = argument;
+    const HistoryShot *shots = partition->store->shots;
+    for (uint64_t shot = partition->begin; shot < partition->end; shot++) {
+        partition->shots[shots[shot]]++;
+    }
+    return NULL;
+}
+
+// Splits [0, total) among the partitions, runs scan on each in its own
+// thread and returns the seconds it took
+static double run_partitions(const HistoryStore *store, Partition *partitions, int thread_count, uint64_t total,
+                             void *(*scan)(void *)) {
+    pthread_t *threads = malloc((size_t)thread_count * sizeof(pthread_t));
+    int started = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < thread_count; i++) {
+        partitions[i].store = store;
+        partitions[i].begin = total * (uint64_t)i / (uint64_t)thread_count;
+        partitions[i].end = total * (uint64_t)(i + 1) / (uint64_t)thread_count;
+    }
+    while (threads != NULL && started < thread_count &&
+           pthread_create(&threads[started], NULL, scan, &partitions[started]) == 0) {
+        started++;
+    }
+    for (int i = started; i < thread_count; i++) {
+        scan(&partitions[i]); // Whatever could not get a thread runs here
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return elapsed_seconds(&start);
+}
+
+static void print_scan(const char *what, uint64_t items, double seconds, int thread_count) {
+    printf("Scanned %llu %s in %.3f s on %d threads (%.1f M/s)\n", (unsigned long long)items, what, seconds,
+           thread_count, seconds > 0 ? (double)items / seconds / 1e6 : 0.0);
+}
+
+static void query_summary(const HistoryStore *store, Partition *partitions, int thread_count) {
+    double seconds = run_partitions(store, partitions, thread_count, store->games, scan_summary);
+    for (int code = 0; code < 256; code++) {
+        VariantSummary total = {0};
+        for (int i = 0; i < thread_count; i++) {
+            const VariantSummary *part = &partitions[i].summary[code];
+            total.games += part->games;
+            total.shots += part->shots;
+            total.duration_ms += part->duration_ms;
+            for (int k = 0; k < 3; k++) {
+                total.wins[k] += part->wins[k];
+                total.ends[k] += part->ends[k];
+            }
+        }
+        if (total.games == 0) {
+            continue;
+        }
+
+        GameVariant variant;
+        char name[64];
+        history_variant_from_code((uint8_t)code, &variant);
+        format_game_variant(&variant, name, sizeof(name));
+        double games = (double)total.games;
+        printf("%-8s %10llu games, %5.1f shots, %6.1f s; seat 0 wins %4.1f%%, seat 1 %4.1f%%, nobody %4.1f%%;",
+               name, (unsigned long long)total.games, (double)total.shots / games,
+               (double)total.duration_ms / games / 1000.0, 100.0 * (double)total.wins[0] / games,
+               100.0 * (double)total.wins[1] / games, 100.0 * (double)total.wins[2] / games);
+        for (int k = 0; k < 3; k++) {
+            printf(" %s %4.1f%%", end_names[k], 100.0 * (double)total.ends[k] / games);
+        }
+        printf("\n");
+    }
+    print_scan("games", store->games, seconds, thread_count);
+}
+
+static void print_grid(const char *title, const double values[BOARD_SIZE * BOARD_SIZE], double scale) {
+    printf("%s\n   ", title);
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        printf("%5d", x);
+    }
+    printf("\n");
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        printf("%2d ", y);
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            printf("%5.1f", values[y * BOARD_SIZE + x] * scale);
+        }
+        printf("\n");
+    }
+}
+
+// Where shots land and how often they hit, early in a game and later on
+static void query_heatmap(const HistoryStore *store, Partition *partitions, int thread_count) {
+    static const int bucket_starts[] = {0, 10, 30, HISTORY_MAX_TURN + 1};
+    double seconds = run_partitions(store, partitions, thread_count, store->shot_total, scan_shots);
+
+    for (int bucket = 0; bucket < 3; bucket++) {
+        uint64_t fired[BOARD_SIZE * BOARD_SIZE] = {0};
+        uint64_t hits[BOARD_SIZE * BOARD_SIZE] = {0};
+        uint64_t bucket_total = 0;
+        for (int i = 0; i < thread_count; i++) {
+            for (int turn = bucket_starts[bucket]; turn < bucket_starts[bucket + 1]; turn++) {
+                for (int low = 0; low < 512; low++) {
+                    uint32_t count = partitions[i].shots[(turn << 9) | low];
+                    int cell = low & 0x7f;
+                    if (count == 0 || cell >= BOARD_SIZE * BOARD_SIZE) {
+                        continue;
+                    }
+                    fired[cell] += count;
+                    hits[cell] += (low & 0x80) ? count : 0;
+                    bucket_total += count;
+                }
+            }
+        }
+
+        double share[BOARD_SIZE * BOARD_SIZE];
+        double hit_rate[BOARD_SIZE * BOARD_SIZE];
+        for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+            share[cell] = bucket_total > 0 ? (double)fired[cell] / (double)bucket_total : 0.0;
+            hit_rate[cell] = fired[cell] > 0 ? (double)hits[cell] / (double)fired[cell] : 0.0;
+        }
+        char title[128];
+        snprintf(title, sizeof(title), "Turns %d-%d: %llu shots; share of shots per cell, %%", bucket_starts[bucket] + 1,
+                 bucket_starts[bucket + 1], (unsigned long long)bucket_total);
+        print_grid(title, share, 100.0);
+        print_grid("Hit rate per cell, %", hit_rate, 100.0);
+    }
+    print_scan("shots", store->shot_total, seconds, thread_count);
+}
+
+// Chance that a cell holds a ship, over both fleets of every game
+static double scan_occupancy(const HistoryStore *store, Partition *partitions, int thread_count,
+                             double occupancy[BOARD_SIZE * BOARD_SIZE]) {
+    double seconds = run_partitions(store, partitions, thread_count, store->games, scan_placements);
+    for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+        uint64_t count = 0;
+        for (int i = 0; i < thread_count; i++) {
+            count += partitions[i].fleet_bits[cell] + partitions[i].fleet_bits[128 + cell];
+        }
+        occupancy[cell] = store->games > 0 ? (double)count / (2.0 * (double)store->games) : 0.0;
+    }
+    return seconds;
+}
+
+static void query_placements(const HistoryStore *store, Partition *partitions, int thread_count) {
+    double occupancy[BOARD_SIZE * BOARD_SIZE];
+    double seconds = scan_occupancy(store, partitions, thread_count, occupancy);
+    print_grid("Chance that a cell holds a ship, %", occupancy, 100.0);
+
+    for (int slot = 0; slot < FLEET_SIZE; slot++) {
+        uint64_t origins[256] = {0};
+        uint64_t placed = 0, vertical = 0;
+        for (int i = 0; i < thread_count; i++) {
+            for (int origin = 0; origin < HISTORY_NO_SHIP; origin++) {
+                origins[origin] += partitions[i].origins[slot][origin];
+            }
+        }
+        for (int origin = 0; origin < HISTORY_NO_SHIP; origin++) {
+            placed += origins[origin];
+            vertical += (origin & HISTORY_VERTICAL) ? origins[origin] : 0;
+        }
+        if (placed == 0) {
+            continue;
+        }
+
+        printf("Ship %d (length %d): %.1f%% vertical; most common origins", slot + 1, slot_lengths[slot],
+               100.0 * (double)vertical / (double)placed);
+        for (int rank = 0; rank < 3; rank++) {
+            int best = 0;
+            for (int origin = 1; origin < HISTORY_NO_SHIP; origin++) {
+                if (origins[origin] > origins[best]) {
+                    best = origin;
+                }
+            }
+            if (origins[best] == 0) {
+                break;
+            }
+            int cell = best & 0x7f;
+            printf(" %d,%d%c %.2f%%", cell % BOARD_SIZE, cell / BOARD_SIZE, (best & HISTORY_VERTICAL) ? 'V' : 'H',
+                   100.0 * (double)origins[best] / (double)placed);
+            origins[best] = 0;
+        }
+        printf("\n");
+    }
+    print_scan("games", store->games, seconds, thread_count);
+}
+
+// Writes the occupancy table make-priors -p blends into the bots' prior
+// tables: comment lines, then ten rows of ten chances
+static int query_priors(const HistoryStore *store, Partition *partitions, int thread_count, const char *path) {
+    double occupancy[BOARD_SIZE * BOARD_SIZE];
+    double seconds = scan_occupancy(store, partitions, thread_count, occupancy);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror("Failed to open priors file");
+        return -1;
+    }
+    fprintf(file, "# battleship priors v1: chance that a cell holds a ship, over %llu games\n",
+            (unsigned long long)store->games);
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            fprintf(file, "%s%.6f", x > 0 ? " " : "", occupancy[y * BOARD_SIZE + x]);
+        }
+        fprintf(file, "\n");
+    }
+    if (fclose(file) != 0) {
+        perror("Failed to write priors file");
+        return -1;
+    }
+    printf("Wrote priors for %llu games to %s\n", (unsigned long long)store->games, path);
+    print_scan("games", store->games, seconds, thread_count);
+    return 0;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// A plausible game between two hunt-and-target players with random fleets;
+// one in five is salvo:3, and a few end early by quitting or on time
+static void synthesize_game(uint64_t *random, HistoryGame *game) {
+    GameBoard boards[2];
+    for (int seat = 0; seat < 2; seat++) {
+        do {
+            initialize_board(&boards[seat]);
+            for (int ship = 0; ship < FLEET_SIZE; ship++) {
+                int placed = 0;
+                for (int attempt = 0; attempt < 200 && !placed; attempt++) {
+                    uint64_t r = next_random(random);
+                    placed = place_ship_c(&boards[seat], (int)(r % BOARD_SIZE), (int)((r >> 8) % BOARD_SIZE),
+                                          slot_lengths[ship], (r >> 16) & 1 ? 'V' : 'H');
+                }
+            }
+        } while (boards[seat].ships_remaining != FLEET_SIZE);
+    }
+    history_set_fleets(game, boards);
+
+    int salvo = next_random(random) % 5 == 0;
+    game->variant = salvo ? (uint8_t)((GAME_MODE_SALVO << 4) | 3) : (uint8_t)(GAME_MODE_CLASSIC << 4);
+    uint64_t fate = next_random(random) % 100;
+    int stop_after = fate < 4 ? (int)(next_random(random) % 120) : HISTORY_MAX_SHOTS;
+
+    // Each seat hunts through its own shuffled cells and works off a stack
+    // of neighbours after a hit
+    unsigned char order[2][BOARD_SIZE * BOARD_SIZE];
+    unsigned char stack[2][BOARD_SIZE * BOARD_SIZE * 4];
+    unsigned char fired[2][BOARD_SIZE * BOARD_SIZE];
+    int next[2] = {0, 0}, depth[2] = {0, 0}, hits[2] = {0, 0};
+    memset(fired, 0, sizeof(fired));
+    for (int seat = 0; seat < 2; seat++) {
+        for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+            order[seat][cell] = (unsigned char)cell;
+        }
+        for (int cell = BOARD_SIZE * BOARD_SIZE - 1; cell > 0; cell--) {
+            int other = (int)(next_random(random) % (uint64_t)(cell + 1));
+            unsigned char swap = order[seat][cell];
+            order[seat][cell] = order[seat][other];
+            order[seat][other] = swap;
+        }
+    }
+
+    int count = 0;
+    game->winner = HISTORY_NO_WINNER;
+    game->end = HISTORY_END_SUNK;
+    for (int turn = 0; game->winner == HISTORY_NO_WINNER; turn++) {
+        for (int seat = 0; seat < 2 && game->winner == HISTORY_NO_WINNER; seat++) {
+            const GameBoard *target = &boards[1 - seat];
+            for (int shot = 0; shot < (salvo ? 3 : 1); shot++) {
+                int cell = -1;
+                while (cell < 0 && depth[seat] > 0) {
+                    int candidate = stack[seat][--depth[seat]];
+                    cell = fired[seat][candidate] ? -1 : candidate;
+                }
+                while (cell < 0 && next[seat] < BOARD_SIZE * BOARD_SIZE) {
+                    int candidate = order[seat][next[seat]++];
+                    cell = fired[seat][candidate] ? -1 : candidate;
+                }
+                if (cell < 0 || count == stop_after) {
+                    // Out of cells cannot happen with a full fleet; a stop is a forfeit
+                    game->winner = (uint8_t)(1 - seat);
+                    game->end = fate < 2 ? HISTORY_END_QUIT : HISTORY_END_TIMEOUT;
+                    break;
+                }
+
+                int x = cell % BOARD_SIZE, y = cell / BOARD_SIZE;
+                int hit = target->grid[y][x] == 1;
+                fired[seat][cell] = 1;
+                game->shots[count++] = history_shot(seat, turn, x, y, hit);
+                if (hit) {
+                    hits[seat]++;
+                    if (x > 0) stack[seat][depth[seat]++] = (unsigned char)(cell - 1);
+                    if (x < BOARD_SIZE - 1) stack[seat][depth[seat]++] = (unsigned char)(cell + 1);
+                    if (y > 0) stack[seat][depth[seat]++] = (unsigned char)(cell - BOARD_SIZE);
+                    if (y < BOARD_SIZE - 1) stack[seat][depth[seat]++] = (unsigned char)(cell + BOARD_SIZE);
+                }
+            }
+            if (hits[seat] == 17) {
+                game->winner = (uint8_t)seat;
+            }
+        }
+    }
+    game->shot_count = (uint16_t)count;
+    game->duration_ms = (uint32_t)(30000 + next_random(random) % 570000);
+}
+
+static int generate_games(const char *directory, long game_count, uint64_t seed) {
+    HistoryWriter writer;
+    if (history_writer_open(&writer, directory) != 0) {
+        return -1;
+    }
+    uint64_t random = seed != 0 ? seed : 0x9e3779b97f4a7c15ULL;
+    HistoryGame game;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < game_count; i++) {
+        synthesize_game(&random, &game);
+        if (history_writer_append(&writer, &game) != 0) {
+            history_writer_close(&writer);
+            return -1;
+        }
+    }
+    uint64_t total = writer.games;
+    history_writer_close(&writer);
+    double seconds = elapsed_seconds(&start);
+    printf("Appended %ld synthetic games in %.3f s; the store holds %llu\n", game_count, seconds,
+           (unsigned long long)total);
+    return 0;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-t threads] <dir> summary\n"
+                    "       %s [-t threads] <dir> heatmap\n"
+                    "       %s [-t threads] <dir> placements\n"
+                    "       %s [-t threads] <dir> priors <file>\n"
+                    "       %s <dir> generate <games> [seed]\n", program, program, program, program, program);
+}
+
+int main(int argc, char *argv[]) {
+    int thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+        thread_count = atoi(argv[2]);
+        first = 3;
+    }
+    if (argc < first + 2 || thread_count < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *directory = argv[first];
+    const char *query = argv[first + 1];
+
+    if (strcmp(query, "generate") == 0) {
+        if (argc < first + 3) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        uint64_t seed = argc > first + 3 ? strtoull(argv[first + 3], NULL, 10) : 0;
+        return generate_games(directory, atol(argv[first + 2]), seed) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    HistoryStore store;
+    if (history_store_open(&store, directory) != 0) {
+        return EXIT_FAILURE;
+    }
+    Partition *partitions = calloc((size_t)thread_count, sizeof(Partition));
+    if (partitions == NULL) {
+        perror("Failed to allocate scan partitions");
+        history_store_close(&store);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    if (strcmp(query, "summary") == 0) {
+        query_summary(&store, partitions, thread_count);
+    } else if (strcmp(query, "heatmap") == 0) {
+        query_heatmap(&store, partitions, thread_count);
+    } else if (strcmp(query, "placements") == 0) {
+        query_placements(&store, partitions, thread_count);
+    } else if (strcmp(query, "priors") == 0 && argc > first + 2) {
+        status = query_priors(&store, partitions, thread_count, argv[first + 2]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else {
+        usage(argv[0]);
+        status = EXIT_FAILURE;
+    }
+
+    free(partitions);
+    history_store_close(&store);
+    return status;
+}
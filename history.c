@@ -0,0 +1,346 @@
+#include "history.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HISTORY_HEADER "HEADER"
+
+static const char *column_files[HISTORY_COLUMNS] = {
+    "variant.u8", "winner.u8", "end.u8", "shot-count.u16", "duration-ms.u32",
+    "first-shot.u64", "fleet.u64x4", "ships.u8x16", "shots.u16",
+};
+
+// Bytes per game; the shots column is sized per shot instead
+static const size_t column_widths[HISTORY_COLUMNS] = {
+    1, 1, 1, 2, 4, 8, 4 * sizeof(uint64_t), 2 * HISTORY_SHIP_SLOTS, sizeof(HistoryShot),
+};
+
+uint8_t history_variant_code(const GameVariant *variant) {
+    return (uint8_t)((variant->mode << 4) | (variant->salvo_shots & 0x0f));
+}
+
+void history_variant_from_code(uint8_t code, GameVariant *variant) {
+    variant->mode = (GameMode)(code >> 4);
+    variant->salvo_shots = code & 0x0f;
+    variant->players = 2;
+    variant->board_size = BOARD_SIZE;
+}
+
+static int is_ship(const GameBoard *board, int x, int y) {
+    if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
+        return 0;
+    }
+    return board->grid[y][x] == 1 || board->grid[y][x] == 2;
+}
+
+void history_set_fleets(HistoryGame *game, const GameBoard boards[2]) {
+    for (int seat = 0; seat < 2; seat++) {
+        const GameBoard *board = &boards[seat];
+        int origins[HISTORY_SHIP_SLOTS];
+        int lengths[HISTORY_SHIP_SLOTS];
+        int ships = 0;
+
+        game->fleet[seat][0] = 0;
+        game->fleet[seat][1] = 0;
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            for (int x = 0; x < BOARD_SIZE; x++) {
+                if (!is_ship(board, x, y)) {
+                    continue;
+                }
+                int index = y * BOARD_SIZE + x;
+                game->fleet[seat][index / 64] |= 1ULL << (index % 64);
+
+                // Ships never touch, so a cell with no ship left of it or
+                // above it starts one
+                if (is_ship(board, x - 1, y) || is_ship(board, x, y - 1) || ships == HISTORY_SHIP_SLOTS) {
+                    continue;
+                }
+                int vertical = is_ship(board, x, y + 1);
+                int length = 1;
+                while (vertical ? is_ship(board, x, y + length) : is_ship(board, x + length, y)) {
+                    length++;
+                }
+                origins[ships] = index | (vertical ? HISTORY_VERTICAL : 0);
+                lengths[ships] = length;
+                ships++;
+            }
+        }
+
+        // Longest first, so slot i holds the same ship in every game
+        for (int i = 1; i < ships; i++) {
+            for (int j = i; j > 0 && lengths[j] > lengths[j - 1]; j--) {
+                int length = lengths[j];
+                int origin = origins[j];
+                lengths[j] = lengths[j - 1];
+                origins[j] = origins[j - 1];
+                lengths[j - 1] = length;
+                origins[j - 1] = origin;
+            }
+        }
+        for (int i = 0; i < HISTORY_SHIP_SLOTS; i++) {
+            game->ships[seat][i] = i < ships ? (uint8_t)origins[i] : HISTORY_NO_SHIP;
+        }
+    }
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+static int check_header(const char *directory) {
+    char path[512];
+    char expected[128];
+    snprintf(path, sizeof(path), "%s/%s", directory, HISTORY_HEADER);
+    snprintf(expected, sizeof(expected), "battleship-history %d board %d fleet 5,4,3,3,2\n", HISTORY_VERSION,
+             BOARD_SIZE);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        perror("Failed to open history header");
+        return -1;
+    }
+    char found[128] = {0};
+    ssize_t length = read(fd, found, sizeof(found) - 1);
+    if (length == 0) {
+        length = write_all(fd, expected, strlen(expected)) == 0 ? (ssize_t)strlen(expected) : -1;
+        memcpy(found, expected, strlen(expected) + 1);
+    }
+    close(fd);
+    if (length < 0 || strcmp(found, expected) != 0) {
+        fprintf(stderr, "History store %s has a different format\n", directory);
+        return -1;
+    }
+    return 0;
+}
+
+static int open_column(const char *directory, int column, int flags) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", directory, column_files[column]);
+    int fd = open(path, flags, 0644);
+    if (fd == -1) {
+        perror("Failed to open history column");
+    }
+    return fd;
+}
+
+static uint64_t column_size(int fd) {
+    struct stat info;
+    return fstat(fd, &info) == 0 ? (uint64_t)info.st_size : 0;
+}
+
+// Games that every fixed column holds in full
+static uint64_t complete_games(const uint64_t sizes[HISTORY_COLUMNS]) {
+    uint64_t games = UINT64_MAX;
+    for (int column = 0; column < HISTORY_COLUMN_SHOTS; column++) {
+        uint64_t rows = sizes[column] / column_widths[column];
+        if (rows < games) {
+            games = rows;
+        }
+    }
+    return games;
+}
+
+// Cuts every column back to the last game that was written completely
+static int repair(HistoryWriter *writer) {
+    uint64_t sizes[HISTORY_COLUMNS];
+    for (int column = 0; column < HISTORY_COLUMNS; column++) {
+        sizes[column] = column_size(writer->fds[column]);
+    }
+    uint64_t games = complete_games(sizes);
+    uint64_t shots = 0;
+    while (games > 0) {
+        uint64_t first = 0;
+        uint16_t count = 0;
+        if (pread(writer->fds[HISTORY_COLUMN_FIRST_SHOT], &first, sizeof(first), (off_t)((games - 1) * 8)) !=
+                sizeof(first) ||
+            pread(writer->fds[HISTORY_COLUMN_SHOT_COUNT], &count, sizeof(count), (off_t)((games - 1) * 2)) !=
+                sizeof(count)) {
+            perror("Failed to read history column");
+            return -1;
+        }
+        shots = first + count;
+        if (shots * sizeof(HistoryShot) <= sizes[HISTORY_COLUMN_SHOTS]) {
+            break;
+        }
+        games--;
+        shots = 0;
+    }
+
+    int repaired = 0;
+    for (int column = 0; column < HISTORY_COLUMNS; column++) {
+        uint64_t size = column == HISTORY_COLUMN_SHOTS ? shots * sizeof(HistoryShot) : games * column_widths[column];
+        if (size == sizes[column]) {
+            continue;
+        }
+        if (ftruncate(writer->fds[column], (off_t)size) == -1) {
+            perror("Failed to repair history column");
+            return -1;
+        }
+        repaired = 1;
+    }
+    if (repaired) {
+        fprintf(stderr, "History store: cut off a game that was only partly written\n");
+    }
+    writer->games = games;
+    writer->shots = shots;
+    return 0;
+}
+
+int history_writer_open(HistoryWriter *writer, const char *directory) {
+    memset(writer, 0, sizeof(*writer));
+    for (int column = 0; column < HISTORY_COLUMNS; column++) {
+        writer->fds[column] = -1;
+    }
+    if (mkdir(directory, 0755) == -1 && errno != EEXIST) {
+        perror("Failed to create history directory");
+        return -1;
+    }
+    if (check_header(directory) != 0) {
+        return -1;
+    }
+    for (int column = 0; column < HISTORY_COLUMNS; column++) {
+        writer->fds[column] = open_column(directory, column, O_RDWR | O_CREAT | O_APPEND);
+        writer->buffers[column] = malloc(HISTORY_BUFFER_BYTES);
+        if (writer->fds[column] == -1 || writer->buffers[column] == NULL) {
+            history_writer_close(writer);
+            return -1;
+        }
+    }
+    if (repair(writer) != 0) {
+        history_writer_close(writer);
+        return -1;
+    }
+    return 0;
+}
+
+static void buffer_column(HistoryWriter *writer, int column, const void *data, size_t size) {
+    memcpy(writer->buffers[column] + writer->buffered[column], data, size);
+    writer->buffered[column] += size;
+}
+
+int history_writer_append(HistoryWriter *writer, const HistoryGame *game) {
+    int shot_count = game->shot_count > HISTORY_MAX_SHOTS ? HISTORY_MAX_SHOTS : game->shot_count;
+    size_t shot_bytes = (size_t)shot_count * sizeof(HistoryShot);
+    if (writer->buffered[HISTORY_COLUMN_SHOTS] + shot_bytes > HISTORY_BUFFER_BYTES ||
+        writer->buffered[HISTORY_COLUMN_FLEET] + column_widths[HISTORY_COLUMN_FLEET] > HISTORY_BUFFER_BYTES) {
+        if (history_writer_flush(writer) != 0) {
+            return -1;
+        }
+    }
+
+    uint16_t count = (uint16_t)shot_count;
+    uint64_t first = writer->shots;
+    buffer_column(writer, HISTORY_COLUMN_VARIANT, &game->variant, 1);
+    buffer_column(writer, HISTORY_COLUMN_WINNER, &game->winner, 1);
+    buffer_column(writer, HISTORY_COLUMN_END, &game->end, 1);
+    buffer_column(writer, HISTORY_COLUMN_SHOT_COUNT, &count, sizeof(count));
+    buffer_column(writer, HISTORY_COLUMN_DURATION, &game->duration_ms, sizeof(game->duration_ms));
+    buffer_column(writer, HISTORY_COLUMN_FIRST_SHOT, &first, sizeof(first));
+    buffer_column(writer, HISTORY_COLUMN_FLEET, game->fleet, sizeof(game->fleet));
+    buffer_column(writer, HISTORY_COLUMN_SHIPS, game->ships, sizeof(game->ships));
+    buffer_column(writer, HISTORY_COLUMN_SHOTS, game->shots, shot_bytes);
+    writer->games++;
+    writer->shots += (uint64_t)shot_count;
+    return 0;
+}
+
+int history_writer_flush(HistoryWriter *writer) {
+    // Shots first: a game whose fixed columns are complete always has its shots
+    for (int i = 0; i < HISTORY_COLUMNS; i++) {
+        int column = i == 0 ? HISTORY_COLUMN_SHOTS : i - 1;
+        if (writer->buffered[column] == 0) {
+            continue;
+        }
+        if (write_all(writer->fds[column], writer->buffers[column], writer->buffered[column]) != 0) {
+            perror("Failed to write history column");
+            return -1;
+        }
+        writer->buffered[column] = 0;
+    }
+    return 0;
+}
+
+void history_writer_close(HistoryWriter *writer) {
+    if (writer->fds[0] != -1) {
+        history_writer_flush(writer);
+    }
+    for (int column = 0; column < HISTORY_COLUMNS; column++) {
+        if (writer->fds[column] != -1) {
+            close(writer->fds[column]);
+            writer->fds[column] = -1;
+        }
+        free(writer->buffers[column]);
+        writer->buffers[column] = NULL;
+    }
+}
+
+int history_store_open(HistoryStore *store, const char *directory) {
+    memset(store, 0, sizeof(*store));
+    uint64_t sizes[HISTORY_COLUMNS];
+    for (int column = 0; column < HISTORY_COLUMNS; column++) {
+        int fd = open_column(directory, column, O_RDONLY);
+        if (fd == -1) {
+            history_store_close(store);
+            return -1;
+        }
+        sizes[column] = column_size(fd);
+        if (sizes[column] > 0) {
+            void *map = mmap(NULL, sizes[column], PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                perror("Failed to map history column");
+                close(fd);
+                history_store_close(store);
+                return -1;
+            }
+            madvise(map, sizes[column], MADV_SEQUENTIAL);
+            store->maps[column] = map;
+            store->map_sizes[column] = sizes[column];
+        }
+        close(fd);
+    }
+
+    // A writer may be appending; only count games whose shots are in as well
+    uint64_t games = complete_games(sizes);
+    store->first_shot = store->maps[HISTORY_COLUMN_FIRST_SHOT];
+    store->shot_count = store->maps[HISTORY_COLUMN_SHOT_COUNT];
+    while (games > 0 && (store->first_shot[games - 1] + store->shot_count[games - 1]) * sizeof(HistoryShot) >
+                            sizes[HISTORY_COLUMN_SHOTS]) {
+        games--;
+    }
+    store->games = games;
+    store->shot_total = games > 0 ? store->first_shot[games - 1] + store->shot_count[games - 1] : 0;
+    store->variant = store->maps[HISTORY_COLUMN_VARIANT];
+    store->winner = store->maps[HISTORY_COLUMN_WINNER];
+    store->end = store->maps[HISTORY_COLUMN_END];
+    store->duration_ms = store->maps[HISTORY_COLUMN_DURATION];
+    store->fleet = store->maps[HISTORY_COLUMN_FLEET];
+    store->ships = store->maps[HISTORY_COLUMN_SHIPS];
+    store->shots = store->maps[HISTORY_COLUMN_SHOTS];
+    return 0;
+}
+
+void history_store_close(HistoryStore *store) {
+    for (int column = 0; column < HISTORY_COLUMNS; column++) {
+        if (store->maps[column] != NULL) {
+            munmap(store->maps[column], store->map_sizes[column]);
+            store->maps[column] = NULL;
+        }
+    }
+}
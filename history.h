@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+#include "game-logic.h"
+
+// Store of finished two-player games. Every column lives in its own file in
+// one directory, so a query maps only the columns it reads and scans them
+// sequentially. Rows are only ever appended; a row torn by a crash is cut
+// off the next time the store is opened for writing.
+
+#define HISTORY_VERSION 1
+#define HISTORY_MAX_SHOTS 200 // Each seat fires at each cell at most once
+#define HISTORY_SHIP_SLOTS 8  // Per seat in the ships column; FLEET_SIZE are used
+#define HISTORY_NO_WINNER 255
+#define HISTORY_NO_SHIP 255
+#define HISTORY_VERTICAL 0x80 // Flag on a ship's origin cell
+
+// One shot: cell y * 10 + x in bits 0-6, hit in bit 7, seat in bit 8 and the
+// seat's turn number in bits 9-15, counted from 0 and capped at 127. Salvo
+// shots of one turn share the turn number.
+typedef uint16_t HistoryShot;
+
+#define HISTORY_SHOT_CELL(shot) ((shot) & 0x7f)
+#define HISTORY_SHOT_HIT(shot) (((shot) >> 7) & 1)
+#define HISTORY_SHOT_SEAT(shot) (((shot) >> 8) & 1)
+#define HISTORY_SHOT_TURN(shot) ((shot) >> 9)
+#define HISTORY_MAX_TURN 127
+
+static inline HistoryShot history_shot(int seat, int turn, int x, int y, int hit) {
+    if (turn > HISTORY_MAX_TURN) {
+        turn = HISTORY_MAX_TURN;
+    }
+    return (HistoryShot)((turn << 9) | (seat << 8) | (hit ? 0x80 : 0) | (y * BOARD_SIZE + x));
+}
+
+typedef enum {
+    HISTORY_END_SUNK,
+    HISTORY_END_QUIT, // Including bots that forfeit and clients cut off for lagging
+    HISTORY_END_TIMEOUT
+} HistoryEnd;
+
+// One finished game, as the server hands it to the writer
+typedef struct {
+    uint8_t variant; // history_variant_code()
+    uint8_t winner;  // Seat, or HISTORY_NO_WINNER
+    uint8_t end;     // HistoryEnd
+    uint16_t shot_count;
+    uint32_t duration_ms;
+    uint64_t fleet[2][2]; // Ship cells per seat, bit y * 10 + x across both words
+    uint8_t ships[2][HISTORY_SHIP_SLOTS]; // Origin cell per ship, longest first, | HISTORY_VERTICAL
+    HistoryShot shots[HISTORY_MAX_SHOTS];
+} HistoryGame;
+
+typedef enum {
+    HISTORY_COLUMN_VARIANT,
+    HISTORY_COLUMN_WINNER,
+    HISTORY_COLUMN_END,
+    HISTORY_COLUMN_SHOT_COUNT,
+    HISTORY_COLUMN_DURATION,
+    HISTORY_COLUMN_FIRST_SHOT, // Index of the game's first shot in the shots column
+    HISTORY_COLUMN_FLEET,
+    HISTORY_COLUMN_SHIPS,
+    HISTORY_COLUMN_SHOTS,      // Variable length: shot_count entries per game
+    HISTORY_COLUMNS
+} HistoryColumn;
+
+#define HISTORY_BUFFER_BYTES 65536 // Per column
+
+typedef struct {
+    int fds[HISTORY_COLUMNS];
+    unsigned char *buffers[HISTORY_COLUMNS];
+    size_t buffered[HISTORY_COLUMNS];
+    uint64_t games;
+    uint64_t shots; // Shots stored so far, the first shot of the next game
+} HistoryWriter;
+
+// Read-only view of every column, mapped with mmap
+typedef struct {
+    uint64_t games;
+    uint64_t shot_total;
+    const uint8_t *variant;
+    const uint8_t *winner;
+    const uint8_t *end;
+    const uint16_t *shot_count;
+    const uint32_t *duration_ms;
+    const uint64_t *first_shot;
+    const uint64_t *fleet; // Four words per game: seat 0 low and high, then seat 1
+    const uint8_t *ships;  // 2 * HISTORY_SHIP_SLOTS per game
+    const HistoryShot *shots;
+    void *maps[HISTORY_COLUMNS];
+    size_t map_sizes[HISTORY_COLUMNS];
+} HistoryStore;
+
+uint8_t history_variant_code(const GameVariant *variant);
+
+void history_variant_from_code(uint8_t code, GameVariant *variant);
+
+// Fills the fleet and ships of a game from the two final boards
+void history_set_fleets(HistoryGame *game, const GameBoard boards[2]);
+
+// Creates the directory and its header when needed. Returns 0 on success.
+int history_writer_open(HistoryWriter *writer, const char *directory);
+
+// Buffers one game; it reaches the files on the next flush
+int history_writer_append(HistoryWriter *writer, const HistoryGame *game);
+
+// Writes every buffered game, the shots column first, so a crash never
+// leaves a game whose shots are missing
+int history_writer_flush(HistoryWriter *writer);
+
+void history_writer_close(HistoryWriter *writer);
+
+int history_store_open(HistoryStore *store, const char *directory);
+
+void history_store_close(HistoryStore *store);
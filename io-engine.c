@@ -0,0 +1,615 @@
+#include "io-engine.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#define URING_TAG_CANCEL 0
+#define URING_TAG_READ 1
+#define URING_TAG_WRITE 2
+
+static double elapsed_seconds(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) + (double)(now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+#ifdef HAVE_IO_URING
+
+// Multishot reads need Linux 6.7; older headers do not know the opcode
+#ifndef IORING_OP_READ_MULTISHOT
+#define IORING_OP_READ_MULTISHOT 49
+#endif
+
+#ifndef RWF_NOWAIT
+#define RWF_NOWAIT 0x00000008
+#endif
+
+#define URING_ENTRIES 64
+#define URING_READ_BUFFERS 8 // Provided buffers for multishot reads, power of two
+#define URING_BUFFER_GROUP 0
+
+typedef enum {
+    URING_READ_NONE,      // Write-only engine
+    URING_READ_MULTISHOT, // One SQE keeps completing as data arrives
+    URING_READ_FIXED      // Re-armed READ_FIXED into a registered buffer
+} UringReadMode;
+
+struct IoUring {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *ring_ptr;
+    size_t ring_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char read_buffers[URING_READ_BUFFERS][BUFFER_SIZE];
+    UringReadMode read_mode;
+    int read_armed;
+    int nowait_unsupported; // The kernel refused RWF_NOWAIT writes to our FIFOs
+    unsigned to_submit;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_register(int ring_fd, unsigned opcode, void *arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, count);
+}
+
+static void uring_free(IoUring *uring) {
+    if (uring->buf_ring != NULL) {
+        munmap(uring->buf_ring, uring->buf_ring_size);
+    }
+    if (uring->sqes != NULL) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->ring_ptr != NULL) {
+        munmap(uring->ring_ptr, uring->ring_size);
+    }
+    if (uring->ring_fd >= 0) {
+        close(uring->ring_fd);
+    }
+    free(uring);
+}
+
+static void uring_recycle_buffer(IoUring *uring, unsigned short bid) {
+    unsigned short tail = uring->buf_ring->tail;
+    struct io_uring_buf *buf = &uring->buf_ring->bufs[tail & (URING_READ_BUFFERS - 1)];
+    buf->addr = (unsigned long long)(uintptr_t)uring->read_buffers[bid];
+    buf->len = BUFFER_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&uring->buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+// Register the provided buffer ring used by multishot reads
+static int uring_setup_buffer_ring(IoUring *uring) {
+    uring->buf_ring_size = URING_READ_BUFFERS * sizeof(struct io_uring_buf);
+    void *ring = mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return -1;
+    }
+    uring->buf_ring = ring;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)ring;
+    reg.ring_entries = URING_READ_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (uring_register(uring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(ring, uring->buf_ring_size);
+        uring->buf_ring = NULL;
+        return -1;
+    }
+
+    for (unsigned short bid = 0; bid < URING_READ_BUFFERS; bid++) {
+        uring_recycle_buffer(uring, bid);
+    }
+    return 0;
+}
+
+static IoUring *uring_create(IoEngine *engine, int read_fd) {
+    IoUring *uring = calloc(1, sizeof(IoUring));
+    if (uring == NULL) {
+        return NULL;
+    }
+    uring->ring_fd = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring->ring_fd = uring_setup(URING_ENTRIES, &params);
+    if (uring->ring_fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        uring_free(uring);
+        return NULL;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    uring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    uring->ring_ptr = mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           uring->ring_fd, IORING_OFF_SQ_RING);
+    if (uring->ring_ptr == MAP_FAILED) {
+        uring->ring_ptr = NULL;
+        uring_free(uring);
+        return NULL;
+    }
+
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uring->ring_fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = NULL;
+        uring_free(uring);
+        return NULL;
+    }
+
+    char *ring = uring->ring_ptr;
+    uring->sq_entries = params.sq_entries;
+    uring->sq_head = (unsigned *)(ring + params.sq_off.head);
+    uring->sq_tail = (unsigned *)(ring + params.sq_off.tail);
+    uring->sq_mask = (unsigned *)(ring + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *)(ring + params.sq_off.array);
+    uring->cq_head = (unsigned *)(ring + params.cq_off.head);
+    uring->cq_tail = (unsigned *)(ring + params.cq_off.tail);
+    uring->cq_mask = (unsigned *)(ring + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+    // Outbound slots and the fallback read buffer are registered once, so
+    // the kernel reads and writes them in place on every submission
+    struct iovec iovecs[IO_ENGINE_MAX_BATCH + 1];
+    for (int i = 0; i < IO_ENGINE_MAX_BATCH; i++) {
+        iovecs[i].iov_base = engine->pending[i].data;
+        iovecs[i].iov_len = BUFFER_SIZE;
+    }
+    iovecs[IO_ENGINE_MAX_BATCH].iov_base = uring->read_buffers[0];
+    iovecs[IO_ENGINE_MAX_BATCH].iov_len = BUFFER_SIZE;
+    if (uring_register(uring->ring_fd, IORING_REGISTER_BUFFERS, iovecs, IO_ENGINE_MAX_BATCH + 1) < 0) {
+        uring_free(uring);
+        return NULL;
+    }
+
+    if (read_fd == -1) {
+        uring->read_mode = URING_READ_NONE;
+    } else if (uring_setup_buffer_ring(uring) == 0) {
+        uring->read_mode = URING_READ_MULTISHOT;
+    } else {
+        uring->read_mode = URING_READ_FIXED;
+    }
+    return uring;
+}
+
+static struct io_uring_sqe *uring_next_sqe(IoUring *uring) {
+    unsigned tail = *uring->sq_tail;
+    unsigned head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= uring->sq_entries) {
+        return NULL;
+    }
+
+    unsigned index = tail & *uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring->sq_array[index] = index;
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring->to_submit++;
+    return sqe;
+}
+
+static int uring_enter(IoEngine *engine, unsigned min_complete) {
+    IoUring *uring = engine->uring;
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int submitted;
+
+    do {
+        engine->stats.syscalls++;
+        submitted = (int)syscall(__NR_io_uring_enter, uring->ring_fd, uring->to_submit, min_complete, flags, NULL, 0);
+    } while (submitted < 0 && errno == EINTR);
+
+    if (submitted < 0) {
+        fprintf(stderr, "io_uring_enter failed: %s\n", strerror(errno));
+        return -1;
+    }
+    uring->to_submit -= (unsigned)submitted;
+    return 0;
+}
+
+static void uring_arm_read(IoEngine *engine) {
+    IoUring *uring = engine->uring;
+    if (uring->read_mode == URING_READ_NONE || uring->read_armed) {
+        return;
+    }
+
+    struct io_uring_sqe *sqe = uring_next_sqe(uring);
+    if (sqe == NULL) {
+        return;
+    }
+
+    sqe->fd = engine->reader.fd;
+    sqe->off = (unsigned long long)-1;
+    sqe->user_data = URING_TAG_READ;
+    if (uring->read_mode == URING_READ_MULTISHOT) {
+        sqe->opcode = IORING_OP_READ_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+    } else {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (unsigned long long)(uintptr_t)uring->read_buffers[0];
+        sqe->len = BUFFER_SIZE;
+        sqe->buf_index = IO_ENGINE_MAX_BATCH;
+    }
+    uring->read_armed = 1;
+}
+
+static void uring_handle_read(IoEngine *engine, const struct io_uring_cqe *cqe) {
+    IoUring *uring = engine->uring;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring->read_armed = 0;
+    }
+
+    if (cqe->res > 0) {
+        const char *data = uring->read_buffers[0];
+        unsigned short bid = 0;
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            data = uring->read_buffers[bid];
+        }
+        message_reader_push(&engine->reader, data, (size_t)cqe->res);
+        engine->stats.bytes_in += (unsigned long long)cqe->res;
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            uring_recycle_buffer(uring, bid);
+        }
+    } else if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+        if (uring->read_mode == URING_READ_MULTISHOT) {
+            // Kernel without multishot reads: keep a single read posted instead
+            uring->read_mode = URING_READ_FIXED;
+        } else {
+            fprintf(stderr, "io_uring read rejected: %s\n", strerror(-cqe->res));
+            uring->read_mode = URING_READ_NONE;
+        }
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -EINTR && cqe->res != -ECANCELED) {
+        fprintf(stderr, "io_uring read failed: %s\n", strerror(-cqe->res));
+    }
+}
+
+// Consume all available completions; returns how many of them were writes
+static int uring_reap(IoEngine *engine) {
+    IoUring *uring = engine->uring;
+    int writes = 0;
+    unsigned head = *uring->cq_head;
+
+    while (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+        if (cqe->user_data == URING_TAG_READ) {
+            uring_handle_read(engine, cqe);
+        } else if (cqe->user_data != URING_TAG_CANCEL) {
+            int error = cqe->res < 0 ? -cqe->res : 0;
+            IoEngineWrite *pending = &engine->pending[cqe->user_data - URING_TAG_WRITE];
+            if (error == EOPNOTSUPP && engine->nowait_writes) {
+                // Not every kernel can write to a FIFO through io_uring
+                // without waiting; the fd is non-blocking, so write() can
+                uring->nowait_unsupported = 1;
+                engine->stats.syscalls++;
+                error = write(pending->fd, pending->data, pending->length) == -1 ? errno : 0;
+            }
+            pending->error = error;
+            if (error != 0 && error != EAGAIN) {
+                fprintf(stderr, "Failed to write to FIFO: %s\n", strerror(error));
+            }
+            writes++;
+        }
+        head++;
+    }
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    return writes;
+}
+
+static int uring_receive(IoEngine *engine, char *buffer, size_t buffer_size) {
+    while (!message_reader_pop(&engine->reader, buffer, buffer_size)) {
+        if (engine->uring->read_mode == URING_READ_NONE) {
+            return -1;
+        }
+        uring_arm_read(engine);
+        if (uring_enter(engine, 1) == -1) {
+            return -1;
+        }
+        uring_reap(engine);
+    }
+    return 0;
+}
+
+// Cancels the posted read and waits until the kernel lets go of it; what it
+// read before that ends up in the reader
+static void uring_cancel_read(IoEngine *engine) {
+    IoUring *uring = engine->uring;
+    if (!uring->read_armed) {
+        return;
+    }
+    struct io_uring_sqe *sqe = uring_next_sqe(uring);
+    if (sqe == NULL && uring_enter(engine, 0) == 0) {
+        sqe = uring_next_sqe(uring); // Submitting empties the ring
+    }
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = URING_TAG_READ;
+    sqe->user_data = URING_TAG_CANCEL;
+    while (uring->read_armed) {
+        if (uring_enter(engine, 1) == -1) {
+            return;
+        }
+        uring_reap(engine);
+    }
+}
+
+// Waits until the first queued writes have all completed
+static int uring_complete_writes(IoEngine *engine, int queued, int *completed) {
+    while (*completed < queued) {
+        if (uring_enter(engine, (unsigned)(queued - *completed)) == -1) {
+            return -1;
+        }
+        *completed += uring_reap(engine);
+    }
+    return 0;
+}
+
+static int uring_flush(IoEngine *engine) {
+    IoUring *uring = engine->uring;
+    int queued = 0, completed = 0, status = 0;
+
+    for (int i = 0; i < engine->pending_count; i++) {
+        IoEngineWrite *pending = &engine->pending[i];
+        struct io_uring_sqe *sqe = uring_next_sqe(uring);
+        if (sqe == NULL && status == 0) {
+            // The ring is full: submit and finish what is in it, so this
+            // write still goes out after the ones before it
+            status = uring_complete_writes(engine, queued, &completed);
+            sqe = status == 0 ? uring_next_sqe(uring) : NULL;
+        }
+        if (sqe == NULL) {
+            // Still no room: write it directly rather than lose it
+            engine->stats.syscalls++;
+            pending->error = write(pending->fd, pending->data, pending->length) == -1 ? errno : 0;
+            if (pending->error != 0 && pending->error != EAGAIN) {
+                fprintf(stderr, "Failed to write to FIFO: %s\n", strerror(pending->error));
+            }
+            continue;
+        }
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = pending->fd;
+        sqe->addr = (unsigned long long)(uintptr_t)pending->data;
+        sqe->len = (unsigned)pending->length;
+        sqe->off = (unsigned long long)-1;
+        sqe->buf_index = (unsigned short)i;
+        sqe->user_data = URING_TAG_WRITE + (unsigned long long)i;
+        if (engine->nowait_writes) {
+            // io_uring would otherwise wait for room in the FIFO itself
+            sqe->rw_flags = RWF_NOWAIT;
+        }
+        queued++;
+    }
+
+    // Re-post the read in the same submission if it has lapsed
+    uring_arm_read(engine);
+
+    if (uring_complete_writes(engine, queued, &completed) == -1) {
+        return -1;
+    }
+    return status;
+}
+
+#endif
+
+static int portable_receive(IoEngine *engine, char *buffer, size_t buffer_size) {
+    while (!message_reader_pop(&engine->reader, buffer, buffer_size)) {
+        char chunk[BUFFER_SIZE];
+        engine->stats.syscalls++;
+        ssize_t bytes_read = read(engine->reader.fd, chunk, sizeof(chunk));
+        if (bytes_read > 0) {
+            engine->stats.bytes_in += (unsigned long long)bytes_read;
+            message_reader_push(&engine->reader, chunk, (size_t)bytes_read);
+        } else if (bytes_read == 0) {
+            fprintf(stderr, "No data available in FIFO.\n");
+            return -1;
+        } else if (errno != EINTR) {
+            fprintf(stderr, "Failed to read from FIFO: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int portable_flush(IoEngine *engine) {
+    int status = 0;
+    for (int i = 0; i < engine->pending_count; i++) {
+        engine->stats.syscalls++;
+        engine->pending[i].error = 0;
+        if (write(engine->pending[i].fd, engine->pending[i].data, engine->pending[i].length) == -1) {
+            engine->pending[i].error = errno;
+            if (errno != EAGAIN) {
+                fprintf(stderr, "Failed to write to FIFO: %s\n", strerror(errno));
+                status = -1;
+            }
+        }
+    }
+    return status;
+}
+
+void io_engine_init(IoEngine *engine, int read_fd) {
+    engine->kind = IO_ENGINE_PORTABLE;
+    engine->uring = NULL;
+    engine->pending_count = 0;
+    engine->nowait_writes = 0;
+    memset(&engine->stats, 0, sizeof(engine->stats));
+    message_reader_init(&engine->reader, read_fd);
+    clock_gettime(CLOCK_MONOTONIC, &engine->started);
+
+#ifdef HAVE_IO_URING
+    const char *requested = getenv("BATTLESHIP_IO_ENGINE");
+    if (requested != NULL && strcmp(requested, "portable") == 0) {
+        return;
+    }
+
+    engine->uring = uring_create(engine, read_fd);
+    if (engine->uring != NULL) {
+        engine->kind = IO_ENGINE_URING;
+    } else {
+        fprintf(stderr, "io_uring unavailable (%s), using portable I/O engine.\n", strerror(errno));
+    }
+#endif
+}
+
+void io_engine_destroy(IoEngine *engine) {
+#ifdef HAVE_IO_URING
+    if (engine->uring != NULL) {
+        uring_free(engine->uring);
+        engine->uring = NULL;
+    }
+#endif
+    engine->kind = IO_ENGINE_PORTABLE;
+}
+
+size_t io_engine_detach(IoEngine *engine, char *pending, size_t capacity) {
+#ifdef HAVE_IO_URING
+    if (engine->uring != NULL) {
+        uring_cancel_read(engine);
+    }
+#endif
+    io_engine_destroy(engine);
+
+    size_t length = engine->reader.end - engine->reader.start;
+    if (length > capacity) {
+        length = capacity;
+    }
+    memcpy(pending, engine->reader.data + engine->reader.start, length);
+    engine->reader.start = 0;
+    engine->reader.end = 0;
+    return length;
+}
+
+int io_engine_receive(IoEngine *engine, char *buffer, size_t buffer_size) {
+    int status;
+#ifdef HAVE_IO_URING
+    if (engine->kind == IO_ENGINE_URING) {
+        status = uring_receive(engine, buffer, buffer_size);
+    } else
+#endif
+    {
+        status = portable_receive(engine, buffer, buffer_size);
+    }
+
+    if (status == 0) {
+        engine->stats.messages_in++;
+    }
+    return status;
+}
+
+int io_engine_queue(IoEngine *engine, int fd, const char *message) {
+    if (fd == -1) {
+        fprintf(stderr, "Invalid file descriptor for writing.\n");
+        return -1;
+    }
+
+    if (engine->pending_count == IO_ENGINE_MAX_BATCH && io_engine_flush(engine) == -1) {
+        return -1;
+    }
+
+    IoEngineWrite *slot = &engine->pending[engine->pending_count++];
+    size_t length = strlen(message) + 1; // Include null terminator
+    if (length > sizeof(slot->data)) {
+        length = sizeof(slot->data);
+    }
+    memcpy(slot->data, message, length);
+    slot->data[length - 1] = '\0';
+    slot->fd = fd;
+    slot->length = length;
+    slot->error = 0;
+    return 0;
+}
+
+int io_engine_flush(IoEngine *engine) {
+    return io_engine_flush_each(engine, NULL);
+}
+
+int io_engine_flush_each(IoEngine *engine, int *errors) {
+    if (engine->pending_count == 0) {
+        return 0;
+    }
+
+    int status;
+#ifdef HAVE_IO_URING
+    if (engine->kind == IO_ENGINE_URING && !(engine->nowait_writes && engine->uring->nowait_unsupported)) {
+        status = uring_flush(engine);
+    } else
+#endif
+    {
+        status = portable_flush(engine);
+    }
+
+    for (int i = 0; i < engine->pending_count; i++) {
+        if (errors != NULL) {
+            errors[i] = engine->pending[i].error;
+        }
+        if (engine->pending[i].error == 0) {
+            engine->stats.bytes_out += engine->pending[i].length;
+            engine->stats.messages_out++;
+        }
+    }
+    engine->stats.submissions++;
+    engine->pending_count = 0;
+    return status;
+}
+
+const char *io_engine_name(const IoEngine *engine) {
+#ifdef HAVE_IO_URING
+    if (engine->kind == IO_ENGINE_URING) {
+        if (engine->nowait_writes && engine->uring->nowait_unsupported) {
+            return "portable write (io_uring cannot write to a FIFO without waiting here)";
+        }
+        switch (engine->uring->read_mode) {
+            case URING_READ_MULTISHOT:
+                return "io_uring (multishot reads, registered buffers)";
+            case URING_READ_FIXED:
+                return "io_uring (posted fixed reads, registered buffers)";
+            default:
+                return "io_uring (registered buffers)";
+        }
+    }
+#endif
+    return "portable read/write";
+}
+
+void io_engine_report(const IoEngine *engine, const char *label, unsigned long long moves, FILE *out) {
+    const IoEngineStats *stats = &engine->stats;
+    double seconds = elapsed_seconds(&engine->started);
+    unsigned long long messages = stats->messages_in + stats->messages_out;
+
+    fprintf(out, "%s I/O engine: %s\n", label, io_engine_name(engine));
+    fprintf(out, "  moves: %llu, syscalls: %llu (%.2f per move), submissions: %llu\n",
+            moves, stats->syscalls,
+            moves ? (double)stats->syscalls / (double)moves : 0.0,
+            stats->submissions);
+    fprintf(out, "  messages in/out: %llu/%llu, bytes in/out: %llu/%llu\n",
+            stats->messages_in, stats->messages_out, stats->bytes_in, stats->bytes_out);
+    fprintf(out, "  throughput: %.1f messages/s over %.2f s\n",
+            seconds > 0.0 ? (double)messages / seconds : 0.0, seconds);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdio.h>
+#include <time.h>
+#include "communication.h"
+#include "config.h"
+
+// Number of outbound messages that can be queued before an implicit flush
+#define IO_ENGINE_MAX_BATCH 16
+
+typedef enum {
+    IO_ENGINE_PORTABLE, // Plain read()/write() per message
+    IO_ENGINE_URING     // io_uring with posted reads and batched writes
+} IoEngineKind;
+
+typedef struct {
+    unsigned long long syscalls;    // read/write/io_uring_enter calls issued
+    unsigned long long submissions; // flushes of the outbound queue
+    unsigned long long messages_in;
+    unsigned long long messages_out;
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+} IoEngineStats;
+
+typedef struct {
+    int fd;
+    size_t length;
+    int error; // Set by the flush
+    char data[BUFFER_SIZE]; // Registered with io_uring, written without a copy
+} IoEngineWrite;
+
+typedef struct IoUring IoUring;
+
+typedef struct {
+    IoEngineKind kind;
+    MessageReader reader;
+    IoUring *uring;
+    IoEngineWrite pending[IO_ENGINE_MAX_BATCH];
+    int pending_count;
+    int nowait_writes; // Writes to a full FIFO fail with EAGAIN; the fds must be non-blocking
+    IoEngineStats stats;
+    struct timespec started;
+} IoEngine;
+
+// Initialize the engine for read_fd (-1 for a write-only engine). io_uring is
+// used when compiled in and not disabled with BATTLESHIP_IO_ENGINE=portable;
+// any setup failure falls back to the portable engine.
+void io_engine_init(IoEngine *engine, int read_fd);
+
+void io_engine_destroy(IoEngine *engine);
+
+// Stops reading, so that whatever clients write next stays in the FIFO, and
+// copies the bytes already read but not yet received to pending. Returns
+// their length; the engine is left destroyed, its counters intact.
+size_t io_engine_detach(IoEngine *engine, char *pending, size_t capacity);
+
+// Block until the next NUL-terminated message is available
+int io_engine_receive(IoEngine *engine, char *buffer, size_t buffer_size);
+
+// Queue a message for fd; nothing is written until io_engine_flush()
+int io_engine_queue(IoEngine *engine, int fd, const char *message);
+
+// Write every queued message, in one submission when io_uring is active
+int io_engine_flush(IoEngine *engine);
+
+// Like io_engine_flush, and stores 0 or the errno of each write in errors, in
+// queue order. A non-blocking fd that is full reports EAGAIN and the message
+// is not written.
+int io_engine_flush_each(IoEngine *engine, int *errors);
+
+const char *io_engine_name(const IoEngine *engine);
+
+// Print counters, normalizing syscalls by the number of moves processed
+void io_engine_report(const IoEngine *engine, const char *label, unsigned long long moves, FILE *out);
@@ -0,0 +1,554 @@
+#include "leaderboard.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LEADERBOARD_HEADER_BYTES 32
+
+static uint64_t record_checksum(const LeaderboardEntry *entry) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char *bytes = (const unsigned char *)entry;
+    for (size_t i = 0; i < sizeof(*entry); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint32_t name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t node_priority(int32_t node) {
+    uint64_t x = (uint64_t)node * 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return (uint32_t)(x ^ (x >> 31));
+}
+
+// Higher ratings first, ties by name
+static int ranks_before(const LeaderboardEntry *a, const LeaderboardEntry *b) {
+    if (a->rating != b->rating) {
+        return a->rating > b->rating;
+    }
+    return strcmp(a->name, b->name) < 0;
+}
+
+static int32_t subtree_size(const Leaderboard *board, int32_t node) {
+    return node == 0 ? 0 : board->nodes[node].size;
+}
+
+static void update_size(Leaderboard *board, int32_t node) {
+    LeaderboardNode *n = &board->nodes[node];
+    n->size = 1 + subtree_size(board, n->left) + subtree_size(board, n->right);
+}
+
+// Splits a subtree into the nodes ranked before key and the rest
+static void split(Leaderboard *board, int32_t node, const LeaderboardEntry *key, int32_t *before, int32_t *after) {
+    if (node == 0) {
+        *before = *after = 0;
+        return;
+    }
+    LeaderboardNode *n = &board->nodes[node];
+    if (ranks_before(&n->entry, key)) {
+        split(board, n->right, key, &n->right, after);
+        *before = node;
+    } else {
+        split(board, n->left, key, before, &n->left);
+        *after = node;
+    }
+    update_size(board, node);
+}
+
+// Joins two subtrees where every node of the first ranks before the second
+static int32_t merge(Leaderboard *board, int32_t first, int32_t second) {
+    if (first == 0 || second == 0) {
+        return first != 0 ? first : second;
+    }
+    if (board->nodes[first].priority > board->nodes[second].priority) {
+        board->nodes[first].right = merge(board, board->nodes[first].right, second);
+        update_size(board, first);
+        return first;
+    }
+    board->nodes[second].left = merge(board, first, board->nodes[second].left);
+    update_size(board, second);
+    return second;
+}
+
+static void tree_insert(Leaderboard *board, int32_t node) {
+    int32_t before, after;
+    split(board, board->root, &board->nodes[node].entry, &before, &after);
+    board->nodes[node].left = board->nodes[node].right = 0;
+    board->nodes[node].size = 1;
+    board->root = merge(board, merge(board, before, node), after);
+}
+
+static int32_t tree_remove(Leaderboard *board, int32_t subtree, int32_t node) {
+    if (subtree == 0) {
+        return 0;
+    }
+    LeaderboardNode *n = &board->nodes[subtree];
+    if (subtree == node) {
+        return merge(board, n->left, n->right);
+    }
+    if (ranks_before(&board->nodes[node].entry, &n->entry)) {
+        n->left = tree_remove(board, n->left, node);
+    } else {
+        n->right = tree_remove(board, n->right, node);
+    }
+    update_size(board, subtree);
+    return subtree;
+}
+
+static int32_t find_node(const Leaderboard *board, const char *name) {
+    if (board->slots == NULL) {
+        return 0;
+    }
+    for (uint32_t slot = name_hash(name) & board->slot_mask;; slot = (slot + 1) & board->slot_mask) {
+        int32_t node = board->slots[slot];
+        if (node == 0 || strcmp(board->nodes[node].entry.name, name) == 0) {
+            return node;
+        }
+    }
+}
+
+static void index_node(Leaderboard *board, int32_t node) {
+    uint32_t slot = name_hash(board->nodes[node].entry.name) & board->slot_mask;
+    while (board->slots[slot] != 0) {
+        slot = (slot + 1) & board->slot_mask;
+    }
+    board->slots[slot] = node;
+}
+
+// Keeps the index at most half full and room for one more node
+static int reserve_node(Leaderboard *board) {
+    if (board->node_count == board->node_capacity) {
+        int32_t capacity = board->node_capacity * 2;
+        LeaderboardNode *nodes = realloc(board->nodes, (size_t)capacity * sizeof(LeaderboardNode));
+        if (nodes == NULL) {
+            perror("Failed to grow the leaderboard");
+            return -1;
+        }
+        board->nodes = nodes;
+        board->node_capacity = capacity;
+    }
+    if ((uint32_t)board->node_count * 2 > board->slot_mask) {
+        uint32_t slot_count = (board->slot_mask + 1) * 2;
+        int32_t *slots = calloc(slot_count, sizeof(int32_t));
+        if (slots == NULL) {
+            perror("Failed to grow the leaderboard index");
+            return -1;
+        }
+        free(board->slots);
+        board->slots = slots;
+        board->slot_mask = slot_count - 1;
+        for (int32_t node = 1; node < board->node_count; node++) {
+            index_node(board, node);
+        }
+    }
+    return 0;
+}
+
+// The node of a player, added at the initial rating when new; 0 when out of memory
+static int32_t player_node(Leaderboard *board, const char *name) {
+    int32_t node = find_node(board, name);
+    if (node != 0 || reserve_node(board) == -1) {
+        return node;
+    }
+    node = board->node_count++;
+    LeaderboardNode *n = &board->nodes[node];
+    memset(n, 0, sizeof(*n));
+    strncpy(n->entry.name, name, PLAYER_NAME_MAX - 1);
+    n->entry.rating = LEADERBOARD_INITIAL_RATING;
+    n->priority = node_priority(node);
+    index_node(board, node);
+    tree_insert(board, node);
+    return node;
+}
+
+static void set_entry(Leaderboard *board, int32_t node, const LeaderboardEntry *entry) {
+    board->root = tree_remove(board, board->root, node);
+    board->nodes[node].entry = *entry;
+    tree_insert(board, node);
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+static void format_header(char header[LEADERBOARD_HEADER_BYTES]) {
+    memset(header, 0, LEADERBOARD_HEADER_BYTES);
+    snprintf(header, LEADERBOARD_HEADER_BYTES, "battleship-ratings %d name %d\n", LEADERBOARD_VERSION,
+             PLAYER_NAME_MAX);
+}
+
+// Replays the records after the header and cuts off a torn or damaged tail.
+// Returns the number of records kept, or -1.
+static long replay_log(Leaderboard *board, int fd) {
+    char expected[LEADERBOARD_HEADER_BYTES], found[LEADERBOARD_HEADER_BYTES];
+    format_header(expected);
+    ssize_t length = pread(fd, found, sizeof(found), 0);
+    if (length == 0) {
+        return write_all(fd, expected, sizeof(expected)) == 0 ? 0 : -1;
+    }
+    if (length != sizeof(found) || memcmp(found, expected, sizeof(found)) != 0) {
+        fprintf(stderr, "Ratings log has a different format\n");
+        return -1;
+    }
+
+    long records = 0;
+    off_t offset = LEADERBOARD_HEADER_BYTES;
+    LeaderboardRecord batch[LEADERBOARD_LOG_BATCH];
+    for (;;) {
+        ssize_t bytes = pread(fd, batch, sizeof(batch), offset);
+        if (bytes < 0) {
+            perror("Failed to read the ratings log");
+            return -1;
+        }
+        int count = (int)((size_t)bytes / sizeof(LeaderboardRecord));
+        int valid = 0;
+        while (valid < count && batch[valid].entry.name[PLAYER_NAME_MAX - 1] == '\0' &&
+               batch[valid].checksum == record_checksum(&batch[valid].entry)) {
+            int32_t node = player_node(board, batch[valid].entry.name);
+            if (node == 0) {
+                return -1;
+            }
+            set_entry(board, node, &batch[valid].entry);
+            valid++;
+        }
+        records += valid;
+        offset += (off_t)valid * (off_t)sizeof(LeaderboardRecord);
+        if (valid < count || (size_t)bytes < sizeof(batch)) {
+            break;
+        }
+    }
+    if (ftruncate(fd, offset) == -1) {
+        perror("Failed to repair the ratings log");
+        return -1;
+    }
+    return records;
+}
+
+static void append_record(Leaderboard *board, const LeaderboardEntry *entry) {
+    if (board->log_fd == -1) {
+        return;
+    }
+    if (board->buffered == LEADERBOARD_LOG_BATCH) {
+        leaderboard_flush(board);
+    }
+    LeaderboardRecord *record = &board->buffer[board->buffered++];
+    record->entry = *entry;
+    record->checksum = record_checksum(entry);
+}
+
+// Rewrites a log that has grown well past one record per player
+static int compact_log(Leaderboard *board, const char *path) {
+    char temporary[512];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    int fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Failed to compact the ratings log");
+        return -1;
+    }
+    char header[LEADERBOARD_HEADER_BYTES];
+    format_header(header);
+    int failed = write_all(fd, header, sizeof(header));
+    LeaderboardRecord batch[LEADERBOARD_LOG_BATCH];
+    int count = 0;
+    for (int32_t node = 1; node < board->node_count && !failed; node++) {
+        batch[count].entry = board->nodes[node].entry;
+        batch[count].checksum = record_checksum(&batch[count].entry);
+        if (++count == LEADERBOARD_LOG_BATCH || node == board->node_count - 1) {
+            failed = write_all(fd, batch, (size_t)count * sizeof(LeaderboardRecord));
+            count = 0;
+        }
+    }
+    if (failed || fdatasync(fd) == -1 || rename(temporary, path) == -1) {
+        perror("Failed to compact the ratings log");
+        close(fd);
+        unlink(temporary);
+        return -1;
+    }
+    close(board->log_fd);
+    board->log_fd = fd;
+    lseek(fd, 0, SEEK_END);
+    return 0;
+}
+
+static void *sync_log(void *arg) {
+    Leaderboard *board = arg;
+    const struct timespec step = {0, 50 * 1000000L};
+    while (!atomic_load(&board->stopping)) {
+        for (int waited = 0; waited < LEADERBOARD_SYNC_MS && !atomic_load(&board->stopping); waited += 50) {
+            nanosleep(&step, NULL);
+        }
+        if (atomic_exchange(&board->dirty, 0) && fdatasync(board->log_fd) == 0) {
+            atomic_fetch_add(&board->syncs, 1);
+        }
+    }
+    return NULL;
+}
+
+int leaderboard_open(Leaderboard *board, const char *path) {
+    memset(board, 0, sizeof(*board));
+    board->log_fd = -1;
+    board->node_capacity = 1024;
+    board->nodes = malloc((size_t)board->node_capacity * sizeof(LeaderboardNode));
+    board->slot_mask = 2047;
+    board->slots = calloc(board->slot_mask + 1, sizeof(int32_t));
+    if (board->nodes == NULL || board->slots == NULL) {
+        perror("Failed to allocate the leaderboard");
+        leaderboard_close(board);
+        return -1;
+    }
+    board->node_count = 1;
+    if (path == NULL) {
+        return 0;
+    }
+
+    board->log_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (board->log_fd == -1) {
+        perror("Failed to open the ratings log");
+        leaderboard_close(board);
+        return -1;
+    }
+    long records = replay_log(board, board->log_fd);
+    if (records == -1) {
+        leaderboard_close(board);
+        return -1;
+    }
+    if (records > 2 * leaderboard_size(board) + LEADERBOARD_LOG_BATCH) {
+        compact_log(board, path);
+    }
+    if (pthread_create(&board->syncer, NULL, sync_log, board) != 0) {
+        perror("Failed to start the ratings log syncer");
+        leaderboard_close(board);
+        return -1;
+    }
+    board->syncer_running = 1;
+    return 0;
+}
+
+void leaderboard_close(Leaderboard *board) {
+    if (board->syncer_running) {
+        atomic_store(&board->stopping, 1);
+        pthread_join(board->syncer, NULL);
+        board->syncer_running = 0;
+    }
+    if (board->log_fd != -1) {
+        if (leaderboard_flush(board) == 0 && fdatasync(board->log_fd) == 0) {
+            atomic_fetch_add(&board->syncs, 1);
+        }
+        close(board->log_fd);
+        board->log_fd = -1;
+    }
+    free(board->nodes);
+    free(board->slots);
+    board->nodes = NULL;
+    board->slots = NULL;
+    board->node_count = 0;
+    board->root = 0;
+}
+
+int leaderboard_flush(Leaderboard *board) {
+    if (board->log_fd == -1 || board->buffered == 0) {
+        return 0;
+    }
+    if (write_all(board->log_fd, board->buffer, (size_t)board->buffered * sizeof(LeaderboardRecord)) != 0) {
+        perror("Failed to write the ratings log");
+        return -1;
+    }
+    board->records += (unsigned long long)board->buffered;
+    board->buffered = 0;
+    atomic_store(&board->dirty, 1);
+    return 0;
+}
+
+int leaderboard_record_game(Leaderboard *board, const char *winner, const char *loser) {
+    if (strcmp(winner, loser) == 0) {
+        return -1;
+    }
+    int32_t won = player_node(board, winner);
+    int32_t lost = player_node(board, loser);
+    if (won == 0 || lost == 0) {
+        return -1;
+    }
+    LeaderboardEntry winner_entry = board->nodes[won].entry;
+    LeaderboardEntry loser_entry = board->nodes[lost].entry;
+    double expected = 1.0 / (1.0 + pow(10.0, (loser_entry.rating - winner_entry.rating) / 400.0));
+    double change = LEADERBOARD_K * (1.0 - expected);
+    winner_entry.rating += change;
+    winner_entry.games++;
+    winner_entry.wins++;
+    loser_entry.rating -= change;
+    loser_entry.games++;
+    set_entry(board, won, &winner_entry);
+    set_entry(board, lost, &loser_entry);
+    append_record(board, &winner_entry);
+    append_record(board, &loser_entry);
+    board->games++;
+    return 0;
+}
+
+void leaderboard_clean_name(const char *name, char clean[PLAYER_NAME_MAX]) {
+    int length = 0;
+    for (; name[length] != '\0' && length < PLAYER_NAME_MAX - 1; length++) {
+        char c = name[length];
+        int keep = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '-';
+        clean[length] = keep ? c : '-';
+    }
+    memset(clean + length, 0, (size_t)(PLAYER_NAME_MAX - length));
+}
+
+long leaderboard_rank(const Leaderboard *board, const char *name, LeaderboardEntry *entry) {
+    int32_t node = find_node(board, name);
+    if (node == 0) {
+        return 0;
+    }
+    const LeaderboardEntry *key = &board->nodes[node].entry;
+    long ahead = 0;
+    for (int32_t at = board->root; at != 0;) {
+        const LeaderboardNode *n = &board->nodes[at];
+        if (at == node) {
+            ahead += subtree_size(board, n->left);
+            break;
+        }
+        if (ranks_before(key, &n->entry)) {
+            at = n->left;
+        } else {
+            ahead += subtree_size(board, n->left) + 1;
+            at = n->right;
+        }
+    }
+    if (entry != NULL) {
+        *entry = *key;
+    }
+    return ahead + 1;
+}
+
+int leaderboard_at(const Leaderboard *board, long rank, LeaderboardEntry *entry) {
+    if (rank < 1 || rank > leaderboard_size(board)) {
+        return -1;
+    }
+    int32_t at = board->root;
+    while (at != 0) {
+        const LeaderboardNode *n = &board->nodes[at];
+        long left = subtree_size(board, n->left);
+        if (rank <= left) {
+            at = n->left;
+        } else if (rank == left + 1) {
+            *entry = n->entry;
+            return 0;
+        } else {
+            rank -= left + 1;
+            at = n->right;
+        }
+    }
+    return -1;
+}
+
+void leaderboard_report(const Leaderboard *board, FILE *out) {
+    fprintf(out, "Leaderboard: %ld players, %llu games rated, %llu records logged, %llu background syncs\n",
+            leaderboard_size(board), board->games, board->records, (unsigned long long)atomic_load(&board->syncs));
+    LeaderboardEntry entry;
+    if (leaderboard_at(board, 1, &entry) == 0) {
+        fprintf(out, "  first: %s at %.0f (%u of %u games won)\n", entry.name, entry.rating, entry.wins, entry.games);
+    }
+}
+
+static double elapsed_seconds(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) + (double)(now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+void leaderboard_benchmark(long player_count, long game_count, FILE *out) {
+    if (player_count < 2) {
+        player_count = 2;
+    }
+    Leaderboard board;
+    if (leaderboard_open(&board, NULL) == -1) {
+        return;
+    }
+    unsigned int seed = 42;
+    char winner[sizeof("player") + 20], loser[sizeof("player") + 20]; // Room for any long
+    struct timespec start;
+
+    // Every player plays once so that all of them are on the board
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i + 1 < player_count; i += 2) {
+        snprintf(winner, sizeof(winner), "player%ld", i);
+        snprintf(loser, sizeof(loser), "player%ld", i + 1);
+        leaderboard_record_game(&board, winner, loser);
+    }
+    double seed_seconds = elapsed_seconds(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long game = 0; game < game_count; game++) {
+        long a = rand_r(&seed) % player_count;
+        long b = (a + 1 + rand_r(&seed) % (player_count - 1)) % player_count;
+        snprintf(winner, sizeof(winner), "player%ld", a);
+        snprintf(loser, sizeof(loser), "player%ld", b);
+        leaderboard_record_game(&board, winner, loser);
+    }
+    double game_seconds = elapsed_seconds(&start);
+
+    long queries = game_count > 0 ? game_count : 1;
+    long checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long q = 0; q < queries; q++) {
+        snprintf(winner, sizeof(winner), "player%ld", (long)(rand_r(&seed) % player_count));
+        checksum += leaderboard_rank(&board, winner, NULL);
+    }
+    double rank_seconds = elapsed_seconds(&start);
+
+    LeaderboardEntry entry;
+    long pages = queries / LEADERBOARD_PAGE_MAX + 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long page = 0; page < pages; page++) {
+        for (long rank = 1; rank <= LEADERBOARD_PAGE_MAX; rank++) {
+            checksum += leaderboard_at(&board, rank, &entry) == 0 ? (long)entry.games : 0;
+        }
+    }
+    double top_seconds = elapsed_seconds(&start);
+
+    // AROUND: the asking player's rank, then the entries either side of it
+    long around = LEADERBOARD_PAGE_MAX / 20;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long q = 0; q < queries; q++) {
+        snprintf(winner, sizeof(winner), "player%ld", (long)(rand_r(&seed) % player_count));
+        long rank = leaderboard_rank(&board, winner, NULL);
+        for (long at = rank > around ? rank - around : 1; rank > 0 && at <= rank + around; at++) {
+            checksum += leaderboard_at(&board, at, &entry) == 0 ? (long)entry.games : 0;
+        }
+    }
+    double around_seconds = elapsed_seconds(&start);
+
+    fprintf(out, "Leaderboard: %ld players, %ld games (checksum %ld)\n", leaderboard_size(&board), game_count,
+            checksum);
+    fprintf(out, "  adding players: %.0f ns per game\n", seed_seconds / (double)(player_count / 2) * 1e9);
+    fprintf(out, "  rating a game:  %.0f ns\n", game_count > 0 ? game_seconds / (double)game_count * 1e9 : 0.0);
+    fprintf(out, "  rank query:     %.0f ns\n", rank_seconds / (double)queries * 1e9);
+    fprintf(out, "  top %d:        %.1f us\n", LEADERBOARD_PAGE_MAX, top_seconds / (double)pages * 1e6);
+    fprintf(out, "  around %ld:       %.1f us\n", around, around_seconds / (double)queries * 1e6);
+    leaderboard_close(&board);
+}
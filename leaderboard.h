@@ -0,0 +1,97 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "config.h"
+
+// Elo ratings of named players, ordered by rating in a treap whose nodes
+// count their subtree, so a player's rank and the player at any rank are
+// found in O(log n). Every change is appended to a log of fixed-size
+// records; a background thread syncs it to disk, so the thread that
+// records a game never waits on the disk. The log is replayed on open, the
+// last record of a player winning.
+
+#define LEADERBOARD_VERSION 1
+#define LEADERBOARD_INITIAL_RATING 1500.0
+#define LEADERBOARD_K 32.0        // Largest change one game makes
+#define LEADERBOARD_LOG_BATCH 64  // Records buffered before they are written
+#define LEADERBOARD_SYNC_MS 1000  // Between syncs of a log that was written
+#define LEADERBOARD_PAGE_MAX 100  // Entries one TOP or AROUND query returns
+
+typedef struct {
+    char name[PLAYER_NAME_MAX];
+    double rating;
+    uint32_t games;
+    uint32_t wins;
+} LeaderboardEntry;
+
+// One treap node; links are indices into the node array, 0 for none
+typedef struct {
+    LeaderboardEntry entry;
+    uint32_t priority;
+    int32_t left;
+    int32_t right;
+    int32_t size; // Nodes in this subtree
+} LeaderboardNode;
+
+// A log record; the checksum covers the entry and drops a torn tail
+typedef struct {
+    LeaderboardEntry entry;
+    uint64_t checksum;
+} LeaderboardRecord;
+
+typedef struct {
+    LeaderboardNode *nodes; // nodes[0] is unused so that 0 means none
+    int32_t node_count;     // Including nodes[0]
+    int32_t node_capacity;
+    int32_t root;
+    int32_t *slots; // Open-addressed name index of node numbers, 0 when free
+    uint32_t slot_mask;
+
+    int log_fd; // -1 when the ratings are only kept in memory
+    LeaderboardRecord buffer[LEADERBOARD_LOG_BATCH];
+    int buffered;
+    atomic_int dirty; // Written since the last sync
+    atomic_int stopping;
+    pthread_t syncer;
+    int syncer_running;
+
+    unsigned long long games;
+    unsigned long long records;
+    atomic_ullong syncs;
+} Leaderboard;
+
+// Opens the board and replays the log at path; a NULL path keeps the
+// ratings in memory only. Returns 0 on success.
+int leaderboard_open(Leaderboard *board, const char *path);
+
+// Flushes and syncs the log and frees the board
+void leaderboard_close(Leaderboard *board);
+
+// Rates a game between two different players, adding either when new
+int leaderboard_record_game(Leaderboard *board, const char *winner, const char *loser);
+
+// Writes the buffered records; the syncer makes them durable
+int leaderboard_flush(Leaderboard *board);
+
+// Copies a player name, keeping letters, digits, '.' and '-' and turning
+// anything else into '-', so names never clash with protocol separators
+void leaderboard_clean_name(const char *name, char clean[PLAYER_NAME_MAX]);
+
+static inline long leaderboard_size(const Leaderboard *board) {
+    return board->node_count - 1;
+}
+
+// 1-based rank of a player with its entry, or 0 when it has not been rated
+long leaderboard_rank(const Leaderboard *board, const char *name, LeaderboardEntry *entry);
+
+// The player at a 1-based rank; returns -1 past the end
+int leaderboard_at(const Leaderboard *board, long rank, LeaderboardEntry *entry);
+
+void leaderboard_report(const Leaderboard *board, FILE *out);
+
+// Rates game_count games among player_count players and times the updates
+// and the RANK, TOP and AROUND queries
+void leaderboard_benchmark(long player_count, long game_count, FILE *out);
@@ -6,7 +6,77 @@
 #endif
 
 #ifdef SERVER
+#include <string.h>
+#include <unistd.h>
 #include "server.h"
+#include "match.h"
+#include "bot-runner.h"
+#include "fleet-validation.h"
+#include "timer-wheel.h"
+#include "handoff.h"
+#include "match-table.h"
+#include "router.h"
+#include "leaderboard.h"
+#include "wait-strategy.h"
+
+// server --bench <name> [args...] runs a benchmark instead of a server
+static int run_benchmark(int argc, char *argv[]) {
+    if (argc > 2 && strcmp(argv[2], "match-churn") == 0) {
+        long matches = argc > 3 ? atol(argv[3]) : 1000000;
+        int threads = argc > 4 ? atoi(argv[4]) : 4;
+        match_churn_benchmark(matches, threads, stdout);
+        return 0;
+    }
+    if (argc > 4 && strcmp(argv[2], "bot-tournament") == 0) {
+        long games = argc > 5 ? atol(argv[5]) : 1000;
+        int threads = argc > 6 ? atoi(argv[6]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        bot_tournament(argv[3], argv[4], games, threads, stdout);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[2], "fleet-validation") == 0) {
+        long boards = argc > 3 ? atol(argv[3]) : 100000000;
+        fleet_validation_benchmark(boards, stdout);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[2], "timer-wheel") == 0) {
+        long timers = argc > 3 ? atol(argv[3]) : 1000000;
+        timer_wheel_benchmark(timers, stdout);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[2], "match-table") == 0) {
+        long shots = argc > 3 ? atol(argv[3]) : 100000000;
+        int matches = argc > 4 ? atoi(argv[4]) : 4096;
+        match_table_benchmark(shots, matches, stdout);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[2], "handoff") == 0) {
+        long matches = argc > 3 ? atol(argv[3]) : 10000;
+        handoff_benchmark(matches, stdout);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[2], "leaderboard") == 0) {
+        long players = argc > 3 ? atol(argv[3]) : 1000000;
+        long games = argc > 4 ? atol(argv[4]) : 1000000;
+        leaderboard_benchmark(players, games, stdout);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[2], "wait") == 0) {
+        long rounds = argc > 3 ? atol(argv[3]) : 2000;
+        wait_strategy_benchmark(rounds, stdout);
+        return 0;
+    }
+
+    fprintf(stderr, "Usage: %s --bench match-churn [matches] [threads]\n"
+                    "       %s --bench bot-tournament <bot.so> <bot.so> [games] [threads]\n"
+                    "       %s --bench fleet-validation [boards]\n"
+                    "       %s --bench timer-wheel [timers]\n"
+                    "       %s --bench match-table [shots] [matches]\n"
+                    "       %s --bench handoff [matches]\n"
+                    "       %s --bench leaderboard [players] [games]\n"
+                    "       %s --bench wait [rounds]\n",
+            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
 #endif
 
 int main(int argc, char *argv[]) {
@@ -15,6 +85,35 @@ int main(int argc, char *argv[]) {
     #endif
 
     #ifdef SERVER
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <server_name> [variant | --takeover | --router <workers> [variant]] | --bench <name>\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (strcmp(argv[1], "--bench") == 0) {
+        return run_benchmark(argc, argv);
+    }
+    if (argc > 2 && strcmp(argv[2], "--takeover") == 0) {
+        takeover_server(argv[1]);
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[2], "--router") == 0) {
+        GameVariant variant;
+        if (parse_game_variant(argc > 4 ? argv[4] : NULL, &variant) == -1) {
+            fprintf(stderr, "Unknown game variant: %s\n", argv[4]);
+            return EXIT_FAILURE;
+        }
+        run_router(argv[1], atoi(argv[3]), &variant);
+        return 0;
+    }
+    if (argc > 2) {
+        GameVariant variant;
+        if (parse_game_variant(argv[2], &variant) == -1) {
+            fprintf(stderr, "Unknown game variant: %s\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        set_server_variant(&variant);
+    }
     run_server(argv[1]);
     #endif
 
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "prior-table.h"
+#include "hint-engine.h"
+
+// Writes the prior tables bots map at startup, or checks and prints a file.
+// Counting the layouts takes seconds to minutes, which is why it is done
+// here once instead of in every bot. With -p, the chances history-query
+// priors observed in played games are blended into the counted ones, so the
+// table is the one place a bot takes its priors from.
+
+#define DEFAULT_BUDGET_MS 30000
+#define LOAD_ROUNDS 1000
+#define COUNTED_WEIGHT_GAMES 100 // The counted chances weigh as much as this many observed games
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void mask_set(uint64_t mask[2], int x, int y) {
+    int cell = y * BOARD_SIZE + x;
+    mask[cell >> 6] |= 1ULL << (cell & 63);
+}
+
+// Every cell from (x0, y0) to (x1, y1) that lies on the board
+static void mask_rectangle(uint64_t mask[2], int x0, int y0, int x1, int y1) {
+    for (int y = y0 < 0 ? 0 : y0; y <= y1 && y < BOARD_SIZE; y++) {
+        for (int x = x0 < 0 ? 0 : x0; x <= x1 && x < BOARD_SIZE; x++) {
+            mask_set(mask, x, y);
+        }
+    }
+}
+
+static void list_placements(PriorTable *table, int ship) {
+    int length = table->lengths[ship];
+    uint32_t count = 0;
+    for (int vertical = 0; vertical < 2; vertical++) {
+        int dx = vertical ? 0 : 1, dy = vertical ? 1 : 0;
+        for (int y = 0; y + dy * (length - 1) < BOARD_SIZE; y++) {
+            for (int x = 0; x + dx * (length - 1) < BOARD_SIZE; x++) {
+                PriorPlacement *placement = &table->placements[ship][count++];
+                int x1 = x + dx * (length - 1), y1 = y + dy * (length - 1);
+                placement->x = (uint8_t)x;
+                placement->y = (uint8_t)y;
+                placement->orientation = vertical ? 'V' : 'H';
+                mask_rectangle(placement->ship, x, y, x1, y1);
+                mask_rectangle(placement->halo, x - 1, y - 1, x1 + 1, y1 + 1);
+                for (int k = 0; k < length; k++) {
+                    table->cover[ship][(y + dy * k) * BOARD_SIZE + x + dx * k]++;
+                }
+            }
+        }
+    }
+    table->placement_count[ship] = count;
+}
+
+// One parity class covers every ship of two cells or more; the likelier
+// class goes first, each ordered by falling probability
+static void order_opening(PriorTable *table) {
+    double class_sum[2] = {0.0, 0.0};
+    for (int cell = 0; cell < PRIOR_CELLS; cell++) {
+        class_sum[(cell / BOARD_SIZE + cell % BOARD_SIZE) % 2] += table->probability[cell];
+    }
+    int first_class = class_sum[1] > class_sum[0];
+
+    int count = 0;
+    for (int cell = 0; cell < PRIOR_CELLS; cell++) {
+        int rank_class = (cell / BOARD_SIZE + cell % BOARD_SIZE) % 2 != first_class;
+        int i = count++;
+        for (; i > 0; i--) {
+            int other = table->opening[i - 1];
+            int other_class = (other / BOARD_SIZE + other % BOARD_SIZE) % 2 != first_class;
+            if (other_class < rank_class ||
+                (other_class == rank_class && table->probability[other] >= table->probability[cell])) {
+                break;
+            }
+            table->opening[i] = table->opening[i - 1];
+        }
+        table->opening[i] = (uint8_t)cell;
+    }
+}
+
+// Reads history-query priors output: comment lines, the first of which
+// gives the games behind the chances, then ten rows of ten chances
+static int load_observed(const char *path, double observed[PRIOR_CELLS], unsigned long long *games) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Failed to open the observed priors");
+        return -1;
+    }
+    char line[512];
+    int row = 0;
+    *games = 0;
+    while (row < BOARD_SIZE && fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            const char *over = strstr(line, "over ");
+            if (over != NULL && *games == 0) {
+                *games = strtoull(over + 5, NULL, 10);
+            }
+            continue;
+        }
+        char *cursor = line;
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            char *end;
+            observed[row * BOARD_SIZE + x] = strtod(cursor, &end);
+            if (end == cursor) {
+                break;
+            }
+            cursor = end;
+        }
+        if (cursor == line) {
+            break;
+        }
+        row++;
+    }
+    fclose(file);
+    if (row != BOARD_SIZE || *games == 0) {
+        fprintf(stderr, "%s is not history-query priors output for a %dx%d board\n", path, BOARD_SIZE, BOARD_SIZE);
+        return -1;
+    }
+    return 0;
+}
+
+// Weighs the observed chances by the games behind them, so a few games
+// only nudge the counted chances and many games outweigh them
+static void blend_observed(PriorTable *table, const double observed[PRIOR_CELLS], unsigned long long games) {
+    double weight = (double)games / (double)(games + COUNTED_WEIGHT_GAMES);
+    for (int cell = 0; cell < PRIOR_CELLS; cell++) {
+        table->probability[cell] = (float)(weight * observed[cell] + (1.0 - weight) * table->probability[cell]);
+    }
+    table->observed_games = games;
+}
+
+static int build_table(PriorTable *table, const Fleet *fleet, int thread_count, int budget_ms,
+                       const char *observed_path) {
+    double observed[PRIOR_CELLS];
+    unsigned long long games = 0;
+    if (observed_path != NULL && load_observed(observed_path, observed, &games) != 0) {
+        return -1;
+    }
+
+    memset(table, 0, sizeof(*table));
+    table->board_size = BOARD_SIZE;
+    table->ship_count = FLEET_SIZE;
+    for (int ship = 0; ship < FLEET_SIZE; ship++) {
+        table->lengths[ship] = (uint8_t)fleet->ships[ship].size;
+        list_placements(table, ship);
+    }
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            mask_rectangle(table->halo[y * BOARD_SIZE + x], x - 1, y - 1, x + 1, y + 1);
+        }
+    }
+
+    GameBoard empty;
+    memset(&empty, 0, sizeof(empty));
+    HintResult hint;
+    if (hint_compute(&empty, fleet, thread_count, budget_ms, &hint) != 0) {
+        fprintf(stderr, "The fleet has no legal layout\n");
+        return -1;
+    }
+    table->exact = (uint8_t)hint.exact;
+    table->layouts = hint.layouts;
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            table->probability[y * BOARD_SIZE + x] = (float)hint.probability[y][x];
+        }
+    }
+    if (observed_path != NULL) {
+        blend_observed(table, observed, games);
+    }
+    order_opening(table);
+    return 0;
+}
+
+static int write_file(const char *path, const PriorTable *tables, uint32_t table_count) {
+    PriorFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PRIOR_FILE_MAGIC, sizeof(header.magic));
+    header.version = PRIOR_FILE_VERSION;
+    header.table_size = sizeof(PriorTable);
+    header.table_count = table_count;
+    header.checksum = prior_file_checksum(tables, table_count);
+
+    char temporary[BUFFER_SIZE];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid());
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        perror("Failed to create the prior tables");
+        return -1;
+    }
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1 ||
+                 fwrite(tables, sizeof(PriorTable), table_count, file) != table_count;
+    failed |= fflush(file) != 0 || fsync(fileno(file)) != 0;
+    failed |= fclose(file) != 0;
+    // Renamed into place, so bots that mapped the old file keep reading it
+    if (failed || rename(temporary, path) != 0) {
+        perror("Failed to write the prior tables");
+        unlink(temporary);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_priors(const char *path, int thread_count, int budget_ms, const char *observed_path) {
+    Fleet fleet;
+    initialize_fleet(&fleet);
+    PriorTable *table = malloc(sizeof(PriorTable));
+    if (table == NULL) {
+        perror("Failed to allocate a prior table");
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = build_table(table, &fleet, thread_count, budget_ms, observed_path);
+    if (status == 0) {
+        status = write_file(path, table, 1);
+    }
+    if (status == 0) {
+        printf("Wrote 1 table (%zu bytes) to %s in %.1f s: %llu layouts, %s, %llu observed games\n",
+               sizeof(PriorFileHeader) + sizeof(PriorTable), path, elapsed_seconds(&start),
+               (unsigned long long)table->layouts, table->exact ? "exact" : "sampled",
+               (unsigned long long)table->observed_games);
+    }
+    free(table);
+    return status;
+}
+
+// Prints every table and times opening the file
+static int show_priors(const char *path) {
+    PriorFile file;
+    if (prior_file_open(&file, path) != 0) {
+        return -1;
+    }
+    printf("%s: version %u, %u tables, %zu bytes\n", path, file.header->version, file.header->table_count,
+           file.size);
+    for (uint32_t i = 0; i < file.header->table_count; i++) {
+        const PriorTable *table = &file.tables[i];
+        printf("Board %u, ships", table->board_size);
+        for (uint32_t k = 0; k < table->ship_count; k++) {
+            printf(" %u (%u placements)", table->lengths[k], table->placement_count[k]);
+        }
+        printf("\n%llu layouts, %s, %llu observed games; chance of a ship per cell:\n",
+               (unsigned long long)table->layouts, table->exact ? "exact" : "sampled",
+               (unsigned long long)table->observed_games);
+        for (uint32_t y = 0; y < table->board_size; y++) {
+            for (uint32_t x = 0; x < table->board_size; x++) {
+                printf("%s%.4f", x > 0 ? " " : "", table->probability[y * table->board_size + x]);
+            }
+            printf("\n");
+        }
+        printf("Opening:");
+        for (int k = 0; k < 10; k++) {
+            int cell = table->opening[k];
+            printf(" (%d, %d)", cell % BOARD_SIZE, cell / BOARD_SIZE);
+        }
+        printf(" ...\n");
+    }
+    prior_file_close(&file);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < LOAD_ROUNDS; round++) {
+        if (prior_file_open(&file, path) != 0) {
+            return -1;
+        }
+        prior_file_close(&file);
+    }
+    printf("Open, check and close: %.1f us\n", elapsed_seconds(&start) * 1e6 / LOAD_ROUNDS);
+    return 0;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-t threads] [-b budget_ms] [-p observed_priors] write <file>\n"
+                    "       %s show <file>\n", program, program);
+}
+
+int main(int argc, char *argv[]) {
+    int thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int budget_ms = DEFAULT_BUDGET_MS;
+    const char *observed_path = NULL;
+    int first = 1;
+    while (argc > first + 1 && (strcmp(argv[first], "-t") == 0 || strcmp(argv[first], "-b") == 0 ||
+                                strcmp(argv[first], "-p") == 0)) {
+        if (argv[first][1] == 't') {
+            thread_count = atoi(argv[first + 1]);
+        } else if (argv[first][1] == 'b') {
+            budget_ms = atoi(argv[first + 1]);
+        } else {
+            observed_path = argv[first + 1];
+        }
+        first += 2;
+    }
+    if (argc != first + 2 || thread_count < 1 || budget_ms < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int status;
+    if (strcmp(argv[first], "write") == 0) {
+        status = write_priors(argv[first + 1], thread_count, budget_ms, observed_path);
+    } else if (strcmp(argv[first], "show") == 0) {
+        status = show_priors(argv[first + 1]);
+    } else {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,305 @@
+#include "match-table.h"
+#include "slab-pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+
+#define LANES 4
+
+int match_table_init(MatchTable *table, int slot_count) {
+    memset(table, 0, sizeof(*table));
+    // One spare row pads the last group of a batch
+    size_t bytes = ((size_t)slot_count * 2 + 1) * sizeof(uint64_t);
+    bytes = (bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    table->ships_low = aligned_alloc(CACHE_LINE_SIZE, bytes);
+    table->ships_high = aligned_alloc(CACHE_LINE_SIZE, bytes);
+    table->shots_low = aligned_alloc(CACHE_LINE_SIZE, bytes);
+    table->shots_high = aligned_alloc(CACHE_LINE_SIZE, bytes);
+    table->free_slots = malloc((size_t)slot_count * sizeof(int));
+    if (table->ships_low == NULL || table->ships_high == NULL || table->shots_low == NULL ||
+        table->shots_high == NULL || table->free_slots == NULL) {
+        match_table_free(table);
+        return -1;
+    }
+    memset(table->ships_low, 0, bytes);
+    memset(table->ships_high, 0, bytes);
+    memset(table->shots_low, 0, bytes);
+    memset(table->shots_high, 0, bytes);
+
+    table->slot_count = slot_count;
+    for (int i = 0; i < slot_count; i++) {
+        table->free_slots[i] = slot_count - 1 - i; // Low slots first
+    }
+    table->free_count = slot_count;
+    return 0;
+}
+
+void match_table_free(MatchTable *table) {
+    free(table->ships_low);
+    free(table->ships_high);
+    free(table->shots_low);
+    free(table->shots_high);
+    free(table->free_slots);
+    memset(table, 0, sizeof(*table));
+}
+
+static void clear_row(MatchTable *table, int row) {
+    table->ships_low[row] = 0;
+    table->ships_high[row] = 0;
+    table->shots_low[row] = 0;
+    table->shots_high[row] = 0;
+}
+
+int match_table_acquire(MatchTable *table) {
+    if (table->free_count == 0) {
+        return -1;
+    }
+    int slot = table->free_slots[--table->free_count];
+    clear_row(table, match_table_row(slot, 0));
+    clear_row(table, match_table_row(slot, 1));
+    return slot;
+}
+
+void match_table_release(MatchTable *table, int slot) {
+    if (slot >= 0 && slot < table->slot_count) {
+        table->free_slots[table->free_count++] = slot;
+    }
+}
+
+void match_table_load(MatchTable *table, int row, const GameBoard *board) {
+    uint64_t ships[2] = {0, 0};
+    uint64_t shots[2] = {0, 0};
+    for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+        int value = board->grid[cell / BOARD_SIZE][cell % BOARD_SIZE];
+        uint64_t bit = 1ULL << (cell & 63);
+        if (value == 1 || value == 2) {
+            ships[cell >> 6] |= bit;
+        }
+        if (value == 2 || value == 3) {
+            shots[cell >> 6] |= bit;
+        }
+    }
+    table->ships_low[row] = ships[0];
+    table->ships_high[row] = ships[1];
+    table->shots_low[row] = shots[0];
+    table->shots_high[row] = shots[1];
+}
+
+// Each lane takes one shot: the cell becomes a bit in the low or the high
+// word, and comparisons produce all-ones lanes that select without branches
+static void attack_lanes(MatchTable *table, const int rows[LANES], const TableShot *shots, uint8_t *flags) {
+    u64x4 cell, ships_low, ships_high, shots_low, shots_high;
+    for (int lane = 0; lane < LANES; lane++) {
+        cell[lane] = (uint64_t)(unsigned int)shots[lane].cell; // -1 becomes out of range
+        ships_low[lane] = table->ships_low[rows[lane]];
+        ships_high[lane] = table->ships_high[rows[lane]];
+        shots_low[lane] = table->shots_low[rows[lane]];
+        shots_high[lane] = table->shots_high[rows[lane]];
+    }
+
+    u64x4 valid = (u64x4)(cell < BOARD_SIZE * BOARD_SIZE);
+    u64x4 in_low = (u64x4)(cell < 64);
+    u64x4 bit = (u64x4){1, 1, 1, 1} << (cell & 63);
+    u64x4 bit_low = bit & in_low & valid;
+    u64x4 bit_high = bit & ~in_low & valid;
+
+    u64x4 invalid = (u64x4)(((shots_low & bit_low) | (shots_high & bit_high)) != 0) | ~valid;
+    bit_low &= ~invalid;
+    bit_high &= ~invalid;
+    u64x4 hit = (u64x4)(((ships_low & bit_low) | (ships_high & bit_high)) != 0);
+    shots_low |= bit_low;
+    shots_high |= bit_high;
+    u64x4 afloat = (ships_low & ~shots_low) | (ships_high & ~shots_high);
+    u64x4 sunk_all = hit & (u64x4)(afloat == 0);
+    u64x4 result = (hit & MATCH_TABLE_HIT) | (invalid & MATCH_TABLE_INVALID) | (sunk_all & MATCH_TABLE_SUNK_ALL);
+
+    for (int lane = 0; lane < LANES; lane++) {
+        table->shots_low[rows[lane]] = shots_low[lane];
+        table->shots_high[rows[lane]] = shots_high[lane];
+        flags[lane] = (uint8_t)result[lane];
+    }
+}
+
+void match_table_attack_batch(MatchTable *table, const TableShot *shots, int count, uint8_t *flags) {
+    int rows[LANES];
+    int i = 0;
+    for (; i + LANES <= count; i += LANES) {
+        for (int lane = 0; lane < LANES; lane++) {
+            rows[lane] = shots[i + lane].board;
+        }
+        attack_lanes(table, rows, shots + i, flags + i);
+    }
+
+    // The rest go in lanes padded with off-board shots at the spare row
+    if (i < count) {
+        TableShot padded[LANES];
+        uint8_t padded_flags[LANES];
+        for (int lane = 0; lane < LANES; lane++) {
+            if (i + lane < count) {
+                padded[lane] = shots[i + lane];
+            } else {
+                padded[lane].board = table->slot_count * 2;
+                padded[lane].cell = -1;
+            }
+            rows[lane] = padded[lane].board;
+        }
+        attack_lanes(table, rows, padded, padded_flags);
+        memcpy(flags + i, padded_flags, (size_t)(count - i));
+    }
+    table->batches++;
+    table->shots += (unsigned long long)count;
+}
+
+void match_table_report(const MatchTable *table, FILE *out) {
+    fprintf(out, "Match table: %d slots, %d in use, %llu shots in %llu batches (%.2f per batch)\n",
+            table->slot_count, table->slot_count - table->free_count, table->shots, table->batches,
+            table->batches > 0 ? (double)table->shots / (double)table->batches : 0.0);
+}
+
+static double elapsed_seconds(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) + (double)(now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+// Five ships at random columns on the even rows, never touching
+static void place_benchmark_fleet(GameBoard *board, unsigned int *seed) {
+    static const int lengths[FLEET_SIZE] = {5, 4, 3, 3, 2};
+    initialize_board(board);
+    for (int ship = 0; ship < FLEET_SIZE; ship++) {
+        int x = rand_r(seed) % (BOARD_SIZE - lengths[ship] + 1);
+        for (int k = 0; k < lengths[ship]; k++) {
+            board->grid[ship * 2][x + k] = 1;
+        }
+    }
+    board_rehash(board);
+}
+
+typedef struct {
+    const GameBoard *fleets;
+    const unsigned char *orders; // Per row, the cells in the order they are shot
+    int match_count;
+    long rounds;
+    unsigned long long hits;
+    unsigned long long sunk;
+} BenchmarkShots;
+
+static int shot_cell(const BenchmarkShots *bench, int row, int phase) {
+    return bench->orders[(size_t)row * BOARD_SIZE * BOARD_SIZE + phase / 2];
+}
+
+// A round is one move in every match, at alternating seats; after 200
+// rounds every board has been shot clean and the fleets are reset. Only
+// the shots are timed.
+static double run_scalar(BenchmarkShots *bench, GameBoard *boards) {
+    double seconds = 0;
+    struct timespec start;
+    bench->hits = bench->sunk = 0;
+    for (long round = 0; round < bench->rounds; round++) {
+        int phase = (int)(round % (2 * BOARD_SIZE * BOARD_SIZE));
+        if (phase == 0) {
+            memcpy(boards, bench->fleets, (size_t)bench->match_count * 2 * sizeof(GameBoard));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int match = 0; match < bench->match_count; match++) {
+            int row = match * 2 + (phase & 1);
+            int cell = shot_cell(bench, row, phase);
+            Shot shot = {cell % BOARD_SIZE, cell / BOARD_SIZE};
+            int hit;
+            int result = attack_salvo(&boards[row], &shot, 1, &hit);
+            bench->hits += hit == 1;
+            bench->sunk += result == 2 && hit == 1;
+        }
+        seconds += elapsed_seconds(&start);
+    }
+    return seconds;
+}
+
+static double run_batched(BenchmarkShots *bench, MatchTable *table, int width) {
+    double seconds = 0;
+    struct timespec start;
+    TableShot batch[MATCH_TABLE_BATCH];
+    uint8_t flags[MATCH_TABLE_BATCH];
+    bench->hits = bench->sunk = 0;
+    for (long round = 0; round < bench->rounds; round++) {
+        int phase = (int)(round % (2 * BOARD_SIZE * BOARD_SIZE));
+        if (phase == 0) {
+            for (int row = 0; row < bench->match_count * 2; row++) {
+                match_table_load(table, row, &bench->fleets[row]);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int first = 0; first < bench->match_count; first += width) {
+            int count = bench->match_count - first < width ? bench->match_count - first : width;
+            for (int k = 0; k < count; k++) {
+                batch[k].board = (first + k) * 2 + (phase & 1);
+                batch[k].cell = shot_cell(bench, batch[k].board, phase);
+            }
+            match_table_attack_batch(table, batch, count, flags);
+            for (int k = 0; k < count; k++) {
+                bench->hits += flags[k] & MATCH_TABLE_HIT;
+                bench->sunk += (flags[k] & MATCH_TABLE_SUNK_ALL) != 0;
+            }
+        }
+        seconds += elapsed_seconds(&start);
+    }
+    return seconds;
+}
+
+void match_table_benchmark(long shot_count, int match_count, FILE *out) {
+    if (match_count < 1) {
+        match_count = 1;
+    }
+    int row_count = match_count * 2;
+    MatchTable table;
+    GameBoard *fleets = malloc((size_t)row_count * sizeof(GameBoard));
+    GameBoard *boards = malloc((size_t)row_count * sizeof(GameBoard));
+    unsigned char *orders = malloc((size_t)row_count * BOARD_SIZE * BOARD_SIZE);
+    if (fleets == NULL || boards == NULL || orders == NULL || match_table_init(&table, match_count) == -1) {
+        fprintf(out, "Match table benchmark could not start.\n");
+        free(fleets);
+        free(boards);
+        free(orders);
+        return;
+    }
+
+    // Every board is shot at in its own random order, one cell per round
+    unsigned int seed = 12345;
+    for (int row = 0; row < row_count; row++) {
+        place_benchmark_fleet(&fleets[row], &seed);
+        unsigned char *order = orders + (size_t)row * BOARD_SIZE * BOARD_SIZE;
+        for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+            order[cell] = (unsigned char)cell;
+        }
+        for (int cell = BOARD_SIZE * BOARD_SIZE - 1; cell > 0; cell--) {
+            int other = rand_r(&seed) % (cell + 1);
+            unsigned char swap = order[cell];
+            order[cell] = order[other];
+            order[other] = swap;
+        }
+    }
+
+    BenchmarkShots bench = {fleets, orders, match_count, (shot_count + match_count - 1) / match_count, 0, 0};
+    double shots = (double)bench.rounds * match_count;
+    fprintf(out, "Match table: %.0f shots at %d matches (%zu bytes of masks)\n", shots, match_count,
+            (size_t)row_count * 4 * sizeof(uint64_t));
+
+    double seconds = run_scalar(&bench, boards);
+    unsigned long long hits = bench.hits, sunk = bench.sunk;
+    fprintf(out, "  attack_salvo, one at a time: %.3f s, %.1f ns per shot\n", seconds, seconds * 1e9 / shots);
+
+    static const int widths[] = {1, 4, 16, MATCH_TABLE_BATCH};
+    for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        seconds = run_batched(&bench, &table, widths[i]);
+        fprintf(out, "  batch kernel, %2d per batch: %.3f s, %.1f ns per shot%s\n", widths[i], seconds,
+                seconds * 1e9 / shots, bench.hits == hits && bench.sunk == sunk ? "" : " (RESULTS DIFFER)");
+    }
+    fprintf(out, "  hits %llu, fleets sunk %llu\n", hits, sunk);
+
+    match_table_free(&table);
+    free(fleets);
+    free(boards);
+    free(orders);
+}
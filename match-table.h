@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "config.h"
+#include "game-logic.h"
+
+// Boards of the two-player matches in structure-of-arrays form, so that
+// shots at many matches are resolved together. Cell y * 10 + x is bit
+// cell % 64 of word cell / 64; the boards of match slot s are rows 2s and
+// 2s + 1. A hit is a ship cell that was shot, a miss any other shot cell.
+
+#define MATCH_TABLE_BATCH 64 // Shots per batch, at most one per board
+
+// Result flags per shot
+#define MATCH_TABLE_HIT 1
+#define MATCH_TABLE_INVALID 2  // Off the board or already shot; nothing changed
+#define MATCH_TABLE_SUNK_ALL 4 // The hit left no ship cell afloat
+
+typedef struct {
+    int board; // Row: slot * 2 + seat
+    int cell;  // y * 10 + x, or -1 for coordinates off the board
+} TableShot;
+
+typedef struct {
+    uint64_t *ships_low; // Cells 0-63
+    uint64_t *ships_high; // Cells 64-99
+    uint64_t *shots_low;
+    uint64_t *shots_high;
+    int slot_count;
+    int *free_slots;
+    int free_count;
+    unsigned long long batches;
+    unsigned long long shots;
+} MatchTable;
+
+static inline int match_table_row(int slot, int seat) {
+    return slot * 2 + seat;
+}
+
+static inline int match_table_cell(int x, int y) {
+    return x >= 0 && x < BOARD_SIZE && y >= 0 && y < BOARD_SIZE ? y * BOARD_SIZE + x : -1;
+}
+
+int match_table_init(MatchTable *table, int slot_count);
+
+void match_table_free(MatchTable *table);
+
+// A slot with both boards empty, or -1 when the table is full
+int match_table_acquire(MatchTable *table);
+
+void match_table_release(MatchTable *table, int slot);
+
+// Copies the ship and shot cells of board into the row
+void match_table_load(MatchTable *table, int row, const GameBoard *board);
+
+// Resolves count shots, four at a time with vector operations, and marks
+// the cells shot. No board may be targeted twice in one batch.
+void match_table_attack_batch(MatchTable *table, const TableShot *shots, int count, uint8_t *flags);
+
+void match_table_report(const MatchTable *table, FILE *out);
+
+// Fires shot_count shots at match_count matches through attack_salvo() one
+// at a time and through the batch kernel at several batch sizes, and prints
+// the rates
+void match_table_benchmark(long shot_count, int match_count, FILE *out);
@@ -0,0 +1,458 @@
+#include "match.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define CHURN_LIVE_MATCHES 256 // Matches each benchmark thread keeps open at once
+
+static SlabPool match_pool;
+static SlabPool session_pool;
+static int pools_ready = 0;
+
+int match_pools_init(void) {
+    if (pools_ready) {
+        return 0;
+    }
+    if (slab_pool_init(&match_pool, "matches", sizeof(Match)) == -1) {
+        return -1;
+    }
+    if (slab_pool_init(&session_pool, "sessions", sizeof(ClientSession)) == -1) {
+        slab_pool_destroy(&match_pool);
+        return -1;
+    }
+    pools_ready = 1;
+    return 0;
+}
+
+void match_pools_destroy(void) {
+    if (!pools_ready) {
+        return;
+    }
+    slab_pool_destroy(&session_pool);
+    slab_pool_destroy(&match_pool);
+    pools_ready = 0;
+}
+
+static int init_match(Match *match, int id, const GameVariant *variant) {
+    memset(match, 0, sizeof(*match));
+    match->variant = *variant;
+    match->seat_count = variant->mode == GAME_MODE_FFA ? variant->players : 2;
+    match->bot_seat = -1;
+    match->table_slot = -1;
+    match->clock_seat = -1;
+    match->winner = -1;
+    match->end = HISTORY_END_QUIT;
+    for (int i = 0; i < MATCH_MAX_SEATS; i++) {
+        match->seats[i] = -1;
+    }
+    initialize_board(&match->boards[0]);
+    initialize_board(&match->boards[1]);
+
+    if (variant->mode == GAME_MODE_FFA) {
+        match->ffa = malloc(sizeof(FreeForAll));
+        if (match->ffa == NULL || ffa_init(match->ffa, variant->players, variant->board_size) == -1) {
+            free(match->ffa);
+            match->ffa = NULL;
+            return -1;
+        }
+    }
+
+    match->id = id;
+    snprintf(match->name, sizeof(match->name), "match-%d", id);
+    clock_gettime(CLOCK_REALTIME, &match->created);
+    return 0;
+}
+
+static void release_match(Match *match) {
+    if (match->ffa != NULL) {
+        ffa_free(match->ffa);
+        free(match->ffa);
+        match->ffa = NULL;
+    }
+}
+
+Match *match_create(int id, const GameVariant *variant) {
+    Match *match = slab_pool_alloc(&match_pool);
+    if (match == NULL) {
+        return NULL;
+    }
+    if (init_match(match, id, variant) == -1) {
+        slab_pool_free(&match_pool, match);
+        return NULL;
+    }
+    return match;
+}
+
+void match_destroy(Match *match) {
+    if (match == NULL) {
+        return;
+    }
+    release_match(match);
+    slab_pool_free(&match_pool, match);
+}
+
+static void init_session(ClientSession *session, int client_id, Match *match, int seat) {
+    memset(session, 0, sizeof(*session));
+    session->match = match;
+    session->client_id = client_id;
+    session->seat = seat;
+    clock_gettime(CLOCK_REALTIME, &session->connected);
+}
+
+ClientSession *session_create(int client_id, Match *match, int seat) {
+    ClientSession *session = slab_pool_alloc(&session_pool);
+    if (session != NULL) {
+        init_session(session, client_id, match, seat);
+    }
+    return session;
+}
+
+void session_destroy(ClientSession *session) {
+    slab_pool_free(&session_pool, session);
+}
+
+static void board_to_masks(const GameBoard *board, uint64_t ships[2], uint64_t shots[2]) {
+    ships[0] = ships[1] = shots[0] = shots[1] = 0;
+    for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+        int value = board->grid[cell / BOARD_SIZE][cell % BOARD_SIZE];
+        uint64_t bit = 1ULL << (cell % 64);
+        if (value == 1 || value == 2) {
+            ships[cell / 64] |= bit;
+        }
+        if (value == 2 || value == 3) {
+            shots[cell / 64] |= bit;
+        }
+    }
+}
+
+static void masks_to_board(const uint64_t ships[2], const uint64_t shots[2], GameBoard *board) {
+    for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+        int ship = (ships[cell / 64] >> (cell % 64)) & 1;
+        int shot = (shots[cell / 64] >> (cell % 64)) & 1;
+        board->grid[cell / BOARD_SIZE][cell % BOARD_SIZE] = shot ? (ship ? 2 : 3) : ship;
+    }
+    board_rehash(board);
+}
+
+static int64_t timespec_ns(const struct timespec *time) {
+    return (int64_t)time->tv_sec * 1000000000LL + time->tv_nsec;
+}
+
+static struct timespec ns_timespec(int64_t ns) {
+    struct timespec time = {(time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL)};
+    return time;
+}
+
+void match_compact(const Match *match, ClientSession *const sessions[2], MatchBlob *blob) {
+    blob->id = match->id;
+    blob->mode = (uint8_t)match->variant.mode;
+    blob->salvo_shots = (uint8_t)match->variant.salvo_shots;
+    blob->player_turn = (uint8_t)match->player_turn;
+    blob->seated = (uint8_t)match->seated;
+    blob->bot_seat = (int8_t)match->bot_seat;
+    blob->clock_seat = (int8_t)match->clock_seat;
+    blob->boards_ready = (uint8_t)match->boards_ready;
+    blob->turns[0] = match->turns[0];
+    blob->turns[1] = match->turns[1];
+    blob->shot_count = (uint16_t)match->shot_count;
+    blob->sequence = match->sequence;
+    blob->turn_started_ms = match->turn_started_ms;
+    blob->active_ms = match->active_ms;
+    blob->created_ns = timespec_ns(&match->created);
+    for (int seat = 0; seat < 2; seat++) {
+        board_to_masks(&match->boards[seat], blob->ships[seat], blob->shots[seat]);
+        blob->seats[seat] = match->seats[seat];
+        blob->clock_ms[seat] = match->clock_ms[seat];
+        blob->messages[seat] = sessions[seat] != NULL ? sessions[seat]->messages : 0;
+        blob->connected_ns[seat] = sessions[seat] != NULL ? timespec_ns(&sessions[seat]->connected) : 0;
+    }
+    memcpy(blob->players, match->players, sizeof(blob->players));
+    memcpy(blob->shot_log, match->shots, (size_t)match->shot_count * sizeof(HistoryShot));
+}
+
+Match *match_expand(const MatchBlob *blob, ClientSession *sessions[2]) {
+    GameVariant variant = {(GameMode)blob->mode, blob->salvo_shots, 2, BOARD_SIZE};
+    Match *match = match_create(blob->id, &variant);
+    if (match == NULL) {
+        return NULL;
+    }
+    match->player_turn = blob->player_turn;
+    match->seated = blob->seated;
+    match->bot_seat = blob->bot_seat;
+    match->clock_seat = blob->clock_seat;
+    match->boards_ready = blob->boards_ready;
+    match->turns[0] = blob->turns[0];
+    match->turns[1] = blob->turns[1];
+    match->shot_count = blob->shot_count;
+    match->sequence = blob->sequence;
+    match->turn_started_ms = blob->turn_started_ms;
+    match->active_ms = blob->active_ms;
+    match->created = ns_timespec(blob->created_ns);
+    memcpy(match->players, blob->players, sizeof(match->players));
+    memcpy(match->shots, blob->shot_log, (size_t)blob->shot_count * sizeof(HistoryShot));
+
+    for (int seat = 0; seat < 2; seat++) {
+        masks_to_board(blob->ships[seat], blob->shots[seat], &match->boards[seat]);
+        match->seats[seat] = blob->seats[seat];
+        match->clock_ms[seat] = blob->clock_ms[seat];
+        sessions[seat] = NULL;
+        if (seat == match->bot_seat || blob->seats[seat] < 0) {
+            continue;
+        }
+        sessions[seat] = session_create(blob->seats[seat], match, seat);
+        if (sessions[seat] == NULL) {
+            for (int other = 0; other < seat; other++) {
+                if (sessions[other] != NULL) {
+                    session_destroy(sessions[other]);
+                }
+            }
+            match_destroy(match);
+            return NULL;
+        }
+        sessions[seat]->messages = blob->messages[seat];
+        sessions[seat]->connected = ns_timespec(blob->connected_ns[seat]);
+    }
+    return match;
+}
+
+void match_pools_report(FILE *out) {
+    if (!pools_ready) {
+        return;
+    }
+    slab_pool_flush_thread(&match_pool);
+    slab_pool_flush_thread(&session_pool);
+    slab_pool_report(&match_pool, out);
+    slab_pool_report(&session_pool, out);
+}
+
+static void encode_board(const GameBoard *board, HandoffBuffer *buffer) {
+    handoff_put(buffer, board->grid, sizeof(board->grid));
+    handoff_put_int(buffer, board->ships_remaining);
+    handoff_put_int(buffer, (int64_t)board->ship_hash);
+    handoff_put_int(buffer, (int64_t)board->shot_hash);
+}
+
+static void decode_board(GameBoard *board, HandoffBuffer *buffer) {
+    handoff_get(buffer, board->grid, sizeof(board->grid));
+    board->ships_remaining = (int)handoff_get_int(buffer);
+    board->ship_hash = (uint64_t)handoff_get_int(buffer);
+    board->shot_hash = (uint64_t)handoff_get_int(buffer);
+}
+
+void match_encode(const Match *match, HandoffBuffer *buffer) {
+    handoff_put_int(buffer, match->id);
+    handoff_put_int(buffer, match->variant.mode);
+    handoff_put_int(buffer, match->variant.salvo_shots);
+    handoff_put_int(buffer, match->variant.players);
+    handoff_put_int(buffer, match->variant.board_size);
+    handoff_put_int(buffer, match->player_turn);
+    handoff_put_int(buffer, match->seated);
+    handoff_put_int(buffer, match->bot_seat);
+    handoff_put_int(buffer, (int64_t)match->sequence);
+    encode_board(&match->boards[0], buffer);
+    encode_board(&match->boards[1], buffer);
+    for (int seat = 0; seat < match->seat_count; seat++) {
+        handoff_put_int(buffer, match->seats[seat]);
+        handoff_put_int(buffer, match->clock_ms[seat]);
+    }
+    handoff_put_int(buffer, match->boards_ready);
+    handoff_put_int(buffer, match->clock_seat);
+
+    handoff_put_int(buffer, match->shot_count);
+    handoff_put(buffer, match->shots, (size_t)match->shot_count * sizeof(HistoryShot));
+    handoff_put(buffer, match->turns, sizeof(match->turns));
+    handoff_put_int(buffer, match->winner);
+    handoff_put_int(buffer, match->end);
+    handoff_put_int(buffer, match->created.tv_sec);
+    handoff_put_int(buffer, match->created.tv_nsec);
+    handoff_put(buffer, match->players, sizeof(match->players));
+
+    if (match->ffa != NULL) {
+        ffa_encode(match->ffa, buffer);
+    }
+}
+
+Match *match_decode(HandoffBuffer *buffer) {
+    int id = (int)handoff_get_int(buffer);
+    GameVariant variant;
+    variant.mode = (GameMode)handoff_get_int(buffer);
+    variant.salvo_shots = (int)handoff_get_int(buffer);
+    variant.players = (int)handoff_get_int(buffer);
+    variant.board_size = (int)handoff_get_int(buffer);
+    if (buffer->failed) {
+        return NULL;
+    }
+    Match *match = match_create(id, &variant);
+    if (match == NULL) {
+        return NULL;
+    }
+
+    match->player_turn = (int)handoff_get_int(buffer);
+    match->seated = (int)handoff_get_int(buffer);
+    match->bot_seat = (int)handoff_get_int(buffer);
+    match->sequence = (unsigned long long)handoff_get_int(buffer);
+    decode_board(&match->boards[0], buffer);
+    decode_board(&match->boards[1], buffer);
+    for (int seat = 0; seat < match->seat_count; seat++) {
+        match->seats[seat] = (int)handoff_get_int(buffer);
+        match->clock_ms[seat] = (int)handoff_get_int(buffer);
+    }
+    match->boards_ready = (unsigned int)handoff_get_int(buffer);
+    match->clock_seat = (int)handoff_get_int(buffer);
+
+    match->shot_count = (int)handoff_get_int(buffer);
+    if (match->shot_count < 0 || match->shot_count > HISTORY_MAX_SHOTS) {
+        match_destroy(match);
+        return NULL;
+    }
+    handoff_get(buffer, match->shots, (size_t)match->shot_count * sizeof(HistoryShot));
+    handoff_get(buffer, match->turns, sizeof(match->turns));
+    match->winner = (int)handoff_get_int(buffer);
+    match->end = (HistoryEnd)handoff_get_int(buffer);
+    match->created.tv_sec = (time_t)handoff_get_int(buffer);
+    match->created.tv_nsec = (long)handoff_get_int(buffer);
+    handoff_get(buffer, match->players, sizeof(match->players));
+    match->players[0][PLAYER_NAME_MAX - 1] = match->players[1][PLAYER_NAME_MAX - 1] = '\0';
+
+    if ((match->ffa != NULL && ffa_decode(match->ffa, buffer) == -1) || buffer->failed) {
+        match_destroy(match);
+        return NULL;
+    }
+    return match;
+}
+
+typedef struct {
+    long matches;
+    int pooled;
+    int thread_index;
+} ChurnArgs;
+
+// One match lifetime: two seats, a single shot, then teardown
+static void *churn_matches(void *arg) {
+    const ChurnArgs *args = arg;
+    GameVariant variant;
+    parse_game_variant(NULL, &variant);
+
+    Match *live[CHURN_LIVE_MATCHES] = {0};
+    ClientSession *seats[CHURN_LIVE_MATCHES][2] = {{0}};
+
+    for (long i = 0; i < args->matches; i++) {
+        int slot = (int)(i % CHURN_LIVE_MATCHES);
+        if (live[slot] != NULL) {
+            for (int s = 0; s < 2; s++) {
+                if (args->pooled) {
+                    session_destroy(seats[slot][s]);
+                } else {
+                    free(seats[slot][s]);
+                }
+            }
+            if (args->pooled) {
+                match_destroy(live[slot]);
+            } else {
+                release_match(live[slot]);
+                free(live[slot]);
+            }
+        }
+
+        Match *match;
+        if (args->pooled) {
+            match = match_create((int)i, &variant);
+        } else {
+            match = aligned_alloc(CACHE_LINE_SIZE, sizeof(Match));
+            if (match != NULL && init_match(match, (int)i, &variant) == -1) {
+                free(match);
+                match = NULL;
+            }
+        }
+        if (match == NULL) {
+            live[slot] = NULL;
+            continue;
+        }
+
+        for (int s = 0; s < 2; s++) {
+            int client_id = args->thread_index * 2 + s;
+            if (args->pooled) {
+                seats[slot][s] = session_create(client_id, match, s);
+            } else {
+                seats[slot][s] = aligned_alloc(CACHE_LINE_SIZE, sizeof(ClientSession));
+                if (seats[slot][s] != NULL) {
+                    init_session(seats[slot][s], client_id, match, s);
+                }
+            }
+            match->seats[s] = client_id;
+        }
+        // Record one miss directly; attack() would print every shot
+        match->boards[1].grid[(i / BOARD_SIZE) % BOARD_SIZE][i % BOARD_SIZE] = 3;
+        match->sequence++;
+        live[slot] = match;
+    }
+
+    for (int slot = 0; slot < CHURN_LIVE_MATCHES; slot++) {
+        if (live[slot] == NULL) {
+            continue;
+        }
+        for (int s = 0; s < 2; s++) {
+            if (args->pooled) {
+                session_destroy(seats[slot][s]);
+            } else {
+                free(seats[slot][s]);
+            }
+        }
+        if (args->pooled) {
+            match_destroy(live[slot]);
+        } else {
+            release_match(live[slot]);
+            free(live[slot]);
+        }
+    }
+
+    if (args->pooled) {
+        slab_pool_flush_thread(&match_pool);
+        slab_pool_flush_thread(&session_pool);
+    }
+    return NULL;
+}
+
+static double run_churn(long match_count, int thread_count, int pooled) {
+    pthread_t threads[64];
+    ChurnArgs args[64];
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int t = 0; t < thread_count; t++) {
+        args[t].matches = match_count / thread_count + (t < match_count % thread_count ? 1 : 0);
+        args[t].pooled = pooled;
+        args[t].thread_index = t;
+        pthread_create(&threads[t], NULL, churn_matches, &args[t]);
+    }
+    for (int t = 0; t < thread_count; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void match_churn_benchmark(long match_count, int thread_count, FILE *out) {
+    if (thread_count < 1) {
+        thread_count = 1;
+    } else if (thread_count > 64) {
+        thread_count = 64;
+    }
+    if (match_count < 1 || match_pools_init() == -1) {
+        fprintf(out, "Match churn benchmark could not start.\n");
+        return;
+    }
+
+    fprintf(out, "Match churn: %ld matches on %d threads, %d live per thread\n",
+            match_count, thread_count, CHURN_LIVE_MATCHES);
+
+    double seconds = run_churn(match_count, thread_count, 0);
+    fprintf(out, "  malloc: %.3f s, %.1f ns per match\n", seconds, seconds * 1e9 / (double)match_count);
+
+    seconds = run_churn(match_count, thread_count, 1);
+    fprintf(out, "  pools:  %.3f s, %.1f ns per match\n", seconds, seconds * 1e9 / (double)match_count);
+
+    match_pools_report(out);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdio.h>
+#include <time.h>
+#include "game-logic.h"
+#include "free-for-all.h"
+#include "slab-pool.h"
+#include "timer-wheel.h"
+#include "history.h"
+
+#define MATCH_MAX_SEATS FFA_MAX_PLAYERS
+
+// A running game. Fields read on every move come first; bookkeeping that is
+// written once lives on its own cache lines so it never shares one with them.
+typedef struct Match {
+    // Hot
+    _Alignas(CACHE_LINE_SIZE) int player_turn; // Seat whose move it is
+    int seat_count;
+    int seated;
+    int finished;
+    int bot_seat; // Seat played by the server's bot, -1 if none
+    int table_slot; // Boards mirrored in the server's match table, -1 if not
+    unsigned long long sequence; // Moves applied so far
+    GameVariant variant;
+    FreeForAll *ffa; // Only allocated for GAME_MODE_FFA
+    GameBoard boards[2];
+    int seats[MATCH_MAX_SEATS]; // Client id per seat
+    unsigned int boards_ready; // Bit per seat that has sent a valid board
+    TimerEntry turn_clock; // Runs out when the seat to move forfeits
+    int clock_seat; // Seat whose clock runs, -1 when stopped or placing fleets
+    unsigned long long turn_started_ms;
+    int clock_ms[MATCH_MAX_SEATS]; // Game time left per seat
+    unsigned long long active_ms; // Last message from a seat, on the server's clock
+
+    // Move log of a two-player match, appended to the history store at the end
+    _Alignas(CACHE_LINE_SIZE) HistoryShot shots[HISTORY_MAX_SHOTS];
+    int shot_count;
+    unsigned char turns[2]; // Turns each seat has finished
+    int winner; // Seat, -1 while playing or when nobody won
+    HistoryEnd end;
+
+    // Cold
+    _Alignas(CACHE_LINE_SIZE) int id;
+    char name[32];
+    char players[2][PLAYER_NAME_MAX]; // Rated names of a two-player match, empty when not given
+    struct timespec created;
+    struct timespec finished_at;
+} Match;
+
+// One connected client and the seat it holds
+typedef struct {
+    // Hot
+    _Alignas(CACHE_LINE_SIZE) Match *match;
+    int client_id;
+    int seat;
+    unsigned long long messages;
+
+    // Cold
+    _Alignas(CACHE_LINE_SIZE) struct timespec connected;
+} ClientSession;
+
+int match_pools_init(void);
+
+void match_pools_destroy(void);
+
+// Returns a match with every seat free, or NULL when out of memory or the
+// free-for-all boards cannot be set up
+Match *match_create(int id, const GameVariant *variant);
+
+void match_destroy(Match *match);
+
+ClientSession *session_create(int client_id, Match *match, int seat);
+
+void session_destroy(ClientSession *session);
+
+void match_pools_report(FILE *out);
+
+// Writes a live match for a handoff; its turn clock belongs to the server's
+// wheel and is left to the caller
+void match_encode(const Match *match, HandoffBuffer *buffer);
+
+// Rebuilds a match from match_encode() output with its clock disarmed, or
+// returns NULL when out of memory or the snapshot is damaged
+Match *match_decode(HandoffBuffer *buffer);
+
+// A two-player match and its sessions compacted for hibernation: each board
+// is a ship and a shot bitmask, bit y * 10 + x across both words
+typedef struct {
+    int32_t id;
+    uint8_t mode;
+    uint8_t salvo_shots;
+    uint8_t player_turn;
+    uint8_t seated;
+    int8_t bot_seat;
+    int8_t clock_seat;
+    uint8_t boards_ready;
+    uint8_t turns[2];
+    uint16_t shot_count;
+    uint64_t sequence;
+    uint64_t ships[2][2];
+    uint64_t shots[2][2];
+    int32_t seats[2];
+    int32_t clock_ms[2];
+    uint64_t turn_started_ms;
+    uint64_t active_ms;
+    int64_t created_ns;
+    uint64_t messages[2];  // Per seat's session
+    int64_t connected_ns[2];
+    char players[2][PLAYER_NAME_MAX];
+    HistoryShot shot_log[HISTORY_MAX_SHOTS];
+} MatchBlob;
+
+// Writes a two-player match and the sessions of its client seats, NULL for
+// the bot's; the turn clock is left to the caller
+void match_compact(const Match *match, ClientSession *const sessions[2], MatchBlob *blob);
+
+// Rebuilds a match from match_compact() output with its clock disarmed and
+// creates its sessions, or returns NULL when out of memory
+Match *match_expand(const MatchBlob *blob, ClientSession *sessions[2]);
+
+// Creates and finishes match_count two-player matches on thread_count threads,
+// first with malloc and then with the pools, and prints the timings
+void match_churn_benchmark(long match_count, int thread_count, FILE *out);
@@ -0,0 +1,567 @@
+#include "outbound.h"
+#include "io-engine.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+typedef struct {
+    unsigned int offset;   // Into the queue's data
+    unsigned short length; // Including the terminator
+    unsigned char live;    // 0 once a newer snapshot replaced it
+} OutboundSlot;
+
+// Message text is packed into a byte ring, so a queue never holds more than
+// byte_capacity of it however long the messages are. A channel that carries
+// the messages of extra client ids (lanes) gets the room and the lag
+// allowance of a channel of its own for each of them.
+typedef struct {
+    OutboundChannel channel;
+    OutboundSlot *slots;
+    char *data;
+    char *retired_data; // Replaced while its head was being written
+    int lanes;          // Client ids sharing the channel besides its own
+    int capacity;       // Slots
+    int byte_capacity;
+    int max_lag;
+    int head;
+    int count;       // Slots in use, replaced ones included
+    int live_count;  // Messages still to be written
+    int tail_offset; // Where the next message's text goes
+    int bytes;       // Text held by the slots in use
+    int sending;     // The head is being written
+    int blocked;     // The FIFO was full; tried again after OUTBOUND_RETRY_MS
+    int cut_off;
+    unsigned long long delivered; // Written to the FIFO and announced
+    unsigned long long acked;     // Confirmed through sem_continue
+    unsigned long long coalesced;
+    unsigned long long dropped;
+    unsigned long long stalls; // Writes refused by a full FIFO
+    int max_backlog;
+    int max_bytes;
+} OutboundQueue;
+
+static OutboundQueue *queues[MAX_CLIENTS];
+static int queue_count = 0; // One past the highest registered client id
+static IoEngine engine;
+
+static int cut_off_ids[MAX_CLIENTS];
+static int cut_off_count = 0;
+
+static pthread_mutex_t outbound_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_available = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t delivery_progress = PTHREAD_COND_INITIALIZER;
+static pthread_t delivery_thread;
+static int running = 0;
+static int in_flight = 0;
+static struct timespec retry_at; // When blocked queues are tried again
+
+// Messages the delivery thread could write right now
+static int can_send(const OutboundQueue *queue) {
+    return queue != NULL && queue->count > 0 && !queue->sending && !queue->blocked && !queue->cut_off;
+}
+
+static int any_sendable(void) {
+    for (int i = 0; i < queue_count; i++) {
+        if (can_send(queues[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int any_pending(void) {
+    for (int i = 0; i < queue_count; i++) {
+        if (queues[i] != NULL && queues[i]->count > 0 && !queues[i]->cut_off) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int any_blocked(void) {
+    for (int i = 0; i < queue_count; i++) {
+        if (queues[i] != NULL && queues[i]->blocked) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void unblock_all(void) {
+    for (int i = 0; i < queue_count; i++) {
+        if (queues[i] != NULL) {
+            queues[i]->blocked = 0;
+        }
+    }
+}
+
+// A full FIFO cannot be watched from here, so it is simply tried again once
+// the retry time has come, even while other queues keep the thread busy
+static void unblock_if_due(void) {
+    if (!any_blocked()) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (now.tv_sec > retry_at.tv_sec || (now.tv_sec == retry_at.tv_sec && now.tv_nsec >= retry_at.tv_nsec)) {
+        unblock_all();
+    }
+}
+
+static void deadline_after(struct timespec *deadline, int timeout_ms) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// Collect acknowledgements that have already arrived without blocking
+static unsigned long long collect_acks(sem_t *sem_continue) {
+    unsigned long long acks = 0;
+    while (sem_trywait(sem_continue) == 0) {
+        acks++;
+    }
+    return acks;
+}
+
+// Takes the snapshot of the sem_continue semaphores without the mutex, so a
+// channel added meanwhile is left for the next round
+static void harvest_acks(sem_t *const *sems, int count, unsigned long long *acks) {
+    for (int i = 0; i < count; i++) {
+        acks[i] = sems[i] != NULL ? collect_acks(sems[i]) : 0;
+    }
+}
+
+static void pop_head(OutboundQueue *queue) {
+    OutboundSlot *slot = &queue->slots[queue->head];
+    queue->live_count -= slot->live;
+    queue->bytes -= slot->length;
+    queue->head = (queue->head + 1) % queue->capacity;
+    if (--queue->count == 0) {
+        queue->tail_offset = 0;
+    }
+}
+
+// Offset at which length more bytes of text fit, or -1 when the queue is full
+static int find_space(const OutboundQueue *queue, int length) {
+    if (queue->count == 0) {
+        return 0;
+    }
+    if (queue->count == queue->capacity) {
+        return -1;
+    }
+    int head_offset = queue->slots[queue->head].offset;
+    if (queue->tail_offset > head_offset) {
+        if (queue->tail_offset + length <= queue->byte_capacity) {
+            return queue->tail_offset;
+        }
+        return length <= head_offset ? 0 : -1; // Wrap around, leaving the end unused
+    }
+    return queue->tail_offset + length <= head_offset ? queue->tail_offset : -1;
+}
+
+// Messages queued, plus those written but not yet acknowledged, which are
+// still waiting in the FIFO. The acknowledgement of a message being written
+// may arrive before it is counted as delivered.
+static unsigned long long lag_of(const OutboundQueue *queue) {
+    unsigned long long unacked = queue->delivered > queue->acked ? queue->delivered - queue->acked : 0;
+    return (unsigned long long)queue->live_count + unacked;
+}
+
+// Frees every slot but the one being written
+static void cut_off(OutboundQueue *queue, int client_id) {
+    queue->dropped += (unsigned long long)(queue->live_count - (queue->sending ? 1 : 0));
+    while (queue->count > (queue->sending ? 1 : 0)) {
+        if (queue->sending) {
+            // Keep the head; drop from the tail
+            int last = (queue->head + queue->count - 1) % queue->capacity;
+            queue->live_count -= queue->slots[last].live;
+            queue->bytes -= queue->slots[last].length;
+            queue->count--;
+            queue->tail_offset = queue->slots[last].offset;
+        } else {
+            pop_head(queue);
+        }
+    }
+    queue->cut_off = 1;
+    cut_off_ids[cut_off_count++] = client_id;
+}
+
+// Length of the part of a snapshot message that names what it is a snapshot
+// of, e.g. "CLIENT_3:BOARD_STATE_MINE"; 0 for any other message
+static size_t snapshot_key_length(const char *message) {
+    const char *body = strchr(message, ':');
+    if (body == NULL || strncmp(body + 1, "BOARD_STATE_", 12) != 0) {
+        return 0;
+    }
+    const char *end = strchr(body + 13, '_');
+    return end != NULL ? (size_t)(end - message) : 0;
+}
+
+// Marks a queued snapshot of the same thing as replaced; it is skipped
+// instead of written
+static void coalesce(OutboundQueue *queue, const char *message) {
+    size_t key_length = snapshot_key_length(message);
+    if (key_length == 0) {
+        return;
+    }
+    for (int i = queue->sending ? 1 : 0; i < queue->count; i++) {
+        OutboundSlot *slot = &queue->slots[(queue->head + i) % queue->capacity];
+        if (slot->live && strncmp(queue->data + slot->offset, message, key_length) == 0 &&
+            queue->data[slot->offset + key_length] == '_') {
+            slot->live = 0;
+            queue->live_count--;
+            queue->coalesced++;
+        }
+    }
+}
+
+// Sizes the queue for its own client and its lanes, copying what it holds
+// to the front of the new buffers. The text of a head being written stays
+// where the write expects it until the write is done.
+static int resize_queue(OutboundQueue *queue) {
+    int capacity = OUTBOUND_QUEUE_CAPACITY * (queue->lanes + 1);
+    int byte_capacity = OUTBOUND_QUEUE_BYTES * (queue->lanes + 1);
+    OutboundSlot *slots = malloc((size_t)capacity * sizeof(OutboundSlot));
+    char *data = malloc((size_t)byte_capacity);
+    if (slots == NULL || data == NULL) {
+        free(slots);
+        free(data);
+        return -1;
+    }
+
+    int offset = 0;
+    for (int i = 0; i < queue->count; i++) {
+        const OutboundSlot *slot = &queue->slots[(queue->head + i) % queue->capacity];
+        slots[i] = *slot;
+        slots[i].offset = (unsigned int)offset;
+        memcpy(data + offset, queue->data + slot->offset, slot->length);
+        offset += slot->length;
+    }
+    if (queue->sending && queue->retired_data == NULL) {
+        queue->retired_data = queue->data;
+    } else {
+        free(queue->data);
+    }
+    free(queue->slots);
+    queue->slots = slots;
+    queue->data = data;
+    queue->head = 0;
+    queue->tail_offset = offset;
+    queue->capacity = capacity;
+    queue->byte_capacity = byte_capacity;
+    queue->max_lag = OUTBOUND_MAX_LAG * (queue->lanes + 1);
+    return 0;
+}
+
+static void free_queue(OutboundQueue *queue) {
+    if (queue != NULL) {
+        free(queue->slots);
+        free(queue->data);
+        free(queue->retired_data);
+        free(queue);
+    }
+}
+
+static void *deliver_messages(void *arg) {
+    (void)arg;
+    int batch[IO_ENGINE_MAX_BATCH];
+    int errors[IO_ENGINE_MAX_BATCH];
+    sem_t *responses[IO_ENGINE_MAX_BATCH];
+    sem_t *continues[MAX_CLIENTS];
+    unsigned long long acks[MAX_CLIENTS] = {0};
+    int next_queue = 0; // Where the next batch starts, so every queue gets its turn
+
+    pthread_mutex_lock(&outbound_mutex);
+    while (1) {
+        unblock_if_due();
+        while (running && !any_sendable()) {
+            if (!any_blocked()) {
+                pthread_cond_wait(&work_available, &outbound_mutex);
+            } else if (pthread_cond_timedwait(&work_available, &outbound_mutex, &retry_at) == ETIMEDOUT) {
+                unblock_all();
+            }
+        }
+        if (!running && !any_sendable()) {
+            break;
+        }
+
+        // Only the head of each queue goes into a batch: messages to the same
+        // FIFO must stay ordered, messages to different FIFOs need not
+        int batch_count = 0;
+        for (int n = 0; n < queue_count && batch_count < IO_ENGINE_MAX_BATCH; n++) {
+            int i = (next_queue + n) % queue_count;
+            OutboundQueue *queue = queues[i];
+            while (can_send(queue) && !queue->slots[queue->head].live) {
+                pop_head(queue); // Replaced by a newer snapshot
+            }
+            if (can_send(queue)) {
+                io_engine_queue(&engine, queue->channel.fd, queue->data + queue->slots[queue->head].offset);
+                queue->sending = 1;
+                responses[batch_count] = queue->channel.sem_response;
+                batch[batch_count++] = i;
+                next_queue = i + 1;
+            }
+        }
+        in_flight = batch_count;
+        int ack_count = queue_count;
+        for (int i = 0; i < ack_count; i++) {
+            continues[i] = queues[i] != NULL ? queues[i]->channel.sem_continue : NULL;
+        }
+        pthread_mutex_unlock(&outbound_mutex);
+
+        io_engine_flush_each(&engine, errors);
+        for (int i = 0; i < batch_count; i++) {
+            if (errors[i] == 0) {
+                sem_post(responses[i]);
+            }
+        }
+        harvest_acks(continues, ack_count, acks);
+
+        pthread_mutex_lock(&outbound_mutex);
+        for (int i = 0; i < batch_count; i++) {
+            OutboundQueue *queue = queues[batch[i]];
+            queue->sending = 0;
+            free(queue->retired_data);
+            queue->retired_data = NULL;
+            if (errors[i] == EAGAIN) {
+                if (!any_blocked()) {
+                    deadline_after(&retry_at, OUTBOUND_RETRY_MS);
+                }
+                queue->blocked = 1;
+                queue->stalls++;
+                if (queue->cut_off) {
+                    pop_head(queue);
+                }
+                continue;
+            }
+            if (errors[i] == 0) {
+                queue->delivered++;
+            } else {
+                queue->dropped++; // Nothing more can be done for it
+            }
+            pop_head(queue);
+        }
+        for (int i = 0; i < ack_count; i++) {
+            if (queues[i] != NULL) {
+                queues[i]->acked += acks[i];
+            }
+        }
+        in_flight = 0;
+        pthread_cond_broadcast(&delivery_progress);
+    }
+    pthread_mutex_unlock(&outbound_mutex);
+    return NULL;
+}
+
+void outbound_start(void) {
+    queue_count = 0;
+    cut_off_count = 0;
+    io_engine_init(&engine, -1);
+    engine.nowait_writes = 1;
+    running = 1;
+    if (pthread_create(&delivery_thread, NULL, deliver_messages, NULL) != 0) {
+        perror("Failed to start outbound delivery thread");
+        running = 0;
+    }
+}
+
+int outbound_add_channel(int client_id, const OutboundChannel *channel) {
+    if (client_id < 0 || client_id >= MAX_CLIENTS) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&outbound_mutex);
+    if (queues[client_id] == NULL) {
+        OutboundQueue *queue = calloc(1, sizeof(OutboundQueue));
+        if (queue != NULL && resize_queue(queue) == -1) {
+            free_queue(queue);
+            queue = NULL;
+        }
+        if (queue != NULL) {
+            queue->channel = *channel; // Set before the queue is published
+        }
+        queues[client_id] = queue;
+    }
+    int status = -1;
+    if (queues[client_id] != NULL) {
+        queues[client_id]->channel = *channel;
+        if (client_id >= queue_count) {
+            queue_count = client_id + 1;
+        }
+        status = 0;
+    }
+    pthread_mutex_unlock(&outbound_mutex);
+    return status;
+}
+
+int outbound_add_lane(int client_id) {
+    pthread_mutex_lock(&outbound_mutex);
+    int status = -1;
+    if (client_id >= 0 && client_id < queue_count && queues[client_id] != NULL) {
+        OutboundQueue *queue = queues[client_id];
+        queue->lanes++;
+        status = resize_queue(queue);
+        if (status == -1) {
+            queue->lanes--;
+        }
+    }
+    pthread_mutex_unlock(&outbound_mutex);
+    return status;
+}
+
+int outbound_enqueue(int client_id, const char *message) {
+    pthread_mutex_lock(&outbound_mutex);
+    if (client_id < 0 || client_id >= queue_count || queues[client_id] == NULL) {
+        pthread_mutex_unlock(&outbound_mutex);
+        fprintf(stderr, "Outbound message for unknown client %d dropped.\n", client_id);
+        return -1;
+    }
+    OutboundQueue *queue = queues[client_id];
+    if (!running || queue->cut_off) {
+        queue->dropped++;
+        pthread_mutex_unlock(&outbound_mutex);
+        return -1;
+    }
+
+    int length = (int)strnlen(message, BUFFER_SIZE - 1) + 1;
+    int offset = -1;
+    if (queue->channel.policy == OUTBOUND_COALESCE) {
+        coalesce(queue, message);
+        // Make room by dropping the oldest updates that are not being written
+        while ((offset = find_space(queue, length)) < 0 && queue->count > 0 && !queue->sending) {
+            queue->dropped += queue->slots[queue->head].live;
+            pop_head(queue);
+        }
+    } else {
+        offset = find_space(queue, length);
+        if (lag_of(queue) >= (unsigned long long)queue->max_lag || offset < 0) {
+            queue->acked += collect_acks(queue->channel.sem_continue);
+            if (lag_of(queue) >= (unsigned long long)queue->max_lag || offset < 0) {
+                queue->dropped++;
+                cut_off(queue, client_id);
+                pthread_mutex_unlock(&outbound_mutex);
+                return -1;
+            }
+        }
+    }
+    if (offset < 0) {
+        queue->dropped++;
+        pthread_mutex_unlock(&outbound_mutex);
+        return 1;
+    }
+
+    OutboundSlot *slot = &queue->slots[(queue->head + queue->count) % queue->capacity];
+    slot->offset = (unsigned int)offset;
+    slot->length = (unsigned short)length;
+    slot->live = 1;
+    memcpy(queue->data + offset, message, (size_t)length - 1);
+    queue->data[offset + length - 1] = '\0';
+    queue->tail_offset = offset + length;
+    queue->count++;
+    queue->live_count++;
+    queue->bytes += length;
+    if (queue->live_count > queue->max_backlog) {
+        queue->max_backlog = queue->live_count;
+    }
+    if (queue->bytes > queue->max_bytes) {
+        queue->max_bytes = queue->bytes;
+    }
+    pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&outbound_mutex);
+    return 0;
+}
+
+int outbound_take_cut_off(int client_ids[MAX_CLIENTS]) {
+    pthread_mutex_lock(&outbound_mutex);
+    int count = cut_off_count;
+    memcpy(client_ids, cut_off_ids, (size_t)count * sizeof(int));
+    cut_off_count = 0;
+    pthread_mutex_unlock(&outbound_mutex);
+    return count;
+}
+
+int outbound_drain(int timeout_ms) {
+    struct timespec deadline;
+    deadline_after(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&outbound_mutex);
+    while (running && (any_pending() || in_flight > 0)) {
+        if (pthread_cond_timedwait(&delivery_progress, &outbound_mutex, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&outbound_mutex);
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&outbound_mutex);
+
+    for (int i = 0; i < queue_count; i++) {
+        OutboundQueue *queue = queues[i];
+        while (queue != NULL) {
+            pthread_mutex_lock(&outbound_mutex);
+            int outstanding = !queue->cut_off && queue->acked < queue->delivered;
+            pthread_mutex_unlock(&outbound_mutex);
+            if (!outstanding) {
+                break;
+            }
+
+            if (sem_timedwait(queue->channel.sem_continue, &deadline) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            pthread_mutex_lock(&outbound_mutex);
+            queue->acked++;
+            pthread_mutex_unlock(&outbound_mutex);
+        }
+    }
+    return 0;
+}
+
+void outbound_stop(void) {
+    pthread_mutex_lock(&outbound_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&outbound_mutex);
+        return;
+    }
+    running = 0;
+    pthread_cond_broadcast(&work_available);
+    pthread_mutex_unlock(&outbound_mutex);
+
+    pthread_join(delivery_thread, NULL);
+    io_engine_destroy(&engine);
+
+    for (int i = 0; i < queue_count; i++) {
+        free_queue(queues[i]);
+        queues[i] = NULL;
+    }
+    queue_count = 0;
+}
+
+void outbound_report(unsigned long long moves, FILE *out) {
+    io_engine_report(&engine, "Outbound", moves, out);
+
+    pthread_mutex_lock(&outbound_mutex);
+    fprintf(out, "  queues: %zu bytes per client, at most %d messages and %d bytes of text per client id\n",
+            sizeof(OutboundQueue), OUTBOUND_QUEUE_CAPACITY, OUTBOUND_QUEUE_BYTES);
+    for (int i = 0; i < queue_count; i++) {
+        const OutboundQueue *queue = queues[i];
+        if (queue == NULL) {
+            continue;
+        }
+        char lanes[32] = "";
+        if (queue->lanes > 0) {
+            snprintf(lanes, sizeof(lanes), " (+%d lanes)", queue->lanes);
+        }
+        fprintf(out, "  client %d%s: delivered %llu, acknowledged %llu, max backlog %d (%d bytes), stalls %llu, "
+                     "coalesced %llu, dropped %llu%s\n",
+                i, lanes, queue->delivered, queue->acked, queue->max_backlog, queue->max_bytes, queue->stalls,
+                queue->coalesced, queue->dropped, queue->cut_off ? ", cut off" : "");
+    }
+    pthread_mutex_unlock(&outbound_mutex);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdio.h>
+#include <semaphore.h>
+#include "config.h"
+
+// Per-client ordered outbound queues. The server thread only enqueues and
+// never blocks; a delivery thread writes the queue heads to non-blocking
+// FIFOs and posts sem_response, and the client's sem_continue
+// acknowledgements are collected asynchronously. A full FIFO holds its
+// queue back without holding up anyone else's.
+
+// What happens when a client falls behind
+typedef enum {
+    // Players need every message, so a player more than OUTBOUND_MAX_LAG
+    // messages behind, or whose queue is full, is cut off
+    OUTBOUND_DISCONNECT,
+    // Watchers only need to stay roughly current: a BOARD_STATE snapshot
+    // replaces a queued one of the same board, and a full queue drops its
+    // oldest updates. The hashes in later messages reveal the gap, and the
+    // client asks for a resync.
+    OUTBOUND_COALESCE
+} OutboundPolicy;
+
+typedef struct {
+    int fd; // Opened non-blocking
+    sem_t *sem_response;
+    sem_t *sem_continue;
+    OutboundPolicy policy;
+} OutboundChannel;
+
+void outbound_start(void);
+
+// Register a client channel and allocate its queue
+int outbound_add_channel(int client_id, const OutboundChannel *channel);
+
+// Lets one more client id share client_id's channel. Its messages go into
+// the channel's queue, which grows by the room and lag allowance of a queue
+// of its own, so a lane is cut off no sooner than a client with a FIFO.
+int outbound_add_lane(int client_id);
+
+// Append a message to the client's queue. Returns 0 when it was queued, 1
+// when the policy dropped it, and -1 when the client is cut off.
+int outbound_enqueue(int client_id, const char *message);
+
+// Stores the clients cut off since the last call in client_ids and returns
+// how many there are
+int outbound_take_cut_off(int client_ids[MAX_CLIENTS]);
+
+// Wait until every queued message is written and acknowledged, or the
+// timeout expires; returns 0 when everything was acknowledged
+int outbound_drain(int timeout_ms);
+
+void outbound_stop(void);
+
+void outbound_report(unsigned long long moves, FILE *out);
@@ -0,0 +1,257 @@
+#include "perf-counters.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+int perf_profiling = 0;
+
+static const struct {
+    uint64_t config;
+    const char *name;
+} counter_kinds[PERF_COUNTER_COUNT] = {
+    {PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_COUNT_HW_CACHE_MISSES, "cache misses"},
+    {PERF_COUNT_HW_BRANCH_MISSES, "branch misses"},
+};
+
+static const char *region_names[PERF_REGION_COUNT] = {
+    "attack", "attack batch", "place_ship_c", "SEND_BOARD decode", "message parse", "print_boards",
+};
+
+typedef struct {
+    atomic_ullong calls;
+    atomic_ullong ns;
+    atomic_ullong counted; // Calls during which the counters were running
+    atomic_ullong counts[PERF_COUNTER_COUNT];
+} RegionTotals;
+
+// One thread's counter group; the counters only count the thread that
+// opened them
+typedef struct {
+    int state; // 0 not tried yet, 1 open, -1 unavailable
+    int leader;
+    int fds[PERF_COUNTER_COUNT];
+    int slot[PERF_COUNTER_COUNT]; // Position in the group read, -1 when missing
+    int opened;
+} ThreadCounters;
+
+static RegionTotals totals[PERF_REGION_COUNT];
+static __thread ThreadCounters thread_counters;
+static atomic_int counter_missing[PERF_COUNTER_COUNT]; // Some thread could not open it
+static atomic_int open_error; // errno of the first failed open
+static char profile_role[64];
+static volatile sig_atomic_t report_requested = 0;
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int exit_report_installed = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void open_thread_counters(ThreadCounters *counters) {
+    counters->state = -1;
+    counters->leader = -1;
+    counters->opened = 0;
+    for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = counter_kinds[k].config;
+        attr.exclude_kernel = 1; // Allowed at the default perf_event_paranoid
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, counters->leader, PERF_FLAG_FD_CLOEXEC);
+        counters->fds[k] = fd;
+        counters->slot[k] = -1;
+        if (fd == -1) {
+            int expected = 0;
+            atomic_compare_exchange_strong(&open_error, &expected, errno);
+            atomic_store(&counter_missing[k], 1);
+            continue;
+        }
+        if (counters->leader == -1) {
+            counters->leader = fd;
+        }
+        counters->slot[k] = counters->opened++;
+    }
+    if (counters->opened > 0) {
+        counters->state = 1;
+    }
+}
+
+static void close_thread_counters(ThreadCounters *counters) {
+    for (int k = 0; counters->state == 1 && k < PERF_COUNTER_COUNT; k++) {
+        if (counters->fds[k] != -1) {
+            close(counters->fds[k]);
+        }
+    }
+    counters->state = 0;
+}
+
+// One read() returns the whole group, so the counters agree with each other
+static int read_counters(const ThreadCounters *counters, uint64_t values[PERF_COUNTER_COUNT], uint64_t *running) {
+    uint64_t group[3 + PERF_COUNTER_COUNT]; // nr, time enabled, time running, values
+    ssize_t expected = (ssize_t)((3 + (size_t)counters->opened) * sizeof(uint64_t));
+    if (read(counters->leader, group, sizeof(group)) != expected) {
+        return -1;
+    }
+    for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+        values[k] = counters->slot[k] >= 0 ? group[3 + counters->slot[k]] : 0;
+    }
+    *running = group[2];
+    return 0;
+}
+
+void perf_sample_begin(PerfSample *sample) {
+    ThreadCounters *counters = &thread_counters;
+    if (counters->state == 0) {
+        open_thread_counters(counters);
+    }
+    sample->start_ns = now_ns();
+    if (counters->state != 1 || read_counters(counters, sample->values, &sample->running_ns) != 0) {
+        sample->running_ns = UINT64_MAX; // Timed only
+    }
+}
+
+void perf_sample_end(PerfRegion region, PerfSample *sample) {
+    uint64_t values[PERF_COUNTER_COUNT], running = 0;
+    int counted = sample->running_ns != UINT64_MAX &&
+                  read_counters(&thread_counters, values, &running) == 0 && running > sample->running_ns;
+    uint64_t elapsed = now_ns() - sample->start_ns;
+
+    RegionTotals *total = &totals[region];
+    atomic_fetch_add_explicit(&total->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&total->ns, elapsed, memory_order_relaxed);
+    if (counted) {
+        atomic_fetch_add_explicit(&total->counted, 1, memory_order_relaxed);
+        for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+            atomic_fetch_add_explicit(&total->counts[k], values[k] - sample->values[k], memory_order_relaxed);
+        }
+    }
+    if (report_requested) {
+        perf_profile_poll();
+    }
+}
+
+static void request_report(int signal_number) {
+    (void)signal_number;
+    report_requested = 1;
+}
+
+static void report_at_exit(void) {
+    if (perf_profiling) {
+        perf_profile_report(stdout);
+    }
+}
+
+void perf_profile_init(const char *role) {
+    const char *text = getenv("BATTLESHIP_PERF");
+    perf_profiling = text != NULL && atoi(text) > 0;
+    if (!perf_profiling) {
+        return;
+    }
+
+    // A forked child inherits the parent's totals and the forking thread's
+    // counters, which go on counting the parent
+    close_thread_counters(&thread_counters);
+    for (int region = 0; region < PERF_REGION_COUNT; region++) {
+        atomic_store(&totals[region].calls, 0);
+        atomic_store(&totals[region].ns, 0);
+        atomic_store(&totals[region].counted, 0);
+        for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+            atomic_store(&totals[region].counts[k], 0);
+        }
+    }
+    for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+        atomic_store(&counter_missing[k], 0);
+    }
+    atomic_store(&open_error, 0);
+    snprintf(profile_role, sizeof(profile_role), "%s %d", role, (int)getpid());
+
+    if (!exit_report_installed) {
+        atexit(report_at_exit);
+        exit_report_installed = 1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_report;
+    // No SA_RESTART: an idle wait has to come back with EINTR so the report
+    // is written now rather than when the next message arrives
+    action.sa_flags = 0;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, NULL);
+}
+
+void perf_profile_poll(void) {
+    if (report_requested) {
+        report_requested = 0;
+        perf_profile_report(stdout);
+    }
+}
+
+// Average per counted call, or "-" when the counter is missing
+static void print_per_call(FILE *out, int width, unsigned long long count, unsigned long long calls, int missing) {
+    if (missing || calls == 0) {
+        fprintf(out, " %*s", width, "-");
+    } else {
+        fprintf(out, " %*.1f", width, (double)count / (double)calls);
+    }
+}
+
+void perf_profile_report(FILE *out) {
+    pthread_mutex_lock(&report_mutex);
+    int missing[PERF_COUNTER_COUNT], any_counter = 0;
+    for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+        missing[k] = atomic_load(&counter_missing[k]);
+        any_counter |= !missing[k];
+    }
+    int error = atomic_load(&open_error);
+    if (!any_counter) {
+        fprintf(out, "Hardware counters (%s): unavailable (%s), regions are timed only\n", profile_role,
+                strerror(error != 0 ? error : ENOTSUP));
+    } else {
+        fprintf(out, "Hardware counters (%s):", profile_role);
+        for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+            fprintf(out, "%s %s%s", k > 0 ? "," : "", counter_kinds[k].name, missing[k] ? " (unavailable)" : "");
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "  %-18s %10s %10s %11s %6s %12s %13s\n", "region", "calls", "ns/call", "cycles/call", "IPC",
+            "cache misses", "branch misses");
+    for (int region = 0; region < PERF_REGION_COUNT; region++) {
+        const RegionTotals *total = &totals[region];
+        unsigned long long calls = atomic_load(&total->calls);
+        if (calls == 0) {
+            continue;
+        }
+        unsigned long long counted = atomic_load(&total->counted);
+        unsigned long long counts[PERF_COUNTER_COUNT];
+        for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+            counts[k] = atomic_load(&total->counts[k]);
+        }
+        fprintf(out, "  %-18s %10llu %10.1f", region_names[region], calls,
+                (double)atomic_load(&total->ns) / (double)calls);
+        print_per_call(out, 11, counts[PERF_COUNTER_CYCLES], counted, missing[PERF_COUNTER_CYCLES]);
+        if (missing[PERF_COUNTER_CYCLES] || missing[PERF_COUNTER_INSTRUCTIONS] || counts[PERF_COUNTER_CYCLES] == 0) {
+            fprintf(out, " %6s", "-");
+        } else {
+            fprintf(out, " %6.2f", (double)counts[PERF_COUNTER_INSTRUCTIONS] / (double)counts[PERF_COUNTER_CYCLES]);
+        }
+        print_per_call(out, 12, counts[PERF_COUNTER_CACHE_MISSES], counted, missing[PERF_COUNTER_CACHE_MISSES]);
+        print_per_call(out, 13, counts[PERF_COUNTER_BRANCH_MISSES], counted, missing[PERF_COUNTER_BRANCH_MISSES]);
+        fprintf(out, "\n");
+    }
+    fflush(out);
+    pthread_mutex_unlock(&report_mutex);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Opt-in profiling of named hot-path regions with the CPU's own counters.
+// BATTLESHIP_PERF=1 makes every thread open cycles, instructions, cache
+// misses and branch misses with perf_event_open the first time it enters a
+// region; each region adds what its calls used to a process-wide total. The
+// totals are printed at exit and whenever the process gets SIGUSR2. Without
+// counters (no permission, no PMU, a container) the regions are only timed,
+// and a counter the CPU lacks is left out. When profiling is off a region
+// costs one predictable branch.
+
+typedef enum {
+    PERF_REGION_ATTACK,        // attack() and attack_salvo()
+    PERF_REGION_ATTACK_BATCH,  // The server's batch kernel over the match table
+    PERF_REGION_PLACE_SHIP,    // place_ship_c()
+    PERF_REGION_DECODE_BOARD,  // SEND_BOARD: validation and decoding of the cells
+    PERF_REGION_PARSE_MESSAGE, // Splitting frames out of what was read
+    PERF_REGION_PRINT_BOARDS,  // print_boards() and its variants
+    PERF_REGION_COUNT
+} PerfRegion;
+
+typedef enum {
+    PERF_COUNTER_CYCLES,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_CACHE_MISSES,
+    PERF_COUNTER_BRANCH_MISSES,
+    PERF_COUNTER_COUNT
+} PerfCounter;
+
+typedef struct {
+    int active;
+    uint64_t start_ns;
+    uint64_t running_ns; // Time the counters were scheduled on the CPU
+    uint64_t values[PERF_COUNTER_COUNT];
+} PerfSample;
+
+// Set by perf_profile_init() before any thread starts
+extern int perf_profiling;
+
+// Reads BATTLESHIP_PERF and names the process in the report. A forked child
+// calls it again to start its own totals.
+void perf_profile_init(const char *role);
+
+void perf_sample_begin(PerfSample *sample);
+
+void perf_sample_end(PerfRegion region, PerfSample *sample);
+
+static inline void perf_begin(PerfSample *sample) {
+    sample->active = perf_profiling;
+    if (__builtin_expect(sample->active, 0)) {
+        perf_sample_begin(sample);
+    }
+}
+
+static inline void perf_end(PerfRegion region, PerfSample *sample) {
+    if (__builtin_expect(sample->active, 0)) {
+        perf_sample_end(region, sample);
+    }
+}
+
+// Prints the report if SIGUSR2 asked for one; for loops that may sleep
+// through a signal without entering a region
+void perf_profile_poll(void);
+
+void perf_profile_report(FILE *out);
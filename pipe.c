@@ -82,6 +82,19 @@ int pipe_open_write(const char *path) {
     return fd;
 }
 
+// Writes fail with EAGAIN instead of blocking once the FIFO is full
+int pipe_open_write_nonblocking(const char *path) {
+    int fd;
+
+    fd = open(path, O_RDWR | O_NONBLOCK);
+    if (fd == -1) {
+        perror("Failed to open FIFO for writing");
+        return -1;
+    }
+
+    return fd;
+}
+
 
 void pipe_close(const int fd) {
   if (close(fd) == -1) {
@@ -0,0 +1,94 @@
+#include "prior-table.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Same word-wise FNV-1a as the handoff snapshots
+static uint64_t checksum(const unsigned char *data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t prior_file_checksum(const PriorTable *tables, uint32_t table_count) {
+    return checksum((const unsigned char *)tables, (size_t)table_count * sizeof(PriorTable));
+}
+
+int prior_file_open(PriorFile *file, const char *path) {
+    memset(file, 0, sizeof(*file));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("Failed to open the prior tables");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(PriorFileHeader)) {
+        fprintf(stderr, "%s is too short for prior tables\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)info.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map the prior tables");
+        return -1;
+    }
+
+    const PriorFileHeader *header = map;
+    const char *problem = NULL;
+    if (memcmp(header->magic, PRIOR_FILE_MAGIC, sizeof(header->magic)) != 0) {
+        problem = "is not a prior table file";
+    } else if (header->version != PRIOR_FILE_VERSION || header->table_size != sizeof(PriorTable)) {
+        problem = "was written by another version";
+    } else if (size != sizeof(PriorFileHeader) + (size_t)header->table_count * sizeof(PriorTable)) {
+        problem = "is truncated";
+    } else if (prior_file_checksum((const PriorTable *)(header + 1), header->table_count) != header->checksum) {
+        problem = "failed its checksum";
+    }
+    if (problem != NULL) {
+        fprintf(stderr, "%s %s\n", path, problem);
+        munmap(map, size);
+        return -1;
+    }
+
+    file->header = header;
+    file->tables = (const PriorTable *)(header + 1);
+    file->size = size;
+    return 0;
+}
+
+void prior_file_close(PriorFile *file) {
+    if (file->header != NULL) {
+        munmap((void *)file->header, file->size);
+    }
+    memset(file, 0, sizeof(*file));
+}
+
+const PriorTable *prior_file_find(const PriorFile *file, int board_size, const Fleet *fleet) {
+    for (uint32_t i = 0; file->header != NULL && i < file->header->table_count; i++) {
+        const PriorTable *table = &file->tables[i];
+        if (table->board_size != (uint32_t)board_size) {
+            continue;
+        }
+        int same = fleet == NULL || table->ship_count == FLEET_SIZE;
+        for (int k = 0; same && fleet != NULL && k < FLEET_SIZE; k++) {
+            same = table->lengths[k] == fleet->ships[k].size;
+        }
+        if (same) {
+            return table;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+#include "game-logic.h"
+
+// Precomputed opening priors for bots, written offline by make-priors and
+// mapped read-only by every bot on the host. The file holds one table per
+// board size and fleet: how many placements of each ship cover every cell,
+// the chance of a ship in every cell before the first shot (counted over
+// every layout, and blended with the placements seen in played games when
+// make-priors is given history-query priors), every legal placement with
+// its halo, and an opening shot order. Opening the file
+// checks its size, version and checksum and copies nothing, so a bot pays a
+// few page faults for it and the pages are shared through the page cache.
+//
+// Bots only play on BOARD_SIZE boards with the standard fleet (classic and
+// salvo share it), so that is the only table make-priors writes today; the
+// directory leaves room for more. This file only reads tables, so a bot
+// plugin can be built with it alone.
+
+#define PRIOR_FILE_MAGIC "BSPRIORS"
+#define PRIOR_FILE_VERSION 2
+#define PRIOR_CELLS (BOARD_SIZE * BOARD_SIZE)
+#define PRIOR_MAX_PLACEMENTS (2 * PRIOR_CELLS)
+
+// A ship in one position; cell (x, y) is bit y * BOARD_SIZE + x of the
+// 128-bit masks, stored as low and high words
+typedef struct {
+    uint64_t ship[2];
+    uint64_t halo[2]; // The ship and every cell around it; no other ship may enter
+    uint8_t x;
+    uint8_t y;
+    uint8_t orientation; // 'H' or 'V'
+    uint8_t unused[5];
+} PriorPlacement;
+
+typedef struct {
+    uint32_t board_size;
+    uint32_t ship_count;
+    uint8_t lengths[FLEET_SIZE]; // In Fleet order
+    uint8_t exact;               // 0 when probability was estimated from samples
+    uint8_t unused[2];
+    uint64_t layouts;            // Fleet layouts behind probability
+    uint64_t observed_games;     // Played games blended into probability, 0 for none
+    uint32_t cover[FLEET_SIZE][PRIOR_CELLS]; // Placements of each ship covering each cell
+    float probability[PRIOR_CELLS];         // Chance of a ship per cell on an untouched board
+    uint64_t halo[PRIOR_CELLS][2];          // Each cell and its eight neighbours
+    uint8_t opening[PRIOR_CELLS];           // Cells by falling probability, one parity class first
+    uint32_t placement_count[FLEET_SIZE];
+    PriorPlacement placements[FLEET_SIZE][PRIOR_MAX_PLACEMENTS];
+} PriorTable;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t table_size; // sizeof(PriorTable) of the writer
+    uint32_t table_count;
+    uint32_t unused;
+    uint64_t checksum;   // Over the tables
+} PriorFileHeader;
+
+typedef struct {
+    const PriorFileHeader *header;
+    const PriorTable *tables;
+    size_t size;
+} PriorFile;
+
+uint64_t prior_file_checksum(const PriorTable *tables, uint32_t table_count);
+
+// Maps the file read-only; returns 0 on success and -1 when it is missing,
+// truncated, from another version or fails its checksum
+int prior_file_open(PriorFile *file, const char *path);
+
+void prior_file_close(PriorFile *file);
+
+// The table for a board size and fleet, any fleet when fleet is NULL, or
+// NULL when the file has none
+const PriorTable *prior_file_find(const PriorFile *file, int board_size, const Fleet *fleet);
+
+static inline int prior_mask_test(const uint64_t mask[2], int cell) {
+    return (int)((mask[cell >> 6] >> (cell & 63)) & 1);
+}
@@ -0,0 +1,376 @@
+#define _GNU_SOURCE // sched_setaffinity() and the CPU_SET macros
+#include "router.h"
+#include "communication.h"
+#include "pipe.h"
+#include "server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROUTER_GENERATIONS 8 // Retired generations of a worker still tracked while they finish
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+typedef struct {
+    const char *name;
+    GameVariant variant;
+    int seats_per_match;
+    RouterWorker workers[ROUTER_MAX_WORKERS];
+    int worker_count;
+    int node_count; // NUMA nodes; workers are pinned only when there are several
+    int read_fd;
+    int write_fd;
+    sem_t *sem_command;
+    int next_match_id;
+    int open_match_id; // Match whose seats are being handed out, -1 when none
+    int open_seats;
+    int open_worker;
+    unsigned long long connects;
+    unsigned long long unanswered; // The client gave up before its route was sent
+    pid_t pids[ROUTER_MAX_WORKERS][ROUTER_GENERATIONS]; // Per worker, its recent generations
+} Router;
+
+// splitmix64's finalizer: consecutive match ids spread evenly over workers
+static uint64_t mix_match_id(uint64_t id) {
+    id = (id ^ (id >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    id = (id ^ (id >> 27)) * 0x94D049BB133111EBULL;
+    return id ^ (id >> 31);
+}
+
+static int count_numa_nodes(void) {
+    int count = 0;
+    char path[BUFFER_SIZE];
+    while (count < ROUTER_MAX_WORKERS) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", count);
+        if (access(path, R_OK) != 0) {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+// Restricts the calling process to the CPUs of a node, read from a list
+// like "0-3,8-11"
+static int pin_to_node(int node) {
+    char path[BUFFER_SIZE], list[BUFFER_SIZE];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    int read_ok = fgets(list, sizeof(list), file) != NULL;
+    fclose(file);
+    if (!read_ok) {
+        return -1;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    char *cursor = list;
+    while (*cursor != '\0' && *cursor != '\n') {
+        char *end;
+        long first = strtol(cursor, &end, 10);
+        long last = first;
+        if (end == cursor) {
+            break;
+        }
+        if (*end == '-') {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET((int)cpu, &cpus);
+        }
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    if (CPU_COUNT(&cpus) == 0 || sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+static sem_t *open_semaphore(const char *template, const char *name) {
+    char sem_name[BUFFER_SIZE];
+    snprintf(sem_name, sizeof(sem_name), template, name);
+    sem_unlink(sem_name);
+    sem_t *sem = sem_open(sem_name, O_CREAT | O_EXCL, 0666, 0);
+    if (sem == SEM_FAILED) {
+        perror("Failed to create semaphore");
+    }
+    return sem;
+}
+
+static void wait_for_semaphore(sem_t *sem, int timeout_ms, int *result) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while ((*result = sem_timedwait(sem, &deadline)) == -1 && errno == EINTR && !stop_requested) {
+    }
+}
+
+// Forks a worker the way a client starts a server: it posts the connect
+// semaphore once it listens on its FIFO
+static int start_worker(Router *router, int index) {
+    RouterWorker *worker = &router->workers[index];
+    snprintf(worker->name, sizeof(worker->name), ROUTER_WORKER_TEMPLATE, router->name, index, worker->generation);
+    worker->seats = 0;
+    char sem_connect_name[BUFFER_SIZE];
+    snprintf(sem_connect_name, sizeof(sem_connect_name), SEM_CONNECT_TEMPLATE, worker->name);
+    mode_t old_umask = umask(0);
+    sem_t *sem_connect = open_semaphore(SEM_CONNECT_TEMPLATE, worker->name);
+    umask(old_umask);
+    if (sem_connect == SEM_FAILED) {
+        return -1;
+    }
+
+    fflush(stdout); // Or the child prints our buffered output again
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Failed to start a worker");
+        sem_close(sem_connect);
+        return -1;
+    }
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        close(router->read_fd);
+        close(router->write_fd);
+        sem_close(router->sem_command);
+        if (worker->node >= 0 && pin_to_node(worker->node) == -1) {
+            fprintf(stderr, "Worker %s could not be pinned to node %d.\n", worker->name, worker->node);
+        }
+        set_server_variant(&router->variant);
+        set_server_persistent(1);
+        run_server(worker->name);
+        exit(EXIT_SUCCESS);
+    }
+
+    int result;
+    wait_for_semaphore(sem_connect, CONNECT_TIMEOUT_MS, &result);
+    sem_close(sem_connect);
+    sem_unlink(sem_connect_name);
+    if (result == -1) {
+        fprintf(stderr, "Worker %s did not start within %d ms.\n", worker->name, CONNECT_TIMEOUT_MS);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    worker->pid = pid;
+    worker->starts++;
+    router->pids[index][worker->generation % ROUTER_GENERATIONS] = pid;
+    printf("Worker %s started with PID %d%s.\n", worker->name, (int)pid, worker->node >= 0 ? " (pinned)" : "");
+    return 0;
+}
+
+// Notes workers that have exited; those that crashed lost only their own
+// matches. A retired generation exits on its own once its matches are over.
+static void reap_workers(Router *router) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < router->worker_count; i++) {
+            RouterWorker *worker = &router->workers[i];
+            int generation = -1;
+            for (int g = 0; g < ROUTER_GENERATIONS; g++) {
+                if (router->pids[i][g] == pid) {
+                    generation = g;
+                    router->pids[i][g] = 0;
+                }
+            }
+            if (generation == -1) {
+                continue;
+            }
+            if (WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0)) {
+                worker->crashes++;
+                printf("Worker %s crashed (%s %d); its matches are lost.\n", worker->pid == pid ? worker->name : "retired",
+                       WIFSIGNALED(status) ? "signal" : "status",
+                       WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+            }
+            if (worker->pid != pid) {
+                continue;
+            }
+            worker->pid = 0;
+            worker->generation++;
+            if (router->open_match_id >= 0 && router->open_worker == i) {
+                router->open_match_id = -1; // Its seated clients went with it
+            }
+        }
+    }
+}
+
+// Asks a worker to exit once its matches are over
+static void drain_worker(const RouterWorker *worker) {
+    char fifo[BUFFER_SIZE], sem_name[BUFFER_SIZE];
+    snprintf(fifo, sizeof(fifo), SERVER_READ_FIFO_TEMPLATE, worker->name);
+    snprintf(sem_name, sizeof(sem_name), SEM_COMMAND_TEMPLATE, worker->name);
+    int fd = open(fifo, O_WRONLY | O_NONBLOCK);
+    sem_t *sem = sem_open(sem_name, O_RDWR);
+    if (fd != -1 && sem != SEM_FAILED && send_message(fd, DRAIN_REQUEST) == 0) {
+        sem_post(sem);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (sem != SEM_FAILED) {
+        sem_close(sem);
+    }
+}
+
+// The worker for the next seat: every seat of a match goes to the worker its
+// id hashes to. The worker seats its clients in the order they arrive, so
+// two matches routed to it at once may be paired differently than here;
+// either way all of them are played on that worker.
+static RouterWorker *route_seat(Router *router) {
+    if (router->open_match_id < 0) {
+        router->open_match_id = router->next_match_id++;
+        router->open_seats = 0;
+        router->open_worker = (int)(mix_match_id((uint64_t)router->open_match_id) % (uint64_t)router->worker_count);
+        router->workers[router->open_worker].matches++;
+    }
+    RouterWorker *worker = &router->workers[router->open_worker];
+    if (router->open_seats == 0 && worker->pid != 0 && worker->seats + router->seats_per_match > MAX_CLIENTS) {
+        drain_worker(worker);
+        worker->pid = 0;
+        worker->generation++;
+    }
+    if (worker->pid == 0 && start_worker(router, router->open_worker) == -1) {
+        router->open_match_id = -1;
+        return NULL;
+    }
+    worker->seats++;
+    if (++router->open_seats == router->seats_per_match) {
+        router->open_match_id = -1;
+    }
+    return worker;
+}
+
+// CONNECT_<pid>[_<ticket>] is answered on the client's reply FIFO, a bare
+// CONNECT on the shared server FIFO
+static void route_connect(Router *router, const char *message) {
+    router->connects++;
+    int pid;
+    int reply_fd = -1;
+    if (sscanf(message, "CONNECT_%d", &pid) == 1) {
+        char reply_fifo[BUFFER_SIZE];
+        snprintf(reply_fifo, sizeof(reply_fifo), CONNECT_FIFO_TEMPLATE, router->name, pid);
+        reply_fd = open(reply_fifo, O_WRONLY | O_NONBLOCK);
+        if (reply_fd == -1) {
+            router->unanswered++;
+            return;
+        }
+    }
+
+    char reply[BUFFER_SIZE];
+    RouterWorker *worker = route_seat(router);
+    if (worker == NULL) {
+        snprintf(reply, sizeof(reply), "REJECT");
+    } else {
+        worker->routed++;
+        snprintf(reply, sizeof(reply), ROUTE_PREFIX "%s", worker->name);
+    }
+    send_message(reply_fd != -1 ? reply_fd : router->write_fd, reply);
+    if (reply_fd != -1) {
+        close(reply_fd);
+    }
+}
+
+static void drain_workers(Router *router) {
+    for (int i = 0; i < router->worker_count; i++) {
+        if (router->workers[i].pid != 0) {
+            drain_worker(&router->workers[i]);
+        }
+    }
+}
+
+static void report_router(const Router *router, FILE *out) {
+    fprintf(out, "Router %s: %llu connects, %llu unanswered, %d matches over %d workers\n", router->name,
+            router->connects, router->unanswered, router->next_match_id, router->worker_count);
+    for (int i = 0; i < router->worker_count; i++) {
+        const RouterWorker *worker = &router->workers[i];
+        fprintf(out, "  worker %d (%s): %llu matches, %llu clients, %llu starts, %llu crashes%s\n", i, worker->name, worker->matches,
+                worker->routed, worker->starts, worker->crashes, worker->pid != 0 ? ", running" : "");
+    }
+}
+
+void run_router(const char *server_name, int worker_count, const GameVariant *variant) {
+    Router router;
+    memset(&router, 0, sizeof(router));
+    router.name = server_name;
+    router.variant = *variant;
+    router.seats_per_match = variant->mode == GAME_MODE_FFA ? variant->players : 2;
+    router.worker_count = worker_count < 1 ? 1 : (worker_count > ROUTER_MAX_WORKERS ? ROUTER_MAX_WORKERS : worker_count);
+    router.node_count = count_numa_nodes();
+    router.open_match_id = -1;
+    for (int i = 0; i < router.worker_count; i++) {
+        snprintf(router.workers[i].name, sizeof(router.workers[i].name), ROUTER_WORKER_TEMPLATE, server_name, i, 0u);
+        router.workers[i].node = router.node_count > 1 ? i % router.node_count : -1;
+    }
+
+    char server_read_fifo[BUFFER_SIZE], server_write_fifo[BUFFER_SIZE];
+    snprintf(server_read_fifo, sizeof(server_read_fifo), SERVER_READ_FIFO_TEMPLATE, server_name);
+    snprintf(server_write_fifo, sizeof(server_write_fifo), SERVER_WRITE_FIFO_TEMPLATE, server_name);
+    mode_t old_umask = umask(0);
+    router.sem_command = open_semaphore(SEM_COMMAND_TEMPLATE, server_name);
+    initialize_fifo(server_read_fifo);
+    initialize_fifo(server_write_fifo);
+    umask(old_umask);
+    router.read_fd = pipe_open_read(server_read_fifo);
+    router.write_fd = pipe_open_write(server_write_fifo);
+    if (router.sem_command == SEM_FAILED || router.read_fd == -1 || router.write_fd == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Router %s is ready: %d workers, %d NUMA nodes.\n", server_name, router.worker_count, router.node_count);
+
+    // Wake up once a tick without commands to notice workers that exited
+    MessageReader reader;
+    message_reader_init(&reader, router.read_fd);
+    while (!stop_requested) {
+        int result;
+        wait_for_semaphore(router.sem_command, TURN_CLOCK_TICK_MS, &result);
+        reap_workers(&router);
+        char buffer[BUFFER_SIZE];
+        if (result == 0 && message_reader_next(&reader, buffer, sizeof(buffer)) == 0 &&
+            strncmp(buffer, "CONNECT", 7) == 0) {
+            route_connect(&router, buffer);
+        }
+    }
+
+    drain_workers(&router);
+    report_router(&router, stdout);
+    close(router.read_fd);
+    close(router.write_fd);
+    sem_close(router.sem_command);
+    char sem_command_name[BUFFER_SIZE];
+    snprintf(sem_command_name, sizeof(sem_command_name), SEM_COMMAND_TEMPLATE, server_name);
+    sem_unlink(sem_command_name);
+    unlink(server_read_fifo);
+    unlink(server_write_fifo);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <sys/types.h>
+#include "config.h"
+#include "game-logic.h"
+
+// Front router. It owns the public endpoint of a server name, the server
+// FIFO and command semaphore, and runs no matches itself: every CONNECT is
+// answered with ROUTE_<worker>, the name of the worker server that hosts
+// the client's match, and the client then connects to that worker and talks
+// to it directly. Match ids are hashed to workers, so all seats of a match
+// land on the same one. Workers are forked server processes that start on
+// first use; one that crashes takes only its own matches with it and is
+// started again for the next match routed to it. A server hands out each
+// client id once, so a worker that has seated MAX_CLIENTS clients is retired:
+// it finishes its matches and exits, and the next generation takes its place
+// under a new name.
+
+#define ROUTER_MAX_WORKERS 64
+#define ROUTE_PREFIX "ROUTE_"
+#define DRAIN_REQUEST "DRAIN" // Sent to a worker: exit once the last match ends
+
+typedef struct {
+    char name[BUFFER_SIZE]; // Of the current generation
+    unsigned int generation;
+    int seats; // Routed to the current generation
+    pid_t pid; // 0 while not running
+    int node;  // NUMA node it is pinned to, -1 when not pinned
+    unsigned long long routed; // Clients sent to it
+    unsigned long long matches;
+    unsigned long long starts;
+    unsigned long long crashes; // Exits on a signal or with a failure status, retired generations included
+} RouterWorker;
+
+// Routes CONNECTs for server_name to worker_count workers playing variant,
+// until SIGINT or SIGTERM; the workers are then told to drain
+void run_router(const char *server_name, int worker_count, const GameVariant *variant);
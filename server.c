@@ -3,17 +3,143 @@
 #include "communication.h"
 #include "game-logic.h"
 #include "config.h"
+#include "io-engine.h"
+#include "outbound.h"
+#include "free-for-all.h"
+#include "match.h"
+#include "bot-runner.h"
+#include "fleet-validation.h"
+#include "timer-wheel.h"
+#include "history.h"
+#include "admission.h"
+#include "handoff.h"
+#include "match-table.h"
+#include "spill-file.h"
+#include "router.h"
+#include "leaderboard.h"
+#include "board-view.h"
+#include "perf-counters.h"
+#include "wait-strategy.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <errno.h>
+#include <time.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <sys/types.h>
 
 static pthread_mutex_t game_mutex = PTHREAD_MUTEX_INITIALIZER;
-static GameData game_data = {0};
+static GameVariant server_variant = {GAME_MODE_CLASSIC, 0, 2, BOARD_SIZE};
+
+// Matches and sessions come from the slab pools in match.c
+static ClientSession *sessions[MAX_CLIENTS];
+static Match *live_matches[MAX_CLIENTS];
+static int live_match_count = 0;
+static Match *open_match = NULL; // Match still waiting for players
+static int next_match_id = 0;
+static int persistent = 0; // A router's worker outlives its matches until drained
+static int draining = 0;   // Set once drained: no new match is opened
+
+// Optional bot that takes the second seat of every two-player match
+static BotRunner server_bot;
+static const char *server_bot_path = NULL;
+static FleetRules fleet_rules; // What every uploaded board must hold
+
+// Turn clocks of every match share one wheel, advanced by the command loop
+static TimerWheel turn_clocks;
+static struct timespec clock_origin;
+static int move_limit_ms = DEFAULT_MOVE_LIMIT_MS;
+static int game_limit_ms = DEFAULT_GAME_LIMIT_MS;
+static const char *clock_server_name; // For the messages sent on expiry
+static sem_t *server_ready; // sem_connect of the client that started us
+
+// CONNECT requests wait here until the server has no moves to handle.
+// Client ids are not reused, so each one keeps its own FIFO for the
+// lifetime of the server.
+static AdmissionControl admission;
+static unsigned long long last_admission_ms;
+static int connected_clients = 0;
+
+// Finished two-player games go to the store in BATTLESHIP_HISTORY_DIR, if set
+static HistoryWriter history;
+static const char *history_dir = NULL;
+static unsigned long long history_games = 0;
+
+// Elo ratings of the named players, logged to BATTLESHIP_RATINGS_LOG if set.
+// Only the serve thread reads or writes the board, so a query waits on
+// nothing; the log's syncer thread shares just an atomic flag with it.
+static Leaderboard leaderboard;
+static int leaderboard_ready = 0;
+
+// A new server binary takes over through this socket; see hand_off()
+static int handoff_listener = -1;
+
+// Boards of the two-player classic matches in structure-of-arrays form.
+// Attacks that arrive together are queued and resolved in one batch.
+typedef struct {
+    ClientSession *session;
+    int x;
+    int y;
+} QueuedAttack;
+
+static MatchTable board_table;
+static QueuedAttack queued_attacks[MATCH_TABLE_BATCH];
+static int queued_attack_count = 0;
+static WaitStrategy command_wait; // How the serve loop waits on sem_command
+
+// Full two-player matches nobody has sent a message to for hibernate_ms are
+// compacted into the spill file. A hibernated match keeps only its turn
+// clock in memory and wakes on the next message from one of its clients.
+typedef struct {
+    TimerEntry clock;
+    int in_use;
+} HibernatedMatch;
+
+static int hibernate_ms = DEFAULT_HIBERNATE_MS;
+static SpillFile spill;
+static HibernatedMatch hibernated[MAX_CLIENTS]; // By spill slot
+static int hibernated_slot[MAX_CLIENTS]; // By client id, -1 when awake
+static int hibernated_count = 0;
+static unsigned long long next_sweep_ms;
+static char inherited_bot_path[BUFFER_SIZE]; // The old server's bot, for a takeover
+
+// Descriptors and semaphores opened once per server instead of per message.
+// A lane (see open_lane()) has none of its own: owner names the client whose
+// channel carries its messages, and each client is its own owner.
+typedef struct {
+    int open;
+    int read_fd;
+    int server_write_fd;
+    int client_fds[MAX_CLIENTS];
+    sem_t *sem_response[MAX_CLIENTS];
+    sem_t *sem_continue[MAX_CLIENTS];
+    BoardViewPage *views[MAX_CLIENTS]; // NULL when the page could not be created, and for lanes
+    int owner[MAX_CLIENTS];
+    uid_t source[MAX_CLIENTS]; // Who connected, for admission; a lane has its owner's
+    int client_count; // Client ids with a channel or a lane
+    unsigned long long moves;
+    unsigned long long resyncs; // Boards resent after a hash mismatch
+    unsigned long long rejected_boards;
+    unsigned long long timeouts; // Matches or seats lost on time
+    unsigned long long lagging; // Clients cut off for falling behind
+} ServerChannels;
+
+static ServerChannels channels = {0};
+static IoEngine engine;
+
+void set_server_variant(const GameVariant *variant) {
+    server_variant = *variant;
+}
+
+void set_server_persistent(int value) {
+    persistent = value;
+}
 
 void initialize_semaphore(const char *sem_name, sem_t **sem, int initial_value) {
     sem_unlink(sem_name);
@@ -34,18 +160,14 @@ void initialize_fifo(const char *fifo_name) {
 void initialize_server(const char *server_name) {
     printf("Initializing server: %s...\n", server_name);
 
+    Fleet fleet;
+    initialize_fleet(&fleet);
+    fleet_rules_init(&fleet_rules, &fleet);
+
     // Generate unique semaphore names
     char sem_connect_name[BUFFER_SIZE], sem_command_name[BUFFER_SIZE];
-    char sem_response_client0_name[BUFFER_SIZE], sem_response_client1_name[BUFFER_SIZE];
-    char sem_continue1_name[BUFFER_SIZE], sem_continue2_name[BUFFER_SIZE];
-
     snprintf(sem_connect_name, sizeof(sem_connect_name), SEM_CONNECT_TEMPLATE, server_name);
     snprintf(sem_command_name, sizeof(sem_command_name), SEM_COMMAND_TEMPLATE, server_name);
-    snprintf(sem_response_client0_name, sizeof(sem_response_client0_name), SEM_RESPONSE_TEMPLATE, server_name, 0);
-    snprintf(sem_response_client1_name, sizeof(sem_response_client1_name), SEM_RESPONSE_TEMPLATE, server_name, 1);
-
-    snprintf(sem_continue1_name, sizeof(sem_continue1_name), SEM_CONTINUE_TEMPLATE, server_name, 0);
-    snprintf(sem_continue2_name, sizeof(sem_continue2_name), SEM_CONTINUE_TEMPLATE, server_name, 1);
 
     mode_t old_umask = umask(0);
     // Initialize semaphores
@@ -58,49 +180,256 @@ void initialize_server(const char *server_name) {
 
     sem_t *sem_command;
     initialize_semaphore(sem_command_name, &sem_command, 0);
+    umask(old_umask);
+
+    // Initialize FIFOs; per-client FIFOs are created when a client connects
+    char server_read_fifo[BUFFER_SIZE], server_write_fifo[BUFFER_SIZE];
+    snprintf(server_read_fifo, sizeof(server_read_fifo), SERVER_READ_FIFO_TEMPLATE, server_name);
+    snprintf(server_write_fifo, sizeof(server_write_fifo), SERVER_WRITE_FIFO_TEMPLATE, server_name);
+
+    initialize_fifo(server_read_fifo);
+    initialize_fifo(server_write_fifo);
+
+    printf("Server initialized and ready.\n");
+
+    // Posted by run_server() once it listens on the FIFOs
+    server_ready = sem_connect;
+}
+
+// CONNECT_<pid> is answered on that process's own reply FIFO, which it holds
+// open for reading; a bare CONNECT on the shared server FIFO. Returns -1 for
+// the shared FIFO, or when the client has already given up.
+static int open_connect_reply(const char *server_name, const char *message, int *gone) {
+    int pid;
+    *gone = 0;
+    if (sscanf(message, "CONNECT_%d", &pid) != 1) {
+        return -1;
+    }
+    char reply_fifo[BUFFER_SIZE];
+    snprintf(reply_fifo, sizeof(reply_fifo), CONNECT_FIFO_TEMPLATE, server_name, pid);
+    int fd = open(reply_fifo, O_WRONLY | O_NONBLOCK);
+    *gone = fd == -1;
+    return fd;
+}
+
+static void reply_to_connect(int reply_fd, const char *message) {
+    if (reply_fd == -1) {
+        io_engine_queue(&engine, channels.server_write_fd, message);
+        io_engine_flush(&engine);
+        return;
+    }
+    send_message(reply_fd, message);
+    close(reply_fd);
+}
+
+static sem_t *open_client_semaphore(const char *template, const char *server_name, int client_id) {
+    char sem_name[BUFFER_SIZE];
+    snprintf(sem_name, sizeof(sem_name), template, server_name, client_id);
 
-    sem_t *sem_continue1;
-    initialize_semaphore(sem_continue1_name, &sem_continue1, 0);
+    sem_t *sem;
+    initialize_semaphore(sem_name, &sem, 0);
+
+    sem = sem_open(sem_name, O_RDWR);
+    if (sem == SEM_FAILED) {
+        perror("Failed to open client semaphore");
+        exit(EXIT_FAILURE);
+    }
+    return sem;
+}
 
-    sem_t *sem_continue2;
-    initialize_semaphore(sem_continue2_name, &sem_continue2, 0);
+static void register_client_channel(int client_id);
 
-    sem_t *sem_response_client0;
-    initialize_semaphore(sem_response_client0_name, &sem_response_client0, 0);
+// Create the FIFO and semaphores of a newly connected client; they must exist
+// before the client learns its ID and opens them
+static void open_client_channel(const char *server_name, int client_id) {
+    char client_write_fifo[BUFFER_SIZE];
+    snprintf(client_write_fifo, sizeof(client_write_fifo), CLIENT_READ_FIFO_TEMPLATE, server_name, client_id);
 
-    sem_t *sem_response_client1;
-    initialize_semaphore(sem_response_client1_name, &sem_response_client1, 0);
+    mode_t old_umask = umask(0);
+    initialize_fifo(client_write_fifo);
+    channels.sem_response[client_id] = open_client_semaphore(SEM_RESPONSE_TEMPLATE, server_name, client_id);
+    channels.sem_continue[client_id] = open_client_semaphore(SEM_CONTINUE_TEMPLATE, server_name, client_id);
     umask(old_umask);
 
-    // Initialize FIFOs
-    char server_read_fifo[BUFFER_SIZE], server_write_fifo[BUFFER_SIZE], client_write_fifo1[BUFFER_SIZE],  client_write_fifo2[BUFFER_SIZE];
+    channels.client_fds[client_id] = pipe_open_write_nonblocking(client_write_fifo);
+    channels.views[client_id] = board_view_create(server_name, client_id);
+    register_client_channel(client_id);
+}
+
+static void register_client_channel(int client_id) {
+    channels.owner[client_id] = client_id;
+    OutboundChannel outbound;
+    outbound.fd = channels.client_fds[client_id];
+    outbound.sem_response = channels.sem_response[client_id];
+    outbound.sem_continue = channels.sem_continue[client_id];
+    outbound.policy = OUTBOUND_DISCONNECT; // Every client holds a seat
+    outbound_add_channel(client_id, &outbound);
+
+    if (client_id >= channels.client_count) {
+        channels.client_count = client_id + 1;
+    }
+}
+
+// Lets lane use owner's channel; the lane has no FIFO, semaphores or view
+static void add_lane(int lane, int owner) {
+    channels.owner[lane] = owner;
+    channels.source[lane] = channels.source[owner];
+    channels.client_fds[lane] = -1;
+    channels.sem_response[lane] = NULL;
+    channels.sem_continue[lane] = NULL;
+    channels.views[lane] = NULL;
+    outbound_add_lane(owner);
+
+    if (lane >= channels.client_count) {
+        channels.client_count = lane + 1;
+    }
+}
+
+static void open_server_channels(const char *server_name) {
+    char server_read_fifo[BUFFER_SIZE], server_write_fifo[BUFFER_SIZE];
     snprintf(server_read_fifo, sizeof(server_read_fifo), SERVER_READ_FIFO_TEMPLATE, server_name);
     snprintf(server_write_fifo, sizeof(server_write_fifo), SERVER_WRITE_FIFO_TEMPLATE, server_name);
 
-    snprintf(client_write_fifo1, sizeof(client_write_fifo1), CLIENT_READ_FIFO_TEMPLATE, server_name, 0);
-    snprintf(client_write_fifo2, sizeof(client_write_fifo2), CLIENT_READ_FIFO_TEMPLATE, server_name, 1);
+    channels.read_fd = pipe_open_read(server_read_fifo);
+    channels.server_write_fd = pipe_open_write(server_write_fifo);
+    channels.client_count = 0;
 
-    initialize_fifo(server_read_fifo);
-    initialize_fifo(server_write_fifo);
-    initialize_fifo(client_write_fifo1);
-    initialize_fifo(client_write_fifo2);
+    io_engine_init(&engine, channels.read_fd);
+    outbound_start();
 
-    printf("Server initialized and ready.\n");
+    channels.moves = 0;
+    channels.resyncs = 0;
+    channels.rejected_boards = 0;
+    channels.open = 1;
+
+    char socket_path[BUFFER_SIZE];
+    snprintf(socket_path, sizeof(socket_path), HANDOFF_SOCKET_TEMPLATE, server_name);
+    handoff_listener = handoff_listen(socket_path);
+}
+
+// Takes over the channels of the server we replace: the descriptors came
+// with the handoff and the semaphores are opened again by name. Frames the
+// old server had read but not handled are read first.
+static int adopt_server_channels(const char *server_name, const int *fds, int fd_count, const int *owners,
+                                 int client_count, const char *pending, size_t pending_length) {
+    channels.read_fd = fds[0];
+    channels.server_write_fd = fds[1];
+    channels.client_count = client_count;
+
+    io_engine_init(&engine, channels.read_fd);
+    message_reader_push(&engine.reader, pending, pending_length);
+    outbound_start();
+
+    int next_fd = 2;
+    for (int i = 0; i < client_count; i++) {
+        if (owners[i] != i) {
+            continue; // Lanes follow once their owners' queues exist
+        }
+        if (next_fd == fd_count) {
+            return -1;
+        }
+        char response_name[BUFFER_SIZE], continue_name[BUFFER_SIZE];
+        snprintf(response_name, sizeof(response_name), SEM_RESPONSE_TEMPLATE, server_name, i);
+        snprintf(continue_name, sizeof(continue_name), SEM_CONTINUE_TEMPLATE, server_name, i);
+        channels.client_fds[i] = fds[next_fd++];
+        channels.sem_response[i] = sem_open(response_name, O_RDWR);
+        channels.sem_continue[i] = sem_open(continue_name, O_RDWR);
+        if (channels.sem_response[i] == SEM_FAILED || channels.sem_continue[i] == SEM_FAILED) {
+            perror("Failed to open client semaphore");
+            return -1;
+        }
+        channels.views[i] = board_view_create(server_name, i); // The pages the clients have mapped
+        register_client_channel(i);
+    }
+    for (int i = 0; i < client_count; i++) {
+        if (owners[i] != i) {
+            add_lane(i, owners[i]);
+        }
+    }
+    channels.open = 1;
+    return 0;
+}
+
+static void report_hibernation(FILE *out);
+static void stop_bot_moves(void);
+
+static void close_server_channels(void) {
+    if (!channels.open) {
+        return;
+    }
+    channels.open = 0;
+
+    outbound_report(channels.moves, stdout);
+    printf("Board resyncs: %llu, rejected boards: %llu, timeouts: %llu, lagging clients: %llu\n", channels.resyncs,
+           channels.rejected_boards, channels.timeouts, channels.lagging);
+    timer_wheel_report(&turn_clocks, stdout);
+    wait_strategy_report(&command_wait, "commands", stdout);
+    admission_report(&admission, stdout);
+    match_table_report(&board_table, stdout);
+    match_table_free(&board_table);
+    if (spill.base != NULL) {
+        report_hibernation(stdout);
+        spill_file_close(&spill);
+    }
+    if (leaderboard_ready) {
+        leaderboard_flush(&leaderboard);
+        leaderboard_report(&leaderboard, stdout);
+        leaderboard_close(&leaderboard);
+        leaderboard_ready = 0;
+    }
+    if (history_dir != NULL) {
+        printf("History: %llu games appended to %s\n", history_games, history_dir);
+        history_writer_close(&history);
+        history_dir = NULL;
+    }
+    outbound_stop();
+    io_engine_report(&engine, "Inbound", channels.moves, stdout);
+    io_engine_destroy(&engine);
 
-    // Signal readiness
-    sem_post(sem_connect);
+    match_pools_report(stdout);
+    if (server_bot_path != NULL) {
+        stop_bot_moves();
+        bot_runner_report(&server_bot, stdout);
+        bot_runner_stop(&server_bot);
+    }
 
-    // Close unused semaphore handles
-    sem_close(sem_connect);
+    for (int i = 0; i < channels.client_count; i++) {
+        if (channels.owner[i] != i) {
+            continue;
+        }
+        close(channels.client_fds[i]);
+        sem_close(channels.sem_response[i]);
+        sem_close(channels.sem_continue[i]);
+        board_view_unmap(channels.views[i]);
+        channels.views[i] = NULL;
+    }
+    close(channels.server_write_fd);
+    close(channels.read_fd);
+    if (handoff_listener != -1) {
+        close(handoff_listener);
+        handoff_listener = -1;
+    }
 }
 
 void cleanup_server(const char *server_name) {
-    char client_write_fifo[BUFFER_SIZE];
-    snprintf(client_write_fifo, sizeof(client_write_fifo), CLIENT_READ_FIFO_TEMPLATE, server_name, 0);
-    unlink(client_write_fifo);
+    int client_count = channels.client_count;
+    close_server_channels();
+
+    for (int i = 0; i < client_count; i++) {
+        if (channels.owner[i] != i) {
+            continue;
+        }
+        char client_write_fifo[BUFFER_SIZE];
+        snprintf(client_write_fifo, sizeof(client_write_fifo), CLIENT_READ_FIFO_TEMPLATE, server_name, i);
+        unlink(client_write_fifo);
 
-    snprintf(client_write_fifo, sizeof(client_write_fifo), CLIENT_READ_FIFO_TEMPLATE, server_name, 1);
-    unlink(client_write_fifo);
+        char sem_name[BUFFER_SIZE];
+        snprintf(sem_name, sizeof(sem_name), SEM_RESPONSE_TEMPLATE, server_name, i);
+        sem_unlink(sem_name);
+        snprintf(sem_name, sizeof(sem_name), SEM_CONTINUE_TEMPLATE, server_name, i);
+        sem_unlink(sem_name);
+        board_view_unlink(server_name, i);
+    }
 
     // Generate FIFO paths
     char server_read_fifo[BUFFER_SIZE];
@@ -112,209 +441,1928 @@ void cleanup_server(const char *server_name) {
     unlink(server_read_fifo);
     unlink(server_write_fifo);
 
+    char socket_path[BUFFER_SIZE];
+    snprintf(socket_path, sizeof(socket_path), HANDOFF_SOCKET_TEMPLATE, server_name);
+    unlink(socket_path);
+
     // Unlink semaphores
     char sem_connect_name[BUFFER_SIZE], sem_command_name[BUFFER_SIZE];
-    char sem_response_client0_name[BUFFER_SIZE], sem_response_client1_name[BUFFER_SIZE];
-    char sem_continue1_name[BUFFER_SIZE], sem_continue2_name[BUFFER_SIZE];
-
     snprintf(sem_connect_name, sizeof(sem_connect_name), SEM_CONNECT_TEMPLATE, server_name);
     snprintf(sem_command_name, sizeof(sem_command_name), SEM_COMMAND_TEMPLATE, server_name);
-    snprintf(sem_response_client0_name, sizeof(sem_response_client0_name), SEM_RESPONSE_TEMPLATE, server_name, 0);
-    snprintf(sem_response_client1_name, sizeof(sem_response_client1_name), SEM_RESPONSE_TEMPLATE, server_name, 1);
-    snprintf(sem_continue1_name, sizeof(sem_continue1_name), SEM_CONTINUE_TEMPLATE, server_name, 0);
-    snprintf(sem_continue2_name, sizeof(sem_continue2_name), SEM_CONTINUE_TEMPLATE, server_name, 1);
 
     sem_unlink(sem_connect_name);
     sem_unlink(sem_command_name);
-    sem_unlink(sem_response_client0_name);
-    sem_unlink(sem_response_client1_name);
 
-    sem_unlink(sem_continue1_name);
-    sem_unlink(sem_continue2_name);
-    
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        session_destroy(sessions[i]);
+        sessions[i] = NULL;
+    }
+    while (live_match_count > 0) {
+        match_destroy(live_matches[--live_match_count]);
+    }
+    open_match = NULL;
+    match_pools_destroy();
+
     // Destroy mutex
     pthread_mutex_destroy(&game_mutex);
 }
 
+// Messages are prefixed and handed to the ordered outbound queue of the
+// channel that carries the client
 void send_message_to_client(int client_id, const char *server_name, const char *message) {
-    char client_write_fifo[BUFFER_SIZE];
-    snprintf(client_write_fifo, sizeof(client_write_fifo), CLIENT_READ_FIFO_TEMPLATE, server_name, client_id);
+    (void)server_name;
+    char prefixed_message[BUFFER_SIZE];
+    snprintf(prefixed_message, sizeof(prefixed_message), "CLIENT_%d:%s", client_id, message);
+    outbound_enqueue(channels.owner[client_id], prefixed_message);
+}
 
-    char server_write_fifo[BUFFER_SIZE];
-    snprintf(server_write_fifo, sizeof(server_write_fifo), SERVER_WRITE_FIFO_TEMPLATE, server_name);
+static void remove_live_match(Match *match) {
+    for (int i = 0; i < live_match_count; i++) {
+        if (live_matches[i] == match) {
+            live_matches[i] = live_matches[--live_match_count];
+            break;
+        }
+    }
+    if (open_match == match) {
+        open_match = NULL;
+    }
+}
+
+// Logs a shot for the history store. Salvo shots of one turn share its number.
+static void record_shot(Match *match, int seat, int x, int y, int hit) {
+    if (match->shot_count < HISTORY_MAX_SHOTS) {
+        match->shots[match->shot_count++] = history_shot(seat, match->turns[seat], x, y, hit);
+    }
+}
+
+// Appends a two-player game that got past fleet placement. Flushed right
+// away: games end rarely, and a crash then loses nothing.
+static void record_history(const Match *match) {
+    if (history_dir == NULL || match->ffa != NULL || match->seated != match->seat_count ||
+        match->boards_ready != (1u << match->seat_count) - 1) {
+        return;
+    }
+    HistoryGame game;
+    game.variant = history_variant_code(&match->variant);
+    game.winner = match->winner >= 0 ? (uint8_t)match->winner : HISTORY_NO_WINNER;
+    game.end = (uint8_t)match->end;
+    game.shot_count = (uint16_t)match->shot_count;
+    long long duration_ms = (long long)(match->finished_at.tv_sec - match->created.tv_sec) * 1000 +
+                            (match->finished_at.tv_nsec - match->created.tv_nsec) / 1000000;
+    game.duration_ms = duration_ms > 0 ? (uint32_t)duration_ms : 0;
+    history_set_fleets(&game, match->boards);
+    memcpy(game.shots, match->shots, (size_t)match->shot_count * sizeof(HistoryShot));
+    if (history_writer_append(&history, &game) == 0 && history_writer_flush(&history) == 0) {
+        history_games++;
+    }
+}
 
-    char sem_response_name[BUFFER_SIZE];
-    snprintf(sem_response_name, sizeof(sem_response_name), SEM_RESPONSE_TEMPLATE, server_name, client_id);
+// Rates a two-player game that got past fleet placement and has a winner,
+// when both seats gave different names
+static void rate_match(const Match *match) {
+    if (!leaderboard_ready || match->ffa != NULL || match->winner < 0 || match->seated != match->seat_count ||
+        match->boards_ready != (1u << match->seat_count) - 1) {
+        return;
+    }
+    const char *winner = match->players[match->winner];
+    const char *loser = match->players[1 - match->winner];
+    if (winner[0] != '\0' && loser[0] != '\0') {
+        leaderboard_record_game(&leaderboard, winner, loser);
+    }
+}
 
-    sem_t *sem_response = sem_open(sem_response_name, O_RDWR);
+// Writes what each seat of a two-player match may see into its client's
+// page. Called before the message announcing the change is queued.
+static void publish_views(const Match *match) {
+    if (match->ffa != NULL) {
+        return;
+    }
+    for (int seat = 0; seat < 2; seat++) {
+        int client_id = match->seats[seat];
+        if (seat == match->bot_seat || client_id < 0 || channels.views[client_id] == NULL) {
+            continue;
+        }
+        const GameBoard *own = &match->boards[seat];
+        const GameBoard *other = &match->boards[1 - seat];
+        BoardSnapshot snapshot;
+        snapshot.match_id = match->id;
+        snapshot.seat = seat;
+        snapshot.player_turn = match->player_turn;
+        snapshot.winner = match->winner;
+        snapshot.finished = (uint32_t)match->finished;
+        snapshot.boards_ready = match->boards_ready;
+        snapshot.moves = match->sequence;
+        snapshot.mine_shot_hash = own->shot_hash;
+        snapshot.enemy_shot_hash = other->shot_hash;
+        for (int i = 0; i < BOARD_SIZE; i++) {
+            for (int j = 0; j < BOARD_SIZE; j++) {
+                // Ships stay hidden on both: anyone may open the page
+                snapshot.mine[i][j] = own->grid[i][j] == 1 ? 0 : (uint8_t)own->grid[i][j];
+                snapshot.enemy[i][j] = other->grid[i][j] == 1 ? 0 : (uint8_t)other->grid[i][j];
+            }
+        }
+        board_view_publish(channels.views[client_id], &snapshot);
+    }
+}
 
-    int write_fd_s = pipe_open_write(server_write_fifo);
-    int write_fd_c = pipe_open_write(client_write_fifo);
-    if (write_fd_s != -1 && strncmp(message, "CLIENT_ID:", 10) == 0) {
-        send_message(write_fd_s, message);
+// Releases a finished match and its sessions. The server keeps running while
+// other matches are live and exits once the last one is over.
+static void end_match(Match *match, const char *server_name) {
+    timer_wheel_cancel(&turn_clocks, &match->turn_clock);
+    match->finished = 1;
+    clock_gettime(CLOCK_REALTIME, &match->finished_at);
+    publish_views(match);
+    record_history(match);
+    rate_match(match);
+    if (match->ffa != NULL) {
+        printf("%s free-for-all memory: %zu bytes\n", match->name, ffa_memory(match->ffa));
     }
-    else if (write_fd_c != -1) {
-            // For all other messages, add the client prefix
-            char prefixed_message[BUFFER_SIZE];
-            snprintf(prefixed_message, sizeof(prefixed_message), "CLIENT_%d:%s", client_id, message);
 
-            send_message(write_fd_c, prefixed_message);
-            sem_post(sem_response);
+    for (int seat = 0; seat < match->seat_count; seat++) {
+        int client_id = match->seats[seat];
+        if (client_id >= 0 && sessions[client_id] != NULL) {
+            session_destroy(sessions[client_id]);
+            sessions[client_id] = NULL;
+        }
+    }
+    remove_live_match(match);
+    if (match->table_slot >= 0) {
+        match_table_release(&board_table, match->table_slot);
     }
-    pipe_close(write_fd_s);
-    pipe_close(write_fd_c);
+    match_destroy(match);
 
-    sem_close(sem_response);
+    if (live_match_count == 0 && hibernated_count == 0 && !persistent) {
+        // Only now wait for the clients, so the FIFOs outlive the last messages
+        outbound_drain(OUTBOUND_DRAIN_TIMEOUT_MS);
+        cleanup_server(server_name);
+        exit(EXIT_SUCCESS);
+    }
 }
 
-void handle_client_message(int client_id, const char *message, const char *server_name, GameData *game_data) {
-    char sem_continue1_name[BUFFER_SIZE], sem_continue2_name[BUFFER_SIZE];
-    snprintf(sem_continue1_name, sizeof(sem_continue1_name), SEM_CONTINUE_TEMPLATE, server_name, 0);
-    snprintf(sem_continue2_name, sizeof(sem_continue2_name), SEM_CONTINUE_TEMPLATE, server_name, 1);
+// Seats held by the server's bot have no client to notify
+static void send_to_seat(const Match *match, int seat, const char *server_name, const char *message) {
+    if (seat != match->bot_seat && match->seats[seat] >= 0) {
+        send_message_to_client(match->seats[seat], server_name, message);
+    }
+}
 
-    sem_t * sem_continue1 = sem_open(sem_continue1_name, O_RDWR);
-    sem_t *sem_continue2 = sem_open(sem_continue2_name, O_RDWR);
+static unsigned long long clock_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)(now.tv_sec - clock_origin.tv_sec) * 1000ULL +
+           (unsigned long long)((now.tv_nsec - clock_origin.tv_nsec) / 1000000L);
+}
 
-    if (strncmp(message, "SEND_BOARD", 10) == 0) {
-        GameBoard *board = &game_data->board_players[client_id];
+static unsigned long long current_tick(void) {
+    return clock_now_ms() / TURN_CLOCK_TICK_MS;
+}
 
-        // Decode the board: Replace 'A' with 0 and 'B' with 1
-        int index = 11;
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                board->grid[i][j] = message[index++] - 'A';
-            }
+// Arms the match's clock limit_ms from now, rounded up to a whole tick
+static void arm_turn_clock(Match *match, long long limit_ms) {
+    match->turn_started_ms = clock_now_ms();
+    unsigned long long deadline = match->turn_started_ms + (unsigned long long)limit_ms;
+    timer_wheel_add(&turn_clocks, &match->turn_clock, (deadline + TURN_CLOCK_TICK_MS - 1) / TURN_CLOCK_TICK_MS);
+}
+
+// Stops the running clock and charges the time used to its seat
+static void stop_turn_clock(Match *match) {
+    timer_wheel_cancel(&turn_clocks, &match->turn_clock);
+    int seat = match->clock_seat;
+    if (seat >= 0 && game_limit_ms > 0) {
+        unsigned long long used = clock_now_ms() - match->turn_started_ms;
+        match->clock_ms[seat] = used < (unsigned long long)match->clock_ms[seat] ? match->clock_ms[seat] - (int)used : 0;
+    }
+    match->clock_seat = -1;
+}
+
+// Gives seat the move limit or what is left of its game time, whichever is
+// shorter. The bot has its own budget and no clock.
+static void start_turn_clock(Match *match, int seat) {
+    stop_turn_clock(match);
+    if (seat == match->bot_seat) {
+        return;
+    }
+    long long limit = move_limit_ms > 0 ? move_limit_ms : -1;
+    if (game_limit_ms > 0 && (limit < 0 || match->clock_ms[seat] < limit)) {
+        limit = match->clock_ms[seat];
+    }
+    if (limit < 0) {
+        return;
+    }
+    match->clock_seat = seat;
+    arm_turn_clock(match, limit);
+}
+
+// Fleets are placed against the move limit, on nobody's game time
+static void start_setup_clock(Match *match) {
+    stop_turn_clock(match);
+    if (move_limit_ms > 0) {
+        arm_turn_clock(match, move_limit_ms);
+    }
+}
+
+// Copies a board that changed outside the batch kernel into the match table
+static void sync_table_row(Match *match, int seat) {
+    if (match->table_slot >= 0) {
+        match_table_load(&board_table, match_table_row(match->table_slot, seat), &match->boards[seat]);
+    }
+}
+
+// Two-player classic matches also keep their boards in the match table
+static void acquire_table_slot(Match *match) {
+    if (match->variant.mode == GAME_MODE_CLASSIC && match->seat_count == 2) {
+        match->table_slot = match_table_acquire(&board_table);
+        sync_table_row(match, 0);
+        sync_table_row(match, 1);
+    }
+}
+
+static void ask_bot_move(Match *match, const char *server_name);
+
+// Ends the match when the move sank the last ship, otherwise passes the turn
+static void finish_move(Match *match, int seat, int opponent_seat, int result, const char *server_name) {
+    match->sequence++;
+    if (match->turns[seat] < HISTORY_MAX_TURN) {
+        match->turns[seat]++;
+    }
+    if (result == 2) { // All ships sunk
+        match->winner = seat;
+        match->end = HISTORY_END_SUNK;
+        send_to_seat(match, seat, server_name, "GAME_OVER_W"); // Attacking player wins
+        send_to_seat(match, opponent_seat, server_name, "GAME_OVER_L"); // Opponent loses
+        end_match(match, server_name);
+        return;
+    }
+
+    // Switch turns
+    match->player_turn = opponent_seat;
+    publish_views(match);
+    if (opponent_seat == match->bot_seat) {
+        stop_turn_clock(match);
+        ask_bot_move(match, server_name);
+    } else {
+        start_turn_clock(match, opponent_seat);
+    }
+}
+
+// The bot's shots are searched on a thread of their own, so a search that
+// uses the bot's whole budget holds up only its own match. The bot has one
+// worker, which answers one request at a time. Each answer is posted on
+// sem_command like a client's command, and the serve loop applies it under
+// the game mutex.
+typedef struct {
+    int match_id;
+    unsigned long long sequence; // The match's moves when the bot was asked
+    GameBoard view;
+    Shot shot;
+    BotResult outcome;
+} BotMove;
+
+typedef struct {
+    BotMove moves[MAX_CLIENTS];
+    int head;
+    int count;
+} BotMoveQueue;
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    sem_t *sem_command;
+    int running;
+    int stopping;
+    BotMoveQueue asked;
+    BotMoveQueue answered;
+} bot_moves = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+// The worker serves one call at a time: shots from the bot thread, fleets
+// and restarts from the serve thread
+static pthread_mutex_t bot_runner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Match *find_live_match(int match_id);
+
+static void bot_queue_push(BotMoveQueue *queue, const BotMove *move) {
+    queue->moves[(queue->head + queue->count++) % MAX_CLIENTS] = *move;
+}
+
+static void bot_queue_pop(BotMoveQueue *queue, BotMove *move) {
+    *move = queue->moves[queue->head];
+    queue->head = (queue->head + 1) % MAX_CLIENTS;
+    queue->count--;
+}
+
+static void *run_bot_moves(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&bot_moves.lock);
+    while (1) {
+        while (!bot_moves.stopping && (bot_moves.asked.count == 0 || bot_moves.answered.count == MAX_CLIENTS)) {
+            pthread_cond_wait(&bot_moves.wake, &bot_moves.lock);
         }
+        if (bot_moves.stopping) {
+            break;
+        }
+        BotMove move;
+        bot_queue_pop(&bot_moves.asked, &move);
+        pthread_mutex_unlock(&bot_moves.lock);
 
-        // Acknowledge receipt of the board
-        char response[BUFFER_SIZE];
-        snprintf(response, sizeof(response), "BOARD_RECEIVED");
-        send_message_to_client(client_id, server_name, response);
-    } else if (strncmp(message, "ATTACK", 6) == 0) {
-        int x, y;
-        if (sscanf(message + 7, "%d_%d", &x, &y) == 2 && client_id == game_data->player_turn) {
-            int opponent_id = (client_id == 0) ? 1 : 0;
-            GameBoard *opponent_board = &game_data->board_players[opponent_id];
+        pthread_mutex_lock(&bot_runner_lock);
+        move.outcome = bot_runner_choose_shot(&server_bot, &move.view, &move.shot);
+        pthread_mutex_unlock(&bot_runner_lock);
+
+        pthread_mutex_lock(&bot_moves.lock);
+        bot_queue_push(&bot_moves.answered, &move);
+        sem_post(bot_moves.sem_command);
+    }
+    pthread_mutex_unlock(&bot_moves.lock);
+    return NULL;
+}
 
-            int result = attack(opponent_board, x, y);
+// A started two-player match whose next shot is the bot's
+static int bot_is_to_move(const Match *match) {
+    return match->bot_seat >= 0 && !match->finished && match->seated == match->seat_count &&
+           match->boards_ready == (1u << match->seat_count) - 1 && match->player_turn == match->bot_seat;
+}
 
-            // Notify attacking client of result
-            char response[BUFFER_SIZE];
-            snprintf(response, sizeof(response), "ATTACK_RESULT_%c_%d_%d", (result == 1 || result == 2) ? 'H' : 'M', x, y);
-            send_message_to_client(client_id, server_name, response);
-            sem_wait(client_id == 0 ? sem_continue1 : sem_continue2);
-
-            // Notify opponent of attack
-            snprintf(response, sizeof(response), "OPPONENT_ATTACKED_%c_%d_%d", (result == 1 || result == 2 ) ? 'H' : 'M', x, y);
-            send_message_to_client(opponent_id, server_name, response);
-            sem_wait(client_id == 0 ? sem_continue2 : sem_continue1);
-
-            // Check for game over condition
-            if (result == 2) { // All ships sunk
-                send_message_to_client(client_id, server_name, "GAME_OVER_W"); // Attacking player wins
-                sem_wait(client_id == 0 ? sem_continue1 : sem_continue2);
-                send_message_to_client(opponent_id, server_name, "GAME_OVER_L"); // Opponent loses
-                sem_wait(client_id == 0 ? sem_continue2 : sem_continue1);
-
-                sem_close(sem_continue1);
-                sem_close(sem_continue2);
-                cleanup_server(server_name);
-                exit(EXIT_SUCCESS);
-            }
+// Plays the shot the bot chose. A bot that breaks the rules or overruns its
+// budget forfeits the match.
+static void play_bot_move(Match *match, const BotMove *move, const char *server_name) {
+    int bot_seat = match->bot_seat;
+    int opponent_seat = 1 - bot_seat;
+    if (move->outcome != BOT_OK) {
+        printf("Bot %s forfeits %s: %s\n", server_bot.name, match->name, bot_result_name(move->outcome));
+        send_to_seat(match, opponent_seat, server_name, "OPPONENT_QUIT");
+        match->winner = opponent_seat;
+        end_match(match, server_name);
+        return;
+    }
 
-            // Switch turns
-            game_data->player_turn = opponent_id;
-        } else {
-            send_message_to_client(client_id, server_name, "WRONG_TURN");
+    Shot shot = move->shot;
+    int hit;
+    int result = attack_salvo(&match->boards[opponent_seat], &shot, 1, &hit);
+    channels.moves++;
+    if (hit >= 0) {
+        record_shot(match, bot_seat, shot.x, shot.y, hit);
+        sync_table_row(match, opponent_seat);
+    }
+    publish_views(match);
+
+    char response[BUFFER_SIZE];
+    if (match->variant.mode == GAME_MODE_SALVO) {
+        snprintf(response, sizeof(response), "OPPONENT_SALVO_1_%c_%d_%d_%016llx", hit == 1 ? 'H' : 'M', shot.x, shot.y,
+                 (unsigned long long)board_hash(&match->boards[opponent_seat]));
+    } else {
+        snprintf(response, sizeof(response), "OPPONENT_ATTACKED_%c_%d_%d_%016llx", hit == 1 ? 'H' : 'M', shot.x, shot.y,
+                 (unsigned long long)board_hash(&match->boards[opponent_seat]));
+    }
+    send_to_seat(match, opponent_seat, server_name, response);
+
+    finish_move(match, bot_seat, opponent_seat, result, server_name);
+}
+
+// Asks the bot thread for the bot's next shot in match, or searches for it
+// right here when there is no thread to ask
+static void ask_bot_move(Match *match, const char *server_name) {
+    BotMove move;
+    move.match_id = match->id;
+    move.sequence = match->sequence;
+    bot_view_from_board(&match->boards[1 - match->bot_seat], &move.view);
+
+    pthread_mutex_lock(&bot_moves.lock);
+    int queued = bot_moves.running && bot_moves.asked.count < MAX_CLIENTS;
+    if (queued) {
+        bot_queue_push(&bot_moves.asked, &move);
+        pthread_cond_signal(&bot_moves.wake);
+    }
+    pthread_mutex_unlock(&bot_moves.lock);
+    if (!queued) {
+        pthread_mutex_lock(&bot_runner_lock);
+        move.outcome = bot_runner_choose_shot(&server_bot, &move.view, &move.shot);
+        pthread_mutex_unlock(&bot_runner_lock);
+        play_bot_move(match, &move, server_name);
+    }
+}
+
+// Takes a shot the bot thread answered, if there is one
+static int take_bot_move(BotMove *move) {
+    pthread_mutex_lock(&bot_moves.lock);
+    int taken = bot_moves.answered.count > 0;
+    if (taken) {
+        bot_queue_pop(&bot_moves.answered, move);
+        pthread_cond_signal(&bot_moves.wake); // The thread may wait for room
+    }
+    pthread_mutex_unlock(&bot_moves.lock);
+    return taken;
+}
+
+// Plays an answered shot, unless its match ended or moved on while the bot
+// was searching
+static void apply_bot_move(const BotMove *move, const char *server_name) {
+    Match *match = find_live_match(move->match_id);
+    if (match != NULL && match->sequence == move->sequence && bot_is_to_move(match)) {
+        play_bot_move(match, move, server_name);
+    }
+}
+
+// Starts the bot thread and asks it for every match already waiting on the
+// bot, as after a takeover
+static void start_bot_moves(const char *server_name, sem_t *sem_command) {
+    if (server_bot_path == NULL || bot_moves.running) {
+        return;
+    }
+    bot_moves.sem_command = sem_command;
+    bot_moves.stopping = 0;
+    if (pthread_create(&bot_moves.thread, NULL, run_bot_moves, NULL) != 0) {
+        perror("Failed to start the bot thread; the bot moves on the serve thread");
+        return;
+    }
+    bot_moves.running = 1;
+    for (int i = 0; i < live_match_count; i++) {
+        if (bot_is_to_move(live_matches[i])) {
+            ask_bot_move(live_matches[i], server_name);
         }
-    } else if (strncmp(message, "QUIT", 4) == 0) {
-        int opponent_id = (client_id == 0) ? 1 : 0;
+    }
+}
 
-        send_message_to_client(opponent_id, server_name, "OPPONENT_QUIT");
-        send_message_to_client(client_id, server_name, "MY_QUIT");
-        sem_close(sem_continue1);
-        sem_close(sem_continue2);
+// Joins the bot thread. Shots it was asked for are dropped, and their
+// matches asked again when it next starts; an answer not yet played takes
+// back its post on sem_command.
+static void stop_bot_moves(void) {
+    if (!bot_moves.running) {
+        return;
+    }
+    pthread_mutex_lock(&bot_moves.lock);
+    bot_moves.stopping = 1;
+    pthread_cond_broadcast(&bot_moves.wake);
+    pthread_mutex_unlock(&bot_moves.lock);
+    pthread_join(bot_moves.thread, NULL);
+    bot_moves.running = 0;
+    for (; bot_moves.answered.count > 0; bot_moves.answered.count--) {
+        sem_trywait(bot_moves.sem_command);
+    }
+    bot_moves.answered.head = 0;
+    bot_moves.asked.head = 0;
+    bot_moves.asked.count = 0;
+}
 
-        cleanup_server(server_name);
-        exit(EXIT_SUCCESS);
+// A two-seat match may only be played once both seats are taken
+static int is_players_turn(const Match *match, int seat) {
+    return match->seated == match->seat_count && seat == match->player_turn;
+}
+
+// SALVO_<count>_<x>_<y>... is answered with one SALVO_RESULT for the attacker
+// and one OPPONENT_SALVO for the defender, each listing <H|M|I>_<x>_<y> per shot
+// and ending with the hash of the recipient's copy of the defender's board
+static void handle_salvo_message(ClientSession *session, const char *message, const char *server_name) {
+    Match *match = session->match;
+    int client_id = session->client_id;
+    if (match->variant.mode != GAME_MODE_SALVO) {
+        send_message_to_client(client_id, server_name, "WRONG_MODE");
+        return;
+    }
+    if (!is_players_turn(match, session->seat)) {
+        send_message_to_client(client_id, server_name, "WRONG_TURN");
+        return;
+    }
+
+    int allowed = salvo_shots_allowed(&match->variant, &match->boards[session->seat]);
+    char response[BUFFER_SIZE];
+    Shot shots[MAX_SALVO_SHOTS];
+    int count, consumed;
+    const char *cursor = message + 5;
+
+    int valid = sscanf(cursor, "_%d%n", &count, &consumed) == 1 && count >= 1 && count <= allowed;
+    for (int k = 0; valid && k < count; k++) {
+        cursor += consumed;
+        valid = sscanf(cursor, "_%d_%d%n", &shots[k].x, &shots[k].y, &consumed) == 2;
+    }
+    if (!valid) {
+        snprintf(response, sizeof(response), "SALVO_REJECTED_%d", allowed);
+        send_message_to_client(client_id, server_name, response);
+        return;
+    }
+
+    int opponent_seat = 1 - session->seat;
+    int results[MAX_SALVO_SHOTS];
+    int result = attack_salvo(&match->boards[opponent_seat], shots, count, results);
+    channels.moves++;
+    for (int k = 0; k < count; k++) {
+        if (results[k] >= 0) {
+            record_shot(match, session->seat, shots[k].x, shots[k].y, results[k]);
+        }
+    }
+    publish_views(match);
+
+    char report[BUFFER_SIZE];
+    int length = snprintf(report, sizeof(report), "%d", count);
+    for (int k = 0; k < count; k++) {
+        char outcome = results[k] == 1 ? 'H' : (results[k] == 0 ? 'M' : 'I');
+        length += snprintf(report + length, sizeof(report) - (size_t)length, "_%c_%d_%d", outcome, shots[k].x, shots[k].y);
     }
-    sem_close(sem_continue1);
-    sem_close(sem_continue2);
+
+    const GameBoard *defender = &match->boards[opponent_seat];
+    snprintf(response, sizeof(response), "SALVO_RESULT_%s_%016llx", report, (unsigned long long)defender->shot_hash);
+    send_message_to_client(client_id, server_name, response);
+    snprintf(response, sizeof(response), "OPPONENT_SALVO_%s_%016llx", report, (unsigned long long)board_hash(defender));
+    send_to_seat(match, opponent_seat, server_name, response);
+
+    finish_move(match, session->seat, opponent_seat, result, server_name);
 }
 
-void run_server(const char *server_name) {
-    initialize_server(server_name);
+// Sends a free-for-all broadcast to every player still afloat
+static void broadcast_to_alive(const Match *match, const char *server_name, const char *message) {
+    for (int seat = 0; seat < match->ffa->player_count; seat++) {
+        if (!match->ffa->eliminated[seat]) {
+            send_message_to_client(match->seats[seat], server_name, message);
+        }
+    }
+}
 
-    char sem_command_name[BUFFER_SIZE];
-    snprintf(sem_command_name, sizeof(sem_command_name), SEM_COMMAND_TEMPLATE, server_name);
+// Ends the match once one player or none is left, as when every fleet is
+// missing at the placement deadline. Returns 1 when the match was released.
+static int finish_ffa_if_decided(Match *match, const char *server_name) {
+    int winner = ffa_winner(match->ffa);
+    if (winner == -1 && match->ffa->alive > 0) {
+        return 0;
+    }
 
-    sem_t *sem_command = sem_open(sem_command_name, O_CREAT | O_RDWR);
-    
-    if (sem_command == SEM_FAILED) {
-        perror("Failed to open command semaphore");
-        cleanup_server(server_name);
-        exit(EXIT_FAILURE);
+    if (winner != -1) {
+        send_message_to_client(match->seats[winner], server_name, "GAME_OVER_W");
     }
+    end_match(match, server_name);
+    return 1;
+}
 
-    char server_read_fifo[BUFFER_SIZE];
-    snprintf(server_read_fifo, sizeof(server_read_fifo), SERVER_READ_FIFO_TEMPLATE, server_name);
+// Once the last fleet is in, or the last player without one has left, every
+// player hears who starts and the first turn clock runs
+static void start_ffa_if_ready(Match *match, int was_started, const char *server_name) {
+    FreeForAll *ffa = match->ffa;
+    if (!was_started && ffa_started(ffa)) {
+        char response[BUFFER_SIZE];
+        snprintf(response, sizeof(response), "FFA_TURN_%d", ffa->turn);
+        broadcast_to_alive(match, server_name, response);
+        start_turn_clock(match, ffa->turn);
+    }
+}
 
-    int connected_clients = 0;
+// PLACE_FLEET_<x>_<y>_<H|V> per ship, ATTACK_<x>_<y>_<target> and QUIT;
+// every shot is broadcast as FFA_SHOT_<attacker>_<target>_<H|M|S>_<x>_<y>_<next>.
+// Players are identified by seat, not by client id.
+static void handle_ffa_message(ClientSession *session, const char *message, const char *server_name) {
+    Match *match = session->match;
+    FreeForAll *ffa = match->ffa;
+    int client_id = session->client_id;
+    int seat = session->seat;
+    char response[BUFFER_SIZE];
 
-    int read_fd = pipe_open_read(server_read_fifo);
+    if (strncmp(message, "PLACE_FLEET", 11) == 0) {
+        ShipPlacement placements[FLEET_SIZE];
+        const char *cursor = message + 11;
+        int count = 0, consumed;
+        while (count < FLEET_SIZE && sscanf(cursor, "_%d_%d_%c%n", &placements[count].x, &placements[count].y,
+                                            &placements[count].orientation, &consumed) == 3) {
+            cursor += consumed;
+            count++;
+        }
 
-    while (1) {
-        sem_wait(sem_command); // Wait for a command from a client
+        if (*cursor != '\0' || !ffa_place_fleet(ffa, seat, placements, count)) {
+            send_message_to_client(client_id, server_name, "FLEET_REJECTED");
+            return;
+        }
+        send_message_to_client(client_id, server_name, "FLEET_ACCEPTED");
+        start_ffa_if_ready(match, 0, server_name);
+    } else if (strncmp(message, "ATTACK", 6) == 0) {
+        int x, y, target;
+        if (sscanf(message + 6, "_%d_%d_%d", &x, &y, &target) != 3) {
+            send_message_to_client(client_id, server_name, "ATTACK_REJECTED");
+            return;
+        }
 
-        char buffer[BUFFER_SIZE];
-        if (receive_message(read_fd, buffer, BUFFER_SIZE) == 0) {
-            int client_id;
-            char message[BUFFER_SIZE];
-            if (strncmp(buffer, "CONNECT", 7) == 0) {
-                pthread_mutex_lock(&game_mutex);
-
-                if (connected_clients < MAX_CLIENTS) {
-                    int new_client_id = connected_clients;
-                    char response[BUFFER_SIZE];
-
-                    // Assign a new client ID and send it to the client
-                    snprintf(response, sizeof(response), "CLIENT_ID:%d", new_client_id);
-                    send_message_to_client(new_client_id, server_name, response);
-
-                    // Update game data for connected clients
-                    if (new_client_id == 0) {
-                        game_data.client_id_1 = new_client_id;
-                    } else if (new_client_id == 1) {
-                        game_data.client_id_2 = new_client_id;
-                    }
-
-                    connected_clients++;
-                } else {
-                    char server_write_fifo[BUFFER_SIZE];
-                    snprintf(server_write_fifo, sizeof(server_write_fifo), SERVER_WRITE_FIFO_TEMPLATE, server_name);
-
-                    int write_fd = pipe_open_write(server_write_fifo);
-                    char response[BUFFER_SIZE];
-                    snprintf(response, sizeof(response), "REJECT");
-                    sem_close(sem_command);
-                    pipe_close(write_fd);
-                    pipe_close(read_fd);
-                    send_message(write_fd, response);
-                }
+        int result = ffa_attack(ffa, seat, target, x, y);
+        if (result == -1) {
+            send_message_to_client(client_id, server_name, seat == ffa->turn ? "ATTACK_REJECTED" : "WRONG_TURN");
+            return;
+        }
+        channels.moves++;
+        match->sequence++;
 
-                pthread_mutex_unlock(&game_mutex);
-            } else if (sscanf(buffer, "CLIENT_%d:%s", &client_id, message) == 2) {
-                pthread_mutex_lock(&game_mutex);
-                if (strstr(message, "QUIT") != NULL) {
-                    pipe_close(read_fd);
-                    sem_close(sem_command);
-                }
-                handle_client_message(client_id, message, server_name, &game_data);
-                pthread_mutex_unlock(&game_mutex);
-            }  
+        char outcome = result == 2 ? 'S' : (result == 1 ? 'H' : 'M');
+        snprintf(response, sizeof(response), "FFA_SHOT_%d_%d_%c_%d_%d_%d", seat, target, outcome, x, y, ffa->turn);
+        broadcast_to_alive(match, server_name, response);
+        if (result == 2) {
+            // The target was already marked eliminated, so it needs its own copy
+            send_message_to_client(match->seats[target], server_name, response);
+            send_message_to_client(match->seats[target], server_name, "GAME_OVER_L");
+        }
+        if (!finish_ffa_if_decided(match, server_name)) {
+            start_turn_clock(match, ffa->turn);
+        }
+    } else if (strncmp(message, "QUIT", 4) == 0) {
+        send_message_to_client(client_id, server_name, "MY_QUIT");
+        int was_started = ffa_started(ffa);
+        int had_turn = was_started && ffa->turn == seat;
+        if (ffa_eliminate(ffa, seat)) {
+            snprintf(response, sizeof(response), "PLAYER_QUIT_%d_%d", seat, ffa->turn);
+            broadcast_to_alive(match, server_name, response);
+        }
+        if (!finish_ffa_if_decided(match, server_name)) {
+            if (had_turn) {
+                start_turn_clock(match, ffa->turn);
+            } else {
+                start_ffa_if_ready(match, was_started, server_name);
+            }
+        }
+    }
+}
+
+// A free-for-all player who runs out of time is out, like one who quits.
+// Before the first turn that is everyone still without a fleet.
+static void expire_ffa_clock(Match *match, int seat, const char *server_name) {
+    FreeForAll *ffa = match->ffa;
+    char response[BUFFER_SIZE];
+    for (int player = 0; player < ffa->player_count; player++) {
+        int late = seat >= 0 ? player == seat : !ffa->fleet_ready[player];
+        if (late && ffa_eliminate(ffa, player)) {
+            send_message_to_client(match->seats[player], server_name, "GAME_OVER_L_TIMEOUT");
+            snprintf(response, sizeof(response), "PLAYER_QUIT_%d_%d", player, ffa->turn);
+            broadcast_to_alive(match, server_name, response);
+        }
+    }
+    if (finish_ffa_if_decided(match, server_name)) {
+        return;
+    }
+    if (seat >= 0) {
+        start_turn_clock(match, ffa->turn);
+    } else {
+        start_ffa_if_ready(match, 0, server_name);
+    }
+}
+
+// Runs from timer_wheel_advance under the game mutex. A seat that runs out of
+// time forfeits; before the first move, every seat still without a board does.
+static void turn_clock_expired(TimerEntry *timer, void *context) {
+    (void)timer;
+    Match *match = context;
+    const char *server_name = clock_server_name;
+    int seat = match->clock_seat;
+    if (seat >= 0) {
+        match->clock_ms[seat] = 0;
+    }
+    match->clock_seat = -1;
+    channels.timeouts++;
+    printf("%s: %s ran out of time\n", match->name, seat >= 0 ? "the player to move" : "fleet placement");
+
+    if (match->ffa != NULL) {
+        expire_ffa_clock(match, seat, server_name);
+        return;
+    }
+    match->end = HISTORY_END_TIMEOUT;
+    for (int other = 0; other < match->seat_count; other++) {
+        int lost = seat >= 0 ? other == seat : !(match->boards_ready & (1u << other));
+        send_to_seat(match, other, server_name, lost ? "GAME_OVER_L_TIMEOUT" : "GAME_OVER_W_TIMEOUT");
+        if (!lost) {
+            match->winner = other;
+        }
+    }
+    end_match(match, server_name);
+}
+
+// Brings a hibernated match back with its sessions and turn clock. Returns
+// NULL when out of memory; the match then stays in the spill file.
+static Match *wake_match(int slot) {
+    struct timespec started, now;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    const MatchBlob *blob = spill_file_slot(&spill, slot);
+    ClientSession *seat_sessions[2];
+    Match *match = match_expand(blob, seat_sessions);
+    if (match == NULL) {
+        fprintf(stderr, "Failed to wake a hibernated match.\n");
+        return NULL;
+    }
+
+    HibernatedMatch *record = &hibernated[slot];
+    timer_entry_init(&match->turn_clock, turn_clock_expired, match);
+    if (timer_entry_armed(&record->clock)) {
+        timer_wheel_add(&turn_clocks, &match->turn_clock, record->clock.expires);
+        timer_wheel_cancel(&turn_clocks, &record->clock);
+    }
+    for (int seat = 0; seat < 2; seat++) {
+        if (seat_sessions[seat] != NULL) {
+            sessions[match->seats[seat]] = seat_sessions[seat];
+            hibernated_slot[match->seats[seat]] = -1;
+        }
+    }
+    live_matches[live_match_count++] = match;
+    acquire_table_slot(match);
+
+    record->in_use = 0;
+    hibernated_count--;
+    spill_file_release(&spill, slot);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    spill_file_restored(&spill, (unsigned long long)((now.tv_sec - started.tv_sec) * 1000000000LL +
+                                                     (now.tv_nsec - started.tv_nsec)));
+    return match;
+}
+
+// The turn clock of a hibernated match ran out: it wakes up to forfeit
+static void hibernated_clock_expired(TimerEntry *timer, void *context) {
+    (void)timer;
+    HibernatedMatch *record = context;
+    Match *match = wake_match((int)(record - hibernated));
+    if (match != NULL) {
+        timer_wheel_cancel(&turn_clocks, &match->turn_clock);
+        turn_clock_expired(&match->turn_clock, match);
+    }
+}
+
+// The client's session, waking its match if it hibernates
+static ClientSession *client_session(int client_id) {
+    if (client_id < 0 || client_id >= MAX_CLIENTS) {
+        return NULL;
+    }
+    if (sessions[client_id] == NULL && hibernated_slot[client_id] >= 0) {
+        wake_match(hibernated_slot[client_id]);
+    }
+    return sessions[client_id];
+}
+
+static void hibernate_match(Match *match) {
+    int slot = spill_file_acquire(&spill);
+    if (slot == -1) {
+        return;
+    }
+    ClientSession *seat_sessions[2] = {NULL, NULL};
+    for (int seat = 0; seat < 2; seat++) {
+        if (seat != match->bot_seat && match->seats[seat] >= 0) {
+            seat_sessions[seat] = sessions[match->seats[seat]];
+        }
+    }
+    match_compact(match, seat_sessions, spill_file_slot(&spill, slot));
+    spill_file_evict(&spill, slot);
+
+    HibernatedMatch *record = &hibernated[slot];
+    record->in_use = 1;
+    timer_entry_init(&record->clock, hibernated_clock_expired, record);
+    if (timer_entry_armed(&match->turn_clock)) {
+        timer_wheel_add(&turn_clocks, &record->clock, match->turn_clock.expires);
+        timer_wheel_cancel(&turn_clocks, &match->turn_clock);
+    }
+    for (int seat = 0; seat < 2; seat++) {
+        if (seat_sessions[seat] != NULL) {
+            sessions[match->seats[seat]] = NULL;
+            hibernated_slot[match->seats[seat]] = slot;
+            session_destroy(seat_sessions[seat]);
+        }
+    }
+    hibernated_count++;
+
+    remove_live_match(match);
+    if (match->table_slot >= 0) {
+        match_table_release(&board_table, match->table_slot);
+    }
+    match_destroy(match);
+}
+
+// Hibernates the full two-player matches that have been idle long enough
+static void hibernate_idle_matches(unsigned long long now) {
+    if (spill.base == NULL) {
+        return;
+    }
+    for (int i = live_match_count - 1; i >= 0; i--) {
+        Match *match = live_matches[i];
+        if (match->ffa == NULL && match->seated == match->seat_count && !bot_is_to_move(match) &&
+            now - match->active_ms >= (unsigned long long)hibernate_ms) {
+            hibernate_match(match);
+        }
+    }
+}
+
+static void wake_all_matches(void) {
+    for (int slot = 0; slot < MAX_CLIENTS; slot++) {
+        if (hibernated[slot].in_use) {
+            wake_match(slot);
+        }
+    }
+}
+
+// Hibernation counters, with the memory held by the matches that are awake
+// and the server's resident set
+static void report_hibernation(FILE *out) {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        if (fscanf(statm, "%*d %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    int session_count = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        session_count += sessions[i] != NULL;
+    }
+    fprintf(out, "Hibernation: %d matches hibernated, %d awake holding %zu bytes, resident set %ld KiB\n",
+            hibernated_count, live_match_count,
+            (size_t)live_match_count * sizeof(Match) + (size_t)session_count * sizeof(ClientSession),
+            pages * (sysconf(_SC_PAGESIZE) / 1024));
+    spill_file_report(&spill, out);
+}
+
+// RESYNC_MINE or RESYNC_ENEMY is sent by a client whose copy of that board no
+// longer matches the hash in a reply. Only that board is sent back, as
+// BOARD_STATE_<MINE|ENEMY>_<cells>_<hash>; the enemy board without its ships.
+static void handle_resync_message(ClientSession *session, const char *message, const char *server_name) {
+    Match *match = session->match;
+    int mine = strncmp(message, "RESYNC_MINE", 11) == 0;
+    const GameBoard *board = &match->boards[mine ? session->seat : 1 - session->seat];
+    channels.resyncs++;
+
+    char cells[BOARD_SIZE * BOARD_SIZE + 1];
+    int index = 0;
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            int cell = board->grid[i][j];
+            if (!mine && cell == 1) {
+                cell = 0;
+            }
+            cells[index++] = (char)('A' + cell);
+        }
+    }
+    cells[index] = '\0';
+
+    char response[BUFFER_SIZE];
+    snprintf(response, sizeof(response), "BOARD_STATE_%s_%s_%016llx", mine ? "MINE" : "ENEMY", cells,
+             (unsigned long long)(mine ? board_hash(board) : board->shot_hash));
+    send_message_to_client(session->client_id, server_name, response);
+}
+
+// Answers an attack the opponent's board has taken: result is 2 when it sank
+// the last ship, 1 for another hit, 0 for a miss and -1 for an invalid shot
+static void answer_attack(ClientSession *session, int x, int y, int result, const char *server_name) {
+    Match *match = session->match;
+    int opponent_seat = 1 - session->seat;
+    GameBoard *opponent_board = &match->boards[opponent_seat];
+    char response[BUFFER_SIZE];
+    if (result < 0) {
+        // Off the board or already shot: nothing changed and the turn stays
+        snprintf(response, sizeof(response), "ATTACK_REJECTED_%d_%d", x, y);
+        send_message_to_client(session->client_id, server_name, response);
+        return;
+    }
+    channels.moves++;
+    record_shot(match, session->seat, x, y, result != 0);
+    publish_views(match);
+
+    // Queue the result and the notification; the delivery thread
+    // keeps each client's messages in order without blocking us.
+    // The attacker checks its view against the shot hash, the
+    // defender its whole board against the full hash.
+    snprintf(response, sizeof(response), "ATTACK_RESULT_%c_%d_%d_%016llx", (result == 1 || result == 2) ? 'H' : 'M', x, y,
+             (unsigned long long)opponent_board->shot_hash);
+    send_message_to_client(session->client_id, server_name, response);
+    snprintf(response, sizeof(response), "OPPONENT_ATTACKED_%c_%d_%d_%016llx", (result == 1 || result == 2 ) ? 'H' : 'M', x, y,
+             (unsigned long long)board_hash(opponent_board));
+    send_to_seat(match, opponent_seat, server_name, response);
+
+    finish_move(match, session->seat, opponent_seat, result, server_name);
+}
+
+// Runs the queued attacks through the batch kernel, marks the shot cells on
+// the boards and answers them in the order they arrived. Every queued
+// attack is at a different match, so no answer depends on another.
+static void resolve_queued_attacks(const char *server_name) {
+    int count = queued_attack_count;
+    if (count == 0) {
+        return;
+    }
+    queued_attack_count = 0;
+
+    TableShot shots[MATCH_TABLE_BATCH];
+    uint8_t flags[MATCH_TABLE_BATCH];
+    for (int i = 0; i < count; i++) {
+        const ClientSession *session = queued_attacks[i].session;
+        shots[i].board = match_table_row(session->match->table_slot, 1 - session->seat);
+        shots[i].cell = match_table_cell(queued_attacks[i].x, queued_attacks[i].y);
+    }
+    PerfSample sample;
+    perf_begin(&sample);
+    match_table_attack_batch(&board_table, shots, count, flags);
+    perf_end(PERF_REGION_ATTACK_BATCH, &sample);
+
+    for (int i = 0; i < count; i++) {
+        QueuedAttack *queued = &queued_attacks[i];
+        int result = -1;
+        if (!(flags[i] & MATCH_TABLE_INVALID)) {
+            int hit = flags[i] & MATCH_TABLE_HIT;
+            board_mark_shot(&queued->session->match->boards[1 - queued->session->seat], queued->x, queued->y,
+                            hit ? 2 : 3);
+            result = (flags[i] & MATCH_TABLE_SUNK_ALL) ? 2 : hit;
+        }
+        answer_attack(queued->session, queued->x, queued->y, result, server_name);
+    }
+}
+
+// Sends the players ranked first to last as LEADERBOARD_ messages of
+// rank:name:rating entries, as many as fit in each, then LEADERBOARD_END
+static void send_leaderboard_page(const ClientSession *session, long first, long last, const char *server_name) {
+    char response[BUFFER_SIZE - 32]; // Leaves room for the CLIENT_ prefix
+    size_t length = 0;
+    LeaderboardEntry entry;
+    for (long rank = first; rank <= last && leaderboard_at(&leaderboard, rank, &entry) == 0; rank++) {
+        char item[64];
+        int item_length = snprintf(item, sizeof(item), "%ld:%s:%.0f", rank, entry.name, entry.rating);
+        if (length > 0 && length + 1 + (size_t)item_length >= sizeof(response)) {
+            send_message_to_client(session->client_id, server_name, response);
+            length = 0;
+        }
+        length += (size_t)snprintf(response + length, sizeof(response) - length, "%s%s",
+                                   length == 0 ? "LEADERBOARD_" : ",", item);
+    }
+    if (length > 0) {
+        send_message_to_client(session->client_id, server_name, response);
+    }
+    snprintf(response, sizeof(response), "LEADERBOARD_END_%ld", leaderboard_size(&leaderboard));
+    send_message_to_client(session->client_id, server_name, response);
+}
+
+// RANK[_<name>], TOP[_<count>] and AROUND[_<count>]: a player's rank, the
+// best players, and the players on either side of the asking one. Each
+// entry costs one descent of the rating tree.
+static void handle_leaderboard_query(ClientSession *session, const char *message, const char *server_name) {
+    const Match *match = session->match;
+    const char *own = session->seat < 2 && match->ffa == NULL ? match->players[session->seat] : "";
+    char response[BUFFER_SIZE];
+    int count = 0;
+
+    if (strncmp(message, "TOP", 3) == 0) {
+        sscanf(message + 3, "_%d", &count);
+        count = count > 0 && count <= LEADERBOARD_PAGE_MAX ? count : 10;
+        send_leaderboard_page(session, 1, count, server_name);
+        return;
+    }
+
+    char name[PLAYER_NAME_MAX];
+    if (strncmp(message, "RANK_", 5) == 0) {
+        leaderboard_clean_name(message + 5, name);
+    } else {
+        memcpy(name, own, PLAYER_NAME_MAX);
+    }
+    if (name[0] == '\0') {
+        send_message_to_client(session->client_id, server_name, "RANK_UNNAMED");
+        return;
+    }
+    LeaderboardEntry entry = {{0}, LEADERBOARD_INITIAL_RATING, 0, 0};
+    long rank = leaderboard_rank(&leaderboard, name, &entry);
+
+    if (strncmp(message, "AROUND", 6) == 0 && rank > 0) {
+        sscanf(message + 6, "_%d", &count);
+        count = count > 0 && count <= LEADERBOARD_PAGE_MAX / 2 ? count : 5;
+        send_leaderboard_page(session, rank > count ? rank - count : 1, rank + count, server_name);
+        return;
+    }
+    snprintf(response, sizeof(response), "RANK_%ld_%ld_%.0f_%u_%u_%s", rank, leaderboard_size(&leaderboard),
+             entry.rating, entry.wins, entry.games, name);
+    send_message_to_client(session->client_id, server_name, response);
+}
+
+static int is_leaderboard_query(const char *message) {
+    return strncmp(message, "RANK", 4) == 0 || strncmp(message, "TOP", 3) == 0 || strncmp(message, "AROUND", 6) == 0;
+}
+
+void handle_client_message(ClientSession *session, const char *message, const char *server_name) {
+    Match *match = session->match;
+    int client_id = session->client_id;
+    session->messages++;
+    match->active_ms = clock_now_ms();
+
+    // The name a player is rated under; only two-player games are rated
+    if (strncmp(message, "PLAYER_", 7) == 0) {
+        if (match->ffa == NULL && session->seat < 2) {
+            leaderboard_clean_name(message + 7, match->players[session->seat]);
+        }
+        return;
+    }
+    if (is_leaderboard_query(message)) {
+        handle_leaderboard_query(session, message, server_name);
+        return;
+    }
+
+    if (match->variant.mode == GAME_MODE_FFA) {
+        handle_ffa_message(session, message, server_name);
+        return;
+    }
+
+    if (strncmp(message, "SEND_BOARD", 10) == 0) {
+        GameBoard *board = &match->boards[session->seat];
+        char response[BUFFER_SIZE];
+
+        // A fleet is placed once; another upload would wipe the hits on it
+        if (match->boards_ready & (1u << session->seat)) {
+            channels.rejected_boards++;
+            send_message_to_client(client_id, server_name, "BOARD_REJECTED_PLACED");
+            return;
+        }
+
+        // Check the fleet before it touches the match: 'A' is water, 'B' ship
+        PerfSample sample;
+        perf_begin(&sample);
+        uint16_t rows[BOARD_SIZE];
+        FleetCheck check = FLEET_BAD_CELLS;
+        if (message[10] == '-') {
+            const char *cells = message + 11;
+            check = validate_fleet_cells(&fleet_rules, cells, strnlen(cells, BOARD_SIZE * BOARD_SIZE), rows);
+        }
+        if (check != FLEET_VALID) {
+            perf_end(PERF_REGION_DECODE_BOARD, &sample);
+            channels.rejected_boards++;
+            snprintf(response, sizeof(response), "BOARD_REJECTED_%s", fleet_check_name(check));
+            send_message_to_client(client_id, server_name, response);
+            return;
+        }
+        for (int i = 0; i < BOARD_SIZE; i++) {
+            for (int j = 0; j < BOARD_SIZE; j++) {
+                board->grid[i][j] = (rows[i] >> j) & 1;
+            }
+        }
+        board_rehash(board);
+        perf_end(PERF_REGION_DECODE_BOARD, &sample);
+        sync_table_row(match, session->seat);
+
+        // The first move's clock starts once both fleets are in
+        unsigned int all_boards = (1u << match->seat_count) - 1;
+        int was_ready = match->boards_ready == all_boards;
+        match->boards_ready |= 1u << session->seat;
+        if (!was_ready && match->boards_ready == all_boards && match->seated == match->seat_count) {
+            start_turn_clock(match, match->player_turn);
+        }
+        publish_views(match);
+
+        // Acknowledge receipt of the board
+        snprintf(response, sizeof(response), "BOARD_RECEIVED_%016llx", (unsigned long long)board_hash(board));
+        send_message_to_client(client_id, server_name, response);
+    } else if (strncmp(message, "SALVO", 5) == 0) {
+        handle_salvo_message(session, message, server_name);
+    } else if (strncmp(message, "RESYNC", 6) == 0) {
+        handle_resync_message(session, message, server_name);
+    } else if (strncmp(message, "ATTACK", 6) == 0) {
+        int x, y;
+        if (sscanf(message + 7, "%d_%d", &x, &y) == 2 && is_players_turn(match, session->seat)) {
+            if (match->table_slot >= 0) {
+                queued_attacks[queued_attack_count++] = (QueuedAttack){session, x, y};
+                resolve_queued_attacks(server_name);
+            } else {
+                answer_attack(session, x, y, attack(&match->boards[1 - session->seat], x, y), server_name);
+            }
+        } else {
+            send_message_to_client(client_id, server_name, "WRONG_TURN");
+        }
+    } else if (strncmp(message, "QUIT", 4) == 0) {
+        send_to_seat(match, 1 - session->seat, server_name, "OPPONENT_QUIT");
+        send_message_to_client(client_id, server_name, "MY_QUIT");
+        match->winner = 1 - session->seat;
+        end_match(match, server_name);
+    }
+}
+
+// Lets the server's bot take the last seat of a new two-player match. A bot
+// whose worker was killed is restarted for the next match.
+static void seat_server_bot(Match *match) {
+    if (server_bot_path == NULL || match->seat_count != 2) {
+        return;
+    }
+    pthread_mutex_lock(&bot_runner_lock);
+    if (server_bot.pid <= 0) {
+        bot_runner_stop(&server_bot);
+        if (bot_runner_start(&server_bot, server_bot_path, (unsigned int)getpid() + (unsigned int)match->id) == -1) {
+            pthread_mutex_unlock(&bot_runner_lock);
+            return;
+        }
+    }
+
+    ShipPlacement placements[FLEET_SIZE];
+    BotResult result = bot_runner_place_fleet(&server_bot, &match->boards[1], placements);
+    pthread_mutex_unlock(&bot_runner_lock);
+    if (result != BOT_OK) {
+        printf("Bot %s could not place a fleet: %s\n", server_bot.name, bot_result_name(result));
+        initialize_board(&match->boards[1]);
+        return;
+    }
+    match->bot_seat = 1;
+    match->boards_ready |= 1u << 1;
+    char bot_name[BUFFER_SIZE];
+    snprintf(bot_name, sizeof(bot_name), "bot-%s", server_bot.name);
+    leaderboard_clean_name(bot_name, match->players[1]);
+    sync_table_row(match, 1);
+}
+
+// A full match gets its clocks: game time for every seat and the placement
+// clock, which gives way to the first turn once the fleets are in
+static void start_match_clocks(Match *match) {
+    timer_entry_init(&match->turn_clock, turn_clock_expired, match);
+    for (int seat = 0; seat < match->seat_count; seat++) {
+        match->clock_ms[seat] = game_limit_ms;
+    }
+    start_setup_clock(match);
+}
+
+// Seats the client in the match that is waiting for players, opening a new
+// one when there is none. Returns NULL when the server is full or draining.
+static ClientSession *seat_client(int client_id) {
+    if (open_match == NULL) {
+        if (draining || live_match_count + hibernated_count == MAX_CLIENTS) {
+            return NULL;
+        }
+        open_match = match_create(next_match_id++, &server_variant);
+        if (open_match == NULL) {
+            fprintf(stderr, "Failed to set up a new match.\n");
+            return NULL;
+        }
+        live_matches[live_match_count++] = open_match;
+        acquire_table_slot(open_match);
+        seat_server_bot(open_match);
+    }
+
+    Match *match = open_match;
+    ClientSession *session = session_create(client_id, match, match->seated);
+    if (session == NULL) {
+        return NULL;
+    }
+    match->seats[match->seated++] = client_id;
+    if (match->seated == match->bot_seat) {
+        match->seated++;
+    }
+    if (match->seated == match->seat_count) {
+        open_match = NULL;
+        match->active_ms = clock_now_ms();
+        start_match_clocks(match);
+    }
+    return session;
+}
+
+// A player the outbound queues cut off for falling behind leaves the match
+// as if it had sent QUIT, and so does every lane of its channel. Leaving
+// sends more messages, which may cut off another client in turn.
+static void disconnect_lagging_clients(const char *server_name) {
+    int client_ids[MAX_CLIENTS];
+    int count;
+    while ((count = outbound_take_cut_off(client_ids)) > 0) {
+        for (int i = 0; i < count; i++) {
+            channels.lagging++;
+            for (int client_id = 0; client_id < channels.client_count; client_id++) {
+                if (channels.owner[client_id] != client_ids[i]) {
+                    continue;
+                }
+                ClientSession *session = client_session(client_id);
+                if (session != NULL) {
+                    printf("Client %d fell too far behind and was disconnected.\n", client_id);
+                    handle_client_message(session, "QUIT", server_name);
+                }
+            }
+        }
+    }
+}
+
+static int clock_limit_from_env(const char *name, int fallback) {
+    const char *text = getenv(name);
+    if (text == NULL || *text == '\0') {
+        return fallback;
+    }
+    int limit = atoi(text);
+    return limit > 0 ? limit : 0;
+}
+
+// Returns 1 once a client posts a command, or 0 when the next clock tick
+// or sweep comes first. Without a running clock, a queued connect, a match
+// that may hibernate or unwritten ratings there is nothing to wake up for.
+static int wait_for_command(sem_t *sem_command) {
+    while (1) {
+        int result;
+        int sweep = (spill.base != NULL && live_match_count > 0) || (leaderboard_ready && leaderboard.buffered > 0);
+        if (turn_clocks.pending == 0 && admission_pending(&admission) == 0 && !sweep) {
+            result = wait_strategy_wait(&command_wait, sem_command, NULL);
+        } else {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            unsigned long long now = clock_now_ms();
+            long wait_ms = TURN_CLOCK_TICK_MS - (long)(now % TURN_CLOCK_TICK_MS);
+            if (turn_clocks.pending == 0 && admission_pending(&admission) == 0) {
+                wait_ms = next_sweep_ms > now ? (long)(next_sweep_ms - now) : 1;
+            }
+            deadline.tv_nsec += wait_ms * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            result = wait_strategy_wait(&command_wait, sem_command, &deadline);
+        }
+        if (result == 0) {
+            return 1;
+        }
+        if (errno == ETIMEDOUT) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+        perf_profile_poll(); // SIGUSR2 may have woken us
+    }
+}
+
+// Queues CONNECT_<pid>[_<ticket>], or turns it away with
+// REJECT_<retry after ms>_<ticket>; a ticket moves the retry ahead of new
+// arrivals. Rejecting costs no more than reading the message, so a flood is
+// shed without holding up the moves behind it.
+static void offer_connect(const char *server_name, const char *message) {
+    int gone;
+    int reply_fd = open_connect_reply(server_name, message, &gone);
+    if (gone) {
+        return; // Timed out before we got to it
+    }
+
+    unsigned long long now = clock_now_ms();
+    AdmissionRequest request = {reply_fd, (uid_t)-1, 0, 0};
+    struct stat info;
+    if (reply_fd != -1 && fstat(reply_fd, &info) == 0) {
+        request.source = info.st_uid;
+    }
+    int pid;
+    unsigned int ticket;
+    if (sscanf(message, "CONNECT_%d_%u", &pid, &ticket) == 2) {
+        request.priority = admission_redeem_ticket(&admission, ticket, now);
+    }
+
+    int retry_after_ms;
+    if (admission_offer(&admission, &request, now, &retry_after_ms) != ADMISSION_QUEUED) {
+        char response[BUFFER_SIZE];
+        snprintf(response, sizeof(response), "REJECT_%d_%u", retry_after_ms, admission_issue_ticket(&admission, now));
+        reply_to_connect(reply_fd, response);
+    }
+}
+
+// A client that timed out has closed its reply FIFO
+static int client_gave_up(int reply_fd) {
+    struct pollfd reply = {reply_fd, POLLOUT, 0};
+    return poll(&reply, 1, 0) == 1 && (reply.revents & POLLERR);
+}
+
+// Seats up to ADMISSION_BATCH queued clients. A plain REJECT means the
+// server is out of client ids for good.
+static void admit_queued_clients(const char *server_name) {
+    AdmissionRequest request;
+    last_admission_ms = clock_now_ms();
+    for (int i = 0; i < ADMISSION_BATCH && admission_take(&admission, &request, last_admission_ms); i++) {
+        if (request.reply_fd != -1 && client_gave_up(request.reply_fd)) {
+            close(request.reply_fd);
+            admission_abandoned(&admission);
+            continue;
+        }
+
+        ClientSession *session = NULL;
+        if (connected_clients < MAX_CLIENTS) {
+            session = seat_client(connected_clients);
+        }
+        if (session == NULL) {
+            reply_to_connect(request.reply_fd, "REJECT");
+            continue;
+        }
+
+        int new_client_id = connected_clients++;
+        sessions[new_client_id] = session;
+        channels.source[new_client_id] = request.source;
+        open_client_channel(server_name, new_client_id);
+        publish_views(session->match); // The seat's page exists only now
+
+        // Assign a new client ID and tell the client its seat and the rules
+        char variant_text[64], response[BUFFER_SIZE];
+        format_game_variant(&server_variant, variant_text, sizeof(variant_text));
+        snprintf(response, sizeof(response), "CLIENT_ID:%d:%d:%s", new_client_id, session->seat, variant_text);
+        reply_to_connect(request.reply_fd, response);
+    }
+}
+
+// OPEN_MATCH from a connected client seats one more client id, a lane,
+// whose messages travel on the asking client's channel with the lane's own
+// CLIENT_<id> prefix; the client sends for it on the server FIFO as usual.
+// A bot farm plays dozens of matches this way over one FIFO and one pair of
+// semaphores. Each lane is charged to the token bucket of whoever connected
+// the channel, like a CONNECT, and a channel carries at most
+// MAX_CHANNEL_LANES of them. Answered with MATCH_OPENED_<id>_<seat>,
+// MATCH_REFUSED_<retry after ms> when throttled, or MATCH_REFUSED.
+static void open_lane(int client_id, const char *server_name) {
+    if (client_id < 0 || client_id >= channels.client_count) {
+        return;
+    }
+    int owner = channels.owner[client_id];
+    int lanes = 0;
+    for (int i = 0; i < channels.client_count; i++) {
+        lanes += channels.owner[i] == owner && i != owner;
+    }
+    int retry_after_ms;
+    if (lanes >= MAX_CHANNEL_LANES || connected_clients >= MAX_CLIENTS) {
+        send_message_to_client(client_id, server_name, "MATCH_REFUSED");
+        return;
+    }
+    if (admission_charge(&admission, channels.source[owner], clock_now_ms(), &retry_after_ms) == -1) {
+        char response[BUFFER_SIZE];
+        snprintf(response, sizeof(response), "MATCH_REFUSED_%d", retry_after_ms);
+        send_message_to_client(client_id, server_name, response);
+        return;
+    }
+    ClientSession *session = seat_client(connected_clients);
+    if (session == NULL) {
+        send_message_to_client(client_id, server_name, "MATCH_REFUSED");
+        return;
+    }
+
+    int lane = connected_clients++;
+    sessions[lane] = session;
+    add_lane(lane, owner);
+
+    char response[BUFFER_SIZE];
+    snprintf(response, sizeof(response), "MATCH_OPENED_%d_%d", lane, session->seat);
+    send_message_to_client(client_id, server_name, response);
+}
+
+// Clients still waiting for a seat try again with the new server. Their
+// tickets would mean nothing there, so they get none.
+static void reject_queued_clients(void) {
+    AdmissionRequest request;
+    char response[BUFFER_SIZE];
+    snprintf(response, sizeof(response), "REJECT_%d_0", TURN_CLOCK_TICK_MS);
+    while (admission_take(&admission, &request, clock_now_ms())) {
+        reply_to_connect(request.reply_fd, response);
+    }
+}
+
+static void put_text(HandoffBuffer *snapshot, const char *text, size_t length) {
+    handoff_put_int(snapshot, (int64_t)length);
+    handoff_put(snapshot, text, length);
+}
+
+// Descriptor count first, so the receiver can take the descriptors before
+// it rebuilds anything; then the rules, the channel carrying each client id,
+// the counters, every live match with what is left of its clock, and the
+// sessions. Only clients that own their channel send a descriptor.
+static void encode_snapshot(HandoffBuffer *snapshot, const char *pending, size_t pending_length) {
+    int channel_count = 0;
+    for (int i = 0; i < channels.client_count; i++) {
+        channel_count += channels.owner[i] == i;
+    }
+    handoff_put_int(snapshot, 2 + channel_count);
+    handoff_put_int(snapshot, server_variant.mode);
+    handoff_put_int(snapshot, server_variant.salvo_shots);
+    handoff_put_int(snapshot, server_variant.players);
+    handoff_put_int(snapshot, server_variant.board_size);
+    handoff_put_int(snapshot, next_match_id);
+    handoff_put_int(snapshot, connected_clients);
+    handoff_put_int(snapshot, channels.client_count);
+    for (int i = 0; i < channels.client_count; i++) {
+        handoff_put_int(snapshot, channels.owner[i]);
+        handoff_put_int(snapshot, (int64_t)channels.source[i]);
+    }
+    handoff_put_int(snapshot, (int64_t)channels.moves);
+    handoff_put_int(snapshot, (int64_t)channels.resyncs);
+    handoff_put_int(snapshot, (int64_t)channels.rejected_boards);
+    handoff_put_int(snapshot, (int64_t)channels.timeouts);
+    handoff_put_int(snapshot, (int64_t)channels.lagging);
+    put_text(snapshot, server_bot_path, server_bot_path != NULL ? strlen(server_bot_path) : 0);
+    put_text(snapshot, pending, pending_length);
+
+    unsigned long long now = clock_now_ms();
+    handoff_put_int(snapshot, live_match_count);
+    for (int i = 0; i < live_match_count; i++) {
+        Match *match = live_matches[i];
+        match_encode(match, snapshot);
+        handoff_put_int(snapshot, match == open_match);
+        long long remaining_ms = -1, elapsed_ms = 0;
+        if (timer_entry_armed(&match->turn_clock)) {
+            unsigned long long deadline = match->turn_clock.expires * TURN_CLOCK_TICK_MS;
+            remaining_ms = deadline > now ? (long long)(deadline - now) : 0;
+            elapsed_ms = (long long)(now - match->turn_started_ms);
+        }
+        handoff_put_int(snapshot, remaining_ms);
+        handoff_put_int(snapshot, elapsed_ms);
+    }
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const ClientSession *session = sessions[i];
+        if (session == NULL) {
+            continue;
+        }
+        handoff_put_int(snapshot, session->client_id);
+        handoff_put_int(snapshot, session->match->id);
+        handoff_put_int(snapshot, session->seat);
+        handoff_put_int(snapshot, (int64_t)session->messages);
+        handoff_put_int(snapshot, session->connected.tv_sec);
+        handoff_put_int(snapshot, session->connected.tv_nsec);
+    }
+    handoff_put_int(snapshot, -1);
+}
+
+// Answers HANDOFF from a new server connected to the handoff socket: once
+// every client has acknowledged its messages, stops reading and passes the
+// snapshot and the descriptors, then exits when the new server is running.
+// Until the new server is told to go, any failure leaves this one serving
+// as before, and it never unlinks what the clients have open.
+static void hand_off(void) {
+    int peer = handoff_accept(handoff_listener);
+    if (peer == -1) {
+        printf("Handoff requested, but no new server is waiting.\n");
+        return;
+    }
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    // Matches waiting on the bot are asked again by whichever server goes on
+    stop_bot_moves();
+    reject_queued_clients();
+    wake_all_matches();
+    if (outbound_drain(OUTBOUND_DRAIN_TIMEOUT_MS) == -1) {
+        printf("Handoff refused: clients did not acknowledge their messages in time.\n");
+        close(peer);
+        start_bot_moves(clock_server_name, bot_moves.sem_command);
+        return;
+    }
+
+    char pending[sizeof(engine.reader.data)];
+    size_t pending_length = io_engine_detach(&engine, pending, sizeof(pending));
+    if (leaderboard_ready) {
+        leaderboard_flush(&leaderboard); // The new server replays the log when it starts
+    }
+
+    HandoffBuffer snapshot;
+    handoff_buffer_init(&snapshot);
+    encode_snapshot(&snapshot, pending, pending_length);
+    int fds[2 + MAX_CLIENTS];
+    int fd_count = 2;
+    fds[0] = channels.read_fd;
+    fds[1] = channels.server_write_fd;
+    for (int i = 0; i < channels.client_count; i++) {
+        if (channels.owner[i] == i) {
+            fds[fd_count++] = channels.client_fds[i];
+        }
+    }
+
+    int status = snapshot.failed ? -1 : handoff_send_snapshot(peer, &snapshot);
+    if (status == 0) {
+        status = handoff_send_fds(peer, fds, fd_count);
+    }
+    if (status == 0) {
+        status = handoff_await(peer, HANDOFF_TIMEOUT_MS);
+    }
+    if (status == 0) {
+        status = handoff_signal(peer);
+    }
+    size_t snapshot_bytes = snapshot.length;
+    handoff_buffer_free(&snapshot);
+    close(peer);
+
+    if (status == -1) {
+        // Read on from where the snapshot left off
+        printf("Handoff failed; this server keeps running.\n");
+        IoEngineStats stats = engine.stats;
+        io_engine_init(&engine, channels.read_fd);
+        engine.stats = stats;
+        message_reader_push(&engine.reader, pending, pending_length);
+        start_bot_moves(clock_server_name, bot_moves.sem_command);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("Handed %d matches and %d clients (%zu bytes) to the new server in %.2f ms.\n", live_match_count,
+           channels.client_count, snapshot_bytes,
+           (double)(now.tv_sec - started.tv_sec) * 1e3 + (double)(now.tv_nsec - started.tv_nsec) / 1e6);
+    close_server_channels();
+    exit(EXIT_SUCCESS);
+}
+
+static Match *find_live_match(int match_id) {
+    for (int i = 0; i < live_match_count; i++) {
+        if (live_matches[i]->id == match_id) {
+            return live_matches[i];
+        }
+    }
+    return NULL;
+}
+
+// Rebuilds the matches and sessions from encode_snapshot() output and starts
+// the clocks again from what was left of them; the time the handoff took is
+// charged to nobody
+static int restore_matches(HandoffBuffer *snapshot) {
+    int match_count = (int)handoff_get_int(snapshot);
+    if (match_count < 0 || match_count > MAX_CLIENTS) {
+        return -1;
+    }
+    for (int i = 0; i < match_count; i++) {
+        Match *match = match_decode(snapshot);
+        if (match == NULL) {
+            return -1;
+        }
+        live_matches[live_match_count++] = match;
+        acquire_table_slot(match);
+        if (handoff_get_int(snapshot)) {
+            open_match = match;
+        }
+        long long remaining_ms = handoff_get_int(snapshot);
+        long long elapsed_ms = handoff_get_int(snapshot);
+
+        timer_entry_init(&match->turn_clock, turn_clock_expired, match);
+        int seat = match->clock_seat;
+        if (seat >= 0 && game_limit_ms > 0) {
+            match->clock_ms[seat] = elapsed_ms < match->clock_ms[seat] ? match->clock_ms[seat] - (int)elapsed_ms : 0;
+        }
+        if (remaining_ms >= 0) {
+            arm_turn_clock(match, remaining_ms);
+        }
+    }
+
+    int client_id;
+    while ((client_id = (int)handoff_get_int(snapshot)) != -1 && !snapshot->failed) {
+        Match *match = find_live_match((int)handoff_get_int(snapshot));
+        int seat = (int)handoff_get_int(snapshot);
+        if (match == NULL || client_id < 0 || client_id >= MAX_CLIENTS) {
+            return -1;
+        }
+        ClientSession *session = session_create(client_id, match, seat);
+        if (session == NULL) {
+            return -1;
+        }
+        session->messages = (unsigned long long)handoff_get_int(snapshot);
+        session->connected.tv_sec = (time_t)handoff_get_int(snapshot);
+        session->connected.tv_nsec = (long)handoff_get_int(snapshot);
+        sessions[client_id] = session;
+    }
+    return snapshot->failed ? -1 : 0;
+}
+
+// Everything but the channels and the matches: pools, the bot, the clocks,
+// admission control and the history store. A bot set in the environment
+// takes precedence over one inherited from the server we replace.
+static int prepare_server(const char *bot_fallback) {
+    if (match_pools_init() == -1) {
+        fprintf(stderr, "Failed to set up the match pools.\n");
+        return -1;
+    }
+
+    // The bot worker is forked before the outbound thread starts
+    const char *bot_path = getenv("BATTLESHIP_SERVER_BOT");
+    if (bot_path == NULL || *bot_path == '\0') {
+        bot_path = bot_fallback;
+    }
+    if (bot_path != NULL && *bot_path != '\0' && server_variant.mode != GAME_MODE_FFA) {
+        if (bot_runner_start(&server_bot, bot_path, (unsigned int)getpid()) == 0) {
+            server_bot_path = bot_path;
+            printf("Bot %s plays the second seat of every match.\n", server_bot.name);
+        }
+    }
+
+    move_limit_ms = clock_limit_from_env("BATTLESHIP_MOVE_LIMIT_MS", DEFAULT_MOVE_LIMIT_MS);
+    game_limit_ms = clock_limit_from_env("BATTLESHIP_GAME_LIMIT_MS", DEFAULT_GAME_LIMIT_MS);
+    clock_gettime(CLOCK_MONOTONIC, &clock_origin);
+    timer_wheel_init(&turn_clocks, 0);
+    admission_init(&admission);
+    last_admission_ms = 0;
+
+    // Free-for-all boards are sparse and have no compact form; they stay awake
+    hibernate_ms = clock_limit_from_env("BATTLESHIP_HIBERNATE_MS", DEFAULT_HIBERNATE_MS);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        hibernated_slot[i] = -1;
+    }
+    next_sweep_ms = HIBERNATE_SWEEP_MS;
+    if (hibernate_ms > 0 && server_variant.mode != GAME_MODE_FFA) {
+        char spill_path[BUFFER_SIZE];
+        snprintf(spill_path, sizeof(spill_path), SPILL_FILE_TEMPLATE, clock_server_name);
+        if (spill_file_open(&spill, spill_path, MAX_CLIENTS, sizeof(MatchBlob)) == -1) {
+            hibernate_ms = 0;
+        }
+    }
+    if (match_table_init(&board_table, MAX_CLIENTS) == -1) {
+        fprintf(stderr, "Failed to set up the match table.\n");
+        return -1;
+    }
+
+    // A client that gives up closes its reply FIFO; writing to it must fail
+    // instead of killing the server
+    signal(SIGPIPE, SIG_IGN);
+
+    const char *ratings_path = getenv("BATTLESHIP_RATINGS_LOG");
+    if (leaderboard_open(&leaderboard, ratings_path != NULL && *ratings_path != '\0' ? ratings_path : NULL) == 0) {
+        leaderboard_ready = 1;
+    }
+
+    const char *history_path = getenv("BATTLESHIP_HISTORY_DIR");
+    if (history_path != NULL && *history_path != '\0' && server_variant.mode != GAME_MODE_FFA) {
+        if (history_writer_open(&history, history_path) == 0) {
+            history_dir = history_path;
+        }
+    }
+    return 0;
+}
+
+static void serve(const char *server_name, sem_t *sem_command);
+
+void run_server(const char *server_name) {
+    perf_profile_init("server");
+    wait_strategy_from_env(&command_wait);
+    initialize_server(server_name);
+
+    char sem_command_name[BUFFER_SIZE];
+    snprintf(sem_command_name, sizeof(sem_command_name), SEM_COMMAND_TEMPLATE, server_name);
+
+    sem_t *sem_command = sem_open(sem_command_name, O_CREAT | O_RDWR);
+    
+    if (sem_command == SEM_FAILED) {
+        perror("Failed to open command semaphore");
+        cleanup_server(server_name);
+        exit(EXIT_FAILURE);
+    }
+
+    clock_server_name = server_name;
+    if (prepare_server(NULL) == -1) {
+        cleanup_server(server_name);
+        exit(EXIT_FAILURE);
+    }
+
+    open_server_channels(server_name);
+    if (server_ready != NULL) {
+        sem_post(server_ready);
+        sem_close(server_ready);
+        server_ready = NULL;
+    }
+
+    serve(server_name, sem_command);
+}
+
+// Decodes what hand_off() sent. Nothing here may unlink or reset what the
+// clients have open: until the old server lets us go, it is still theirs.
+static int restore_snapshot(const char *server_name, HandoffBuffer *snapshot, const int *fds, int fd_count) {
+    server_variant.mode = (GameMode)handoff_get_int(snapshot);
+    server_variant.salvo_shots = (int)handoff_get_int(snapshot);
+    server_variant.players = (int)handoff_get_int(snapshot);
+    server_variant.board_size = (int)handoff_get_int(snapshot);
+    next_match_id = (int)handoff_get_int(snapshot);
+    connected_clients = (int)handoff_get_int(snapshot);
+    int client_count = (int)handoff_get_int(snapshot);
+    if (client_count < fd_count - 2 || client_count > MAX_CLIENTS) {
+        return -1;
+    }
+    int owners[MAX_CLIENTS];
+    uid_t sources[MAX_CLIENTS];
+    for (int i = 0; i < client_count; i++) {
+        owners[i] = (int)handoff_get_int(snapshot);
+        sources[i] = (uid_t)handoff_get_int(snapshot);
+        if (owners[i] < 0 || owners[i] > i || (owners[i] != i && owners[owners[i]] != owners[i])) {
+            return -1;
+        }
+    }
+    unsigned long long counters[5];
+    for (int i = 0; i < 5; i++) {
+        counters[i] = (unsigned long long)handoff_get_int(snapshot);
+    }
+
+    size_t length = (size_t)handoff_get_int(snapshot);
+    if (length >= sizeof(inherited_bot_path)) {
+        return -1;
+    }
+    handoff_get(snapshot, inherited_bot_path, length);
+    inherited_bot_path[length] = '\0';
+
+    char pending[sizeof(engine.reader.data)];
+    size_t pending_length = (size_t)handoff_get_int(snapshot);
+    if (snapshot->failed || pending_length > sizeof(pending)) {
+        return -1;
+    }
+    handoff_get(snapshot, pending, pending_length);
+
+    if (prepare_server(inherited_bot_path) == -1 ||
+        adopt_server_channels(server_name, fds, fd_count, owners, client_count, pending, pending_length) == -1) {
+        return -1;
+    }
+    memcpy(channels.source, sources, (size_t)client_count * sizeof(uid_t));
+    channels.moves = counters[0];
+    channels.resyncs = counters[1];
+    channels.rejected_boards = counters[2];
+    channels.timeouts = counters[3];
+    channels.lagging = counters[4];
+    return restore_matches(snapshot);
+}
+
+void takeover_server(const char *server_name) {
+    char socket_path[BUFFER_SIZE];
+    snprintf(socket_path, sizeof(socket_path), HANDOFF_SOCKET_TEMPLATE, server_name);
+    int peer = handoff_connect(socket_path);
+    if (peer == -1) {
+        fprintf(stderr, "No server %s is running to take over.\n", server_name);
+        exit(EXIT_FAILURE);
+    }
+    printf("Taking over server: %s...\n", server_name);
+
+    // Ask like any client would, so the request waits behind the moves
+    // already sent
+    char sem_command_name[BUFFER_SIZE], server_read_fifo[BUFFER_SIZE];
+    snprintf(sem_command_name, sizeof(sem_command_name), SEM_COMMAND_TEMPLATE, server_name);
+    snprintf(server_read_fifo, sizeof(server_read_fifo), SERVER_READ_FIFO_TEMPLATE, server_name);
+    sem_t *sem_command = sem_open(sem_command_name, O_RDWR);
+    int request_fd = open(server_read_fifo, O_WRONLY | O_NONBLOCK);
+    if (sem_command == SEM_FAILED || request_fd == -1 || send_message(request_fd, HANDOFF_REQUEST) == -1) {
+        perror("Failed to ask for the handoff");
+        exit(EXIT_FAILURE);
+    }
+    close(request_fd);
+    sem_post(sem_command);
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    HandoffBuffer snapshot;
+    int fds[2 + MAX_CLIENTS];
+    int fd_count = -1;
+    if (handoff_receive_snapshot(peer, &snapshot) == 0) {
+        fd_count = (int)handoff_get_int(&snapshot);
+    }
+    if (fd_count < 2 || fd_count > 2 + MAX_CLIENTS || handoff_receive_fds(peer, fds, fd_count) == -1) {
+        fprintf(stderr, "Server %s did not hand over; it keeps running.\n", server_name);
+        exit(EXIT_FAILURE);
+    }
+
+    clock_server_name = server_name;
+    if (restore_snapshot(server_name, &snapshot, fds, fd_count) == -1 || handoff_signal(peer) == -1 ||
+        handoff_await(peer, HANDOFF_TIMEOUT_MS) == -1) {
+        fprintf(stderr, "Takeover of %s failed; the old server keeps running.\n", server_name);
+        exit(EXIT_FAILURE);
+    }
+    handoff_buffer_free(&snapshot);
+    close(peer);
+
+    handoff_listener = handoff_listen(socket_path);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("Took over %d matches and %d clients in %.2f ms.\n", live_match_count, channels.client_count,
+           (double)(now.tv_sec - started.tv_sec) * 1e3 + (double)(now.tv_nsec - started.tv_nsec) / 1e6);
+
+    serve(server_name, sem_command);
+}
+
+// The router sends a draining worker no new seats, so a match still waiting
+// for players would never start and would keep the worker alive. Its seated
+// clients are told MATCH_CLOSED, and it ends with no winner, unrated.
+static void close_open_match(const char *server_name) {
+    Match *match = open_match;
+    if (match == NULL) {
+        return;
+    }
+    printf("Closing %s: draining with %d of %d seats taken\n", match->name, match->seated, match->seat_count);
+    for (int seat = 0; seat < match->seat_count; seat++) {
+        send_to_seat(match, seat, server_name, "MATCH_CLOSED");
+    }
+    end_match(match, server_name);
+}
+
+// The router is going away: close the match still waiting for players, then
+// exit now if no match is left, or else once the last one ends
+static void drain_server(const char *server_name) {
+    persistent = 0;
+    draining = 1;
+    close_open_match(server_name);
+    if (live_match_count == 0 && hibernated_count == 0) {
+        outbound_drain(OUTBOUND_DRAIN_TIMEOUT_MS);
+        cleanup_server(server_name);
+        exit(EXIT_SUCCESS);
+    }
+}
+
+// Queues ATTACK_<x>_<y> from the player to move in a match on the match
+// table, unless that match already has an attack queued
+static int queue_attack(const char *command) {
+    int client_id, x, y;
+    if (sscanf(command, "CLIENT_%d:ATTACK_%d_%d", &client_id, &x, &y) != 3) {
+        return 0;
+    }
+    ClientSession *session = client_session(client_id);
+    if (session == NULL) {
+        return 0;
+    }
+    Match *match = session->match;
+    if (match->table_slot < 0 || !is_players_turn(match, session->seat)) {
+        return 0;
+    }
+    for (int i = 0; i < queued_attack_count; i++) {
+        if (queued_attacks[i].session->match == match) {
+            return 0;
+        }
+    }
+    session->messages++;
+    match->active_ms = clock_now_ms();
+    queued_attacks[queued_attack_count++] = (QueuedAttack){session, x, y};
+    return 1;
+}
+
+static void dispatch_command(const char *server_name, const char *command) {
+    if (queue_attack(command)) {
+        return;
+    }
+    resolve_queued_attacks(server_name);
+    if (queue_attack(command)) {
+        return; // It was waiting on a queued move in its own match
+    }
+
+    int client_id;
+    char message[BUFFER_SIZE];
+    if (strncmp(command, "CONNECT", 7) == 0) {
+        offer_connect(server_name, command);
+    } else if (strcmp(command, HANDOFF_REQUEST) == 0) {
+        hand_off();
+    } else if (strcmp(command, DRAIN_REQUEST) == 0) {
+        drain_server(server_name);
+    } else if (sscanf(command, "CLIENT_%d:%s", &client_id, message) == 2) {
+        if (strcmp(message, "OPEN_MATCH") == 0) {
+            open_lane(client_id, server_name);
+        } else {
+            ClientSession *session = client_session(client_id);
+            if (session != NULL) {
+                handle_client_message(session, message, server_name);
+            }
+        }
+        disconnect_lagging_clients(server_name);
+    }
+}
+
+// Once every HIBERNATE_SWEEP_MS: spills idle matches and writes the ratings
+// rated since the last sweep, which the log's syncer then makes durable
+static void sweep_server(void) {
+    unsigned long long now = clock_now_ms();
+    if (now < next_sweep_ms) {
+        return;
+    }
+    next_sweep_ms = now + HIBERNATE_SWEEP_MS;
+    hibernate_idle_matches(now);
+    if (leaderboard_ready) {
+        leaderboard_flush(&leaderboard);
+    }
+}
+
+// Each post on sem_command stands for one command: a frame on the FIFO, or
+// a shot the bot thread answered. Returns 1 with a frame in buffer, 0 with a
+// bot move, or -1 when no frame could be read.
+static int receive_command(char *buffer, BotMove *move) {
+    if (take_bot_move(move)) {
+        return 0;
+    }
+    return io_engine_receive(&engine, buffer, BUFFER_SIZE) == 0 ? 1 : -1;
+}
+
+static void serve(const char *server_name, sem_t *sem_command) {
+    start_bot_moves(server_name, sem_command);
+    while (1) {
+        // Wait for a command from a client, or while any clock runs, for the
+        // next tick at the latest; one wakeup per tick serves every match
+        int command = wait_for_command(sem_command);
+        if (command == -1) {
+            perror("Failed to wait for a command");
+            break;
+        }
+        pthread_mutex_lock(&game_mutex);
+        timer_wheel_advance(&turn_clocks, current_tick());
+        disconnect_lagging_clients(server_name);
+        sweep_server();
+        pthread_mutex_unlock(&game_mutex);
+
+        // Attacks already posted behind this command join its batch; the
+        // first command of another kind resolves the batch before it runs
+        char buffer[BUFFER_SIZE];
+        BotMove move;
+        int received = command == 1 ? receive_command(buffer, &move) : -1;
+        if (received == 0) {
+            pthread_mutex_lock(&game_mutex);
+            apply_bot_move(&move, server_name);
+            disconnect_lagging_clients(server_name);
+            pthread_mutex_unlock(&game_mutex);
+        } else if (received == 1) {
+            pthread_mutex_lock(&game_mutex);
+            dispatch_command(server_name, buffer);
+            while (queued_attack_count > 0 && queued_attack_count < MATCH_TABLE_BATCH && sem_trywait(sem_command) == 0) {
+                received = receive_command(buffer, &move);
+                if (received == 1) {
+                    dispatch_command(server_name, buffer);
+                } else if (received == 0) {
+                    apply_bot_move(&move, server_name);
+                }
+            }
+            resolve_queued_attacks(server_name);
+            disconnect_lagging_clients(server_name);
+            pthread_mutex_unlock(&game_mutex);
+        }
+
+        // Seat waiting clients once no command is pending, or once a tick
+        // has passed without a chance to, so a steady flood cannot starve them
+        int waiting = 0;
+        sem_getvalue(sem_command, &waiting);
+        if (admission_pending(&admission) > 0 &&
+            (waiting == 0 || clock_now_ms() - last_admission_ms >= TURN_CLOCK_TICK_MS)) {
+            pthread_mutex_lock(&game_mutex);
+            admit_queued_clients(server_name);
+            disconnect_lagging_clients(server_name);
+            pthread_mutex_unlock(&game_mutex);
         }
     }
 
-    pipe_close(read_fd);
     sem_close(sem_command);
 }
@@ -2,25 +2,29 @@
 #define SERVER_H
 
 #include "game-logic.h"
+#include "match.h"
+#include "config.h"
 #include <pthread.h>
 
-#define MAX_CLIENTS 2
 
-typedef struct {
-    GameBoard board_players[MAX_CLIENTS];
-    int player_turn;
-    int client_id_1;
-    int client_id_2;
-    int boards_ready[2];
-    int game_started;
-} GameData;
+// Selects the rules for the next run_server(); must be called before it
+void set_server_variant(const GameVariant *variant);
 
+// Keeps run_server() going after its last match ends until it is sent
+// DRAIN_REQUEST, as a router's worker
+void set_server_persistent(int persistent);
 
+
+// Replaces any FIFO left at the path with a new one
+void initialize_fifo(const char *fifo_name);
 void initialize_server(const char *server_name);
 void cleanup_server(const char *server_name);
 void run_server(const char *server_name);
-void handle_client_message(int client_id, const char *message, const char *server_name, GameData *game_data);
+
+// Takes the channels and matches over from the running server of that name
+// through a live handoff, then serves them in its place
+void takeover_server(const char *server_name);
+void handle_client_message(ClientSession *session, const char *message, const char *server_name);
 void send_message_to_client(int client_id, const char *server_name, const char *message) ;
-void handle_board_message(int client_id, const char *message, GameData *game_data);
 
 #endif
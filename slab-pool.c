@@ -0,0 +1,211 @@
+#include "slab-pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    void *head;
+    size_t count;
+    unsigned long long allocations;
+    unsigned long long frees;
+} SlabThreadCache;
+
+static _Thread_local SlabThreadCache thread_caches[SLAB_POOL_MAX_POOLS];
+
+static pthread_mutex_t pool_ids_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int pool_ids_used[SLAB_POOL_MAX_POOLS];
+
+// Free objects are linked through their first word
+static void *next_object(void *object) {
+    return *(void **)object;
+}
+
+static void set_next_object(void *object, void *next) {
+    *(void **)object = next;
+}
+
+// Caller holds pool->mutex
+static void fold_thread_counters(SlabPool *pool, SlabThreadCache *cache) {
+    pool->stats.allocations += cache->allocations;
+    pool->stats.frees += cache->frees;
+    cache->allocations = 0;
+    cache->frees = 0;
+
+    pool->stats.in_use = pool->stats.allocations - pool->stats.frees;
+    if (pool->stats.in_use > pool->stats.peak_in_use) {
+        pool->stats.peak_in_use = pool->stats.in_use;
+    }
+}
+
+// Caller holds pool->mutex
+static int add_slab(SlabPool *pool) {
+    if (pool->slab_count == pool->slab_capacity) {
+        size_t capacity = pool->slab_capacity ? pool->slab_capacity * 2 : 16;
+        void **slabs = realloc(pool->slabs, capacity * sizeof(void *));
+        if (slabs == NULL) {
+            return -1;
+        }
+        pool->slabs = slabs;
+        pool->slab_capacity = capacity;
+    }
+
+    char *slab = aligned_alloc(CACHE_LINE_SIZE, pool->object_size * pool->objects_per_slab);
+    if (slab == NULL) {
+        return -1;
+    }
+    pool->slabs[pool->slab_count++] = slab;
+
+    for (size_t i = pool->objects_per_slab; i-- > 0;) {
+        void *object = slab + i * pool->object_size;
+        set_next_object(object, pool->free_list);
+        pool->free_list = object;
+    }
+    pool->free_count += pool->objects_per_slab;
+    pool->stats.slabs++;
+    pool->stats.capacity += pool->objects_per_slab;
+    return 0;
+}
+
+int slab_pool_init(SlabPool *pool, const char *name, size_t object_size) {
+    memset(pool, 0, sizeof(*pool));
+
+    pthread_mutex_lock(&pool_ids_mutex);
+    pool->id = -1;
+    for (int i = 0; i < SLAB_POOL_MAX_POOLS; i++) {
+        if (!pool_ids_used[i]) {
+            pool_ids_used[i] = 1;
+            pool->id = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_ids_mutex);
+    if (pool->id == -1) {
+        return -1;
+    }
+
+    if (object_size < sizeof(void *)) {
+        object_size = sizeof(void *);
+    }
+    pool->name = name;
+    pool->object_size = (object_size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+    pool->objects_per_slab = SLAB_POOL_SLAB_BYTES / pool->object_size;
+    if (pool->objects_per_slab < 8) {
+        pool->objects_per_slab = 8;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    return 0;
+}
+
+void slab_pool_destroy(SlabPool *pool) {
+    if (pool->id < 0) {
+        return;
+    }
+    slab_pool_flush_thread(pool);
+
+    for (size_t i = 0; i < pool->slab_count; i++) {
+        free(pool->slabs[i]);
+    }
+    free(pool->slabs);
+    pthread_mutex_destroy(&pool->mutex);
+
+    pthread_mutex_lock(&pool_ids_mutex);
+    pool_ids_used[pool->id] = 0;
+    pthread_mutex_unlock(&pool_ids_mutex);
+    memset(pool, 0, sizeof(*pool));
+    pool->id = -1;
+}
+
+void *slab_pool_alloc(SlabPool *pool) {
+    SlabThreadCache *cache = &thread_caches[pool->id];
+
+    if (cache->head == NULL) {
+        // Refill half a cache at once so the mutex is taken once per batch
+        pthread_mutex_lock(&pool->mutex);
+        if (pool->free_count == 0 && add_slab(pool) == -1) {
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        void *object = pool->free_list;
+        pool->free_list = next_object(object);
+        pool->free_count--;
+        for (size_t i = 1; i < SLAB_THREAD_CACHE_LIMIT / 2 && pool->free_list != NULL; i++) {
+            void *cached = pool->free_list;
+            pool->free_list = next_object(cached);
+            pool->free_count--;
+            set_next_object(cached, cache->head);
+            cache->head = cached;
+            cache->count++;
+        }
+        cache->allocations++;
+        pool->stats.refills++;
+        fold_thread_counters(pool, cache);
+        pthread_mutex_unlock(&pool->mutex);
+        return object;
+    }
+
+    void *object = cache->head;
+    cache->head = next_object(object);
+    cache->count--;
+    cache->allocations++;
+    return object;
+}
+
+void slab_pool_free(SlabPool *pool, void *object) {
+    if (object == NULL) {
+        return;
+    }
+
+    SlabThreadCache *cache = &thread_caches[pool->id];
+    set_next_object(object, cache->head);
+    cache->head = object;
+    cache->count++;
+    cache->frees++;
+
+    if (cache->count >= SLAB_THREAD_CACHE_LIMIT) {
+        // Keep half, so a thread that alternates alloc and free stays local
+        pthread_mutex_lock(&pool->mutex);
+        while (cache->count > SLAB_THREAD_CACHE_LIMIT / 2) {
+            void *spilled = cache->head;
+            cache->head = next_object(spilled);
+            cache->count--;
+            set_next_object(spilled, pool->free_list);
+            pool->free_list = spilled;
+            pool->free_count++;
+        }
+        pool->stats.spills++;
+        fold_thread_counters(pool, cache);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+void slab_pool_flush_thread(SlabPool *pool) {
+    SlabThreadCache *cache = &thread_caches[pool->id];
+
+    pthread_mutex_lock(&pool->mutex);
+    while (cache->head != NULL) {
+        void *object = cache->head;
+        cache->head = next_object(object);
+        set_next_object(object, pool->free_list);
+        pool->free_list = object;
+        pool->free_count++;
+    }
+    cache->count = 0;
+    fold_thread_counters(pool, cache);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void slab_pool_stats(SlabPool *pool, SlabPoolStats *stats) {
+    pthread_mutex_lock(&pool->mutex);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void slab_pool_report(SlabPool *pool, FILE *out) {
+    SlabPoolStats stats;
+    slab_pool_stats(pool, &stats);
+
+    fprintf(out, "Pool %s: %zu-byte objects, %llu slabs, capacity %llu\n",
+            pool->name, pool->object_size, stats.slabs, stats.capacity);
+    fprintf(out, "  in use: %llu (peak %llu), allocations: %llu, frees: %llu\n",
+            stats.in_use, stats.peak_in_use, stats.allocations, stats.frees);
+    fprintf(out, "  thread cache refills: %llu, spills: %llu\n", stats.refills, stats.spills);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define CACHE_LINE_SIZE 64
+#define SLAB_POOL_MAX_POOLS 8
+#define SLAB_POOL_SLAB_BYTES (64 * 1024)
+#define SLAB_THREAD_CACHE_LIMIT 64 // Objects a thread keeps before giving half back
+
+// Fixed-size object pool. Objects are carved out of large cache-line aligned
+// slabs and never handed back to malloc until the pool is destroyed. Every
+// thread keeps its own free list, so allocation and release only take the
+// pool mutex when a thread cache runs empty or overflows.
+
+typedef struct {
+    unsigned long long slabs;
+    unsigned long long capacity;     // Objects carved out of all slabs
+    unsigned long long in_use;
+    unsigned long long peak_in_use;
+    unsigned long long allocations;
+    unsigned long long frees;
+    unsigned long long refills;      // Batches moved from the shared list into a thread cache
+    unsigned long long spills;       // Batches moved back from a thread cache
+} SlabPoolStats;
+
+typedef struct {
+    const char *name;
+    int id; // Index of this pool in every thread's cache array
+    size_t object_size;
+    size_t objects_per_slab;
+
+    pthread_mutex_t mutex;
+    void *free_list; // Shared free list, guarded by mutex
+    size_t free_count;
+    void **slabs;
+    size_t slab_count;
+    size_t slab_capacity;
+    SlabPoolStats stats; // Thread counters are folded in on refill, spill and flush,
+                         // so in_use and peak_in_use are sampled at those points
+} SlabPool;
+
+// object_size is rounded up to a whole number of cache lines
+int slab_pool_init(SlabPool *pool, const char *name, size_t object_size);
+
+// Every thread that used the pool must have called slab_pool_flush_thread()
+void slab_pool_destroy(SlabPool *pool);
+
+// Returns an uninitialized, cache-line aligned object, or NULL
+void *slab_pool_alloc(SlabPool *pool);
+
+void slab_pool_free(SlabPool *pool, void *object);
+
+// Gives the calling thread's cached objects and counters back to the pool
+void slab_pool_flush_thread(SlabPool *pool);
+
+// Counters as last folded; flush the calling thread first for exact numbers
+void slab_pool_stats(SlabPool *pool, SlabPoolStats *stats);
+
+void slab_pool_report(SlabPool *pool, FILE *out);
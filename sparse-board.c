@@ -0,0 +1,244 @@
+#include "sparse-board.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SPARSE_INITIAL_CAPACITY 16
+
+static uint64_t tile_key(int x, int y) {
+    uint64_t tile_x = (uint64_t)(x >> SPARSE_TILE_SHIFT);
+    uint64_t tile_y = (uint64_t)(y >> SPARSE_TILE_SHIFT);
+    return ((tile_y << 32) | tile_x) + 1;
+}
+
+static size_t tile_slot(const SparseBoard *board, uint64_t key) {
+    // Fibonacci hashing; capacity is always a power of two
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (board->capacity - 1);
+}
+
+static SparseTile *find_tile(const SparseBoard *board, int x, int y) {
+    uint64_t key = tile_key(x, y);
+    for (size_t slot = tile_slot(board, key);; slot = (slot + 1) & (board->capacity - 1)) {
+        SparseTile *tile = board->slots[slot];
+        if (tile == NULL) {
+            return NULL;
+        }
+        if (tile->key == key) {
+            return tile;
+        }
+    }
+}
+
+static int grow_table(SparseBoard *board) {
+    size_t old_capacity = board->capacity;
+    SparseTile **old_slots = board->slots;
+
+    SparseTile **slots = calloc(old_capacity * 2, sizeof(SparseTile *));
+    if (slots == NULL) {
+        return -1;
+    }
+    board->slots = slots;
+    board->capacity = old_capacity * 2;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        SparseTile *tile = old_slots[i];
+        if (tile == NULL) {
+            continue;
+        }
+        size_t slot = tile_slot(board, tile->key);
+        while (board->slots[slot] != NULL) {
+            slot = (slot + 1) & (board->capacity - 1);
+        }
+        board->slots[slot] = tile;
+    }
+    free(old_slots);
+    return 0;
+}
+
+static SparseTile *get_or_create_tile(SparseBoard *board, int x, int y) {
+    SparseTile *tile = find_tile(board, x, y);
+    if (tile != NULL) {
+        return tile;
+    }
+
+    // Keep the load factor under 3/4 so probes stay short
+    if ((board->tile_count + 1) * 4 > board->capacity * 3 && grow_table(board) == -1) {
+        return NULL;
+    }
+
+    tile = calloc(1, sizeof(SparseTile));
+    if (tile == NULL) {
+        return NULL;
+    }
+    tile->key = tile_key(x, y);
+
+    size_t slot = tile_slot(board, tile->key);
+    while (board->slots[slot] != NULL) {
+        slot = (slot + 1) & (board->capacity - 1);
+    }
+    board->slots[slot] = tile;
+    board->tile_count++;
+    return tile;
+}
+
+static int in_bounds(const SparseBoard *board, int x, int y) {
+    return x >= 0 && x < board->width && y >= 0 && y < board->height;
+}
+
+static uint64_t cell_bit(int x) {
+    return 1ULL << (x & (SPARSE_TILE_SIZE - 1));
+}
+
+static int has_ship(const SparseBoard *board, int x, int y) {
+    if (!in_bounds(board, x, y)) {
+        return 0;
+    }
+    const SparseTile *tile = find_tile(board, x, y);
+    return tile != NULL && (tile->ships[y & (SPARSE_TILE_SIZE - 1)] & cell_bit(x)) != 0;
+}
+
+int sparse_board_init(SparseBoard *board, int width, int height) {
+    memset(board, 0, sizeof(*board));
+    if (width < 1 || height < 1 || width > SPARSE_MAX_BOARD_SIZE || height > SPARSE_MAX_BOARD_SIZE) {
+        return -1;
+    }
+
+    board->slots = calloc(SPARSE_INITIAL_CAPACITY, sizeof(SparseTile *));
+    if (board->slots == NULL) {
+        return -1;
+    }
+    board->capacity = SPARSE_INITIAL_CAPACITY;
+    board->width = width;
+    board->height = height;
+    return 0;
+}
+
+void sparse_board_free(SparseBoard *board) {
+    for (size_t i = 0; i < board->capacity; i++) {
+        free(board->slots[i]);
+    }
+    free(board->slots);
+    memset(board, 0, sizeof(*board));
+}
+
+int sparse_board_get(const SparseBoard *board, int x, int y) {
+    if (!in_bounds(board, x, y)) {
+        return 0;
+    }
+    const SparseTile *tile = find_tile(board, x, y);
+    if (tile == NULL) {
+        return 0;
+    }
+
+    int row = y & (SPARSE_TILE_SIZE - 1);
+    int ship = (tile->ships[row] & cell_bit(x)) != 0;
+    int shot = (tile->shots[row] & cell_bit(x)) != 0;
+    if (shot) {
+        return ship ? 2 : 3;
+    }
+    return ship ? 1 : 0;
+}
+
+int sparse_board_place_ship(SparseBoard *board, int x, int y, int length, char orientation) {
+    if (length < 2 || length > 5 || (orientation != 'H' && orientation != 'V')) {
+        return 0;
+    }
+
+    int dx = orientation == 'H' ? 1 : 0;
+    int dy = orientation == 'V' ? 1 : 0;
+    if (!in_bounds(board, x, y) || !in_bounds(board, x + dx * (length - 1), y + dy * (length - 1))) {
+        return 0; // Out of bounds
+    }
+
+    // Validate if the space and surroundings are free
+    for (int i = x - 1; i <= x + dx * (length - 1) + 1; i++) {
+        for (int j = y - 1; j <= y + dy * (length - 1) + 1; j++) {
+            if (has_ship(board, i, j)) {
+                return 0;
+            }
+        }
+    }
+
+    for (int k = 0; k < length; k++) {
+        int cx = x + dx * k;
+        int cy = y + dy * k;
+        SparseTile *tile = get_or_create_tile(board, cx, cy);
+        if (tile == NULL) {
+            return 0;
+        }
+        tile->ships[cy & (SPARSE_TILE_SIZE - 1)] |= cell_bit(cx);
+    }
+
+    board->ship_cells += length;
+    board->ships_placed++;
+    return 1;
+}
+
+int sparse_board_attack(SparseBoard *board, int x, int y) {
+    if (!in_bounds(board, x, y)) {
+        return -1; // Invalid attack
+    }
+
+    SparseTile *tile = get_or_create_tile(board, x, y);
+    if (tile == NULL) {
+        return -1;
+    }
+
+    int row = y & (SPARSE_TILE_SIZE - 1);
+    uint64_t bit = cell_bit(x);
+    if (tile->shots[row] & bit) {
+        return -1; // Already attacked
+    }
+    tile->shots[row] |= bit;
+
+    if (!(tile->ships[row] & bit)) {
+        return 0; // Miss
+    }
+
+    // The hit counter makes the game-over check constant time
+    board->ship_cells_hit++;
+    return sparse_board_is_defeated(board) ? 2 : 1;
+}
+
+int sparse_board_is_defeated(const SparseBoard *board) {
+    return board->ship_cells > 0 && board->ship_cells_hit == board->ship_cells;
+}
+
+size_t sparse_board_memory(const SparseBoard *board) {
+    return board->tile_count * sizeof(SparseTile) + board->capacity * sizeof(SparseTile *);
+}
+
+void sparse_board_encode(const SparseBoard *board, HandoffBuffer *buffer) {
+    handoff_put_int(buffer, board->ship_cells);
+    handoff_put_int(buffer, board->ship_cells_hit);
+    handoff_put_int(buffer, board->ships_placed);
+    handoff_put_int(buffer, (int64_t)board->tile_count);
+    for (size_t i = 0; i < board->capacity; i++) {
+        const SparseTile *tile = board->slots[i];
+        if (tile != NULL) {
+            handoff_put(buffer, tile, sizeof(*tile));
+        }
+    }
+}
+
+int sparse_board_decode(SparseBoard *board, HandoffBuffer *buffer) {
+    board->ship_cells = (long)handoff_get_int(buffer);
+    board->ship_cells_hit = (long)handoff_get_int(buffer);
+    board->ships_placed = (int)handoff_get_int(buffer);
+    int64_t tile_count = handoff_get_int(buffer);
+    for (int64_t i = 0; i < tile_count && !buffer->failed; i++) {
+        SparseTile copy;
+        handoff_get(buffer, &copy, sizeof(copy));
+        if (copy.key == 0) {
+            return -1;
+        }
+        // The key is the tile's coordinates plus one
+        int x = (int)(((copy.key - 1) & 0xffffffffULL) << SPARSE_TILE_SHIFT);
+        int y = (int)(((copy.key - 1) >> 32) << SPARSE_TILE_SHIFT);
+        SparseTile *tile = get_or_create_tile(board, x, y);
+        if (tile == NULL) {
+            return -1;
+        }
+        memcpy(tile, &copy, sizeof(copy));
+    }
+    return buffer->failed ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "handoff.h"
+
+// Large boards are split into 64x64 tiles. A tile holds one ship bitmap and
+// one shot bitmap (a 64-bit word per row) and is only allocated once a ship or
+// a shot lands on it, so memory follows activity rather than board area.
+#define SPARSE_TILE_SHIFT 6
+#define SPARSE_TILE_SIZE (1 << SPARSE_TILE_SHIFT)
+#define SPARSE_MAX_BOARD_SIZE (1 << 20)
+
+typedef struct {
+    uint64_t key; // Packed tile coordinates plus one, so 0 marks a free slot
+    uint64_t ships[SPARSE_TILE_SIZE];
+    uint64_t shots[SPARSE_TILE_SIZE];
+} SparseTile;
+
+typedef struct {
+    int width;
+    int height;
+    SparseTile **slots; // Open-addressing table of allocated tiles
+    size_t capacity;
+    size_t tile_count;
+    long ship_cells;
+    long ship_cells_hit;
+    int ships_placed;
+} SparseBoard;
+
+int sparse_board_init(SparseBoard *board, int width, int height);
+
+void sparse_board_free(SparseBoard *board);
+
+// Cell state with the same encoding as GameBoard: 0 water, 1 ship, 2 hit, 3 miss
+int sparse_board_get(const SparseBoard *board, int x, int y);
+
+// Same rules as place_ship_c(): straight, in bounds, not touching other ships
+int sparse_board_place_ship(SparseBoard *board, int x, int y, int length, char orientation);
+
+// Same return values as attack(): -1 invalid, 0 miss, 1 hit, 2 last ship cell hit
+int sparse_board_attack(SparseBoard *board, int x, int y);
+
+int sparse_board_is_defeated(const SparseBoard *board);
+
+// Bytes currently held by the tiles and the tile table
+size_t sparse_board_memory(const SparseBoard *board);
+
+// Writes the counters and every allocated tile for a live handoff
+void sparse_board_encode(const SparseBoard *board, HandoffBuffer *buffer);
+
+// Refills a board set up with sparse_board_init() from sparse_board_encode()
+// output; returns -1 when out of memory or the snapshot is short
+int sparse_board_decode(SparseBoard *board, HandoffBuffer *buffer);
@@ -0,0 +1,96 @@
+#include "spill-file.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+int spill_file_open(SpillFile *spill, const char *path, int slot_count, size_t object_size) {
+    memset(spill, 0, sizeof(*spill));
+    spill->fd = -1;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    spill->slot_size = (object_size + page - 1) / page * page;
+    size_t size = spill->slot_size * (size_t)slot_count;
+
+    spill->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (spill->fd == -1) {
+        perror("Failed to create the spill file");
+        return -1;
+    }
+    unlink(path);
+    if (ftruncate(spill->fd, (off_t)size) == -1) {
+        perror("Failed to size the spill file");
+        spill_file_close(spill);
+        return -1;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, spill->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Failed to map the spill file");
+        spill_file_close(spill);
+        return -1;
+    }
+    spill->base = map;
+
+    spill->free_slots = malloc((size_t)slot_count * sizeof(int));
+    if (spill->free_slots == NULL) {
+        perror("Failed to allocate spill slots");
+        spill_file_close(spill);
+        return -1;
+    }
+    spill->slot_count = slot_count;
+    for (int i = 0; i < slot_count; i++) {
+        spill->free_slots[i] = slot_count - 1 - i; // Low slots first
+    }
+    spill->free_count = slot_count;
+    return 0;
+}
+
+void spill_file_close(SpillFile *spill) {
+    if (spill->base != NULL) {
+        munmap(spill->base, spill->slot_size * (size_t)spill->slot_count);
+    }
+    if (spill->fd != -1) {
+        close(spill->fd);
+    }
+    free(spill->free_slots);
+    memset(spill, 0, sizeof(*spill));
+    spill->fd = -1;
+}
+
+int spill_file_acquire(SpillFile *spill) {
+    if (spill->free_count == 0) {
+        return -1;
+    }
+    return spill->free_slots[--spill->free_count];
+}
+
+void spill_file_release(SpillFile *spill, int slot) {
+    if (slot >= 0 && slot < spill->slot_count) {
+        spill->free_slots[spill->free_count++] = slot;
+    }
+}
+
+void spill_file_evict(SpillFile *spill, int slot) {
+    // Dirty pages of a shared file mapping are kept in the page cache, so
+    // nothing written is lost
+    madvise(spill_file_slot(spill, slot), spill->slot_size, MADV_DONTNEED);
+    spill->stats.evicted++;
+}
+
+void spill_file_restored(SpillFile *spill, unsigned long long restore_ns) {
+    spill->stats.restored++;
+    spill->stats.restore_ns += restore_ns;
+    if (restore_ns > spill->stats.max_restore_ns) {
+        spill->stats.max_restore_ns = restore_ns;
+    }
+}
+
+void spill_file_report(const SpillFile *spill, FILE *out) {
+    const SpillStats *stats = &spill->stats;
+    fprintf(out, "Spill file: %d of %d slots in use (%zu bytes each), %llu evicted, %llu restored\n",
+            spill_file_in_use(spill), spill->slot_count, spill->slot_size, stats->evicted, stats->restored);
+    if (stats->restored > 0) {
+        fprintf(out, "  restore: mean %.1f us, max %.1f us\n", (double)stats->restore_ns / (double)stats->restored / 1e3,
+                (double)stats->max_restore_ns / 1e3);
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Memory-mapped file of fixed-size slots for state the server has evicted.
+// Every slot starts on its own page, so a written slot can be dropped from
+// the process's resident memory and is read back from the page cache, or
+// the disk, on the next access. The file is unlinked as soon as it is open
+// and goes away with the process.
+
+typedef struct {
+    unsigned long long evicted;
+    unsigned long long restored;
+    unsigned long long restore_ns; // Summed over restores
+    unsigned long long max_restore_ns;
+} SpillStats;
+
+typedef struct {
+    int fd;
+    unsigned char *base;
+    size_t slot_size; // Bytes per slot, a whole number of pages
+    int slot_count;
+    int *free_slots;
+    int free_count;
+    SpillStats stats;
+} SpillFile;
+
+int spill_file_open(SpillFile *spill, const char *path, int slot_count, size_t object_size);
+
+void spill_file_close(SpillFile *spill);
+
+// A free slot, or -1 when the file is full
+int spill_file_acquire(SpillFile *spill);
+
+void spill_file_release(SpillFile *spill, int slot);
+
+static inline void *spill_file_slot(const SpillFile *spill, int slot) {
+    return spill->base + (size_t)slot * spill->slot_size;
+}
+
+// Drops a written slot's pages from resident memory; they stay in the file
+void spill_file_evict(SpillFile *spill, int slot);
+
+// Counts a restore that took restore_ns, for the report
+void spill_file_restored(SpillFile *spill, unsigned long long restore_ns);
+
+static inline int spill_file_in_use(const SpillFile *spill) {
+    return spill->slot_count - spill->free_count;
+}
+
+void spill_file_report(const SpillFile *spill, FILE *out);
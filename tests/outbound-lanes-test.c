@@ -0,0 +1,101 @@
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../outbound.h"
+
+// A channel carrying many lanes has a ring larger than 64 KiB. With the
+// FIFO already full, nothing is delivered while the messages are queued, so
+// the queued text passes that mark; every message must still be read back
+// exactly as it was queued.
+
+#define LANES 12
+#define MESSAGE_COUNT 100
+#define MESSAGE_LENGTH 1000
+
+static void format_message(int index, char *message) {
+    int length = snprintf(message, MESSAGE_LENGTH + 1, "CLIENT_%d:%04d_", index % (LANES + 1), index);
+    memset(message + length, 'a' + index % 26, (size_t)(MESSAGE_LENGTH - length));
+    message[MESSAGE_LENGTH] = '\0';
+}
+
+int main(void) {
+    // Corrupted frames can leave the reader waiting for bytes that never come
+    alarm(10);
+    int fds[2];
+    if (pipe(fds) == -1 || fcntl(fds[1], F_SETFL, O_NONBLOCK) == -1) {
+        perror("Failed to create the pipe");
+        return EXIT_FAILURE;
+    }
+    char filler[4096];
+    memset(filler, '-', sizeof(filler));
+    size_t filled = 0;
+    ssize_t written;
+    while ((written = write(fds[1], filler, sizeof(filler))) > 0) {
+        filled += (size_t)written;
+    }
+
+    sem_t sem_response, sem_continue;
+    sem_init(&sem_response, 0, 0);
+    sem_init(&sem_continue, 0, 0);
+
+    outbound_start();
+    OutboundChannel channel = {fds[1], &sem_response, &sem_continue, OUTBOUND_DISCONNECT};
+    if (outbound_add_channel(0, &channel) == -1) {
+        fprintf(stderr, "Failed to add the channel\n");
+        return EXIT_FAILURE;
+    }
+    for (int lane = 0; lane < LANES; lane++) {
+        if (outbound_add_lane(0) == -1) {
+            fprintf(stderr, "Failed to add lane %d\n", lane);
+            return EXIT_FAILURE;
+        }
+    }
+
+    char message[MESSAGE_LENGTH + 1];
+    for (int i = 0; i < MESSAGE_COUNT; i++) {
+        format_message(i, message);
+        if (outbound_enqueue(0, message) != 0) {
+            fprintf(stderr, "Message %d was not queued\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    while (filled > 0) {
+        ssize_t length = read(fds[0], filler, filled < sizeof(filler) ? filled : sizeof(filler));
+        if (length <= 0) {
+            perror("Failed to empty the pipe");
+            return EXIT_FAILURE;
+        }
+        filled -= (size_t)length;
+    }
+
+    // Frames are split on their terminators, as the client does
+    static char received[MESSAGE_COUNT * (MESSAGE_LENGTH + 1)];
+    size_t total = 0, expected = sizeof(received);
+    while (total < expected) {
+        ssize_t length = read(fds[0], received + total, expected - total);
+        if (length <= 0) {
+            perror("Failed to read the messages back");
+            return EXIT_FAILURE;
+        }
+        total += (size_t)length;
+    }
+    int failures = 0;
+    for (int i = 0; i < MESSAGE_COUNT; i++) {
+        format_message(i, message);
+        const char *frame = received + (size_t)i * (MESSAGE_LENGTH + 1);
+        if (memcmp(frame, message, MESSAGE_LENGTH + 1) != 0) {
+            fprintf(stderr, "Message %d came back as %.24s...\n", i, frame);
+            failures++;
+        }
+    }
+
+    outbound_stop();
+    close(fds[0]);
+    close(fds[1]);
+    printf("%d of %d messages read back intact\n", MESSAGE_COUNT - failures, MESSAGE_COUNT);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,202 @@
+#include "timer-wheel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_DELTA ((1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+void timer_wheel_init(TimerWheel *wheel, unsigned long long now) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+void timer_entry_init(TimerEntry *timer, void (*callback)(TimerEntry *timer, void *context), void *context) {
+    timer->next = NULL;
+    timer->link = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->context = context;
+}
+
+static void unlink_timer(TimerEntry *timer) {
+    *timer->link = timer->next;
+    if (timer->next != NULL) {
+        timer->next->link = timer->link;
+    }
+    timer->next = NULL;
+    timer->link = NULL;
+}
+
+// Puts an unarmed timer into the slot for its expiry, on the finest level
+// whose range still covers it
+static void place_timer(TimerWheel *wheel, TimerEntry *timer) {
+    unsigned long long expires = timer->expires;
+    if (expires < wheel->now) {
+        expires = wheel->now;
+    }
+    unsigned long long delta = expires - wheel->now;
+    if (delta > MAX_DELTA) {
+        expires = wheel->now + MAX_DELTA;
+        delta = MAX_DELTA;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    TimerEntry **slot = &wheel->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK];
+    timer->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->link = &timer->next;
+    }
+    timer->link = slot;
+    *slot = timer;
+}
+
+void timer_wheel_add(TimerWheel *wheel, TimerEntry *timer, unsigned long long expires) {
+    if (timer->link != NULL) {
+        unlink_timer(timer);
+    } else {
+        wheel->pending++;
+    }
+    timer->expires = expires;
+    place_timer(wheel, timer);
+    wheel->stats.added++;
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, TimerEntry *timer) {
+    if (timer->link == NULL) {
+        return;
+    }
+    unlink_timer(timer);
+    wheel->pending--;
+    wheel->stats.cancelled++;
+}
+
+// Moves every timer of one slot of a coarser level down to where it now belongs
+static void cascade(TimerWheel *wheel, int level, int index) {
+    TimerEntry *timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (timer != NULL) {
+        TimerEntry *next = timer->next;
+        timer->next = NULL;
+        timer->link = NULL;
+        place_timer(wheel, timer);
+        wheel->stats.cascaded++;
+        timer = next;
+    }
+}
+
+void timer_wheel_advance(TimerWheel *wheel, unsigned long long until) {
+    if (wheel->pending == 0 && wheel->now <= until) {
+        wheel->now = until + 1; // Nothing to expire or cascade on the way
+        return;
+    }
+    while (wheel->now <= until) {
+        unsigned long long tick = wheel->now;
+
+        // At the start of each rotation the next slot of the level above
+        // falls within range of this one
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if (((tick >> (TIMER_WHEEL_BITS * (level - 1))) & SLOT_MASK) != 0) {
+                break;
+            }
+            cascade(wheel, level, (int)((tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK));
+        }
+
+        // Detach the due slot first and move on, so callbacks that re-arm
+        // for this tick land in the next one instead of a full rotation later
+        TimerEntry *due = wheel->slots[0][tick & SLOT_MASK];
+        wheel->slots[0][tick & SLOT_MASK] = NULL;
+        if (due != NULL) {
+            due->link = &due;
+        }
+        wheel->now = tick + 1;
+        wheel->stats.ticks++;
+
+        while (due != NULL) {
+            TimerEntry *timer = due;
+            unlink_timer(timer); // Keeps due valid if a callback cancels the next one
+            wheel->pending--;
+            wheel->stats.expired++;
+            timer->callback(timer, timer->context);
+        }
+    }
+}
+
+void timer_wheel_report(const TimerWheel *wheel, FILE *out) {
+    fprintf(out, "Timer wheel: %llu pending, %llu added, %llu cancelled, %llu expired, %llu cascaded, %llu ticks\n",
+            wheel->pending, wheel->stats.added, wheel->stats.cancelled, wheel->stats.expired, wheel->stats.cascaded,
+            wheel->stats.ticks);
+}
+
+typedef struct {
+    TimerWheel *wheel;
+    unsigned long long fired;
+    unsigned int seed;
+} BenchmarkContext;
+
+static void count_expiry(TimerEntry *timer, void *context) {
+    (void)timer;
+    ((BenchmarkContext *)context)->fired++;
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void timer_wheel_benchmark(long timer_count, FILE *out) {
+    const unsigned long long horizon = 18000; // Fifteen minutes of 50 ms ticks
+    TimerWheel *wheel = malloc(sizeof(TimerWheel));
+    TimerEntry *timers = malloc((size_t)timer_count * sizeof(TimerEntry));
+    if (wheel == NULL || timers == NULL || timer_count < 1) {
+        fprintf(out, "Timer wheel benchmark could not start.\n");
+        free(wheel);
+        free(timers);
+        return;
+    }
+
+    BenchmarkContext context = {wheel, 0, 35};
+    timer_wheel_init(wheel, 0);
+    for (long i = 0; i < timer_count; i++) {
+        timer_entry_init(&timers[i], count_expiry, &context);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < timer_count; i++) {
+        timer_wheel_add(wheel, &timers[i], 1 + (unsigned long long)rand_r(&context.seed) % horizon);
+    }
+    double add_seconds = elapsed_seconds(&start);
+
+    // Three out of four players move in time: their clock is stopped and
+    // started again for the next turn
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long moved = 0;
+    for (long i = 0; i < timer_count; i++) {
+        if (i % 4 != 0) {
+            timer_wheel_cancel(wheel, &timers[i]);
+            timer_wheel_add(wheel, &timers[i], 1 + (unsigned long long)rand_r(&context.seed) % horizon);
+            moved++;
+        }
+    }
+    double rearm_seconds = elapsed_seconds(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    timer_wheel_advance(wheel, horizon);
+    double expire_seconds = elapsed_seconds(&start);
+
+    fprintf(out, "Timer wheel: %ld timers over %llu ticks\n", timer_count, horizon);
+    fprintf(out, "  add:     %.1f ns per timer\n", add_seconds * 1e9 / (double)timer_count);
+    fprintf(out, "  re-arm:  %.1f ns per cancel and add\n", moved > 0 ? rearm_seconds * 1e9 / (double)moved : 0.0);
+    fprintf(out, "  expire:  %llu timers in %.3f s, %.1f M expiries/s, %.1f ns per tick\n", context.fired,
+            expire_seconds, (double)context.fired / expire_seconds / 1e6, expire_seconds * 1e9 / (double)horizon);
+    timer_wheel_report(wheel, out);
+
+    free(timers);
+    free(wheel);
+}
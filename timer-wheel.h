@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdio.h>
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // 2^24 ticks of range; later deadlines are clamped
+
+// Hierarchical timer wheel. Level 0 holds the next 64 ticks one slot per
+// tick, every further level 64 times coarser; a timer moves down a level
+// when its slot comes due. Adding and cancelling are O(1) list operations,
+// and the owner advances the wheel once per tick for all timers at once.
+
+typedef struct TimerEntry {
+    struct TimerEntry *next;
+    struct TimerEntry **link; // The pointer that points at us; NULL when not armed
+    unsigned long long expires; // Tick
+    void (*callback)(struct TimerEntry *timer, void *context);
+    void *context;
+} TimerEntry;
+
+typedef struct {
+    unsigned long long added;
+    unsigned long long cancelled;
+    unsigned long long expired;
+    unsigned long long cascaded; // Timers moved down a level
+    unsigned long long ticks;
+} TimerWheelStats;
+
+typedef struct {
+    TimerEntry *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    unsigned long long now; // Next tick to process; every earlier one is done
+    unsigned long long pending;
+    TimerWheelStats stats;
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *wheel, unsigned long long now);
+
+void timer_entry_init(TimerEntry *timer, void (*callback)(TimerEntry *timer, void *context), void *context);
+
+static inline int timer_entry_armed(const TimerEntry *timer) {
+    return timer->link != NULL;
+}
+
+// Arms timer for tick expires, re-arming it if it was already armed. A tick
+// that has passed fires on the next advance.
+void timer_wheel_add(TimerWheel *wheel, TimerEntry *timer, unsigned long long expires);
+
+// Disarms timer; harmless when it is not armed
+void timer_wheel_cancel(TimerWheel *wheel, TimerEntry *timer);
+
+// Processes every tick up to and including until and runs the callbacks of
+// the timers that expire. Callbacks may add and cancel timers.
+void timer_wheel_advance(TimerWheel *wheel, unsigned long long until);
+
+void timer_wheel_report(const TimerWheel *wheel, FILE *out);
+
+// Arms timer_count timers over fifteen minutes of 50 ms ticks, re-arms most
+// of them as moves would, expires them all and prints the rates
+void timer_wheel_benchmark(long timer_count, FILE *out);
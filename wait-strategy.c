@@ -0,0 +1,224 @@
+#include "wait-strategy.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_SLEEP_GAP_NS 100000 // Longer gaps are slept, shorter ones timed on the clock
+
+static inline void cpu_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+static unsigned long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+int wait_strategy_parse(const char *text, WaitStrategy *strategy) {
+    memset(strategy, 0, sizeof(*strategy));
+    strategy->spin_limit = WAIT_DEFAULT_SPINS;
+    strategy->can_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    size_t length = strcspn(text, ":");
+    if (length == 5 && strncmp(text, "block", 5) == 0) {
+        strategy->mode = WAIT_BLOCK;
+    } else if (length == 4 && strncmp(text, "spin", 4) == 0) {
+        strategy->mode = WAIT_SPIN;
+    } else if (length == 8 && strncmp(text, "adaptive", 8) == 0) {
+        strategy->mode = WAIT_ADAPTIVE;
+    } else {
+        return -1;
+    }
+    if (text[length] == ':') {
+        int spins = atoi(text + length + 1);
+        if (spins < 1 || spins > WAIT_MAX_SPINS || strategy->mode == WAIT_BLOCK) {
+            return -1;
+        }
+        strategy->spin_limit = spins;
+    }
+    return 0;
+}
+
+void wait_strategy_from_env(WaitStrategy *strategy) {
+    const char *text = getenv("BATTLESHIP_WAIT");
+    if (text == NULL || *text == '\0' || wait_strategy_parse(text, strategy) != 0) {
+        if (text != NULL && *text != '\0') {
+            fprintf(stderr, "Unknown wait strategy %s, blocking instead\n", text);
+        }
+        wait_strategy_parse("block", strategy);
+    }
+}
+
+// Moves the limit an eighth of the way towards twice what the wait needed
+static void adapt_spin_limit(WaitStrategy *strategy, int needed) {
+    if (strategy->mode != WAIT_ADAPTIVE) {
+        return;
+    }
+    int target = needed > WAIT_MAX_SPINS / 2 ? WAIT_MAX_SPINS : needed * 2;
+    strategy->spin_limit += (target - strategy->spin_limit) / 8;
+    if (strategy->spin_limit < WAIT_MIN_SPINS) {
+        strategy->spin_limit = WAIT_MIN_SPINS;
+    }
+}
+
+int wait_strategy_wait(WaitStrategy *strategy, sem_t *sem, const struct timespec *deadline) {
+    strategy->waits++;
+    if (strategy->mode != WAIT_BLOCK) {
+        for (int i = 0; strategy->can_spin && i < strategy->spin_limit; i++) {
+            if (sem_trywait(sem) == 0) {
+                strategy->spun++;
+                strategy->spins += (unsigned long long)i + 1;
+                adapt_spin_limit(strategy, i + 1);
+                return 0;
+            }
+            cpu_pause();
+        }
+        strategy->spins += strategy->can_spin ? (unsigned long long)strategy->spin_limit : 0;
+        for (int i = 0; i < WAIT_YIELDS; i++) {
+            sched_yield();
+            if (sem_trywait(sem) == 0) {
+                strategy->yielded++;
+                if (strategy->can_spin) {
+                    adapt_spin_limit(strategy, strategy->spin_limit * 2); // Just missed it: spin longer
+                }
+                return 0;
+            }
+        }
+        if (strategy->mode == WAIT_ADAPTIVE && strategy->can_spin && strategy->spin_limit / 2 >= WAIT_MIN_SPINS) {
+            strategy->spin_limit /= 2; // The gaps are longer than a spin; stop paying for it
+        }
+    }
+    strategy->parked++;
+    return deadline != NULL ? sem_timedwait(sem, deadline) : sem_wait(sem);
+}
+
+const char *wait_mode_name(WaitMode mode) {
+    switch (mode) {
+        case WAIT_BLOCK:
+            return "block";
+        case WAIT_SPIN:
+            return "spin";
+        case WAIT_ADAPTIVE:
+            return "adaptive";
+    }
+    return "unknown";
+}
+
+void wait_strategy_report(const WaitStrategy *strategy, const char *what, FILE *out) {
+    if (strategy->mode == WAIT_BLOCK) {
+        fprintf(out, "Wait strategy (%s): block, %llu waits\n", what, strategy->waits);
+        return;
+    }
+    fprintf(out, "Wait strategy (%s): %s, %llu waits: %llu spun, %llu yielded, %llu parked; "
+                 "%.1f spins per wait, limit now %d\n",
+            what, wait_mode_name(strategy->mode), strategy->waits, strategy->spun, strategy->yielded,
+            strategy->parked, strategy->waits > 0 ? (double)strategy->spins / (double)strategy->waits : 0.0,
+            strategy->spin_limit);
+}
+
+typedef struct {
+    sem_t sem;
+    atomic_int ready;              // The waiter is about to wait
+    atomic_ullong posted_ns;
+    long gap_ns;
+    long round_count;
+} WaitBench;
+
+// Posts once per round, gap_ns after the waiter said it was ready
+static void *bench_poster(void *argument) {
+    WaitBench *bench = argument;
+    for (long round = 0; round < bench->round_count; round++) {
+        for (int spins = 0; !atomic_exchange(&bench->ready, 0); spins++) {
+            if ((spins & 63) == 63) {
+                sched_yield();
+            } else {
+                cpu_pause();
+            }
+        }
+        if (bench->gap_ns >= BENCH_SLEEP_GAP_NS) {
+            struct timespec gap = {0, bench->gap_ns};
+            nanosleep(&gap, NULL);
+        } else {
+            unsigned long long until = now_ns() + (unsigned long long)bench->gap_ns;
+            while (now_ns() < until) {
+                cpu_pause();
+            }
+        }
+        atomic_store(&bench->posted_ns, now_ns());
+        sem_post(&bench->sem);
+    }
+    return NULL;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    unsigned long long left = *(const unsigned long long *)a, right = *(const unsigned long long *)b;
+    return (left > right) - (left < right);
+}
+
+static unsigned long long thread_cpu_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+void wait_strategy_benchmark(long round_count, FILE *out) {
+    static const char *settings[] = {"block", "spin:200", "spin:2000", "spin:20000", "adaptive"};
+    static const long gaps_ns[] = {0, 5000, 50000, 500000};
+    unsigned long long *latency = malloc((size_t)round_count * sizeof(*latency));
+    if (round_count < 1 || latency == NULL) {
+        free(latency);
+        return;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    fprintf(out, "Wait benchmark: %ld wake-ups per row on %ld CPUs%s\n", round_count, cpus,
+            cpus > 1 ? "" : "; one CPU, so the spin modes only yield before they park");
+    fprintf(out, "  %-11s %8s %9s %9s %9s %13s %7s %7s %7s %6s\n", "strategy", "gap us", "p50 us", "p99 us",
+            "max us", "CPU us/wait", "spun", "yielded", "parked", "limit");
+    for (size_t s = 0; s < sizeof(settings) / sizeof(settings[0]); s++) {
+        for (size_t g = 0; g < sizeof(gaps_ns) / sizeof(gaps_ns[0]); g++) {
+            WaitStrategy strategy;
+            wait_strategy_parse(settings[s], &strategy);
+            WaitBench bench;
+            sem_init(&bench.sem, 0, 0);
+            atomic_init(&bench.ready, 0);
+            atomic_init(&bench.posted_ns, 0);
+            bench.gap_ns = gaps_ns[g];
+            bench.round_count = round_count;
+
+            pthread_t poster;
+            if (pthread_create(&poster, NULL, bench_poster, &bench) != 0) {
+                perror("Failed to start the poster thread");
+                sem_destroy(&bench.sem);
+                free(latency);
+                return;
+            }
+            unsigned long long cpu_start = thread_cpu_ns();
+            for (long round = 0; round < round_count; round++) {
+                atomic_store(&bench.ready, 1);
+                while (wait_strategy_wait(&strategy, &bench.sem, NULL) == -1 && errno == EINTR) {
+                }
+                latency[round] = now_ns() - atomic_load(&bench.posted_ns);
+            }
+            // The waiter's time includes the clock reads, the same for every row
+            double cpu_per_wait = (double)(thread_cpu_ns() - cpu_start) / 1e3 / (double)round_count;
+            pthread_join(poster, NULL);
+            sem_destroy(&bench.sem);
+
+            qsort(latency, (size_t)round_count, sizeof(*latency), compare_latency);
+            fprintf(out, "  %-11s %8.0f %9.2f %9.2f %9.2f %13.2f %7llu %7llu %7llu %6d\n", settings[s],
+                    (double)gaps_ns[g] / 1e3, (double)latency[round_count / 2] / 1e3,
+                    (double)latency[(round_count * 99) / 100] / 1e3, (double)latency[round_count - 1] / 1e3,
+                    cpu_per_wait, strategy.spun, strategy.yielded, strategy.parked, strategy.spin_limit);
+        }
+    }
+    free(latency);
+}
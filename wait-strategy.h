@@ -0,0 +1,56 @@
+#pragma once
+
+#include <semaphore.h>
+#include <stdio.h>
+#include <time.h>
+
+// How a thread waits on a semaphore. WAIT_BLOCK is a plain sem_wait. The
+// other modes first poll with sem_trywait in a busy loop with a CPU pause,
+// then yield the CPU a few times, and only then park in sem_wait, so a post
+// that arrives within the spin costs no context switch on either side.
+// WAIT_ADAPTIVE moves its spin limit towards twice the spins the last waits
+// needed and halves it after each park, so a thread whose messages come far
+// apart soon stops burning CPU on them. With a single CPU the poster cannot
+// run while we spin, so there the spin is skipped and only the yields are
+// left. BATTLESHIP_WAIT selects the mode for the whole process: block,
+// spin[:<spins>] or adaptive[:<spins>].
+
+#define WAIT_DEFAULT_SPINS 2000
+#define WAIT_MIN_SPINS 16
+#define WAIT_MAX_SPINS 20000
+#define WAIT_YIELDS 8 // sched_yield() calls between the spin and the park
+
+typedef enum {
+    WAIT_BLOCK,
+    WAIT_SPIN,    // Fixed spin limit
+    WAIT_ADAPTIVE
+} WaitMode;
+
+typedef struct {
+    WaitMode mode;
+    int spin_limit;
+    int can_spin; // More than one CPU is online
+    unsigned long long waits;
+    unsigned long long spun;    // Waits the spin ended
+    unsigned long long yielded; // Waits that ended while yielding
+    unsigned long long parked;  // Waits that slept in the kernel
+    unsigned long long spins;   // Spin iterations over all waits
+} WaitStrategy;
+
+// Parses block, spin[:N] or adaptive[:N]; returns -1 for anything else
+int wait_strategy_parse(const char *text, WaitStrategy *strategy);
+
+// From BATTLESHIP_WAIT, WAIT_BLOCK when it is unset or not understood
+void wait_strategy_from_env(WaitStrategy *strategy);
+
+// sem_wait() or sem_timedwait() behind the spin; a NULL deadline waits
+// without a limit. Returns 0 or -1 with errno set as sem_timedwait() does.
+int wait_strategy_wait(WaitStrategy *strategy, sem_t *sem, const struct timespec *deadline);
+
+const char *wait_mode_name(WaitMode mode);
+
+void wait_strategy_report(const WaitStrategy *strategy, const char *what, FILE *out);
+
+// Wakes a waiting thread round_count times per mode and gap between posts
+// and prints the wake-up latency next to the waiter's CPU time per wait
+void wait_strategy_benchmark(long round_count, FILE *out);
@@ -0,0 +1,36 @@
+#include "zobrist.h"
+#include <pthread.h>
+
+#define ZOBRIST_SEED 0x42A77E5B17E5EEDULL
+#define ZOBRIST_CELLS 100
+
+static uint64_t ship_keys[ZOBRIST_CELLS];
+static uint64_t shot_keys[ZOBRIST_CELLS][2];
+static pthread_once_t keys_once = PTHREAD_ONCE_INIT;
+
+// splitmix64: a full-period generator with well-mixed output
+static uint64_t next_key(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void generate_keys(void) {
+    uint64_t state = ZOBRIST_SEED;
+    for (int i = 0; i < ZOBRIST_CELLS; i++) {
+        ship_keys[i] = next_key(&state);
+        shot_keys[i][0] = next_key(&state);
+        shot_keys[i][1] = next_key(&state);
+    }
+}
+
+uint64_t zobrist_ship_key(int x, int y) {
+    pthread_once(&keys_once, generate_keys);
+    return ship_keys[y * 10 + x];
+}
+
+uint64_t zobrist_shot_key(int x, int y, int hit) {
+    pthread_once(&keys_once, generate_keys);
+    return shot_keys[y * 10 + x][hit ? 1 : 0];
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// Zobrist keys for 10x10 boards. Keys are derived from a fixed seed, so every
+// build of the client and the server agrees on them without exchanging a table.
+// A board keeps two hashes: one over its ship cells and one over the cells
+// that were fired at (hit and miss keys differ). The shot hash alone describes
+// what the opponent can see; both together describe the whole board.
+
+uint64_t zobrist_ship_key(int x, int y);
+
+uint64_t zobrist_shot_key(int x, int y, int hit);